@@ -18,7 +18,7 @@ CREATE TABLE IF NOT EXISTS dns_verifications (
     expire_time DATETIME NOT NULL,
     mode VARCHAR(20) NOT NULL,
     created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
-    INDEX idx_ip_domain (client_ip, domain)
+    INDEX idx_verify_lookup (client_ip, domain, mode, expire_time)
 );
 
 -- -IPӳ
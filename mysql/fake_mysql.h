@@ -0,0 +1,903 @@
+// 基准测试与测试用的进程内 MySQL 替身（定义 DNS_AUTH_BENCH 或 DNS_AUTH_FAKE_DB 时代替 libmysqlclient）
+//
+// 只实现 mysql.cpp 用到的 C API 子集，四张表保存在内存中：
+//   ip_whitelist / domain_configs / domain_mappings / dns_verifications
+// SQL 按语句前缀识别，只支持服务本身会发出的语句；其余语句视为成功且无结果。
+// 每次执行可注入固定延迟 + 确定性抖动，用于模拟数据库往返耗时。
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+typedef char** MYSQL_ROW;
+
+typedef struct MYSQL_FIELD { char* name; } MYSQL_FIELD;
+
+typedef struct MYSQL_RES {
+    std::vector<std::string> fieldNames;      // 只有 SHOW REPLICA STATUS 填写
+    std::vector<MYSQL_FIELD> fields;
+    std::vector<std::vector<std::string>> rows;
+    std::vector<std::vector<bool>> nulls;     // 为空时表示没有 NULL 列
+    std::vector<char*> current;
+    size_t next = 0;
+} MYSQL_RES;
+
+// net.fd 在 Linux 上是一个 timerfd：非阻塞查询的注入延迟由它计时，到期后变为可读
+typedef struct NET { int fd = -1; } NET;
+
+typedef struct MYSQL {
+    bool connected;
+    std::string endpoint;       // host:port，区分主库与只读副本
+    NET net;
+    bool asyncBusy;             // 非阻塞查询已执行、等待定时器到期
+    bool asyncUsed;             // 执行过非阻塞查询（属于异步查询的连接）
+    MYSQL_RES* asyncResult;     // 非阻塞查询的结果，mysql_store_result_nonblocking 取走
+} MYSQL;
+
+#define CR_SERVER_GONE_ERROR 2006
+#define CR_SERVER_LOST 2013
+
+enum enum_field_types { MYSQL_TYPE_LONG = 3, MYSQL_TYPE_LONGLONG = 8, MYSQL_TYPE_STRING = 254 };
+
+typedef struct MYSQL_BIND {
+    unsigned long* length;
+    bool* is_null;
+    void* buffer;
+    bool* error;
+    enum enum_field_types buffer_type;
+    unsigned long buffer_length;
+    bool is_unsigned;
+} MYSQL_BIND;
+
+#define MYSQL_NO_DATA 100
+#define MYSQL_DATA_TRUNCATED 101
+
+namespace fakedb {
+
+    // 替身的行数与延迟配置
+    struct Options {
+        size_t clients = 1000;             // 白名单 IP 数（每个 IP 一个客户端）
+        size_t domainsPerClient = 10;      // 每个客户端在 domain_configs 中的域名数
+        bool preloadVerifications = true;  // 为每个 (client, domain) 预先写入一条验证记录
+        int readLatencyUs = 0;             // 每次查询注入的固定延迟
+        int writeLatencyUs = 0;            // 每次写入注入的固定延迟
+        int jitterUs = 0;                  // 额外的 [0, jitterUs) 随机延迟（每线程固定种子，可复现）
+        bool compactSchema = false;        // 报告表结构为精简结构（二进制 IP + domains 表）；数据仍按文本保存
+        bool noBackslashEscapes = false;   // 模拟 sql_mode 含 NO_BACKSLASH_ESCAPES：反斜杠是普通字符，引号成对转义
+    };
+
+    inline std::string clientIP(size_t index) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "10.%u.%u.%u", static_cast<unsigned>((index >> 16) & 0xff),
+            static_cast<unsigned>((index >> 8) & 0xff), static_cast<unsigned>(index & 0xff));
+        return buf;
+    }
+
+    inline std::string domainName(size_t index) {
+        return "d" + std::to_string(index) + ".bench.test";
+    }
+
+    inline std::string mappedIP(size_t index) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "192.0.%u.%u", static_cast<unsigned>((index >> 8) & 0xff),
+            static_cast<unsigned>(index & 0xff));
+        return buf;
+    }
+
+    // 'YYYY-MM-DD HH:MM:SS' 按本地时区转为时间戳，与 UNIX_TIMESTAMP 一致
+    inline long long unixTimestamp(const std::string& value) {
+        int fields[6] = {};
+        size_t field = 0;
+        bool digits = false;
+        for (char c : value) {
+            if (c >= '0' && c <= '9') {
+                fields[field] = fields[field] * 10 + (c - '0');
+                digits = true;
+            }
+            else if (digits && ++field == 6) {
+                break;
+            }
+            else {
+                digits = false;
+            }
+        }
+        if (field < 5) {
+            return 0;
+        }
+
+        std::tm tmValue = {};
+        tmValue.tm_year = fields[0];
+        tmValue.tm_mon = fields[1];
+        tmValue.tm_mday = fields[2];
+        tmValue.tm_hour = fields[3];
+        tmValue.tm_min = fields[4];
+        tmValue.tm_sec = fields[5];
+        tmValue.tm_year -= 1900;
+        tmValue.tm_mon -= 1;
+        tmValue.tm_isdst = -1;
+        long long ts = static_cast<long long>(mktime(&tmValue));
+        return ts < 0 ? 0 : ts;
+    }
+
+    inline std::string key(const std::string& ip, const std::string& domain) {
+        return ip + '\x1f' + domain;
+    }
+
+    struct ConfigRow {
+        std::string expireTime;
+        long long expireAt = 0;
+        long long status = 1;
+    };
+
+    // 唯一键 unique_verify (client_ip, domain, mode) 下每个键一行
+    struct VerificationRow {
+        std::string expireTime;
+        long long expireAt = 0;
+    };
+
+    class Backend {
+    private:
+        std::mutex mtx;
+        std::vector<std::pair<long long, std::string>> whitelist;   // (id, ip)，id 递增
+        std::unordered_set<std::string> whitelistIndex;
+        std::unordered_map<std::string, std::pair<std::string, std::string>> whitelistLimits;   // ip -> (rate, burst)
+        std::unordered_map<std::string, ConfigRow> configs;          // key(client_ip, domain)
+        std::unordered_map<std::string, std::string> mappings;       // domain -> target_ip
+        std::unordered_map<std::string, VerificationRow> verifications;
+        long long nextWhitelistId = 1;
+        Options options;
+
+        std::atomic<uint64_t> queryCount{ 0 };
+        std::atomic<uint64_t> verificationRows{ 0 };
+
+        std::mutex connectionsMtx;
+        std::unordered_set<MYSQL*> connections;                      // 未关闭的连接
+
+        // 只读副本：所有端点共享同一份数据，延迟只影响 SHOW REPLICA STATUS 的应答
+        std::atomic<bool> hasReplicas{ false };
+        std::unordered_map<std::string, long long> replicaLag;      // endpoint -> 秒，-1 表示复制未运行
+        std::unordered_map<std::string, uint64_t> endpointReads;
+
+        void delay(int baseUs) {
+            int us = baseUs;
+            int* deferred = deferredDelay();
+            if (options.jitterUs > 0) {
+                thread_local uint32_t state = 2463534242u;
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                us += static_cast<int>(state % static_cast<uint32_t>(options.jitterUs));
+            }
+            if (us <= 0) return;
+            if (deferred) {
+                *deferred += us;
+                return;
+            }
+
+            // 短延迟用忙等，避免 sleep 的调度粒度把 50µs 放大成上百微秒
+            auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+            if (us >= 200) {
+                std::this_thread::sleep_until(until);
+            }
+            else {
+                while (std::chrono::steady_clock::now() < until) {}
+            }
+        }
+
+    public:
+        // 非零时当前线程的注入延迟累加到该变量而不是原地等待（非阻塞查询用定时器模拟往返）
+        static int*& deferredDelay() {
+            thread_local int* target = nullptr;
+            return target;
+        }
+
+        static Backend& instance() {
+            static Backend backend;
+            return backend;
+        }
+
+        // 清空并按配置生成确定性数据
+        void seed(const Options& opts) {
+            std::lock_guard<std::mutex> lock(mtx);
+            options = opts;
+            whitelist.clear();
+            whitelistIndex.clear();
+            whitelistLimits.clear();
+            configs.clear();
+            mappings.clear();
+            verifications.clear();
+            nextWhitelistId = 1;
+            verificationRows.store(0);
+
+            const std::string expireTime = "2099-12-31 23:59:59";
+            const long long expireAt = unixTimestamp(expireTime);
+            addWhitelistLocked("127.0.0.1");
+            for (size_t c = 0; c < opts.clients; ++c) {
+                std::string ip = clientIP(c);
+                addWhitelistLocked(ip);
+                for (size_t d = 0; d < opts.domainsPerClient; ++d) {
+                    size_t domainIndex = c * opts.domainsPerClient + d;
+                    std::string domain = domainName(domainIndex);
+                    ConfigRow& row = configs[key(ip, domain)];
+                    row.expireTime = expireTime;
+                    row.expireAt = expireAt;
+                    mappings[domain] = mappedIP(domainIndex);
+                    if (opts.preloadVerifications) {
+                        VerificationRow& v = verifications[key(ip, domain)];
+                        v.expireTime = expireTime;
+                        v.expireAt = expireAt;
+                        verificationRows.fetch_add(1);
+                    }
+                }
+            }
+        }
+
+        const Options& config() const { return options; }
+        uint64_t queries() const { return queryCount.load(); }
+        uint64_t verificationRowCount() const { return verificationRows.load(); }
+
+        void readDelay() { queryCount.fetch_add(1, std::memory_order_relaxed); delay(options.readLatencyUs); }
+
+        // 把 endpoint 登记为只读副本并设置其复制延迟
+        void setReplicaLag(const std::string& endpoint, long long lagSec) {
+            std::lock_guard<std::mutex> lock(mtx);
+            replicaLag[endpoint] = lagSec;
+            hasReplicas.store(true);
+        }
+
+        // endpoint 不是副本时返回 false
+        bool replicaStatus(const std::string& endpoint, long long& lagSec) {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = replicaLag.find(endpoint);
+            if (it == replicaLag.end()) return false;
+            lagSec = it->second;
+            return true;
+        }
+
+        // 登记过副本后才按端点统计读查询，避免基准测试多一次加锁
+        void countRead(const std::string& endpoint) {
+            if (!hasReplicas.load(std::memory_order_relaxed)) return;
+            std::lock_guard<std::mutex> lock(mtx);
+            ++endpointReads[endpoint];
+        }
+
+        uint64_t readsFrom(const std::string& endpoint) {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = endpointReads.find(endpoint);
+            return it == endpointReads.end() ? 0 : it->second;
+        }
+        void writeDelay() { queryCount.fetch_add(1, std::memory_order_relaxed); delay(options.writeLatencyUs); }
+
+        void track(MYSQL* conn) {
+            std::lock_guard<std::mutex> lock(connectionsMtx);
+            connections.insert(conn);
+        }
+
+        void untrack(MYSQL* conn) {
+            std::lock_guard<std::mutex> lock(connectionsMtx);
+            connections.erase(conn);
+        }
+
+#ifdef __linux__
+        // 模拟服务端关闭空闲的异步查询连接（如 wait_timeout）：连接标记为断开，timerfd 一直可读，
+        // 与对端关闭后套接字停在 EOF 相同。只能在没有进行中查询时调用，返回受影响的连接数
+        size_t closeIdleAsyncConnections() {
+            std::lock_guard<std::mutex> lock(connectionsMtx);
+            size_t closed = 0;
+            for (MYSQL* conn : connections) {
+                if (!conn->asyncUsed || conn->asyncBusy || conn->net.fd < 0) continue;
+                conn->connected = false;
+                itimerspec spec = {};
+                spec.it_value.tv_nsec = 1;
+                timerfd_settime(conn->net.fd, 0, &spec, nullptr);
+                ++closed;
+            }
+            return closed;
+        }
+#endif
+
+        void addWhitelistLocked(const std::string& ip) {
+            if (whitelistIndex.insert(ip).second) {
+                whitelist.emplace_back(nextWhitelistId++, ip);
+            }
+        }
+
+        void addWhitelist(const std::string& ip) {
+            std::lock_guard<std::mutex> lock(mtx);
+            addWhitelistLocked(ip);
+        }
+
+        bool whitelistContains(const std::string& ip) {
+            std::lock_guard<std::mutex> lock(mtx);
+            return whitelistIndex.count(ip) > 0;
+        }
+
+        // SELECT id, ip, rate_limit, rate_burst FROM ip_whitelist WHERE id > ? ORDER BY id
+        void whitelistAfter(long long afterId, std::vector<std::vector<std::string>>& rows) {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const auto& entry : whitelist) {
+                if (entry.first > afterId) {
+                    auto it = whitelistLimits.find(entry.second);
+                    bool limited = it != whitelistLimits.end();
+                    rows.push_back({ std::to_string(entry.first), entry.second,
+                        limited ? it->second.first : "0", limited ? it->second.second : "0" });
+                }
+            }
+        }
+
+        // UPDATE ip_whitelist SET rate_limit = ?, rate_burst = ? WHERE ip = ?
+        void setWhitelistLimit(const std::string& ip, const std::string& rate, const std::string& burst) {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (whitelistIndex.count(ip) > 0) {
+                whitelistLimits[ip] = std::make_pair(rate, burst);
+            }
+        }
+
+        void whitelistSummary(long long& count, long long& maxId) {
+            std::lock_guard<std::mutex> lock(mtx);
+            count = static_cast<long long>(whitelist.size());
+            maxId = whitelist.empty() ? 0 : whitelist.back().first;
+        }
+
+        bool configExpire(const std::string& ip, const std::string& domain, ConfigRow& out) {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = configs.find(key(ip, domain));
+            if (it == configs.end() || it->second.status != 1) return false;
+            out = it->second;
+            return true;
+        }
+
+        void upsertConfig(const std::string& ip, const std::string& domain, const std::string& expireTime, long long status) {
+            long long expireAt = unixTimestamp(expireTime);
+            std::lock_guard<std::mutex> lock(mtx);
+            ConfigRow& row = configs[key(ip, domain)];
+            row.expireTime = expireTime;
+            row.expireAt = expireAt;
+            row.status = status;
+        }
+
+        // SELECT client_ip, domain, expire_time FROM domain_configs WHERE status = 1
+        void activeConfigs(std::vector<std::vector<std::string>>& rows) {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const auto& entry : configs) {
+                if (entry.second.status != 1) continue;
+                size_t sep = entry.first.find('\x1f');
+                rows.push_back({ entry.first.substr(0, sep), entry.first.substr(sep + 1), entry.second.expireTime });
+            }
+        }
+
+        // SELECT DISTINCT client_ip, domain FROM dns_verifications / SELECT client_ip, domain FROM domain_configs
+        void keyPairs(bool verificationKeys, std::vector<std::vector<std::string>>& rows) {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto push = [&rows](const std::string& k) {
+                size_t sep = k.find('\x1f');
+                rows.push_back({ k.substr(0, sep), k.substr(sep + 1) });
+            };
+            if (verificationKeys) {
+                for (const auto& entry : verifications) push(entry.first);
+            }
+            else {
+                for (const auto& entry : configs) push(entry.first);
+            }
+        }
+
+        // SELECT domain, target_ip FROM domain_mappings
+        void allMappings(std::vector<std::vector<std::string>>& rows) {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const auto& entry : mappings) {
+                rows.push_back({ entry.first, entry.second });
+            }
+        }
+
+        void upsertMapping(const std::string& domain, const std::string& targetIP) {
+            std::lock_guard<std::mutex> lock(mtx);
+            mappings[domain] = targetIP;
+        }
+
+        // 多行插入：values 依次为 (client_ip, domain, expire_time)。与 ON DUPLICATE KEY UPDATE 相同，
+        // 键已存在时覆盖到期时间；返回值按 MySQL 的影响行数计：新行 1，覆盖 2，未改变 0
+        size_t insertVerifications(const std::vector<std::string>& values) {
+            std::vector<long long> expireAts;
+            expireAts.reserve(values.size() / 3);
+            for (size_t i = 2; i < values.size(); i += 3) {
+                expireAts.push_back(unixTimestamp(values[i]));
+            }
+
+            size_t affected = 0;
+            size_t inserted = 0;
+            std::lock_guard<std::mutex> lock(mtx);
+            for (size_t i = 0; i + 2 < values.size(); i += 3) {
+                auto result = verifications.emplace(key(values[i], values[i + 1]), VerificationRow());
+                VerificationRow& v = result.first->second;
+                if (!result.second && values[i + 2] == v.expireTime) {
+                    continue;
+                }
+                affected += result.second ? 1 : 2;
+                inserted += result.second ? 1 : 0;
+                v.expireTime = values[i + 2];
+                v.expireAt = expireAts[i / 3];
+            }
+            verificationRows.fetch_add(inserted, std::memory_order_relaxed);
+            return affected;
+        }
+
+        // find：最新验证记录 LEFT JOIN 映射
+        bool findActive(const std::string& ip, const std::string& domain, std::vector<std::string>& row, bool& mappingNull) {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = verifications.find(key(ip, domain));
+            if (it == verifications.end()) return false;
+            auto mapping = mappings.find(domain);
+            mappingNull = mapping == mappings.end();
+            row = { it->second.expireTime, mappingNull ? std::string() : mapping->second,
+                std::to_string(it->second.expireAt) };
+            return true;
+        }
+    };
+
+    // 语句类型：按 SQL 前缀识别
+    enum StatementKind {
+        KIND_OTHER = 0,
+        KIND_WHITELIST_LOOKUP,
+        KIND_CONFIG_EXPIRE,
+        KIND_INSERT_VERIFICATIONS,
+        KIND_FIND_ACTIVE,
+        KIND_BATCH_FIND,
+        KIND_BATCH_CONFIG,
+        KIND_ADD_WHITELIST,
+        KIND_SET_WHITELIST_LIMIT,
+        KIND_ADD_CONFIG,
+        KIND_ADD_MAPPING,
+        KIND_INTERN_DOMAINS
+    };
+
+    inline bool startsWith(const std::string& sql, const char* prefix) {
+        return sql.compare(0, strlen(prefix), prefix) == 0;
+    }
+
+    // 精简结构的语句参数顺序与文本结构相同（IP 经 INET6_ATON、域名已规范化），识别为同一类型
+    inline StatementKind classify(const std::string& sql) {
+        if (startsWith(sql, "SELECT id FROM ip_whitelist WHERE ip = ?")) return KIND_WHITELIST_LOOKUP;
+        if (startsWith(sql, "SELECT expire_time, UNIX_TIMESTAMP(expire_time) FROM domain_configs")) return KIND_CONFIG_EXPIRE;
+        if (startsWith(sql, "SELECT c.expire_time, UNIX_TIMESTAMP(c.expire_time) FROM domain_configs")) return KIND_CONFIG_EXPIRE;
+        if (startsWith(sql, "INSERT INTO dns_verifications")) return KIND_INSERT_VERIFICATIONS;
+        if (startsWith(sql, "REPLACE INTO dns_verifications")) return KIND_INSERT_VERIFICATIONS;
+        if (startsWith(sql, "SELECT v.expire_time, m.target_ip")) return KIND_FIND_ACTIVE;
+        if (startsWith(sql, "SELECT v.expire_time, INET6_NTOA(m.target_ip)")) return KIND_FIND_ACTIVE;
+        if (startsWith(sql, "SELECT v.client_ip, v.domain, ")) return KIND_BATCH_FIND;
+        if (startsWith(sql, "SELECT INET6_NTOA(v.client_ip), d.name, ")) return KIND_BATCH_FIND;
+        if (startsWith(sql, "SELECT domain, expire_time FROM domain_configs")) return KIND_BATCH_CONFIG;
+        if (startsWith(sql, "SELECT d.name, c.expire_time FROM domain_configs")) return KIND_BATCH_CONFIG;
+        if (startsWith(sql, "INSERT IGNORE INTO domains")) return KIND_INTERN_DOMAINS;
+        if (startsWith(sql, "INSERT IGNORE INTO ip_whitelist")) return KIND_ADD_WHITELIST;
+        if (startsWith(sql, "UPDATE ip_whitelist SET rate_limit")) return KIND_SET_WHITELIST_LIMIT;
+        if (startsWith(sql, "INSERT INTO domain_configs")) return KIND_ADD_CONFIG;
+        if (startsWith(sql, "INSERT INTO domain_mappings")) return KIND_ADD_MAPPING;
+        return KIND_OTHER;
+    }
+
+    inline Backend& backend() { return Backend::instance(); }
+}
+
+typedef struct MYSQL_STMT {
+    fakedb::StatementKind kind = fakedb::KIND_OTHER;
+    std::string endpoint;
+    unsigned long paramCount = 0;
+    std::vector<std::string> params;
+    MYSQL_BIND* resultBinds = nullptr;
+    std::vector<std::vector<std::string>> rows;
+    std::vector<std::vector<bool>> nulls;
+    size_t next = 0;
+    unsigned long long affected = 0;
+} MYSQL_STMT;
+
+inline MYSQL* mysql_init(MYSQL* /*unused*/) { MYSQL* m = new MYSQL(); m->connected = false; return m; }
+inline MYSQL* mysql_real_connect(MYSQL* conn, const char* host, const char* /*user*/, const char* /*passwd*/,
+    const char* /*db*/, unsigned int port, const char* /*unix_socket*/, unsigned long /*client_flag*/) {
+    if (!conn) return nullptr;
+    conn->connected = true;
+    conn->endpoint = std::string(host ? host : "") + ":" + std::to_string(port);
+#ifdef __linux__
+    if (conn->net.fd < 0) conn->net.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+    fakedb::backend().track(conn);
+    return conn;
+}
+inline void mysql_close(MYSQL* conn) {
+    if (!conn) return;
+    fakedb::backend().untrack(conn);
+#ifdef __linux__
+    if (conn->net.fd >= 0) close(conn->net.fd);
+#endif
+    delete conn->asyncResult;
+    delete conn;
+}
+inline int mysql_set_character_set(MYSQL* /*conn*/, const char* /*cs*/) { return 0; }
+inline const char* mysql_error(MYSQL* /*conn*/) { return ""; }
+inline unsigned int mysql_errno(MYSQL* /*conn*/) { return 0; }
+inline int mysql_ping(MYSQL* conn) { return (conn && conn->connected) ? 0 : 1; }
+
+// 与 libmysqlclient 相同：默认用反斜杠转义；会话为 NO_BACKSLASH_ESCAPES 时只把 quote 成对写出
+inline unsigned long mysql_real_escape_string_quote(MYSQL* /*conn*/, char* to, const char* from, unsigned long length, char quote) {
+    bool backslash = !fakedb::backend().config().noBackslashEscapes;
+    unsigned long n = 0;
+    for (unsigned long i = 0; i < length; ++i) {
+        char c = from[i];
+        if (!backslash) {
+            if (c == quote) to[n++] = quote;
+            to[n++] = c;
+            continue;
+        }
+        switch (c) {
+        case '\0': to[n++] = '\\'; to[n++] = '0'; break;
+        case '\n': to[n++] = '\\'; to[n++] = 'n'; break;
+        case '\r': to[n++] = '\\'; to[n++] = 'r'; break;
+        case '\x1a': to[n++] = '\\'; to[n++] = 'Z'; break;
+        case '\'':
+        case '"':
+        case '\\':
+            to[n++] = '\\';
+            to[n++] = c;
+            break;
+        default: to[n++] = c; break;
+        }
+    }
+    to[n] = '\0';
+    return n;
+}
+
+// 文本协议查询的结果暂存在当前线程，mysql_store_result 取走
+inline MYSQL_RES*& fakePendingResult() {
+    thread_local MYSQL_RES* pending = nullptr;
+    return pending;
+}
+
+inline int mysql_query(MYSQL* conn, const char* q) {
+    std::string sql(q);
+    MYSQL_RES*& pending = fakePendingResult();
+    delete pending;
+    pending = nullptr;
+
+    fakedb::Backend& db = fakedb::backend();
+    if (sql == "SHOW REPLICA STATUS") {
+        pending = new MYSQL_RES();
+        pending->fieldNames = { "Channel_Name", "Seconds_Behind_Source" };
+        for (std::string& name : pending->fieldNames) {
+            pending->fields.push_back(MYSQL_FIELD{ &name[0] });
+        }
+        long long lagSec = 0;
+        if (db.replicaStatus(conn->endpoint, lagSec)) {
+            pending->rows.push_back({ "", std::to_string(lagSec) });
+            pending->nulls.push_back({ false, lagSec < 0 });
+        }
+    }
+    else if (fakedb::startsWith(sql, "SELECT")) {
+        db.readDelay();
+        db.countRead(conn->endpoint);
+        pending = new MYSQL_RES();
+        if (fakedb::startsWith(sql, "SELECT id, ip, rate_limit, rate_burst FROM ip_whitelist WHERE id > ")) {
+            long long afterId = atoll(sql.c_str() + strlen("SELECT id, ip, rate_limit, rate_burst FROM ip_whitelist WHERE id > "));
+            db.whitelistAfter(afterId, pending->rows);
+        }
+        else if (fakedb::startsWith(sql, "SELECT COUNT(*), COALESCE(MAX(id), 0) FROM ip_whitelist")) {
+            long long count = 0, maxId = 0;
+            db.whitelistSummary(count, maxId);
+            pending->rows.push_back({ std::to_string(count), std::to_string(maxId) });
+        }
+        else if (fakedb::startsWith(sql, "SELECT client_ip, domain, expire_time FROM domain_configs WHERE status = 1") ||
+            fakedb::startsWith(sql, "SELECT INET6_NTOA(c.client_ip), d.name, c.expire_time FROM domain_configs")) {
+            db.activeConfigs(pending->rows);
+        }
+        else if (fakedb::startsWith(sql, "SELECT domain, target_ip FROM domain_mappings") ||
+            fakedb::startsWith(sql, "SELECT d.name, INET6_NTOA(m.target_ip) FROM domain_mappings")) {
+            db.allMappings(pending->rows);
+        }
+        else if (fakedb::startsWith(sql, "SELECT DISTINCT client_ip, domain FROM dns_verifications") ||
+            fakedb::startsWith(sql, "SELECT DISTINCT INET6_NTOA(v.client_ip), d.name FROM dns_verifications")) {
+            db.keyPairs(true, pending->rows);
+        }
+        else if (fakedb::startsWith(sql, "SELECT client_ip, domain FROM domain_configs") ||
+            fakedb::startsWith(sql, "SELECT INET6_NTOA(c.client_ip), d.name FROM domain_configs")) {
+            db.keyPairs(false, pending->rows);
+        }
+        else if (sql.find("information_schema.") != std::string::npos) {
+            // 替身的表结构固定，报告所有表、索引与列都已存在；domain_id 列只在精简结构下存在，
+            // 唯一键 unique_verify 不含 expire_time
+            bool present = (sql.find("'domain_id'") == std::string::npos || db.config().compactSchema) &&
+                sql.find("index_name = 'unique_verify' AND column_name = 'expire_time'") == std::string::npos;
+            pending->rows.push_back({ present ? "1" : "0" });
+        }
+    }
+    else if (fakedb::startsWith(sql, "INSERT") || fakedb::startsWith(sql, "REPLACE") || fakedb::startsWith(sql, "COMMIT")) {
+        db.writeDelay();
+    }
+    return 0;
+}
+
+inline MYSQL_RES* mysql_store_result(MYSQL* /*conn*/) {
+    MYSQL_RES* res = fakePendingResult();
+    fakePendingResult() = nullptr;
+    return res;
+}
+// 替身的结果集本来就在内存中，逐行读取与一次取回相同
+inline MYSQL_RES* mysql_use_result(MYSQL* conn) { return mysql_store_result(conn); }
+inline unsigned long mysql_num_rows(MYSQL_RES* res) { return res ? static_cast<unsigned long>(res->rows.size()) : 0; }
+inline unsigned int mysql_num_fields(MYSQL_RES* res) { return res ? static_cast<unsigned int>(res->fields.size()) : 0; }
+inline MYSQL_FIELD* mysql_fetch_fields(MYSQL_RES* res) { return res && !res->fields.empty() ? res->fields.data() : nullptr; }
+inline void mysql_free_result(MYSQL_RES* res) { delete res; }
+inline MYSQL_ROW mysql_fetch_row(MYSQL_RES* res) {
+    if (!res || res->next >= res->rows.size()) return nullptr;
+    size_t index = res->next++;
+    std::vector<std::string>& row = res->rows[index];
+    res->current.clear();
+    for (size_t i = 0; i < row.size(); ++i) {
+        bool isNull = index < res->nulls.size() && res->nulls[index][i];
+        res->current.push_back(isNull ? nullptr : &row[i][0]);
+    }
+    return res->current.data();
+}
+
+inline MYSQL_STMT* mysql_stmt_init(MYSQL* conn) {
+    MYSQL_STMT* stmt = new MYSQL_STMT();
+    if (conn) stmt->endpoint = conn->endpoint;
+    return stmt;
+}
+inline int mysql_stmt_prepare(MYSQL_STMT* stmt, const char* q, unsigned long len) {
+    std::string sql(q, len);
+    stmt->kind = fakedb::classify(sql);
+    stmt->paramCount = 0;
+    for (char c : sql) {
+        if (c == '?') ++stmt->paramCount;
+    }
+    stmt->params.assign(stmt->paramCount, std::string());
+    return 0;
+}
+inline unsigned long mysql_stmt_param_count(MYSQL_STMT* stmt) { return stmt->paramCount; }
+
+inline bool mysql_stmt_bind_param(MYSQL_STMT* stmt, MYSQL_BIND* binds) {
+    for (unsigned long i = 0; i < stmt->paramCount; ++i) {
+        const MYSQL_BIND& b = binds[i];
+        if (b.buffer_type == MYSQL_TYPE_LONGLONG) {
+            stmt->params[i] = std::to_string(*static_cast<const long long*>(b.buffer));
+        }
+        else {
+            unsigned long n = b.length ? *b.length : b.buffer_length;
+            stmt->params[i].assign(static_cast<const char*>(b.buffer), n);
+        }
+    }
+    return false;
+}
+
+inline bool mysql_stmt_bind_result(MYSQL_STMT* stmt, MYSQL_BIND* binds) { stmt->resultBinds = binds; return false; }
+
+inline int mysql_stmt_execute(MYSQL_STMT* stmt) {
+    fakedb::Backend& db = fakedb::backend();
+    db.countRead(stmt->endpoint);
+    const std::vector<std::string>& p = stmt->params;
+    stmt->rows.clear();
+    stmt->nulls.clear();
+    stmt->next = 0;
+    stmt->affected = 0;
+
+    switch (stmt->kind) {
+    case fakedb::KIND_WHITELIST_LOOKUP:
+        db.readDelay();
+        if (db.whitelistContains(p[0])) {
+            stmt->rows.push_back({ "1" });
+            stmt->nulls.push_back({ false });
+        }
+        break;
+    case fakedb::KIND_CONFIG_EXPIRE: {
+        db.readDelay();
+        fakedb::ConfigRow row;
+        if (db.configExpire(p[0], p[1], row)) {
+            stmt->rows.push_back({ row.expireTime, std::to_string(row.expireAt) });
+            stmt->nulls.push_back({ false, false });
+        }
+        break;
+    }
+    case fakedb::KIND_INSERT_VERIFICATIONS:
+        db.writeDelay();
+        stmt->affected = db.insertVerifications(p);
+        break;
+    case fakedb::KIND_FIND_ACTIVE: {
+        db.readDelay();
+        std::vector<std::string> row;
+        bool mappingNull = false;
+        if (db.findActive(p[0], p[1], row, mappingNull)) {
+            stmt->rows.push_back(row);
+            stmt->nulls.push_back({ false, mappingNull, false });
+        }
+        break;
+    }
+    case fakedb::KIND_BATCH_FIND: {
+        db.readDelay();
+        std::unordered_set<std::string> seen;
+        for (size_t i = 0; i + 1 < p.size(); i += 2) {
+            std::vector<std::string> row;
+            bool mappingNull = false;
+            if (!seen.insert(fakedb::key(p[i], p[i + 1])).second || !db.findActive(p[i], p[i + 1], row, mappingNull)) {
+                continue;
+            }
+            stmt->rows.push_back({ p[i], p[i + 1], row[0], row[1], row[2] });
+            stmt->nulls.push_back({ false, false, false, mappingNull, false });
+        }
+        break;
+    }
+    case fakedb::KIND_BATCH_CONFIG: {
+        db.readDelay();
+        std::unordered_set<std::string> seen;
+        for (size_t i = 1; i < p.size(); ++i) {
+            fakedb::ConfigRow row;
+            if (!seen.insert(p[i]).second || !db.configExpire(p[0], p[i], row)) {
+                continue;
+            }
+            stmt->rows.push_back({ p[i], row.expireTime });
+            stmt->nulls.push_back({ false, false });
+        }
+        break;
+    }
+    case fakedb::KIND_ADD_WHITELIST:
+        db.writeDelay();
+        db.addWhitelist(p[0]);
+        stmt->affected = 1;
+        break;
+    case fakedb::KIND_SET_WHITELIST_LIMIT:
+        db.writeDelay();
+        db.setWhitelistLimit(p[2], p[0], p[1]);
+        stmt->affected = 1;
+        break;
+    case fakedb::KIND_ADD_CONFIG:
+        db.writeDelay();
+        for (size_t i = 0; i + 3 < p.size(); i += 4) {
+            db.upsertConfig(p[i], p[i + 1], p[i + 2], atoll(p[i + 3].c_str()));
+        }
+        stmt->affected = p.size() / 4;
+        break;
+    case fakedb::KIND_ADD_MAPPING:
+        db.writeDelay();
+        for (size_t i = 0; i + 1 < p.size(); i += 2) {
+            db.upsertMapping(p[i], p[i + 1]);
+        }
+        stmt->affected = p.size() / 2;
+        break;
+    case fakedb::KIND_INTERN_DOMAINS:
+        db.writeDelay();
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+inline int mysql_stmt_store_result(MYSQL_STMT* /*stmt*/) { return 0; }
+
+inline int mysql_stmt_fetch(MYSQL_STMT* stmt) {
+    if (stmt->next >= stmt->rows.size()) return MYSQL_NO_DATA;
+    const std::vector<std::string>& row = stmt->rows[stmt->next];
+    const std::vector<bool>& nulls = stmt->nulls[stmt->next];
+    ++stmt->next;
+    if (!stmt->resultBinds) return 0;
+
+    int rc = 0;
+    for (size_t i = 0; i < row.size(); ++i) {
+        MYSQL_BIND& b = stmt->resultBinds[i];
+        *b.is_null = nulls[i];
+        *b.length = static_cast<unsigned long>(row[i].size());
+        size_t n = row[i].size();
+        if (n > b.buffer_length) {
+            n = b.buffer_length;
+            rc = MYSQL_DATA_TRUNCATED;
+        }
+        memcpy(b.buffer, row[i].data(), n);
+    }
+    return rc;
+}
+
+inline bool mysql_stmt_free_result(MYSQL_STMT* stmt) {
+    stmt->rows.clear();
+    stmt->nulls.clear();
+    stmt->next = 0;
+    return false;
+}
+inline bool mysql_stmt_close(MYSQL_STMT* stmt) { delete stmt; return false; }
+inline unsigned int mysql_stmt_errno(MYSQL_STMT* /*stmt*/) { return 0; }
+inline const char* mysql_stmt_error(MYSQL_STMT* /*stmt*/) { return ""; }
+inline unsigned long long mysql_stmt_affected_rows(MYSQL_STMT* stmt) { return stmt->affected; }
+
+#ifdef __linux__
+// 非阻塞 API（libmysqlclient 8.0.16+）：文本 SQL 按前缀识别为与预编译语句相同的类型，
+// 单引号字面量依次作为参数（'verify' 是语句自带的 mode 常量，跳过），按会话的 sql_mode 解析转义。注入延迟不在调用线程等待，
+// 而是设置到连接的 timerfd 上，到期前返回 NET_ASYNC_NOT_READY，与真实网络往返一样可由 epoll 等待。
+enum net_async_status { NET_ASYNC_COMPLETE = 0, NET_ASYNC_NOT_READY, NET_ASYNC_ERROR, NET_ASYNC_COMPLETE_NO_MORE_RESULTS };
+
+namespace fakedb {
+    inline std::vector<std::string> literals(const std::string& sql) {
+        bool backslash = !backend().config().noBackslashEscapes;
+        std::vector<std::string> values;
+        size_t pos = 0;
+        while ((pos = sql.find('\'', pos)) != std::string::npos) {
+            std::string value;
+            size_t i = pos + 1;
+            for (; i < sql.size(); ++i) {
+                char c = sql[i];
+                if (backslash && c == '\\' && i + 1 < sql.size()) {
+                    char e = sql[++i];
+                    value += e == '0' ? '\0' : e == 'n' ? '\n' : e == 'r' ? '\r' : e == 'Z' ? '\x1a' : e;
+                    continue;
+                }
+                if (c == '\'') {
+                    if (i + 1 < sql.size() && sql[i + 1] == '\'') {
+                        value += '\'';
+                        ++i;
+                        continue;
+                    }
+                    break;
+                }
+                value += c;
+            }
+            if (value != "verify") values.push_back(value);
+            pos = i + 1;
+        }
+        return values;
+    }
+}
+
+inline net_async_status mysql_real_query_nonblocking(MYSQL* conn, const char* q, unsigned long len) {
+    conn->asyncUsed = true;
+    if (!conn->connected) {
+        return NET_ASYNC_ERROR;
+    }
+    if (conn->asyncBusy) {
+        uint64_t expirations = 0;
+        if (read(conn->net.fd, &expirations, sizeof(expirations)) != static_cast<ssize_t>(sizeof(expirations))) {
+            return NET_ASYNC_NOT_READY;
+        }
+        conn->asyncBusy = false;
+        return NET_ASYNC_COMPLETE;
+    }
+
+    std::string sql(q, len);
+    MYSQL_STMT stmt;
+    stmt.kind = fakedb::classify(sql);
+    stmt.params = fakedb::literals(sql);
+    int delayUs = 0;
+    fakedb::Backend::deferredDelay() = &delayUs;
+    mysql_stmt_execute(&stmt);
+    fakedb::Backend::deferredDelay() = nullptr;
+
+    delete conn->asyncResult;
+    conn->asyncResult = new MYSQL_RES();
+    conn->asyncResult->rows.swap(stmt.rows);
+    conn->asyncResult->nulls.swap(stmt.nulls);
+    if (delayUs <= 0 || conn->net.fd < 0) {
+        return NET_ASYNC_COMPLETE;
+    }
+
+    itimerspec spec = {};
+    spec.it_value.tv_sec = delayUs / 1000000;
+    spec.it_value.tv_nsec = static_cast<long>(delayUs % 1000000) * 1000;
+    timerfd_settime(conn->net.fd, 0, &spec, nullptr);
+    conn->asyncBusy = true;
+    return NET_ASYNC_NOT_READY;
+}
+
+inline net_async_status mysql_store_result_nonblocking(MYSQL* conn, MYSQL_RES** result) {
+    *result = conn->asyncResult;
+    conn->asyncResult = nullptr;
+    return NET_ASYNC_COMPLETE;
+}
+#endif
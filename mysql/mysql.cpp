@@ -3,21 +3,62 @@
 #include <sstream>
 #include <ctime>
 #include <cstring>
+#include <cstdlib>
+#include <cstdio>
 #include <map>
 #include <unordered_map>
 #include <functional>
-#include <iomanip>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <initializer_list>
+#include <deque>
+#include <algorithm>
+#include <cctype>
+#include <future>
+#include <unordered_set>
+#include <shared_mutex>
+#include <cmath>
+
+#ifdef _WIN32
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  include <direct.h>
+#  include <io.h>
+#  include <process.h>
+#else
+#  include <arpa/inet.h>
+#  include <netinet/in.h>
+#  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <unistd.h>
+#endif
 
 // Try to include third-party headers when available; otherwise provide lightweight stubs
 #if defined(__has_include)
-#  if __has_include(<mysql/mysql.h>)
+#  if defined(DNS_AUTH_BENCH) || defined(DNS_AUTH_FAKE_DB)
+// 基准测试与测试构建：用进程内的内存数据库替身代替 libmysqlclient
+#    include "fake_mysql.h"
+#  elif __has_include(<mysql/mysql.h>)
 #    include <mysql/mysql.h>
+#    include <mysql/errmsg.h>
 #  else
 // Minimal MySQL stubs so code can compile when libmysqlclient is not available
-typedef struct MYSQL { bool connected; } MYSQL;
+typedef struct NET { int fd; } NET;
+typedef struct MYSQL { bool connected; NET net; } MYSQL;
 typedef struct MYSQL_RES { int rows; } MYSQL_RES;
 typedef char** MYSQL_ROW;
-inline MYSQL* mysql_init(MYSQL* /*unused*/) { MYSQL* m = new MYSQL(); m->connected = false; return m; }
+typedef struct MYSQL_FIELD { char* name; } MYSQL_FIELD;
+inline MYSQL* mysql_init(MYSQL* /*unused*/) { MYSQL* m = new MYSQL(); m->connected = false; m->net.fd = -1; return m; }
 inline MYSQL* mysql_real_connect(MYSQL* conn, const char* host, const char* user, const char* passwd, const char* db, unsigned int /*port*/, const char* /*unix_socket*/, unsigned long /*client_flag*/) {
     if (!conn) return nullptr; conn->connected = true; (void)host; (void)user; (void)passwd; (void)db; return conn;
 }
@@ -26,9 +67,55 @@ inline int mysql_set_character_set(MYSQL* /*conn*/, const char* /*cs*/) { return
 inline const char* mysql_error(MYSQL* /*conn*/) { return "mysql stub"; }
 inline int mysql_query(MYSQL* /*conn*/, const char* /*q*/) { return 0; }
 inline MYSQL_RES* mysql_store_result(MYSQL* /*conn*/) { return nullptr; }
+inline MYSQL_RES* mysql_use_result(MYSQL* /*conn*/) { return nullptr; }
 inline unsigned long mysql_num_rows(MYSQL_RES* /*res*/) { return 0; }
 inline void mysql_free_result(MYSQL_RES* /*res*/) { }
 inline MYSQL_ROW mysql_fetch_row(MYSQL_RES* /*res*/) { return nullptr; }
+inline unsigned int mysql_num_fields(MYSQL_RES* /*res*/) { return 0; }
+inline MYSQL_FIELD* mysql_fetch_fields(MYSQL_RES* /*res*/) { return nullptr; }
+inline unsigned int mysql_errno(MYSQL* /*conn*/) { return 0; }
+inline int mysql_ping(MYSQL* conn) { return (conn && conn->connected) ? 0 : 1; }
+enum net_async_status { NET_ASYNC_COMPLETE = 0, NET_ASYNC_NOT_READY, NET_ASYNC_ERROR, NET_ASYNC_COMPLETE_NO_MORE_RESULTS };
+inline net_async_status mysql_real_query_nonblocking(MYSQL* /*conn*/, const char* /*q*/, unsigned long /*len*/) { return NET_ASYNC_ERROR; }
+inline net_async_status mysql_store_result_nonblocking(MYSQL* /*conn*/, MYSQL_RES** result) { *result = nullptr; return NET_ASYNC_ERROR; }
+inline unsigned long mysql_real_escape_string_quote(MYSQL* /*conn*/, char* to, const char* from, unsigned long length, char /*quote*/) {
+    unsigned long n = 0;
+    for (unsigned long i = 0; i < length; ++i) {
+        char c = from[i];
+        if (c == '\0' || c == '\'' || c == '"' || c == '\\') to[n++] = '\\';
+        to[n++] = c == '\0' ? '0' : c;
+    }
+    to[n] = '\0';
+    return n;
+}
+#    define CR_SERVER_GONE_ERROR 2006
+#    define CR_SERVER_LOST 2013
+enum enum_field_types { MYSQL_TYPE_LONG = 3, MYSQL_TYPE_LONGLONG = 8, MYSQL_TYPE_STRING = 254 };
+typedef struct MYSQL_STMT { int unused; } MYSQL_STMT;
+typedef struct MYSQL_BIND {
+    unsigned long* length;
+    bool* is_null;
+    void* buffer;
+    bool* error;
+    enum enum_field_types buffer_type;
+    unsigned long buffer_length;
+    bool is_unsigned;
+} MYSQL_BIND;
+#    define MYSQL_NO_DATA 100
+#    define MYSQL_DATA_TRUNCATED 101
+inline MYSQL_STMT* mysql_stmt_init(MYSQL* /*conn*/) { return new MYSQL_STMT(); }
+inline int mysql_stmt_prepare(MYSQL_STMT* /*stmt*/, const char* /*q*/, unsigned long /*len*/) { return 0; }
+inline unsigned long mysql_stmt_param_count(MYSQL_STMT* /*stmt*/) { return 0; }
+inline bool mysql_stmt_bind_param(MYSQL_STMT* /*stmt*/, MYSQL_BIND* /*b*/) { return false; }
+inline bool mysql_stmt_bind_result(MYSQL_STMT* /*stmt*/, MYSQL_BIND* /*b*/) { return false; }
+inline int mysql_stmt_execute(MYSQL_STMT* /*stmt*/) { return 0; }
+inline int mysql_stmt_store_result(MYSQL_STMT* /*stmt*/) { return 0; }
+inline int mysql_stmt_fetch(MYSQL_STMT* /*stmt*/) { return MYSQL_NO_DATA; }
+inline bool mysql_stmt_free_result(MYSQL_STMT* /*stmt*/) { return false; }
+inline bool mysql_stmt_close(MYSQL_STMT* stmt) { delete stmt; return false; }
+inline unsigned int mysql_stmt_errno(MYSQL_STMT* /*stmt*/) { return 0; }
+inline const char* mysql_stmt_error(MYSQL_STMT* /*stmt*/) { return "mysql stub"; }
+inline unsigned long long mysql_stmt_affected_rows(MYSQL_STMT* /*stmt*/) { return 1; }
 #  endif
 
 #  if __has_include(<jsoncpp/json/json.h>)
@@ -38,11 +125,13 @@ inline MYSQL_ROW mysql_fetch_row(MYSQL_RES* /*res*/) { return nullptr; }
 namespace Json {
     struct StreamWriterBuilder {};
     struct CharReaderBuilder {};
+    typedef unsigned int ArrayIndex;
 
     class Value {
     public:
         std::string value;
         std::unordered_map<std::string, Value> children;
+        std::vector<Value> items;   // 数组元素（stub 解析器不会生成数组）
 
         Value() = default;
         Value(const std::string& v) : value(v) {}
@@ -64,7 +153,12 @@ namespace Json {
 
         std::string asString() const { return value; }
 
-        void clear() { value.clear(); children.clear(); }
+        bool isObject() const { return !children.empty(); }
+        bool isArray() const { return !items.empty(); }
+        ArrayIndex size() const { return static_cast<ArrayIndex>(isArray() ? items.size() : children.size()); }
+        const Value& operator[](ArrayIndex index) const { return items[index]; }
+
+        void clear() { value.clear(); children.clear(); items.clear(); }
     };
 
     inline bool parseFromStream(const CharReaderBuilder& /*b*/, std::istream& is, Value* root, std::string* errs) {
@@ -127,32 +221,198 @@ namespace httplib {
         std::string remote_addr;
         std::string body;
         std::map<std::string, std::string> headers;
+        std::multimap<std::string, std::string> params;
         bool has_header(const std::string& key) const { return headers.find(key) != headers.end(); }
         std::string get_header_value(const std::string& key) const {
             auto it = headers.find(key);
             return it == headers.end() ? std::string() : it->second;
         }
+        bool has_param(const std::string& key) const { return params.find(key) != params.end(); }
+        std::string get_param_value(const std::string& key) const {
+            auto it = params.find(key);
+            return it == params.end() ? std::string() : it->second;
+        }
     };
 
     struct Response {
-        std::string content;
-        void set_content(const std::string& c, const std::string& /*type*/) { content = c; }
+        std::string body;
+        void set_content(const std::string& c, const std::string& /*type*/) { body = c; }
+        void set_content(const char* c, size_t n, const std::string& /*type*/) { body.assign(c, n); }
+    };
+
+    using ContentReceiver = std::function<bool(const char* data, size_t length)>;
+
+    class ContentReader {
+    public:
+        using Reader = std::function<bool(ContentReceiver receiver)>;
+        explicit ContentReader(Reader r) : reader(std::move(r)) {}
+        bool operator()(ContentReceiver receiver) const { return reader(std::move(receiver)); }
+
+    private:
+        Reader reader;
     };
 
     class Server {
     public:
         using Handler = std::function<void(const Request&, Response&)>;
+        using HandlerWithContentReader = std::function<void(const Request&, Response&, const ContentReader&)>;
         void Post(const std::string& /*path*/, const Handler& /*h*/) { }
+        void Post(const std::string& /*path*/, const HandlerWithContentReader& /*h*/) { }
         void Get(const std::string& /*path*/, const Handler& /*h*/) { }
-        void listen(const char* /*host*/, int /*port*/) { }
+        void set_payload_max_length(size_t /*length*/) { }
+        using SocketOptions = std::function<void(int)>;
+        void set_socket_options(SocketOptions /*options*/) { }
+        // 不接受连接，但与真实库一样阻塞到 stop()
+        void listen(const char* /*host*/, int /*port*/) { listen_after_bind(); }
+        bool bind_to_port(const std::string& /*host*/, int /*port*/) { return true; }
+        bool listen_after_bind() {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this]() { return stopped; });
+            return true;
+        }
+        void stop() {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopped = true;
+            cv.notify_all();
+        }
+
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stopped = false;
     };
 }
 #  endif
 #endif
 
+// 异步数据库访问需要 C++20 协程、epoll 以及 libmysqlclient 8.0.16 起提供的非阻塞 API
+#if defined(__cpp_impl_coroutine) && defined(__linux__) && (!defined(MYSQL_VERSION_ID) || MYSQL_VERSION_ID >= 80016)
+#  define DNS_AUTH_ASYNC_DB 1
+#  include <coroutine>
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#endif
+
+// 多进程工作模式依赖 SO_REUSEPORT 在各进程的监听套接字之间分配连接（Linux 3.9+）
+#if defined(__linux__)
+#  define DNS_AUTH_WORKERS 1
+#  include <sched.h>
+#  include <signal.h>
+#  include <sys/prctl.h>
+#  include <sys/wait.h>
+#endif
+
 using namespace std;
 using namespace httplib;
 
+// verify 模式写入 dns_verifications 的方式
+enum VerifyWriteMode {
+    VERIFY_WRITE_SYNC = 0,          // 每个请求同步插入一行（旧行为）
+    VERIFY_WRITE_ACK_ON_ENQUEUE,    // 进入写队列即返回，由后台批量写入；批次重试一次仍失败或进程在提交前退出时，已应答 200 的记录会丢失
+    VERIFY_WRITE_ACK_ON_COMMIT      // 进入写队列后等待所在批次提交成功再返回
+};
+
+// 存储后端
+enum StorageEngine {
+    STORAGE_ENGINE_MYSQL = 0,       // MySQL（libmysqlclient）
+    STORAGE_ENGINE_EMBEDDED         // 进程内嵌入式引擎：内存哈希索引 + 追加日志 + 快照
+};
+
+// 日志级别
+enum LogLevel {
+    LOG_DEBUG = 0,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+};
+
+// 服务运行参数（与数据库连接无关的部分）
+struct ServerConfig {
+    // 存储后端
+    StorageEngine storageEngine = STORAGE_ENGINE_MYSQL;
+    string embeddedDataDir = "dns_auth_data";     // 嵌入式引擎的数据目录（日志与快照）
+    int embeddedSnapshotIntervalSec = 60;         // 检查是否需要快照的间隔
+    size_t embeddedSnapshotMinRecords = 100000;   // 日志累计超过该记录数才做快照并截断日志
+    bool embeddedFsync = false;                   // 每次提交后 fsync，否则只刷到操作系统缓存
+
+    int whitelistRefreshMs = 5000;       // 白名单后台增量刷新间隔
+    int whitelistFullReloadEvery = 60;   // 每隔多少次增量刷新做一次全量重建
+
+    // dns_verifications 批量写入
+    VerifyWriteMode verifyWriteMode = VERIFY_WRITE_ACK_ON_COMMIT;   // ACK_ON_ENQUEUE 的应答不代表已落库，见 VerifyWriteMode
+    size_t verifyQueueCapacity = 65536;  // 写队列容量上限
+    size_t verifyBatchSize = 256;        // 单批最多写入行数
+    int verifyFlushIntervalMs = 5;       // 队列中最早一条等待超过该时长即刷盘
+    int verifyEnqueueTimeoutMs = 100;    // 队列满时入队最长等待时间，超时拒绝请求
+    int verifyCoalesceWindowMs = 2000;   // 本进程写入后该时长内同一 (client_ip, domain)、同一到期时间的 verify 不再写库，0 表示关闭
+    size_t verifyCoalesceCapacity = 100000;   // verify 合并记录的条目上限
+
+    // find 结果缓存
+    size_t findCacheCapacity = 100000;   // 缓存条目总数上限，0 表示关闭
+    size_t findCacheShards = 64;         // 分片数，每个分片独立加锁
+    int findCacheTtlSec = 30;            // 条目最长存活时间（同时不超过记录本身的 expire_time）
+
+    // 未命中保护：不在白名单中的 IP（白名单回退查询时）与没有验证记录的 (ip, domain) 不重复访问存储
+    size_t negativeCacheCapacity = 100000;   // 未命中结果缓存的条目上限，0 表示关闭
+    int negativeCacheTtlSec = 5;             // 未命中结果的存活时间
+    bool findFilterEnabled = false;          // 由 dns_verifications / domain_configs 的键构建布隆过滤器，判定不存在的 find 直接返回 404
+    int findFilterRebuildSec = 300;          // 过滤器全量重建间隔，其他进程新增的键在重建前可能被误判为不存在
+    double findFilterFalsePositiveRate = 0.01;
+
+    // 准入控制：每个客户端 IP 一个令牌桶，白名单条目可单独指定限额（ip_whitelist.rate_limit / rate_burst）
+    uint32_t clientRateLimit = 0;        // 默认每秒补充的令牌数，0 表示不限速
+    uint32_t clientRateBurst = 0;        // 默认令牌桶容量，0 表示与每秒令牌数相同；最大 16777
+    size_t rateLimitSlots = 65536;       // 令牌桶槽位数，同时活跃的客户端 IP 超出时多出的不限速
+    int maxConcurrentRequests = 0;       // 同时处理的 verify / find / batch 请求上限，超出直接返回 503，0 表示不限
+
+    // 批量接口
+    size_t batchMaxItems = 1000;         // /dns-auth/batch 单次请求最多条目数
+
+    // dns_verifications 数据保留
+    bool retentionEnabled = true;        // 后台定期删除过期与被取代的验证记录
+    int retentionIntervalSec = 3600;     // 两轮清理之间的间隔
+    int retentionGraceSec = 7 * 86400;   // 过期超过该时长才删除，此前 find 仍返回“域名已过期”
+    size_t retentionBatchRows = 2000;    // 每批处理的主键范围宽度
+    int retentionBatchPauseMs = 100;     // 批次之间的停顿，限制对线上查询的影响
+
+    // 启动快照（ip_whitelist、domain_mappings、启用状态的 domain_configs），仅 MySQL 存储使用
+    string warmSnapshotPath;             // 启动快照文件，如 "dns_auth_warm.snap"；默认为空即关闭
+    int warmSnapshotIntervalSec = 300;   // 重写快照的间隔
+    bool warmSnapshotRewrite = true;     // 定期重写快照；多进程模式下只由 0 号工作进程重写
+    int warmSnapshotMaxAgeSec = 600;     // 超过该时长的快照不用于启动，实际上限不超过 2 × warmSnapshotIntervalSec
+    int warmSnapshotServeSec = 60;       // 启动后在该时长内域名配置查询优先由快照应答
+
+    // UDP DNS 应答：以报文源 IP 作为 client_ip 直接回答 find 查询（A/AAAA）
+    int dnsPort = 0;                     // 0 表示关闭
+    string dnsBindAddress = "0.0.0.0";
+    int dnsTtlSec = 30;                  // 应答 TTL 上限，不超过记录剩余有效期
+    size_t dnsBatchSize = 32;            // 每次 recvmmsg/sendmmsg 收发的报文数上限
+    int dnsThreads = 1;                  // 共享同一套接字的收发线程数
+
+    // 多进程（仅 Linux）：主进程只负责启动与重启工作进程，每个工作进程有自己的连接池与缓存，
+    // 以 SO_REUSEPORT 各自监听同一 HTTP / DNS 端口
+    int workerProcesses = 0;             // 0 表示单进程运行，小于 0 表示按可用 CPU 数启动
+    bool workerCpuAffinity = false;      // 每个工作进程绑定一个 CPU
+    int workerReadyTimeoutSec = 60;      // 等待新工作进程开始监听的时长，滚动重启超时即中止
+    int workerStopTimeoutSec = 30;       // 停止工作进程时等待在途请求处理完的时长，超时强制结束
+    // 数据保留任务、启动快照重写与建表/表结构变更只在 0 号工作进程运行，0 号进程开始监听后才启动其余进程
+
+    // 管理接口
+    string adminToken;                   // POST /admin/import 要求的 Bearer 令牌，空字符串表示不注册管理接口
+    size_t importBatchRows = 5000;       // 批量导入时每个事务写入的行数
+    size_t importMaxBytes = 256 * 1024 * 1024;  // POST /admin/import 请求体上限，超过返回 413；同时是所有请求体的上限
+
+    // 日志
+    LogLevel logLevel = LOG_INFO;        // 低于该级别的日志直接丢弃
+    unsigned accessLogSampleEvery = 100; // 每个线程每 N 个请求记录一条访问日志（5xx 总是记录），0 表示不记录
+};
+
+// 只读副本地址；用户名、密码、库名与连接池大小沿用主库配置
+struct ReplicaConfig {
+    string host;
+    int port = 3306;
+};
+
 // MySQL数据库连接配置
 struct DBConfig {
     string host = "localhost";
@@ -160,442 +420,9731 @@ struct DBConfig {
     string password = "password";
     string database = "dns_auth";
     int port = 3306;
-};
-
-// 响应结构体
-struct ResponseStruct {
-    int code = 0; // 始终初始化成员变量
-    string message;
-    string data;
-};
 
-class DNSAuthServer {
-private:
-    DBConfig dbConfig;
-    MYSQL* mysqlConn;
-    Server server;
+    // 连接池配置
+    size_t poolMinSize = 4;              // 启动时预先建立的连接数
+    size_t poolMaxSize = 32;             // 连接总数上限
+    int poolAcquireTimeoutMs = 3000;     // 借出连接的最长等待时间
+    int poolIdleCheckMs = 30000;         // 空闲超过该时长的连接在借出前先 ping 一次
 
-public:
-    DNSAuthServer() : mysqlConn(nullptr) {}
+    // 精简表结构（仅在新建表时生效，已有的文本表用 migrate-schema 子命令转换）：IP 存为 VARBINARY(16)，
+    // 域名规范化（小写、去掉末尾的点）后存入 domains 表，其他表以整数 id 引用
+    bool compactSchema = false;
 
-    ~DNSAuthServer() {
-        if (mysqlConn) {
-            mysql_close(mysqlConn);
-        }
-    }
+    // dns_verifications 按 expire_time 按月分区（仅在新建表时生效），过期分区由数据保留任务整体删除
+    bool partitionVerifications = false;
+    int partitionMonthsAhead = 3;        // 预先建好的未来月份分区数
 
-    // 初始化MySQL连接
-    bool initMySQL() {
-        mysqlConn = mysql_init(nullptr);
-        if (!mysqlConn) {
-            cerr << "MySQL初始化失败" << endl;
-            return false;
-        }
+    bool manageSchema = true;            // 启动时建表并补齐索引与列；为 false 时只读取现有表结构
 
-        if (!mysql_real_connect(mysqlConn,
-            dbConfig.host.c_str(),
-            dbConfig.user.c_str(),
-            dbConfig.password.c_str(),
-            dbConfig.database.c_str(),
-            dbConfig.port, nullptr, 0)) {
-            cerr << "MySQL连接失败: " << mysql_error(mysqlConn) << endl;
-            return false;
-        }
+    // 读写分离：上面的 host / port 为主库，find、白名单与导出类读查询发往负载最低的健康副本，
+    // 写入与 verify 的域名配置查询始终走主库
+    vector<ReplicaConfig> replicas;
+    int replicaCheckIntervalMs = 1000;   // 检查副本复制延迟的间隔
+    int replicaMaxLagSec = 5;            // 延迟超过该值、复制中断或不是副本时不向其发送读请求
 
-        mysql_set_character_set(mysqlConn, "utf8");
-        cout << "MySQL连接成功" << endl;
+    // 异步查询：verify / find 与 DNS 应答经非阻塞连接访问数据库，由少量 reactor 线程驱动
+    // （仅在支持 C++20 协程的 Linux 构建中生效，否则始终使用连接池同步查询）
+    bool asyncQueries = false;
+    int asyncReactorThreads = 2;
+    size_t asyncConnectionsPerThread = 16;
+};
 
-        // 创建必要的表
-        createTables();
+// 异步日志：每个线程写自己的单生产者环形缓冲区（无锁、无系统调用），后台线程定期汇总输出。
+// 缓冲区满时丢弃新日志并计数，不阻塞业务线程。
+class Logger {
+private:
+    static const size_t kRingSize = 1024;       // 每个线程的日志槽位数（2 的幂）
+    static const size_t kTextMax = 200;         // 单条日志正文上限，超出截断
 
-        return true;
-    }
+    enum RecordKind { RECORD_TEXT = 0, RECORD_ACCESS };
 
-    // 创建数据库表
-    void createTables() {
-        const char* createTablesSQL[] = {
-            // 白名单表
-            "CREATE TABLE IF NOT EXISTS ip_whitelist ("
-            "id INT AUTO_INCREMENT PRIMARY KEY,"
-            "ip VARCHAR(45) NOT NULL UNIQUE,"
-            "description VARCHAR(255),"
-            "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
-            ")",
+    struct Record {
+        int64_t timeUs;
+        uint8_t level;
+        uint8_t kind;
+        uint16_t length;
+        int32_t code;
+        int64_t latencyUs;
+        char mode[16];
+        char text[kTextMax];
+    };
 
-            // A表：验证记录表
-            "CREATE TABLE IF NOT EXISTS dns_verifications ("
-            "id INT AUTO_INCREMENT PRIMARY KEY,"
-            "client_ip VARCHAR(45) NOT NULL,"
-            "domain VARCHAR(255) NOT NULL,"
-            "expire_time DATETIME NOT NULL,"
-            "mode VARCHAR(20) NOT NULL,"
-            "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
-            "INDEX idx_ip_domain (client_ip, domain)"
-            ")",
+    struct Ring {
+        alignas(64) atomic<size_t> head{ 0 };    // 生产者写入位置
+        alignas(64) atomic<size_t> tail{ 0 };    // 消费者读取位置
+        atomic<uint64_t> dropped{ 0 };
+        atomic<bool> abandoned{ false };         // 所属线程已退出，读空后回收
+        Record records[kRingSize];
+    };
 
-            // B表：域名-IP映射表
-            "CREATE TABLE IF NOT EXISTS domain_mappings ("
-            "id INT AUTO_INCREMENT PRIMARY KEY,"
-            "domain VARCHAR(255) NOT NULL UNIQUE,"
-            "target_ip VARCHAR(45) NOT NULL,"
-            "updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP"
-            ")",
+    // 线程退出时通知后台线程回收其缓冲区
+    struct RingHolder {
+        shared_ptr<Ring> ring;
+        ~RingHolder() {
+            if (ring) ring->abandoned.store(true, memory_order_release);
+        }
+    };
 
-            // C表：域名配置表
-            "CREATE TABLE IF NOT EXISTS domain_configs ("
-            "id INT AUTO_INCREMENT PRIMARY KEY,"
-            "client_ip VARCHAR(45) NOT NULL,"
-            "domain VARCHAR(255) NOT NULL,"
-            "expire_time DATETIME NOT NULL,"
-            "status INT DEFAULT 1,"
-            "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
-            "UNIQUE KEY unique_ip_domain (client_ip, domain)"
-            ")"
-        };
+    atomic<int> minLevel{ LOG_INFO };
+    atomic<unsigned> sampleEvery{ 1 };
+    mutex ringsMtx;
+    vector<shared_ptr<Ring>> rings;
+    mutex flushMtx;
+    condition_variable flushCv;
+    thread flusher;
+    bool stopping = false;
+    int flushIntervalMs = 20;
 
-        for (const char* sql : createTablesSQL) {
-            if (mysql_query(mysqlConn, sql) != 0) {
-                cerr << "创建表失败: " << mysql_error(mysqlConn) << endl;
-            }
-        }
+    Logger() {
+        flusher = thread([this]() { run(); });
     }
 
-    // 检查IP是否在白名单中
-    bool checkIPInWhitelist(const string& ip) {
-        string sql = "SELECT id FROM ip_whitelist WHERE ip = '" + ip + "'";
+    ~Logger() { shutdown(); }
 
-        if (mysql_query(mysqlConn, sql.c_str()) != 0) {
-            cerr << "查询白名单失败: " << mysql_error(mysqlConn) << endl;
-            return false;
+    Ring& localRing() {
+        thread_local RingHolder holder;
+        if (!holder.ring) {
+            holder.ring = make_shared<Ring>();
+            lock_guard<mutex> lock(ringsMtx);
+            rings.push_back(holder.ring);
         }
+        return *holder.ring;
+    }
 
-        MYSQL_RES* result = mysql_store_result(mysqlConn);
-        if (!result) {
-            return false;
+    // 取一个空闲槽位，缓冲区满时返回 nullptr
+    Record* beginRecord(Ring& ring, size_t& pos) {
+        pos = ring.head.load(memory_order_relaxed);
+        if (pos - ring.tail.load(memory_order_acquire) >= kRingSize) {
+            ring.dropped.fetch_add(1, memory_order_relaxed);
+            return nullptr;
         }
+        return &ring.records[pos & (kRingSize - 1)];
+    }
 
-        bool exists = (mysql_num_rows(result) > 0);
-        mysql_free_result(result);
-
-        return exists;
+    static int64_t nowUs() {
+        return chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
     }
 
-    // 执行SQL查询
-    bool executeSQL(const string& sql) {
-        if (mysql_query(mysqlConn, sql.c_str()) != 0) {
-            cerr << "SQL执行失败: " << mysql_error(mysqlConn) << endl;
-            return false;
-        }
-        return true;
+    static void appendText(Record& r, const char* text, size_t len) {
+        size_t room = kTextMax - r.length;
+        if (len > room) len = room;
+        memcpy(r.text + r.length, text, len);
+        r.length = static_cast<uint16_t>(r.length + len);
     }
 
-    // 查询单个结果
-    string querySingleValue(const string& sql) {
-        if (mysql_query(mysqlConn, sql.c_str()) != 0) {
-            return "";
-        }
+    static void appendPart(Record& r, const char* text) { appendText(r, text ? text : "", text ? strlen(text) : 0); }
+    static void appendPart(Record& r, char* text) { appendPart(r, static_cast<const char*>(text)); }
+    static void appendPart(Record& r, const string& text) { appendText(r, text.data(), text.size()); }
 
-        MYSQL_RES* result = mysql_store_result(mysqlConn);
-        if (!result) {
-            return "";
-        }
+    template <typename T>
+    static typename enable_if<is_integral<T>::value>::type appendPart(Record& r, T value) {
+        char digits[24];
+        size_t n = 0;
+        bool negative = value < 0;
+        unsigned long long v = negative ? 0ULL - static_cast<unsigned long long>(value)
+            : static_cast<unsigned long long>(value);
+        do {
+            digits[n++] = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v != 0);
+        if (negative) digits[n++] = '-';
+        char out[24];
+        for (size_t i = 0; i < n; ++i) out[i] = digits[n - 1 - i];
+        appendText(r, out, n);
+    }
 
-        MYSQL_ROW row = mysql_fetch_row(result);
-        string value = row ? row[0] : "";
+    static void appendParts(Record&) {}
 
-        mysql_free_result(result);
-        return value;
+    template <typename T, typename... Rest>
+    static void appendParts(Record& r, const T& first, const Rest&... rest) {
+        appendPart(r, first);
+        appendParts(r, rest...);
     }
 
-    // 验证模式处理
-    ResponseStruct handleVerifyMode(const string& clientIP, const Json::Value& jsonData) {
-        ResponseStruct response;
+    static const char* levelName(int level) {
+        static const char* const kNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+        return kNames[level < 0 || level > LOG_ERROR ? LOG_ERROR : level];
+    }
 
-        // 获取域名
-        if (!jsonData.isMember("domain") || jsonData["domain"].asString().empty()) {
-            response.code = 400;
-            response.message = "缺少域名参数";
-            return response;
+    static void formatTime(string& out, int64_t timeUs) {
+        time_t seconds = static_cast<time_t>(timeUs / 1000000);
+        struct tm tmValue = {};
+#ifdef _WIN32
+        localtime_s(&tmValue, &seconds);
+#else
+        localtime_r(&seconds, &tmValue);
+#endif
+        char buf[40];
+        int n = snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%06d",
+            tmValue.tm_year + 1900, tmValue.tm_mon + 1, tmValue.tm_mday,
+            tmValue.tm_hour, tmValue.tm_min, tmValue.tm_sec, static_cast<int>(timeUs % 1000000));
+        out.append(buf, n > 0 ? static_cast<size_t>(n) : 0);
+    }
+
+    static void formatRecord(string& out, const Record& r) {
+        formatTime(out, r.timeUs);
+        out += ' ';
+        out += levelName(r.level);
+        out += ' ';
+        if (r.kind == RECORD_ACCESS) {
+            char buf[96];
+            out += "access client_ip=";
+            out.append(r.text, r.length);
+            int n = snprintf(buf, sizeof(buf), " mode=%s code=%d latency_us=%lld",
+                r.mode, static_cast<int>(r.code), static_cast<long long>(r.latencyUs));
+            out.append(buf, n > 0 ? static_cast<size_t>(n) : 0);
         }
+        else {
+            out.append(r.text, r.length);
+        }
+        out += '\n';
+    }
 
-        string domain = jsonData["domain"].asString();
+    // 读空所有线程的缓冲区；WARN 及以上写 stderr，其余写 stdout
+    void drain() {
+        vector<shared_ptr<Ring>> snapshot;
+        {
+            lock_guard<mutex> lock(ringsMtx);
+            snapshot = rings;
+        }
 
-        // 从C表查询到期时间
-        string sql = "SELECT expire_time FROM domain_configs WHERE client_ip = '" +
-            clientIP + "' AND domain = '" + domain + "' AND status = 1";
+        string outText;
+        string errText;
+        for (auto& ring : snapshot) {
+            size_t tail = ring->tail.load(memory_order_relaxed);
+            size_t head = ring->head.load(memory_order_acquire);
+            for (; tail != head; ++tail) {
+                const Record& r = ring->records[tail & (kRingSize - 1)];
+                formatRecord(r.level >= LOG_WARN ? errText : outText, r);
+            }
+            ring->tail.store(tail, memory_order_release);
 
-        string expireTime = querySingleValue(sql);
-        if (expireTime.empty()) {
-            response.code = 404;
-            response.message = "域名配置不存在或已禁用";
-            return response;
+            uint64_t dropped = ring->dropped.exchange(0, memory_order_relaxed);
+            if (dropped > 0) {
+                errText += "日志缓冲区已满，丢弃 " + to_string(dropped) + " 条日志\n";
+            }
         }
 
-        // 插入A表记录
-        sql = "INSERT INTO dns_verifications (client_ip, domain, expire_time, mode) VALUES ('" +
-            clientIP + "', '" + domain + "', '" + expireTime + "', 'verify')";
-
-        if (!executeSQL(sql)) {
-            response.code = 500;
-            response.message = "数据库插入失败";
-            return response;
+        if (!outText.empty()) {
+            fwrite(outText.data(), 1, outText.size(), stdout);
+            fflush(stdout);
+        }
+        if (!errText.empty()) {
+            fwrite(errText.data(), 1, errText.size(), stderr);
+            fflush(stderr);
         }
 
-        response.code = 200;
-        response.message = "验证成功";
+        // 回收已退出线程的缓冲区
+        lock_guard<mutex> lock(ringsMtx);
+        rings.erase(remove_if(rings.begin(), rings.end(), [](const shared_ptr<Ring>& ring) {
+            return ring->abandoned.load(memory_order_acquire) &&
+                ring->tail.load(memory_order_relaxed) == ring->head.load(memory_order_acquire);
+            }), rings.end());
+    }
 
-        Json::Value respJson;
-        respJson["ip"] = Json::Value(clientIP);
-        respJson["domain"] = Json::Value(domain);
-        respJson["expire_time"] = Json::Value(expireTime);
+    void run() {
+        unique_lock<mutex> lock(flushMtx);
+        while (!stopping) {
+            flushCv.wait_for(lock, chrono::milliseconds(flushIntervalMs));
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+        lock.unlock();
+        drain();
+    }
 
-        Json::StreamWriterBuilder writer;
-        response.data = Json::writeString(writer, respJson);
+public:
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
 
-        return response;
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
     }
 
-    // 查找模式处理
-    ResponseStruct handleFindMode(const string& clientIP, const Json::Value& jsonData) {
-        ResponseStruct response;
+    void setLevel(LogLevel level) { minLevel.store(level, memory_order_relaxed); }
+    void setAccessSampling(unsigned every) { sampleEvery.store(every, memory_order_relaxed); }
+    bool enabled(LogLevel level) const { return level >= minLevel.load(memory_order_relaxed); }
 
-        // 验证必要参数
-        if (!jsonData.isMember("ip") || jsonData["ip"].asString().empty()) {
-            response.code = 400;
-            response.message = "缺少IP参数";
-            return response;
-        }
+    template <typename... Parts>
+    void log(LogLevel level, const Parts&... parts) {
+        if (!enabled(level)) return;
 
-        if (!jsonData.isMember("dn") || jsonData["dn"].asString().empty()) {
-            response.code = 400;
-            response.message = "缺少域名参数";
-            return response;
-        }
+        Ring& ring = localRing();
+        size_t pos;
+        Record* r = beginRecord(ring, pos);
+        if (!r) return;
 
-        string ip = jsonData["ip"].asString();
-        string domain = jsonData["dn"].asString();
+        r->timeUs = nowUs();
+        r->level = static_cast<uint8_t>(level);
+        r->kind = RECORD_TEXT;
+        r->length = 0;
+        appendParts(*r, parts...);
+        ring.head.store(pos + 1, memory_order_release);
+    }
 
-        // 在A表中查找对应记录
-        string sql = "SELECT expire_time FROM dns_verifications WHERE client_ip = '" +
-            ip + "' AND domain = '" + domain + "' AND mode = 'verify'";
+    // 结构化访问日志：按线程计数采样，5xx 不采样
+    void access(const string& clientIP, const char* mode, int code, int64_t latencyUs) {
+        if (!enabled(LOG_INFO)) return;
 
-        string expireTime = querySingleValue(sql);
-        if (expireTime.empty()) {
-            response.code = 404;
-            response.message = "验证记录不存在";
-            return response;
+        unsigned every = sampleEvery.load(memory_order_relaxed);
+        if (code < 500) {
+            thread_local unsigned counter = 0;
+            if (every == 0 || ++counter % every != 0) return;
         }
 
-        // 检查是否到期
-        time_t now = time(nullptr);
-        struct tm expireTm = {};
+        Ring& ring = localRing();
+        size_t pos;
+        Record* r = beginRecord(ring, pos);
+        if (!r) return;
+
+        r->timeUs = nowUs();
+        r->level = LOG_INFO;
+        r->kind = RECORD_ACCESS;
+        r->length = 0;
+        r->code = code;
+        r->latencyUs = latencyUs;
+        size_t modeLen = strlen(mode);
+        if (modeLen >= sizeof(r->mode)) modeLen = sizeof(r->mode) - 1;
+        memcpy(r->mode, mode, modeLen);
+        r->mode[modeLen] = '\0';
+        appendText(*r, clientIP.data(), clientIP.size());
+        ring.head.store(pos + 1, memory_order_release);
+    }
+
+    // 停止后台线程并输出剩余日志
+    void shutdown() {
         {
-            std::istringstream ss(expireTime);
-            ss >> std::get_time(&expireTm, "%Y-%m-%d %H:%M:%S");
+            lock_guard<mutex> lock(flushMtx);
+            if (stopping) return;
+            stopping = true;
         }
-        time_t expireTimestamp = mktime(&expireTm);
-
-        if (now > expireTimestamp) {
-            response.code = 403;
-            response.message = "域名已过期";
-            return response;
+        flushCv.notify_all();
+        if (flusher.joinable()) {
+            flusher.join();
         }
+    }
+};
 
-        // 从B表查询对应的IP
-        sql = "SELECT target_ip FROM domain_mappings WHERE domain = '" + domain + "'";
-        string targetIP = querySingleValue(sql);
+template <typename... Parts>
+inline void logDebug(const Parts&... parts) { Logger::instance().log(LOG_DEBUG, parts...); }
 
-        if (targetIP.empty()) {
-            response.code = 404;
-            response.message = "域名映射不存在";
-            return response;
-        }
+template <typename... Parts>
+inline void logInfo(const Parts&... parts) { Logger::instance().log(LOG_INFO, parts...); }
 
-        response.code = 200;
-        response.message = "查询成功";
+template <typename... Parts>
+inline void logWarn(const Parts&... parts) { Logger::instance().log(LOG_WARN, parts...); }
 
-        Json::Value respJson;
-        respJson["domain"] = Json::Value(domain);
-        respJson["ip"] = Json::Value(targetIP);
-        respJson["expire_time"] = Json::Value(expireTime);
+template <typename... Parts>
+inline void logError(const Parts&... parts) { Logger::instance().log(LOG_ERROR, parts...); }
 
-        Json::StreamWriterBuilder writer;
-        response.data = Json::writeString(writer, respJson);
+// 请求处理阶段，用于分阶段耗时直方图
+enum MetricStage {
+    STAGE_WHITELIST = 0,    // 白名单检查
+    STAGE_PARSE,            // 请求体 JSON 解析
+    STAGE_POOL_ACQUIRE,     // 借出数据库连接
+    STAGE_CONFIG_QUERY,     // verify：查询 domain_configs
+    STAGE_FIND_QUERY,       // find：查询验证记录与映射
+    STAGE_VERIFY_INSERT,    // verify：写入 dns_verifications（批量模式下含等待提交）
+    STAGE_SERIALIZE,        // 响应序列化
+    STAGE_COUNT
+};
 
-        return response;
-    }
+enum MetricMode {
+    MODE_VERIFY = 0,
+    MODE_FIND,
+    MODE_BATCH,
+    MODE_DNS,
+    MODE_UNKNOWN,
+    MODE_COUNT
+};
 
-    // 处理HTTP POST请求
-    void handlePost(const Request& req, Response& res) {
-        // 获取客户端IP
-        string clientIP = req.has_header("X-Real-IP") ?
-            req.get_header_value("X-Real-IP") :
-            req.remote_addr;
+// 请求指标：每个线程写自己的分片（单写者，无锁、无原子读改写），抓取时汇总所有分片。
+// 耗时直方图按 HDR 方式分桶：每个 2 的幂区间再等分 8 份，相对误差不超过 12.5%。
+class Metrics {
+private:
+    static const unsigned kSubBits = 3;
+    static const size_t kSubBuckets = 1 << kSubBits;
+    static const unsigned kMaxExponent = 32;    // 最大记录 2^32 微秒，超出计入最后一桶
+    static const size_t kBuckets = (kMaxExponent - kSubBits + 2) * kSubBuckets;
 
-        cout << "收到请求，客户端IP: " << clientIP << endl;
+    static const int kCodes[];
+    static const size_t kCodeCount = 8;          // 最后一项统计其他返回码
 
-        // 检查IP白名单
-        if (!checkIPInWhitelist(clientIP)) {
-            Json::Value errorJson;
-            errorJson["code"] = Json::Value(std::to_string(403));
-            errorJson["message"] = Json::Value("IP不在白名单中");
+    struct Histogram {
+        atomic<uint64_t> buckets[kBuckets];
+        atomic<uint64_t> sumUs{ 0 };
 
-            Json::StreamWriterBuilder writer;
-            res.set_content(Json::writeString(writer, errorJson), "application/json");
-            return;
+        Histogram() {
+            for (auto& bucket : buckets) bucket.store(0, memory_order_relaxed);
         }
+    };
 
-        // 解析JSON数据
-        Json::Value jsonData;
-        Json::CharReaderBuilder reader;
-        string errors;
+    struct Shard {
+        Histogram stages[STAGE_COUNT];
+        Histogram requests[MODE_COUNT];
+        atomic<uint64_t> responses[MODE_COUNT][kCodeCount];
+        atomic<bool> abandoned{ false };
 
-        istringstream jsonStream(req.body);
-        if (!Json::parseFromStream(reader, jsonStream, &jsonData, &errors)) {
-            Json::Value errorJson;
-            errorJson["code"] = Json::Value(std::to_string(400));
-            errorJson["message"] = Json::Value("JSON解析失败: " + errors);
+        Shard() {
+            for (auto& row : responses) {
+                for (auto& counter : row) counter.store(0, memory_order_relaxed);
+            }
+        }
+    };
 
-            Json::StreamWriterBuilder writer;
-            res.set_content(Json::writeString(writer, errorJson), "application/json");
-            return;
+    // 汇总结果（普通整数）
+    struct HistogramTotals {
+        uint64_t buckets[kBuckets] = {};
+        uint64_t sumUs = 0;
+    };
+
+    struct Totals {
+        HistogramTotals stages[STAGE_COUNT];
+        HistogramTotals requests[MODE_COUNT];
+        uint64_t responses[MODE_COUNT][kCodeCount] = {};
+    };
+
+    struct ShardHolder {
+        shared_ptr<Shard> shard;
+        ~ShardHolder() {
+            if (shard) shard->abandoned.store(true, memory_order_release);
         }
+    };
 
-        // 验证mode字段
-        if (!jsonData.isMember("mode") || jsonData["mode"].asString().empty()) {
-            Json::Value errorJson;
-            errorJson["code"] = Json::Value(std::to_string(400));
-            errorJson["message"] = Json::Value("缺少mode参数");
+    mutex shardsMtx;
+    vector<shared_ptr<Shard>> shards;
+    Totals retired;                              // 已退出线程的计数，避免计数器回退
 
-            Json::StreamWriterBuilder writer;
-            res.set_content(Json::writeString(writer, errorJson), "application/json");
-            return;
+    Metrics() {}
+
+    Shard& localShard() {
+        thread_local ShardHolder holder;
+        if (!holder.shard) {
+            holder.shard = make_shared<Shard>();
+            lock_guard<mutex> lock(shardsMtx);
+            shards.push_back(holder.shard);
         }
+        return *holder.shard;
+    }
 
-        string mode = jsonData["mode"].asString();
-        ResponseStruct processResponse;
+    // 只有所属线程写入，用 load + store 代替 fetch_add
+    static void bump(atomic<uint64_t>& counter, uint64_t delta) {
+        counter.store(counter.load(memory_order_relaxed) + delta, memory_order_relaxed);
+    }
 
-        // 根据mode处理不同请求
-        if (mode == "verify") {
-            processResponse = handleVerifyMode(clientIP, jsonData);
+    static unsigned floorLog2(uint64_t v) {
+        unsigned e = 0;
+        for (unsigned shift = 32; shift > 0; shift >>= 1) {
+            if (v >> shift) {
+                v >>= shift;
+                e += shift;
+            }
         }
-        else if (mode == "find") {
-            processResponse = handleFindMode(clientIP, jsonData);
+        return e;
+    }
+
+    static size_t bucketIndex(uint64_t us) {
+        if (us < kSubBuckets) {
+            return static_cast<size_t>(us);
         }
-        else {
-            processResponse.code = 400;
-            processResponse.message = "不支持的mode类型";
+        unsigned e = floorLog2(us);
+        if (e > kMaxExponent) {
+            return kBuckets - 1;
         }
+        return (e - kSubBits + 1) * kSubBuckets + ((us >> (e - kSubBits)) & (kSubBuckets - 1));
+    }
 
-        // 构建响应
-        Json::Value respJson;
-        respJson["code"] = Json::Value(std::to_string(processResponse.code));
-        respJson["message"] = Json::Value(processResponse.message);
+    // 桶内最大值（微秒）
+    static uint64_t bucketUpper(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        unsigned e = static_cast<unsigned>(index / kSubBuckets) + kSubBits - 1;
+        uint64_t low = (kSubBuckets + index % kSubBuckets) << (e - kSubBits);
+        return low + (1ULL << (e - kSubBits)) - 1;
+    }
 
-        if (!processResponse.data.empty()) {
-            Json::Value dataJson;
-            Json::CharReaderBuilder dataReader;
-            istringstream dataStream(processResponse.data);
-            if (Json::parseFromStream(dataReader, dataStream, &dataJson, &errors)) {
-                respJson["data"] = dataJson;
-            }
+    static size_t codeIndex(int code) {
+        for (size_t i = 0; i + 1 < kCodeCount; ++i) {
+            if (kCodes[i] == code) return i;
         }
+        return kCodeCount - 1;
+    }
 
-        Json::StreamWriterBuilder writer;
-        res.set_content(Json::writeString(writer, respJson), "application/json");
+    static void record(Histogram& histogram, int64_t us) {
+        uint64_t value = us > 0 ? static_cast<uint64_t>(us) : 0;
+        bump(histogram.buckets[bucketIndex(value)], 1);
+        bump(histogram.sumUs, value);
     }
 
-    // 启动服务器
-    void start(int port = 8080) {
-        if (!initMySQL()) {
-            cerr << "MySQL初始化失败，服务器启动中止" << endl;
-            return;
+    static void accumulate(HistogramTotals& to, const Histogram& from) {
+        for (size_t i = 0; i < kBuckets; ++i) to.buckets[i] += from.buckets[i].load(memory_order_relaxed);
+        to.sumUs += from.sumUs.load(memory_order_relaxed);
+    }
+
+    static void accumulate(Totals& to, const Shard& from) {
+        for (size_t s = 0; s < STAGE_COUNT; ++s) accumulate(to.stages[s], from.stages[s]);
+        for (size_t m = 0; m < MODE_COUNT; ++m) {
+            accumulate(to.requests[m], from.requests[m]);
+            for (size_t c = 0; c < kCodeCount; ++c) {
+                to.responses[m][c] += from.responses[m][c].load(memory_order_relaxed);
+            }
         }
+    }
 
-        server.Post("/dns-auth", [this](const Request& req, Response& res) {
+    static void merge(Totals& to, const Totals& from) {
+        for (size_t s = 0; s < STAGE_COUNT; ++s) {
+            for (size_t i = 0; i < kBuckets; ++i) to.stages[s].buckets[i] += from.stages[s].buckets[i];
+            to.stages[s].sumUs += from.stages[s].sumUs;
+        }
+        for (size_t m = 0; m < MODE_COUNT; ++m) {
+            for (size_t i = 0; i < kBuckets; ++i) to.requests[m].buckets[i] += from.requests[m].buckets[i];
+            to.requests[m].sumUs += from.requests[m].sumUs;
+            for (size_t c = 0; c < kCodeCount; ++c) to.responses[m][c] += from.responses[m][c];
+        }
+    }
+
+    static void appendSeconds(string& out, uint64_t us) {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "%.6f", static_cast<double>(us) / 1e6);
+        out.append(buf, n > 0 ? static_cast<size_t>(n) : 0);
+    }
+
+    // 按固定的 le 边界输出累计桶；细桶上界不超过边界的计入该边界
+    static void writeHistogram(string& out, const char* name, const char* labelName,
+        const char* labelValue, const HistogramTotals& h) {
+        static const uint64_t kBoundsUs[] = {
+            50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+            100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+        };
+
+        uint64_t cumulative = 0;
+        size_t index = 0;
+        for (uint64_t bound : kBoundsUs) {
+            for (; index < kBuckets && bucketUpper(index) <= bound; ++index) {
+                cumulative += h.buckets[index];
+            }
+            out += name;
+            out += "_bucket{";
+            out += labelName;
+            out += "=\"";
+            out += labelValue;
+            out += "\",le=\"";
+            appendSeconds(out, bound);
+            out += "\"} ";
+            out += to_string(cumulative);
+            out += '\n';
+        }
+        for (; index < kBuckets; ++index) {
+            cumulative += h.buckets[index];
+        }
+
+        string labels = string("{") + labelName + "=\"" + labelValue + "\"";
+        out += name;
+        out += "_bucket" + labels + ",le=\"+Inf\"} " + to_string(cumulative) + '\n';
+        out += name;
+        out += "_sum" + labels + "} ";
+        appendSeconds(out, h.sumUs);
+        out += '\n';
+        out += name;
+        out += "_count" + labels + "} " + to_string(cumulative) + '\n';
+    }
+
+public:
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    static Metrics& instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    static const char* stageName(int stage) {
+        static const char* const kNames[STAGE_COUNT] = {
+            "whitelist", "parse", "pool_acquire", "config_query", "find_query", "verify_insert", "serialize"
+        };
+        return kNames[stage];
+    }
+
+    static const char* modeName(int mode) {
+        static const char* const kNames[MODE_COUNT] = { "verify", "find", "batch", "dns", "unknown" };
+        return kNames[mode];
+    }
+
+    static MetricMode modeFromString(const string& mode) {
+        if (mode == "verify") return MODE_VERIFY;
+        if (mode == "find") return MODE_FIND;
+        return MODE_UNKNOWN;
+    }
+
+    void recordStage(MetricStage stage, int64_t us) {
+        record(localShard().stages[stage], us);
+    }
+
+    void recordRequest(MetricMode mode, int code, int64_t us) {
+        Shard& shard = localShard();
+        record(shard.requests[mode], us);
+        bump(shard.responses[mode][codeIndex(code)], 1);
+    }
+
+    // 汇总所有线程的分片并按 Prometheus 文本格式追加到 out
+    void render(string& out) {
+        Totals totals;
+        {
+            lock_guard<mutex> lock(shardsMtx);
+            merge(totals, retired);
+            for (auto it = shards.begin(); it != shards.end();) {
+                if ((*it)->abandoned.load(memory_order_acquire)) {
+                    accumulate(retired, **it);
+                    accumulate(totals, **it);
+                    it = shards.erase(it);
+                }
+                else {
+                    accumulate(totals, **it);
+                    ++it;
+                }
+            }
+        }
+
+        out += "# HELP dns_auth_requests_total Requests handled, by mode and response code.\n";
+        out += "# TYPE dns_auth_requests_total counter\n";
+        for (size_t m = 0; m < MODE_COUNT; ++m) {
+            for (size_t c = 0; c < kCodeCount; ++c) {
+                if (totals.responses[m][c] == 0) continue;
+                out += "dns_auth_requests_total{mode=\"";
+                out += modeName(static_cast<int>(m));
+                out += "\",code=\"";
+                out += c + 1 < kCodeCount ? to_string(kCodes[c]) : string("other");
+                out += "\"} " + to_string(totals.responses[m][c]) + '\n';
+            }
+        }
+
+        out += "# HELP dns_auth_request_duration_seconds End-to-end request latency, by mode.\n";
+        out += "# TYPE dns_auth_request_duration_seconds histogram\n";
+        for (size_t m = 0; m < MODE_COUNT; ++m) {
+            writeHistogram(out, "dns_auth_request_duration_seconds", "mode",
+                modeName(static_cast<int>(m)), totals.requests[m]);
+        }
+
+        out += "# HELP dns_auth_stage_duration_seconds Latency of each request processing stage.\n";
+        out += "# TYPE dns_auth_stage_duration_seconds histogram\n";
+        for (size_t s = 0; s < STAGE_COUNT; ++s) {
+            writeHistogram(out, "dns_auth_stage_duration_seconds", "stage",
+                stageName(static_cast<int>(s)), totals.stages[s]);
+        }
+    }
+
+    // 追加一个 gauge / counter 指标
+    static void writeValue(string& out, const char* name, const char* type, const char* help, uint64_t value) {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+        out += name;
+        out += ' ';
+        out += to_string(value);
+        out += '\n';
+    }
+};
+
+const int Metrics::kCodes[] = { 200, 400, 403, 404, 429, 500, 503 };
+
+// 阶段计时：析构或 finish() 时记录一次耗时
+class StageTimer {
+private:
+    MetricStage stage;
+    chrono::steady_clock::time_point start;
+    bool finished = false;
+
+public:
+    explicit StageTimer(MetricStage stage) : stage(stage), start(chrono::steady_clock::now()) {}
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    void finish() {
+        if (finished) return;
+        finished = true;
+        Metrics::instance().recordStage(stage, chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - start).count());
+    }
+
+    ~StageTimer() { finish(); }
+};
+
+// 请求收尾：析构时记录访问日志（客户端 IP、mode、返回码、耗时）以及请求计数与总耗时
+class RequestScope {
+private:
+    const string& clientIP;
+    chrono::steady_clock::time_point start;
+    MetricMode metricMode;
+    char mode[16];
+
+public:
+    int code = 0;
+
+    RequestScope(const string& ip, const char* initialMode)
+        : clientIP(ip), start(chrono::steady_clock::now()) {
+        setMode(initialMode);
+    }
+
+    RequestScope(const RequestScope&) = delete;
+    RequestScope& operator=(const RequestScope&) = delete;
+
+    void setMode(const string& value) { setMode(value.c_str()); }
+
+    void setMode(const char* value) {
+        size_t len = strlen(value);
+        if (len >= sizeof(mode)) len = sizeof(mode) - 1;
+        memcpy(mode, value, len);
+        mode[len] = '\0';
+        metricMode = strcmp(mode, "batch") == 0 ? MODE_BATCH :
+            strcmp(mode, "dns") == 0 ? MODE_DNS : Metrics::modeFromString(mode);
+    }
+
+    ~RequestScope() {
+        int64_t latencyUs = chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - start).count();
+        Metrics::instance().recordRequest(metricMode, code, latencyUs);
+        Logger::instance().access(clientIP, mode, code, latencyUs);
+    }
+};
+
+// 响应结构体：data 按字段保存，由 ResponseWriter 直接序列化，不再经过中间 JSON 字符串
+struct ResponseStruct {
+    int code = 0; // 始终初始化成员变量
+    const char* message = "";   // 固定文案（字符串字面量）
+    string detail;              // 追加在 message 之后的动态信息，如 JSON 解析错误
+    bool hasData = false;
+    string domain;
+    string ip;
+    string expireTime;
+};
+
+// 响应序列化：直接拼接到线程内复用的缓冲区，稳定运行后不再分配内存
+class ResponseWriter {
+private:
+    static void appendEscaped(string& out, const char* text, size_t len) {
+        static const char kHex[] = "0123456789abcdef";
+        for (size_t i = 0; i < len; ++i) {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    out += "\\u00";
+                    out += kHex[c >> 4];
+                    out += kHex[c & 0xf];
+                }
+                else {
+                    out += static_cast<char>(c);
+                }
+            }
+        }
+    }
+
+    static void appendString(string& out, const string& text) {
+        appendEscaped(out, text.data(), text.size());
+    }
+
+    static void appendCode(string& out, int code) {
+        char digits[16];
+        int n = snprintf(digits, sizeof(digits), "%d", code);
+        out.append(digits, n > 0 ? static_cast<size_t>(n) : 0);
+    }
+
+public:
+    // 线程内复用的输出缓冲区
+    static string& buffer() {
+        thread_local string buf;
+        buf.clear();
+        if (buf.capacity() < 512) buf.reserve(512);
+        return buf;
+    }
+
+    static void write(string& out, const ResponseStruct& response) {
+        out += "{\"code\":\"";
+        appendCode(out, response.code);
+        out += "\",\"message\":\"";
+        appendEscaped(out, response.message, strlen(response.message));
+        appendString(out, response.detail);
+        out += '"';
+        if (response.hasData) {
+            out += ",\"data\":{\"domain\":\"";
+            appendString(out, response.domain);
+            out += "\",\"ip\":\"";
+            appendString(out, response.ip);
+            out += "\",\"expire_time\":\"";
+            appendString(out, response.expireTime);
+            out += "\"}";
+        }
+        out += '}';
+    }
+
+    // 批量响应：data 为逐条结果数组，每条结果与单条接口的 code/message/data 结构一致
+    static void writeBatch(string& out, const ResponseStruct& envelope, const vector<ResponseStruct>& items) {
+        out += "{\"code\":\"";
+        appendCode(out, envelope.code);
+        out += "\",\"message\":\"";
+        appendEscaped(out, envelope.message, strlen(envelope.message));
+        appendString(out, envelope.detail);
+        out += "\",\"data\":[";
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (i > 0) out += ',';
+            write(out, items[i]);
+        }
+        out += "]}";
+    }
+
+    // 只有 code/message 的固定响应：启动时生成一次，之后直接复用
+    static string makeTemplate(int code, const char* message) {
+        ResponseStruct response;
+        response.code = code;
+        response.message = message;
+        string out;
+        write(out, response);
+        return out;
+    }
+};
+
+// 连接池统计信息（快照）
+struct PoolStats {
+    size_t total = 0;            // 当前已建立的连接数
+    size_t idle = 0;             // 空闲连接数
+    uint64_t acquired = 0;       // 累计借出次数
+    uint64_t waited = 0;         // 需要等待才借到连接的次数
+    uint64_t timeouts = 0;       // 等待超时次数
+    uint64_t reconnects = 0;     // 因连接失效而重建的次数
+    uint64_t totalWaitUs = 0;    // 累计等待时间（微秒）
+    uint64_t maxWaitUs = 0;      // 单次最长等待时间（微秒）
+};
+
+inline bool isConnectionLostError(unsigned int err) {
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+// 预编译语句封装：参数与结果缓冲区在 prepare 时一次性分配，之后每次执行直接复用
+class PreparedStatement {
+private:
+    // MySQL 8 中 is_null 为 bool*，旧版本与 MariaDB 为 my_bool*
+    typedef remove_pointer<decltype(MYSQL_BIND::is_null)>::type StmtBool;
+
+    static const unsigned long kResultBufferSize = 1024;
+
+    MYSQL_STMT* stmt = nullptr;
+    unsigned int resultCount = 0;
+    vector<MYSQL_BIND> params;
+    vector<unsigned long> paramLengths;
+    vector<long long> paramInts;
+    vector<MYSQL_BIND> results;
+    vector<char> resultBuffer;
+    vector<unsigned long> resultLengths;
+    unique_ptr<StmtBool[]> resultNulls;
+
+public:
+    PreparedStatement() = default;
+    PreparedStatement(const PreparedStatement&) = delete;
+    PreparedStatement& operator=(const PreparedStatement&) = delete;
+
+    ~PreparedStatement() { close(); }
+
+    // 预编译 SQL，结果列统一以字符串形式绑定到预分配缓冲区
+    bool prepare(MYSQL* conn, const char* sql, unsigned int resultColumns) {
+        close();
+        stmt = mysql_stmt_init(conn);
+        if (!stmt) {
+            return false;
+        }
+        if (mysql_stmt_prepare(stmt, sql, static_cast<unsigned long>(strlen(sql))) != 0) {
+            logError("预编译语句失败: ", mysql_stmt_error(stmt));
+            return false;
+        }
+
+        unsigned long paramCount = mysql_stmt_param_count(stmt);
+        params.assign(paramCount, MYSQL_BIND());
+        paramLengths.assign(paramCount, 0);
+        paramInts.assign(paramCount, 0);
+
+        resultCount = resultColumns;
+        results.assign(resultCount, MYSQL_BIND());
+        resultBuffer.assign(static_cast<size_t>(resultCount) * kResultBufferSize, 0);
+        resultLengths.assign(resultCount, 0);
+        resultNulls.reset(new StmtBool[resultCount > 0 ? resultCount : 1]());
+        for (unsigned int i = 0; i < resultCount; ++i) {
+            MYSQL_BIND& bind = results[i];
+            bind.buffer_type = MYSQL_TYPE_STRING;
+            bind.buffer = &resultBuffer[i * kResultBufferSize];
+            bind.buffer_length = kResultBufferSize;
+            bind.length = &resultLengths[i];
+            bind.is_null = &resultNulls[i];
+        }
+        if (resultCount > 0 && mysql_stmt_bind_result(stmt, results.data())) {
+            logError("绑定结果集失败: ", mysql_stmt_error(stmt));
+            return false;
+        }
+        return true;
+    }
+
+    bool isPrepared() const { return stmt != nullptr; }
+
+    // 绑定字符串参数；只保存指针，调用方需保证 execute 前字符串有效
+    void bind(size_t index, const string& value) {
+        if (index >= params.size()) return;
+        MYSQL_BIND& bind = params[index];
+        bind = MYSQL_BIND();
+        paramLengths[index] = static_cast<unsigned long>(value.size());
+        bind.buffer_type = MYSQL_TYPE_STRING;
+        bind.buffer = const_cast<char*>(value.data());
+        bind.buffer_length = paramLengths[index];
+        bind.length = &paramLengths[index];
+    }
+
+    void bind(size_t index, long long value) {
+        if (index >= params.size()) return;
+        MYSQL_BIND& bind = params[index];
+        bind = MYSQL_BIND();
+        paramInts[index] = value;
+        bind.buffer_type = MYSQL_TYPE_LONGLONG;
+        bind.buffer = &paramInts[index];
+    }
+
+    // 执行语句；有结果列时把结果集缓存在客户端
+    bool execute() {
+        if (!stmt) return false;
+        mysql_stmt_free_result(stmt);
+        if (!params.empty() && mysql_stmt_bind_param(stmt, params.data())) {
+            return false;
+        }
+        if (mysql_stmt_execute(stmt) != 0) {
+            return false;
+        }
+        if (resultCount > 0 && mysql_stmt_store_result(stmt) != 0) {
+            return false;
+        }
+        return true;
+    }
+
+    bool fetch() {
+        int rc = mysql_stmt_fetch(stmt);
+        return rc == 0 || rc == MYSQL_DATA_TRUNCATED;
+    }
+
+    bool isNull(unsigned int column) const {
+        return column >= resultCount || resultNulls[column];
+    }
+
+    // 整数列直接从结果缓冲区解析，不构造临时字符串
+    int64_t columnInt64(unsigned int column) const {
+        if (isNull(column)) return 0;
+        const char* p = &resultBuffer[column * kResultBufferSize];
+        const char* end = p + (resultLengths[column] < kResultBufferSize ? resultLengths[column] : kResultBufferSize);
+        bool negative = p < end && *p == '-';
+        if (negative) ++p;
+        int64_t value = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            value = value * 10 + (*p - '0');
+        }
+        return negative ? -value : value;
+    }
+
+    string column(unsigned int column) const {
+        if (isNull(column)) return string();
+        unsigned long len = resultLengths[column] < kResultBufferSize ? resultLengths[column] : kResultBufferSize;
+        return string(&resultBuffer[column * kResultBufferSize], len);
+    }
+
+    void freeResult() {
+        if (stmt) mysql_stmt_free_result(stmt);
+    }
+
+    unsigned long long affectedRows() const { return mysql_stmt_affected_rows(stmt); }
+    unsigned int errorCode() const { return stmt ? mysql_stmt_errno(stmt) : 0; }
+    const char* errorMessage() const { return stmt ? mysql_stmt_error(stmt) : "语句未预编译"; }
+
+    void close() {
+        if (stmt) {
+            mysql_stmt_close(stmt);
+            stmt = nullptr;
+        }
+    }
+};
+
+// 热路径语句编号：每条语句在每个连接上只预编译一次
+enum StatementId {
+    STMT_WHITELIST_LOOKUP = 0,
+    STMT_CONFIG_EXPIRE,
+    STMT_INSERT_VERIFICATION,
+    STMT_REPLACE_VERIFICATION,
+    STMT_FIND_ACTIVE,
+    STMT_FIND_LATEST,
+    STMT_COUNT
+};
+
+struct StatementDef {
+    const char* sql;
+    unsigned int resultColumns;
+};
+
+// 表结构：SCHEMA_TEXT 为 IP 与域名都存文本的原有结构；SCHEMA_COMPACT 中 IP 为 VARBINARY(16)，
+// 域名存入 domains 表后以整数 id 引用。两种结构的语句参数顺序相同，精简结构的域名参数需先经
+// normalizeDomain 规范化
+enum SchemaLayout {
+    SCHEMA_TEXT = 0,
+    SCHEMA_COMPACT,
+    SCHEMA_COUNT
+};
+
+inline SchemaLayout schemaLayout(const DBConfig& config) {
+    return config.compactSchema ? SCHEMA_COMPACT : SCHEMA_TEXT;
+}
+
+static const StatementDef kStatementDefs[SCHEMA_COUNT][STMT_COUNT] = {
+    {
+        { "SELECT id FROM ip_whitelist WHERE ip = ?", 1 },
+        { "SELECT expire_time, UNIX_TIMESTAMP(expire_time) FROM domain_configs "
+          "WHERE client_ip = ? AND domain = ? AND status = 1", 2 },
+        // 同一键已有记录时覆盖到期时间（唯一键 unique_verify），缩短或撤销的到期时间同样生效
+        { "INSERT INTO dns_verifications (client_ip, domain, expire_time, mode) VALUES (?, ?, ?, 'verify') "
+          "ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time)", 0 },
+        // 分区表的唯一键含 expire_time：删除到期时间相同的旧行后以新 id 插入，最新写入总是 id 最大的一行
+        { "REPLACE INTO dns_verifications (client_ip, domain, expire_time, mode) VALUES (?, ?, ?, 'verify')", 0 },
+        // find：按唯一键单点读取（覆盖索引 idx_verify_lookup），同一次往返带回映射 IP 与到期时间戳
+        { "SELECT v.expire_time, m.target_ip, UNIX_TIMESTAMP(v.expire_time) "
+          "FROM dns_verifications v LEFT JOIN domain_mappings m ON m.domain = v.domain "
+          "WHERE v.client_ip = ? AND v.domain = ? AND v.mode = 'verify'", 3 },
+        // 每个键可能有多行时（分区表，或尚未建立唯一键的旧表）取最新写入的一条
+        { "SELECT v.expire_time, m.target_ip, UNIX_TIMESTAMP(v.expire_time) "
+          "FROM dns_verifications v LEFT JOIN domain_mappings m ON m.domain = v.domain "
+          "WHERE v.client_ip = ? AND v.domain = ? AND v.mode = 'verify' "
+          "ORDER BY v.id DESC LIMIT 1", 3 },
+    },
+    {
+        // 白名单条目可以是网段，仍按文本保存
+        { "SELECT id FROM ip_whitelist WHERE ip = ?", 1 },
+        // 先按唯一索引把域名换成 id，再走 (client_ip, domain_id) 唯一索引
+        { "SELECT c.expire_time, UNIX_TIMESTAMP(c.expire_time) FROM domain_configs c "
+          "JOIN domains d ON d.id = c.domain_id "
+          "WHERE c.client_ip = INET6_ATON(?) AND d.name = ? AND c.status = 1", 2 },
+        // verify 只在域名配置存在时写入，域名此时已在 domains 中
+        { "INSERT INTO dns_verifications (client_ip, domain_id, expire_time, mode) "
+          "VALUES (INET6_ATON(?), (SELECT id FROM domains WHERE name = ?), ?, 'verify') "
+          "ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time)", 0 },
+        { "REPLACE INTO dns_verifications (client_ip, domain_id, expire_time, mode) "
+          "VALUES (INET6_ATON(?), (SELECT id FROM domains WHERE name = ?), ?, 'verify')", 0 },
+        { "SELECT v.expire_time, INET6_NTOA(m.target_ip), UNIX_TIMESTAMP(v.expire_time) "
+          "FROM dns_verifications v JOIN domains d ON d.id = v.domain_id "
+          "LEFT JOIN domain_mappings m ON m.domain_id = v.domain_id "
+          "WHERE v.client_ip = INET6_ATON(?) AND d.name = ? AND v.mode = 'verify'", 3 },
+        { "SELECT v.expire_time, INET6_NTOA(m.target_ip), UNIX_TIMESTAMP(v.expire_time) "
+          "FROM dns_verifications v JOIN domains d ON d.id = v.domain_id "
+          "LEFT JOIN domain_mappings m ON m.domain_id = v.domain_id "
+          "WHERE v.client_ip = INET6_ATON(?) AND d.name = ? AND v.mode = 'verify' "
+          "ORDER BY v.id DESC LIMIT 1", 3 },
+    },
+};
+
+// 连接池中的一条连接及其语句缓存
+struct DBConnection {
+    MYSQL* handle = nullptr;
+    SchemaLayout schema = SCHEMA_TEXT;
+    unique_ptr<PreparedStatement> statements[STMT_COUNT];
+
+    unordered_map<string, unique_ptr<PreparedStatement>> dynamicStatements;
+
+    DBConnection(MYSQL* h, SchemaLayout layout) : handle(h), schema(layout) {}
+    DBConnection(const DBConnection&) = delete;
+    DBConnection& operator=(const DBConnection&) = delete;
+
+    ~DBConnection() { closeHandle(); }
+
+    // 首次使用时预编译，失败返回 nullptr
+    PreparedStatement* statement(StatementId id) {
+        unique_ptr<PreparedStatement>& stmt = statements[id];
+        if (!stmt) {
+            stmt.reset(new PreparedStatement());
+        }
+        const StatementDef& def = kStatementDefs[schema][id];
+        if (!stmt->isPrepared() && !stmt->prepare(handle, def.sql, def.resultColumns)) {
+            stmt->close();
+            return nullptr;
+        }
+        return stmt.get();
+    }
+
+    // 运行时生成的 SQL（如多行 INSERT）按文本缓存
+    PreparedStatement* statement(const string& sql, unsigned int resultColumns) {
+        unique_ptr<PreparedStatement>& stmt = dynamicStatements[sql];
+        if (!stmt) {
+            stmt.reset(new PreparedStatement());
+        }
+        if (!stmt->isPrepared() && !stmt->prepare(handle, sql.c_str(), resultColumns)) {
+            stmt->close();
+            return nullptr;
+        }
+        return stmt.get();
+    }
+
+    // 语句句柄属于连接，关闭连接前必须先关闭全部语句
+    void closeHandle() {
+        for (auto& stmt : statements) {
+            stmt.reset();
+        }
+        dynamicStatements.clear();
+        if (handle) {
+            mysql_close(handle);
+            handle = nullptr;
+        }
+    }
+};
+
+class MySQLConnectionPool;
+
+// 连接句柄：RAII 方式借出连接，析构时自动归还连接池
+class PooledConnection {
+private:
+    MySQLConnectionPool* pool;
+    DBConnection* conn;
+    bool broken;
+
+public:
+    PooledConnection() : pool(nullptr), conn(nullptr), broken(false) {}
+    PooledConnection(MySQLConnectionPool* p, DBConnection* c) : pool(p), conn(c), broken(false) {}
+
+    PooledConnection(const PooledConnection&) = delete;
+    PooledConnection& operator=(const PooledConnection&) = delete;
+
+    PooledConnection(PooledConnection&& other) noexcept
+        : pool(other.pool), conn(other.conn), broken(other.broken) {
+        other.pool = nullptr;
+        other.conn = nullptr;
+    }
+
+    PooledConnection& operator=(PooledConnection&& other) noexcept {
+        if (this != &other) {
+            release();
+            pool = other.pool;
+            conn = other.conn;
+            broken = other.broken;
+            other.pool = nullptr;
+            other.conn = nullptr;
+        }
+        return *this;
+    }
+
+    ~PooledConnection() { release(); }
+
+    MYSQL* get() const { return conn ? conn->handle : nullptr; }
+    explicit operator bool() const { return conn != nullptr; }
+    SchemaLayout schema() const { return conn ? conn->schema : SCHEMA_TEXT; }
+
+    // 取得本连接上缓存的预编译语句
+    PreparedStatement* statement(StatementId id) { return conn ? conn->statement(id) : nullptr; }
+    PreparedStatement* statement(const string& sql, unsigned int resultColumns) {
+        return conn ? conn->statement(sql, resultColumns) : nullptr;
+    }
+
+    // 标记连接已损坏，归还时由连接池关闭而不是放回空闲队列
+    void markBroken() { broken = true; }
+
+    // 若最近一次错误表示连接已断开（CR_SERVER_GONE_ERROR / CR_SERVER_LOST），
+    // 则关闭旧连接并原地重建，返回是否重连成功；err 为 0 时读取连接上的错误码
+    bool reconnectIfLost(unsigned int err = 0);
+
+    void release();
+};
+
+// 建立一条 MySQL 连接，失败返回 nullptr
+inline MYSQL* openMySQLHandle(const DBConfig& config) {
+    MYSQL* conn = mysql_init(nullptr);
+    if (!conn) {
+        logError("MySQL初始化失败");
+        return nullptr;
+    }
+
+    if (!mysql_real_connect(conn,
+        config.host.c_str(),
+        config.user.c_str(),
+        config.password.c_str(),
+        config.database.c_str(),
+        config.port, nullptr, 0)) {
+        logError("MySQL连接失败: ", mysql_error(conn));
+        mysql_close(conn);
+        return nullptr;
+    }
+
+    mysql_set_character_set(conn, "utf8");
+    return conn;
+}
+
+// 线程安全的 MySQL 连接池
+class MySQLConnectionPool {
+private:
+    struct IdleEntry {
+        DBConnection* conn;
+        chrono::steady_clock::time_point lastUsed;
+    };
+
+    DBConfig config;
+    mutable mutex mtx;
+    condition_variable cv;
+    vector<IdleEntry> idle;
+    size_t total = 0;
+    bool closed = false;
+
+    atomic<size_t> borrowedCount{ 0 };
+    atomic<uint64_t> acquiredCount{ 0 };
+    atomic<uint64_t> waitedCount{ 0 };
+    atomic<uint64_t> timeoutCount{ 0 };
+    atomic<uint64_t> reconnectCount{ 0 };
+    atomic<uint64_t> totalWaitUs{ 0 };
+    atomic<uint64_t> maxWaitUs{ 0 };
+
+    MYSQL* openHandle() {
+        return openMySQLHandle(config);
+    }
+
+    DBConnection* openConnection() {
+        MYSQL* handle = openHandle();
+        return handle ? new DBConnection(handle, schemaLayout(config)) : nullptr;
+    }
+
+    // 重建连接，失败时释放 conn 并返回 nullptr（不调整 total）
+    DBConnection* reopenInPlace(DBConnection* conn) {
+        reconnectCount.fetch_add(1, memory_order_relaxed);
+        conn->closeHandle();
+        conn->handle = openHandle();
+        if (!conn->handle) {
+            delete conn;
+            return nullptr;
+        }
+        return conn;
+    }
+
+    void recordWait(uint64_t us) {
+        totalWaitUs.fetch_add(us, memory_order_relaxed);
+        uint64_t prev = maxWaitUs.load(memory_order_relaxed);
+        while (us > prev && !maxWaitUs.compare_exchange_weak(prev, us, memory_order_relaxed)) {
+        }
+    }
+
+    void finishAcquire(chrono::steady_clock::time_point start, bool waited) {
+        borrowedCount.fetch_add(1, memory_order_relaxed);
+        acquiredCount.fetch_add(1, memory_order_relaxed);
+        if (waited) {
+            waitedCount.fetch_add(1, memory_order_relaxed);
+            recordWait(static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start).count()));
+        }
+    }
+
+public:
+    MySQLConnectionPool() = default;
+    MySQLConnectionPool(const MySQLConnectionPool&) = delete;
+    MySQLConnectionPool& operator=(const MySQLConnectionPool&) = delete;
+
+    ~MySQLConnectionPool() { shutdown(); }
+
+    // 按配置预先建立 poolMinSize 个连接，至少一个连接成功才算初始化成功
+    bool init(const DBConfig& cfg) {
+        config = cfg;
+        if (config.poolMaxSize == 0) config.poolMaxSize = 1;
+        if (config.poolMinSize > config.poolMaxSize) config.poolMinSize = config.poolMaxSize;
+
+        size_t target = config.poolMinSize > 0 ? config.poolMinSize : 1;
+        for (size_t i = 0; i < target; ++i) {
+            DBConnection* conn = openConnection();
+            if (!conn) {
+                break;
+            }
+            lock_guard<mutex> lock(mtx);
+            idle.push_back({ conn, chrono::steady_clock::now() });
+            ++total;
+        }
+
+        lock_guard<mutex> lock(mtx);
+        closed = false;
+        return total > 0;
+    }
+
+    // 借出一个连接；池满时最多等待 poolAcquireTimeoutMs，超时返回空句柄
+    PooledConnection acquire() {
+        auto start = chrono::steady_clock::now();
+        auto deadline = start + chrono::milliseconds(config.poolAcquireTimeoutMs);
+        bool waited = false;
+
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            if (closed) {
+                return PooledConnection();
+            }
+
+            if (!idle.empty()) {
+                IdleEntry entry = idle.back();
+                idle.pop_back();
+                lock.unlock();
+
+                // 长时间空闲的连接可能已被服务端断开，借出前做健康检查
+                auto idleFor = chrono::steady_clock::now() - entry.lastUsed;
+                if (idleFor > chrono::milliseconds(config.poolIdleCheckMs) && mysql_ping(entry.conn->handle) != 0) {
+                    entry.conn = reopenInPlace(entry.conn);
+                    if (!entry.conn) {
+                        lock.lock();
+                        --total;
+                        cv.notify_one();
+                        continue;
+                    }
+                }
+
+                finishAcquire(start, waited);
+                return PooledConnection(this, entry.conn);
+            }
+
+            if (total < config.poolMaxSize) {
+                ++total;
+                lock.unlock();
+
+                DBConnection* conn = openConnection();
+                if (!conn) {
+                    lock.lock();
+                    --total;
+                    cv.notify_one();
+                    return PooledConnection();
+                }
+
+                finishAcquire(start, waited);
+                return PooledConnection(this, conn);
+            }
+
+            waited = true;
+            if (cv.wait_until(lock, deadline) == cv_status::timeout && idle.empty() && total >= config.poolMaxSize) {
+                timeoutCount.fetch_add(1, memory_order_relaxed);
+                recordWait(static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(
+                    chrono::steady_clock::now() - start).count()));
+                logError("获取数据库连接超时");
+                return PooledConnection();
+            }
+        }
+    }
+
+    // 归还连接；损坏的连接直接关闭，由后续借出按需重建
+    void release(DBConnection* conn, bool broken) {
+        if (!conn) return;
+
+        borrowedCount.fetch_sub(1, memory_order_relaxed);
+        unique_lock<mutex> lock(mtx);
+        if (broken || closed) {
+            --total;
+            lock.unlock();
+            delete conn;
+        }
+        else {
+            idle.push_back({ conn, chrono::steady_clock::now() });
+            lock.unlock();
+        }
+        cv.notify_one();
+    }
+
+    // 关闭旧连接（连同其语句缓存）并建立新连接，供句柄在检测到断线后调用
+    DBConnection* reopen(DBConnection* conn) {
+        DBConnection* fresh = reopenInPlace(conn);
+        if (!fresh) {
+            borrowedCount.fetch_sub(1, memory_order_relaxed);
+            lock_guard<mutex> lock(mtx);
+            --total;
+            cv.notify_one();
+        }
+        return fresh;
+    }
+
+    static bool isConnectionLost(MYSQL* conn) {
+        return isConnectionLostError(mysql_errno(conn));
+    }
+
+    // 当前借出未还的连接数，读写分离时用于选择负载最低的副本
+    size_t borrowed() const { return borrowedCount.load(memory_order_relaxed); }
+
+    PoolStats getStats() const {
+        PoolStats stats;
+        {
+            lock_guard<mutex> lock(mtx);
+            stats.total = total;
+            stats.idle = idle.size();
+        }
+        stats.acquired = acquiredCount.load(memory_order_relaxed);
+        stats.waited = waitedCount.load(memory_order_relaxed);
+        stats.timeouts = timeoutCount.load(memory_order_relaxed);
+        stats.reconnects = reconnectCount.load(memory_order_relaxed);
+        stats.totalWaitUs = totalWaitUs.load(memory_order_relaxed);
+        stats.maxWaitUs = maxWaitUs.load(memory_order_relaxed);
+        return stats;
+    }
+
+    void shutdown() {
+        vector<IdleEntry> toClose;
+        {
+            lock_guard<mutex> lock(mtx);
+            closed = true;
+            toClose.swap(idle);
+            total -= toClose.size();
+        }
+        cv.notify_all();
+        for (auto& entry : toClose) {
+            delete entry.conn;
+        }
+    }
+};
+
+inline bool PooledConnection::reconnectIfLost(unsigned int err) {
+    if (!pool || !conn) {
+        return false;
+    }
+    if (err == 0) {
+        err = mysql_errno(conn->handle);
+    }
+    if (!isConnectionLostError(err)) {
+        return false;
+    }
+    conn = pool->reopen(conn);
+    if (!conn) {
+        pool = nullptr;
+        return false;
+    }
+    return true;
+}
+
+inline void PooledConnection::release() {
+    if (pool && conn) {
+        pool->release(conn, broken);
+    }
+    pool = nullptr;
+    conn = nullptr;
+    broken = false;
+}
+
+// 统一的 128 位 IP 表示，IPv4 映射为 ::ffff:a.b.c.d
+struct IPAddress {
+    uint8_t bytes[16] = {};
+
+    bool bit(int i) const { return (bytes[i >> 3] >> (7 - (i & 7))) & 1; }
+};
+
+// 解析 IPv4/IPv6 地址文本
+inline bool parseIPAddress(const string& text, IPAddress& out) {
+    in_addr v4;
+    if (inet_pton(AF_INET, text.c_str(), &v4) == 1) {
+        memset(out.bytes, 0, sizeof(out.bytes));
+        out.bytes[10] = 0xff;
+        out.bytes[11] = 0xff;
+        memcpy(out.bytes + 12, &v4, 4);
+        return true;
+    }
+
+    in6_addr v6;
+    if (inet_pton(AF_INET6, text.c_str(), &v6) == 1) {
+        memcpy(out.bytes, &v6, 16);
+        return true;
+    }
+    return false;
+}
+
+// 解析 "ip" 或 "ip/prefix" 形式的白名单条目，前缀长度统一换算到 128 位空间
+inline bool parseIPPrefix(const string& text, IPAddress& addr, int& prefixLen) {
+    size_t slash = text.find('/');
+    string host = slash == string::npos ? text : text.substr(0, slash);
+    if (!parseIPAddress(host, addr)) {
+        return false;
+    }
+
+    bool isV4 = host.find(':') == string::npos;
+    int maxLen = isV4 ? 32 : 128;
+    int len = maxLen;
+    if (slash != string::npos) {
+        string lenText = text.substr(slash + 1);
+        if (lenText.empty() || lenText.size() > 3 ||
+            lenText.find_first_not_of("0123456789") != string::npos) {
+            return false;
+        }
+        len = stoi(lenText);
+        if (len > maxLen) {
+            return false;
+        }
+    }
+
+    prefixLen = isV4 ? len + 96 : len;
+    return true;
+}
+
+// 白名单条目的请求限额：每秒补充的令牌数与令牌桶容量，0 表示使用全局默认值
+struct RateLimit {
+    uint32_t rate = 0;
+    uint32_t burst = 0;
+};
+
+// 二叉前缀树：构建完成后只读，可被多个线程无锁并发查询。
+// 每个前缀带一份限额，查询时取最长匹配前缀的限额
+class IPPrefixTrie {
+private:
+    struct Node {
+        int32_t child[2] = { -1, -1 };
+        int32_t limit = -1;     // limits 中的下标，>= 0 表示该节点是一个前缀的终点
+    };
+
+    vector<Node> nodes;
+    vector<RateLimit> limits;
+    size_t prefixCount = 0;
+
+public:
+    IPPrefixTrie() : nodes(1) {}
+
+    // 同一前缀重复插入时以最后一次的限额为准
+    void insert(const IPAddress& addr, int prefixLen, const RateLimit& limit = RateLimit()) {
+        int32_t cur = 0;
+        for (int i = 0; i < prefixLen; ++i) {
+            int b = addr.bit(i);
+            if (nodes[cur].child[b] < 0) {
+                nodes[cur].child[b] = static_cast<int32_t>(nodes.size());
+                nodes.emplace_back();
+            }
+            cur = nodes[cur].child[b];
+        }
+        if (nodes[cur].limit < 0) {
+            nodes[cur].limit = static_cast<int32_t>(limits.size());
+            limits.push_back(limit);
+            ++prefixCount;
+        }
+        else {
+            limits[nodes[cur].limit] = limit;
+        }
+    }
+
+    // limit 不为空时写入最长匹配前缀的限额
+    bool contains(const IPAddress& addr, RateLimit* limit = nullptr) const {
+        int32_t cur = 0;
+        int32_t matched = nodes[0].limit;
+        for (int i = 0; i < 128; ++i) {
+            if (matched >= 0 && !limit) {
+                break;
+            }
+            cur = nodes[cur].child[addr.bit(i)];
+            if (cur < 0) {
+                break;
+            }
+            if (nodes[cur].limit >= 0) {
+                matched = nodes[cur].limit;
+            }
+        }
+        if (matched >= 0 && limit) {
+            *limit = limits[matched];
+        }
+        return matched >= 0;
+    }
+
+    size_t size() const { return prefixCount; }
+};
+
+// IP 的规范写法：IPv4（含 IPv4 映射地址）为点分十进制，IPv6 为 inet_ntop 的压缩小写形式
+inline string formatIPAddress(const IPAddress& addr) {
+    static const uint8_t kMappedPrefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    char text[INET6_ADDRSTRLEN] = {};
+    if (memcmp(addr.bytes, kMappedPrefix, sizeof(kMappedPrefix)) == 0) {
+        inet_ntop(AF_INET, addr.bytes + 12, text, sizeof(text));
+    }
+    else {
+        inet_ntop(AF_INET6, addr.bytes, text, sizeof(text));
+    }
+    return text;
+}
+
+// 缓存与索引键中的 IP 部分：可解析的地址写成 '\0' + 16 字节，等价写法（大小写、省略的零、
+// IPv4 映射地址）得到同一个定长键；其余文本按小写原样保留
+inline void appendIPKey(string& key, const string& ip) {
+    IPAddress addr;
+    if (parseIPAddress(ip, addr)) {
+        key += '\0';
+        key.append(reinterpret_cast<const char*>(addr.bytes), sizeof(addr.bytes));
+        return;
+    }
+    for (char c : ip) key += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+}
+
+// 大小写不敏感的 (ip, domain) 键，与数据库默认排序规则的比较方式一致
+inline string foldedKey(const string& ip, const string& domain) {
+    string key;
+    key.reserve(18 + domain.size());
+    appendIPKey(key, ip);
+    key += '\x1f';
+    for (char c : domain) key += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return key;
+}
+
+// foldedKey 的逆操作，IP 还原为规范写法
+inline void splitFoldedKey(const string& key, string& ip, string& domain) {
+    if (key.size() >= 18 && key[0] == '\0' && key[17] == '\x1f') {
+        IPAddress addr;
+        memcpy(addr.bytes, key.data() + 1, sizeof(addr.bytes));
+        ip = formatIPAddress(addr);
+        domain = key.substr(18);
+        return;
+    }
+    size_t sep = key.find('\x1f');
+    ip = key.substr(0, sep);
+    domain = sep == string::npos ? string() : key.substr(sep + 1);
+}
+
+// 精简表结构中保存的域名：小写并去掉末尾的点
+inline string normalizeDomain(const string& domain) {
+    size_t length = domain.size();
+    while (length > 0 && domain[length - 1] == '.') {
+        --length;
+    }
+    string out(domain, 0, length);
+    for (char& c : out) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return out;
+}
+
+// dns_verifications 的一行
+struct VerificationRow {
+    string clientIP;
+    string domain;
+    string expireTime;
+};
+
+// 存储操作结果
+enum StorageStatus {
+    STORAGE_OK = 0,
+    STORAGE_NOT_FOUND,      // 没有匹配的记录
+    STORAGE_UNAVAILABLE,    // 暂时无法访问（如连接池耗尽），对应 503
+    STORAGE_ERROR           // 查询或写入失败，对应 500
+};
+
+struct WhitelistEntry {
+    int64_t id = 0;
+    string ip;
+    RateLimit limit;
+};
+
+// find 查询结果：最新一条 verify 记录及其域名映射
+struct FindRecord {
+    string clientIP;
+    string domain;
+    string expireTime;
+    string targetIP;        // 没有映射时为空
+    int64_t expireAt = 0;   // 到期时间戳，<= 0 时由调用方解析 expireTime
+};
+
+// 启用状态的域名配置
+struct ConfigRecord {
+    string domain;
+    string expireTime;
+};
+
+// 启动快照导出与批量导入用：域名配置与域名映射（导出时只含启用状态的配置）
+struct DomainConfigRow {
+    string clientIP;
+    string domain;
+    string expireTime;
+    int status = 1;
+};
+
+struct MappingRow {
+    string domain;
+    string targetIP;
+};
+
+// 数据保留的扫描位置：一轮清理分多批推进，每批处理一段位置（MySQL 为主键范围）
+struct PurgeCursor {
+    int64_t next = 0;       // 下一批的起始位置
+    int64_t end = -1;       // 本轮的结束位置（不含），< 0 表示本轮尚未开始
+    uint64_t deleted = 0;   // 本轮已删除的行数
+    bool done = false;
+};
+
+// 存储后端接口：白名单、域名配置、验证记录与域名映射的读写都经由此接口，
+// DNSAuthServer 不直接依赖 libmysqlclient
+class DNSAuthStorage {
+public:
+    virtual ~DNSAuthStorage() {}
+
+    virtual const char* name() const = 0;
+
+    // 建表或恢复数据；失败时服务不启动
+    virtual bool open() = 0;
+    virtual void close() = 0;
+
+    // ip_whitelist：读取 id > afterId 的条目（按 id 升序），以及条目总数与最大 id
+    virtual bool loadWhitelist(int64_t afterId, vector<WhitelistEntry>& out) = 0;
+    virtual bool whitelistSummary(uint64_t& count, int64_t& maxId) = 0;
+    virtual StorageStatus whitelistContains(const string& ip) = 0;
+
+    // domain_configs：启用状态下的到期时间；批量版本只返回找到的域名
+    virtual StorageStatus lookupConfig(const string& clientIP, const string& domain, string& expireTime) = 0;
+    virtual StorageStatus lookupConfigs(const string& clientIP, const vector<const string*>& domains,
+        vector<ConfigRecord>& out) = 0;
+
+    // dns_verifications：一次调用中的行全部写入或全部失败
+    virtual StorageStatus insertVerifications(const VerificationRow* rows, size_t count) = 0;
+
+    // 最新一条 verify 记录 LEFT JOIN domain_mappings；批量版本只返回有验证记录的 (ip, domain)
+    virtual StorageStatus findActive(const string& clientIP, const string& domain, FindRecord& out) = 0;
+    virtual StorageStatus findActiveBatch(const vector<pair<const string*, const string*>>& keys,
+        vector<FindRecord>& out) = 0;
+
+    // 逐个回调 dns_verifications 与 domain_configs 中的 (client_ip, domain)，以 foldedKey 形式给出，可能重复
+    virtual bool scanFindKeys(const function<void(const string& key)>& visit) = 0;
+
+    // 管理操作
+    virtual bool addWhitelist(const string& ip, const string& description) = 0;
+    // 修改已有条目的请求限额；不改变 id，其他进程在下一次白名单全量重建时生效
+    virtual bool setWhitelistLimit(const string& ip, const RateLimit& limit) = 0;
+    virtual bool upsertDomainConfig(const string& clientIP, const string& domain,
+        const string& expireTime, int status) = 0;
+    virtual bool upsertDomainMapping(const string& domain, const string& targetIP) = 0;
+
+    // 批量导入：一次调用中的行全部写入或全部失败，同一个键以最后一行为准
+    virtual bool upsertDomainConfigs(const DomainConfigRow* rows, size_t count) = 0;
+    virtual bool upsertDomainMappings(const MappingRow* rows, size_t count) = 0;
+
+    // 全量导出（生成启动快照）：status = 1 的域名配置与全部域名映射
+    virtual bool listActiveConfigs(vector<DomainConfigRow>& out) = 0;
+    virtual bool listMappings(vector<MappingRow>& out) = 0;
+
+    // 数据保留：从 cursor 处处理一批（span 个位置），删除 expire_time 早于 expiredBefore
+    // 或已被同一 (client_ip, domain) 更晚记录取代的验证记录
+    virtual StorageStatus purgeVerifications(PurgeCursor& cursor, size_t span, int64_t expiredBefore) = 0;
+
+    // 整体删除上界不晚于 expiredBefore 的分区并预建后续分区；不分区的实现什么也不做
+    virtual bool maintainPartitions(int64_t /*expiredBefore*/, uint64_t& droppedPartitions) {
+        droppedPartitions = 0;
+        return true;
+    }
+
+    // 运行状态：没有连接池的实现返回全 0
+    virtual PoolStats poolStats() { return PoolStats(); }
+    virtual void appendMetrics(string& /*out*/) {}
+};
+
+// 内存白名单：读路径只做一次原子 shared_ptr 读取，刷新时整体替换（RCU 方式）
+class IPWhitelistCache {
+private:
+    shared_ptr<const IPPrefixTrie> current;
+    int64_t lastMaxId = 0;
+    uint64_t lastCount = 0;
+    int refreshesSinceFull = 0;
+    atomic<bool> ready{ false };
+
+    mutex refreshMtx;
+    condition_variable refreshCv;
+    thread refresher;
+    bool stopping = false;
+
+    // 读取 id > afterId 的条目并插入 trie，返回读到的行数，失败返回 -1
+    static int64_t loadRows(DNSAuthStorage& storage, int64_t afterId, IPPrefixTrie& trie, int64_t& maxId) {
+        vector<WhitelistEntry> entries;
+        if (!storage.loadWhitelist(afterId, entries)) {
+            logError("加载白名单失败");
+            return -1;
+        }
+        insertEntries(entries, trie, maxId);
+        return static_cast<int64_t>(entries.size());
+    }
+
+    static void insertEntries(const vector<WhitelistEntry>& entries, IPPrefixTrie& trie, int64_t& maxId) {
+        for (const WhitelistEntry& entry : entries) {
+            if (entry.id > maxId) maxId = entry.id;
+
+            IPAddress addr;
+            int prefixLen = 0;
+            if (!parseIPPrefix(entry.ip, addr, prefixLen)) {
+                logWarn("忽略无法解析的白名单条目: ", entry.ip);
+                continue;
+            }
+            trie.insert(addr, prefixLen, entry.limit);
+        }
+    }
+
+public:
+    ~IPWhitelistCache() { stop(); }
+
+    bool isReady() const { return ready.load(memory_order_acquire); }
+
+    size_t size() const {
+        auto snapshot = atomic_load(&current);
+        return snapshot ? snapshot->size() : 0;
+    }
+
+    // limit 不为空时写入匹配条目的限额
+    bool contains(const string& ip, RateLimit* limit = nullptr) const {
+        IPAddress addr;
+        if (!parseIPAddress(ip, addr)) {
+            return false;
+        }
+        auto snapshot = atomic_load(&current);
+        return snapshot && snapshot->contains(addr, limit);
+    }
+
+    // 全量重建
+    bool reload(DNSAuthStorage& storage) {
+        uint64_t count = 0;
+        int64_t summaryMaxId = 0;
+        if (!storage.whitelistSummary(count, summaryMaxId)) {
+            return false;
+        }
+
+        auto trie = make_shared<IPPrefixTrie>();
+        int64_t maxId = 0;
+        int64_t rows = loadRows(storage, 0, *trie, maxId);
+        if (rows < 0) {
+            return false;
+        }
+
+        atomic_store(&current, shared_ptr<const IPPrefixTrie>(trie));
+        lastMaxId = maxId;
+        lastCount = static_cast<uint64_t>(rows);
+        refreshesSinceFull = 0;
+        ready.store(true, memory_order_release);
+        return true;
+    }
+
+    // 用启动快照中的条目建树；之后的增量刷新按 id 与行数和数据库对齐
+    void seed(const vector<WhitelistEntry>& entries) {
+        auto trie = make_shared<IPPrefixTrie>();
+        int64_t maxId = 0;
+        insertEntries(entries, *trie, maxId);
+
+        atomic_store(&current, shared_ptr<const IPPrefixTrie>(trie));
+        lastMaxId = maxId;
+        lastCount = entries.size();
+        refreshesSinceFull = 0;
+        ready.store(true, memory_order_release);
+    }
+
+    // 增量刷新：只拉取新增的 id；行数对不上（有删除）或到达全量周期时退化为全量重建
+    bool refresh(DNSAuthStorage& storage, int fullReloadEvery) {
+        if (!isReady() || ++refreshesSinceFull >= fullReloadEvery) {
+            return reload(storage);
+        }
+
+        uint64_t count = 0;
+        int64_t maxId = 0;
+        if (!storage.whitelistSummary(count, maxId)) {
+            return false;
+        }
+        if (count == lastCount && maxId == lastMaxId) {
+            return true;
+        }
+
+        auto trie = make_shared<IPPrefixTrie>(*atomic_load(&current));
+        int64_t newMaxId = lastMaxId;
+        int64_t rows = loadRows(storage, lastMaxId, *trie, newMaxId);
+        if (rows < 0) {
+            return false;
+        }
+        if (lastCount + static_cast<uint64_t>(rows) != count) {
+            return reload(storage);
+        }
+
+        atomic_store(&current, shared_ptr<const IPPrefixTrie>(trie));
+        lastMaxId = newMaxId;
+        lastCount = count;
+        return true;
+    }
+
+    // 启动后台刷新线程；catchUp 为 true 时（白名单来自启动快照）立即与数据库对齐一次
+    void startRefresher(DNSAuthStorage& storage, const ServerConfig& cfg, bool catchUp = false) {
+        stopping = false;
+        refresher = thread([this, &storage, cfg, catchUp]() {
+            unique_lock<mutex> lock(refreshMtx);
+            bool waitFirst = !catchUp;
+            while (!stopping) {
+                if (waitFirst) {
+                    refreshCv.wait_for(lock, chrono::milliseconds(cfg.whitelistRefreshMs));
+                }
+                waitFirst = true;
+                if (stopping) break;
+
+                lock.unlock();
+                refresh(storage, cfg.whitelistFullReloadEvery);
+                lock.lock();
+            }
+        });
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> lock(refreshMtx);
+            stopping = true;
+        }
+        refreshCv.notify_all();
+        if (refresher.joinable()) {
+            refresher.join();
+        }
+    }
+};
+
+// 公历日期到 1970-01-01 的天数
+inline int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// 本地时区在指定本地日期、整点处相对 UTC 的偏移（秒），由 mktime（tm_isdst = -1）按该日期计算，
+// 夏令时前后的时间各取各自的偏移；同一线程内按小时缓存，连续解析同一小时的时间不再进入 mktime
+inline int64_t localUtcOffset(int64_t year, unsigned month, unsigned day, unsigned hour) {
+    thread_local int64_t cachedHour = INT64_MIN;
+    thread_local int64_t cachedOffset = 0;
+
+    int64_t localHour = daysFromCivil(year, month, day) * 24 + hour;
+    if (localHour != cachedHour) {
+        struct tm localTm = {};
+        localTm.tm_year = static_cast<int>(year - 1900);
+        localTm.tm_mon = static_cast<int>(month) - 1;
+        localTm.tm_mday = static_cast<int>(day);
+        localTm.tm_hour = static_cast<int>(hour);
+        localTm.tm_isdst = -1;
+        time_t utc = mktime(&localTm);
+        if (utc == static_cast<time_t>(-1)) {
+            return cachedOffset;
+        }
+        cachedOffset = localHour * 3600 - static_cast<int64_t>(utc);
+        cachedHour = localHour;
+    }
+    return cachedOffset;
+}
+
+// 解析固定格式 "YYYY-MM-DD HH:MM:SS"（按本地时区）为 Unix 时间戳，格式不符返回 -1
+inline int64_t parseDateTime(const char* p, size_t len) {
+    if (len < 19 || p[4] != '-' || p[7] != '-' || (p[10] != ' ' && p[10] != 'T') ||
+        p[13] != ':' || p[16] != ':') {
+        return -1;
+    }
+
+    static const int kDigitPos[14] = { 0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18 };
+    unsigned v[14];
+    unsigned bad = 0;
+    for (int i = 0; i < 14; ++i) {
+        v[i] = static_cast<unsigned>(p[kDigitPos[i]] - '0');
+        bad |= v[i] > 9;
+    }
+    if (bad) {
+        return -1;
+    }
+
+    int64_t year = v[0] * 1000 + v[1] * 100 + v[2] * 10 + v[3];
+    unsigned month = v[4] * 10 + v[5];
+    unsigned day = v[6] * 10 + v[7];
+    unsigned hour = v[8] * 10 + v[9];
+    unsigned minute = v[10] * 10 + v[11];
+    unsigned second = v[12] * 10 + v[13];
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return -1;
+    }
+
+    return daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second -
+        localUtcOffset(year, month, day, hour);
+}
+
+inline int64_t parseDateTime(const string& text) {
+    return parseDateTime(text.data(), text.size());
+}
+
+// find 结果缓存条目
+struct FindCacheValue {
+    string targetIP;
+    string expireTime;
+    int64_t expireAt = 0;   // expire_time 的 Unix 时间戳
+};
+
+// find 结果缓存：按 (client_ip, domain) 分片，每个分片独立加锁，满时按 CLOCK 算法淘汰
+class FindResultCache {
+private:
+    struct Slot {
+        string clientIP;
+        string domain;
+        FindCacheValue value;
+        int64_t validUntil = 0;
+        bool used = false;
+        bool referenced = false;
+    };
+
+    struct Shard {
+        mutex mtx;
+        unordered_map<string, size_t> index;
+        vector<Slot> slots;
+        size_t hand = 0;
+        size_t capacity = 0;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    int ttlSec = 30;
+    bool compactSchema = false;
+    atomic<uint64_t> hitCount{ 0 };
+    atomic<uint64_t> missCount{ 0 };
+    atomic<uint64_t> evictCount{ 0 };
+
+    // 条目中的域名按存储的比较方式归一：不区分大小写（默认排序规则）；精简结构下存储的域名已去掉
+    // 末尾的点，"Example.com." 与 "example.com" 是同一行，文本结构下则是两行，末尾的点须保留
+    string canonicalDomain(const string& domain) const {
+        if (compactSchema) {
+            return normalizeDomain(domain);
+        }
+        string out(domain);
+        for (char& c : out) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return out;
+    }
+
+    // slot.domain 已是 canonicalDomain 的结果
+    static string makeKey(const string& clientIP, const string& canonical) {
+        string key;
+        key.reserve(18 + canonical.size());
+        appendIPKey(key, clientIP);
+        key.push_back('\x1f');
+        key.append(canonical);
+        return key;
+    }
+
+    Shard& shardFor(const string& key) {
+        return *shards[hash<string>()(key) % shards.size()];
+    }
+
+    static void removeSlot(Shard& shard, size_t pos, const string& key) {
+        shard.index.erase(key);
+        Slot& slot = shard.slots[pos];
+        slot.used = false;
+        slot.referenced = false;
+        slot.clientIP.clear();
+        slot.domain.clear();
+    }
+
+    // CLOCK：跳过最近被访问过的槽位，找到第一个可复用槽位
+    size_t findVictim(Shard& shard) {
+        if (shard.slots.size() < shard.capacity) {
+            shard.slots.emplace_back();
+            return shard.slots.size() - 1;
+        }
+        while (true) {
+            size_t pos = shard.hand;
+            shard.hand = (shard.hand + 1) % shard.slots.size();
+            Slot& slot = shard.slots[pos];
+            if (!slot.used) {
+                return pos;
+            }
+            if (slot.referenced) {
+                slot.referenced = false;
+                continue;
+            }
+            removeSlot(shard, pos, makeKey(slot.clientIP, slot.domain));
+            evictCount.fetch_add(1, memory_order_relaxed);
+            return pos;
+        }
+    }
+
+public:
+    void init(const ServerConfig& cfg, bool compact) {
+        size_t shardCount = cfg.findCacheShards > 0 ? cfg.findCacheShards : 1;
+        ttlSec = cfg.findCacheTtlSec;
+        compactSchema = compact;
+        shards.clear();
+        if (cfg.findCacheCapacity == 0) {
+            return;
+        }
+        size_t perShard = (cfg.findCacheCapacity + shardCount - 1) / shardCount;
+        for (size_t i = 0; i < shardCount; ++i) {
+            shards.emplace_back(new Shard());
+            shards.back()->capacity = perShard;
+        }
+    }
+
+    bool enabled() const { return !shards.empty(); }
+
+    bool lookup(const string& clientIP, const string& domain, FindCacheValue& out) {
+        if (!enabled()) return false;
+
+        string key = makeKey(clientIP, canonicalDomain(domain));
+        Shard& shard = shardFor(key);
+        int64_t now = static_cast<int64_t>(time(nullptr));
+
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            missCount.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+
+        Slot& slot = shard.slots[it->second];
+        if (now >= slot.validUntil) {
+            removeSlot(shard, it->second, key);
+            missCount.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+
+        slot.referenced = true;
+        out = slot.value;
+        hitCount.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    // 写入缓存；存活时间取 findCacheTtlSec 与记录到期时间中较早者
+    void insert(const string& clientIP, const string& domain, const FindCacheValue& value) {
+        if (!enabled()) return;
+
+        int64_t now = static_cast<int64_t>(time(nullptr));
+        int64_t validUntil = now + ttlSec;
+        if (value.expireAt < validUntil) validUntil = value.expireAt;
+        if (validUntil <= now) return;
+
+        string canonical = canonicalDomain(domain);
+        string key = makeKey(clientIP, canonical);
+        Shard& shard = shardFor(key);
+
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.index.find(key);
+        size_t pos = it != shard.index.end() ? it->second : findVictim(shard);
+
+        Slot& slot = shard.slots[pos];
+        slot.clientIP = clientIP;
+        slot.domain = move(canonical);
+        slot.value = value;
+        slot.validUntil = validUntil;
+        slot.used = true;
+        slot.referenced = true;
+        shard.index[key] = pos;
+    }
+
+    // 失效单个 (client_ip, domain)
+    void invalidate(const string& clientIP, const string& domain) {
+        if (!enabled()) return;
+
+        string key = makeKey(clientIP, canonicalDomain(domain));
+        Shard& shard = shardFor(key);
+
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            removeSlot(shard, it->second, key);
+        }
+    }
+
+    // 失效某个域名下的全部条目（域名映射变更时使用，需遍历所有分片）
+    void invalidateDomain(const string& domain) {
+        string normalized = canonicalDomain(domain);
+        for (auto& shardPtr : shards) {
+            Shard& shard = *shardPtr;
+            lock_guard<mutex> lock(shard.mtx);
+            for (size_t pos = 0; pos < shard.slots.size(); ++pos) {
+                Slot& slot = shard.slots[pos];
+                if (slot.used && slot.domain == normalized) {
+                    removeSlot(shard, pos, makeKey(slot.clientIP, slot.domain));
+                }
+            }
+        }
+    }
+
+    void clear() {
+        for (auto& shardPtr : shards) {
+            lock_guard<mutex> lock(shardPtr->mtx);
+            shardPtr->index.clear();
+            shardPtr->slots.clear();
+            shardPtr->hand = 0;
+        }
+    }
+
+    size_t size() {
+        size_t n = 0;
+        for (auto& shardPtr : shards) {
+            lock_guard<mutex> lock(shardPtr->mtx);
+            n += shardPtr->index.size();
+        }
+        return n;
+    }
+
+    uint64_t hits() const { return hitCount.load(memory_order_relaxed); }
+    uint64_t misses() const { return missCount.load(memory_order_relaxed); }
+    uint64_t evictions() const { return evictCount.load(memory_order_relaxed); }
+};
+
+// 未命中结果的短时缓存：记录确定不存在的键（白名单回退查询未命中的 IP、没有验证记录的 (ip, domain)），
+// 到期前同一个键直接按未命中应答。分片加锁；分片满时先清理过期条目，仍满则清空该分片
+class NegativeCache {
+private:
+    struct Shard {
+        mutex mtx;
+        unordered_map<string, int64_t> expiresAt;   // steady_clock 毫秒
+        size_t capacity = 0;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    int64_t ttlMs = 5000;
+    atomic<uint64_t> hitCount{ 0 };
+
+    static int64_t nowMs() {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    Shard& shardFor(const string& key) {
+        return *shards[hash<string>()(key) % shards.size()];
+    }
+
+public:
+    void init(const ServerConfig& cfg) {
+        size_t shardCount = cfg.findCacheShards > 0 ? cfg.findCacheShards : 1;
+        ttlMs = static_cast<int64_t>(cfg.negativeCacheTtlSec) * 1000;
+        shards.clear();
+        if (cfg.negativeCacheCapacity == 0 || cfg.negativeCacheTtlSec <= 0) {
+            return;
+        }
+        size_t perShard = (cfg.negativeCacheCapacity + shardCount - 1) / shardCount;
+        for (size_t i = 0; i < shardCount; ++i) {
+            shards.emplace_back(new Shard());
+            shards.back()->capacity = perShard;
+        }
+    }
+
+    bool enabled() const { return !shards.empty(); }
+
+    bool contains(const string& key) {
+        if (!enabled()) return false;
+
+        Shard& shard = shardFor(key);
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.expiresAt.find(key);
+        if (it == shard.expiresAt.end()) {
+            return false;
+        }
+        if (nowMs() >= it->second) {
+            shard.expiresAt.erase(it);
+            return false;
+        }
+        hitCount.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    void insert(const string& key) {
+        if (!enabled()) return;
+
+        int64_t now = nowMs();
+        Shard& shard = shardFor(key);
+        lock_guard<mutex> lock(shard.mtx);
+        if (shard.expiresAt.size() >= shard.capacity && shard.expiresAt.count(key) == 0) {
+            for (auto it = shard.expiresAt.begin(); it != shard.expiresAt.end();) {
+                it = now >= it->second ? shard.expiresAt.erase(it) : next(it);
+            }
+            if (shard.expiresAt.size() >= shard.capacity) {
+                shard.expiresAt.clear();
+            }
+        }
+        shard.expiresAt[key] = now + ttlMs;
+    }
+
+    // 键已存在（如本进程刚写入验证记录）时立即移除
+    void erase(const string& key) {
+        if (!enabled()) return;
+
+        Shard& shard = shardFor(key);
+        lock_guard<mutex> lock(shard.mtx);
+        shard.expiresAt.erase(key);
+    }
+
+    size_t size() {
+        size_t n = 0;
+        for (auto& shardPtr : shards) {
+            lock_guard<mutex> lock(shardPtr->mtx);
+            n += shardPtr->expiresAt.size();
+        }
+        return n;
+    }
+
+    uint64_t hits() const { return hitCount.load(memory_order_relaxed); }
+};
+
+// verify 合并：记录本进程最近写入成功的 (client_ip, domain) 及其到期时间。窗口内到期时间相同的重复 verify
+// 直接应答，不再写库；到期时间不同（配置被修改）时照常写入。窗口从写入时算起，不随重复请求顺延
+class VerifyCoalescer {
+private:
+    struct Entry {
+        string expireTime;
+        int64_t until = 0;      // steady_clock 毫秒
+    };
+
+    struct Shard {
+        mutex mtx;
+        unordered_map<string, Entry> entries;
+        size_t capacity = 0;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    int64_t windowMs = 0;
+    atomic<uint64_t> hitCount{ 0 };
+
+    static int64_t nowMs() {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    Shard& shardFor(const string& key) {
+        return *shards[hash<string>()(key) % shards.size()];
+    }
+
+public:
+    void init(const ServerConfig& cfg) {
+        size_t shardCount = cfg.findCacheShards > 0 ? cfg.findCacheShards : 1;
+        windowMs = cfg.verifyCoalesceWindowMs;
+        shards.clear();
+        if (cfg.verifyCoalesceCapacity == 0 || cfg.verifyCoalesceWindowMs <= 0) {
+            return;
+        }
+        size_t perShard = (cfg.verifyCoalesceCapacity + shardCount - 1) / shardCount;
+        for (size_t i = 0; i < shardCount; ++i) {
+            shards.emplace_back(new Shard());
+            shards.back()->capacity = perShard;
+        }
+    }
+
+    bool enabled() const { return !shards.empty(); }
+
+    // 参数为 foldedKey；窗口内已以相同到期时间写入过时返回 true
+    bool coalesce(const string& key, const string& expireTime) {
+        if (!enabled()) return false;
+
+        Shard& shard = shardFor(key);
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end() || it->second.expireTime != expireTime) {
+            return false;
+        }
+        if (nowMs() >= it->second.until) {
+            shard.entries.erase(it);
+            return false;
+        }
+        hitCount.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    // 验证记录写入提交后调用
+    void record(const string& key, const string& expireTime) {
+        if (!enabled()) return;
+
+        int64_t now = nowMs();
+        Shard& shard = shardFor(key);
+        lock_guard<mutex> lock(shard.mtx);
+        if (shard.entries.size() >= shard.capacity && shard.entries.count(key) == 0) {
+            for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+                it = now >= it->second.until ? shard.entries.erase(it) : next(it);
+            }
+            if (shard.entries.size() >= shard.capacity) {
+                shard.entries.clear();
+            }
+        }
+        Entry& entry = shard.entries[key];
+        entry.expireTime = expireTime;
+        entry.until = now + windowMs;
+    }
+
+    size_t size() {
+        size_t n = 0;
+        for (auto& shardPtr : shards) {
+            lock_guard<mutex> lock(shardPtr->mtx);
+            n += shardPtr->entries.size();
+        }
+        return n;
+    }
+
+    uint64_t hits() const { return hitCount.load(memory_order_relaxed); }
+};
+
+// FNV-1a 后再做一次混合，使高低 32 位都可单独使用（双重哈希、分片选择）
+inline uint64_t hashString(const string& key) {
+    uint64_t h = 1469598103934665603ULL;
+    for (char c : key) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// find 键的布隆过滤器：由 dns_verifications 与 domain_configs 的全部 (client_ip, domain) 在后台定期重建，
+// 本进程写入的键即时加入。过滤器判定不存在的 (ip, domain) 没有验证记录，可不访问存储直接返回 404；
+// 例外是其他进程在两次重建之间新增的配置与验证，因此只在可接受 findFilterRebuildSec 的延迟时开启
+class FindKeyFilter {
+private:
+    // 位数组与哈希函数个数在构建时确定；置位用原子或，允许与查询并发
+    class Bits {
+    private:
+        vector<atomic<uint64_t>> words;
+        uint64_t bitCount;
+        int hashCount;
+
+    public:
+        Bits(size_t expectedKeys, double falsePositiveRate) {
+            double n = static_cast<double>(expectedKeys > 0 ? expectedKeys : 1);
+            double p = falsePositiveRate > 0 && falsePositiveRate < 1 ? falsePositiveRate : 0.01;
+            double m = -n * log(p) / (log(2.0) * log(2.0));
+            size_t wordCount = static_cast<size_t>(m / 64) + 1;
+            words = vector<atomic<uint64_t>>(wordCount);
+            bitCount = static_cast<uint64_t>(wordCount) * 64;
+            int k = static_cast<int>(static_cast<double>(bitCount) / n * log(2.0) + 0.5);
+            hashCount = k < 1 ? 1 : (k > 16 ? 16 : k);
+        }
+
+        // 双重哈希：第 i 个位置为 h1 + i * h2
+        void add(uint64_t h) {
+            uint64_t h2 = (h >> 32) | 1;
+            for (int i = 0; i < hashCount; ++i) {
+                uint64_t bit = (h + static_cast<uint64_t>(i) * h2) % bitCount;
+                words[bit >> 6].fetch_or(static_cast<uint64_t>(1) << (bit & 63), memory_order_relaxed);
+            }
+        }
+
+        bool mayContain(uint64_t h) const {
+            uint64_t h2 = (h >> 32) | 1;
+            for (int i = 0; i < hashCount; ++i) {
+                uint64_t bit = (h + static_cast<uint64_t>(i) * h2) % bitCount;
+                if ((words[bit >> 6].load(memory_order_relaxed) & (static_cast<uint64_t>(1) << (bit & 63))) == 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        uint64_t bits() const { return bitCount; }
+    };
+
+    static const size_t kMinExpectedKeys = 65536;
+    static const size_t kMaxPendingKeys = 1 << 20;
+
+    ServerConfig config;
+    bool compactSchema = false;
+    DNSAuthStorage* storage = nullptr;
+    shared_ptr<Bits> current;           // 为空时不做判定（尚未建好或已失效）
+
+    mutex pendingMtx;
+    vector<uint64_t> pending;           // 当前过滤器之后加入的键，重建时补入新过滤器
+
+    mutex mtx;
+    condition_variable wake;
+    thread worker;
+    bool stopping = false;
+    bool running = false;
+    bool rebuildRequested = false;
+    atomic<bool> active{ false };       // start() 之后才接受 add()
+
+    atomic<uint64_t> keyCount{ 0 };
+    atomic<uint64_t> rejectCount{ 0 };
+    atomic<uint64_t> rebuildCount{ 0 };
+    atomic<uint64_t> failureCount{ 0 };
+
+    void run() {
+        while (true) {
+            rebuild();
+            unique_lock<mutex> lock(mtx);
+            wake.wait_for(lock, chrono::seconds(config.findFilterRebuildSec),
+                [this]() { return stopping || rebuildRequested; });
+            if (stopping) return;
+            rebuildRequested = false;
+        }
+    }
+
+public:
+    FindKeyFilter() = default;
+    FindKeyFilter(const FindKeyFilter&) = delete;
+    FindKeyFilter& operator=(const FindKeyFilter&) = delete;
+
+    ~FindKeyFilter() { stop(); }
+
+    // 精简结构下存储里的域名已去掉末尾的点，查询时带点的写法也要落到同一个位上；
+    // 文本结构下带点与不带点是不同的行，按原样哈希
+    uint64_t hashKey(const string& key) const {
+        if (!compactSchema) {
+            return hashString(key);
+        }
+        size_t end = key.size();
+        while (end > 0 && key[end - 1] == '.') {
+            --end;
+        }
+        return end == key.size() ? hashString(key) : hashString(key.substr(0, end));
+    }
+
+    // 扫描存储建立新过滤器并替换当前过滤器；失败时保留原过滤器
+    bool rebuild() {
+        auto started = chrono::steady_clock::now();
+        vector<uint64_t> hashes;
+        if (!storage->scanFindKeys([this, &hashes](const string& key) { hashes.push_back(hashKey(key)); })) {
+            failureCount.fetch_add(1, memory_order_relaxed);
+            logWarn("find 布隆过滤器重建失败，沿用当前过滤器");
+            return false;
+        }
+
+        // 按现有键数的两倍定容，为两次重建之间新增的键留出余量
+        size_t expected = hashes.size() * 2 > kMinExpectedKeys ? hashes.size() * 2 : kMinExpectedKeys;
+        auto bits = make_shared<Bits>(expected, config.findFilterFalsePositiveRate);
+        for (uint64_t h : hashes) {
+            bits->add(h);
+        }
+        {
+            lock_guard<mutex> lock(pendingMtx);
+            for (uint64_t h : pending) {
+                bits->add(h);
+            }
+            pending.clear();
+            atomic_store(&current, bits);
+        }
+
+        keyCount.store(hashes.size(), memory_order_relaxed);
+        rebuildCount.fetch_add(1, memory_order_relaxed);
+        logInfo("find 布隆过滤器已重建，键 ", hashes.size(), " 个，", bits->bits() / 8 / 1024, " KB，耗时 ",
+            chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count(), " ms");
+        return true;
+    }
+
+    void start(DNSAuthStorage& backend, const ServerConfig& cfg, bool compact) {
+        config = cfg;
+        compactSchema = compact;
+        if (config.findFilterRebuildSec <= 0) config.findFilterRebuildSec = 1;
+
+        storage = &backend;
+        stopping = false;
+        running = true;
+        active.store(true, memory_order_release);
+        worker = thread([this]() { run(); });
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (!running) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        active.store(false, memory_order_release);
+        lock_guard<mutex> lock(mtx);
+        running = false;
+    }
+
+    // 提前重建（如批量导入了太多配置、无法逐个加入）
+    void requestRebuild() {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (!running) return;
+            rebuildRequested = true;
+        }
+        wake.notify_all();
+    }
+
+    // 加入本进程写入的键（参数为 foldedKey）。重建持续失败、待补入的键过多时停用过滤器，等下次重建成功
+    void add(const string& key) {
+        if (!active.load(memory_order_acquire)) return;
+
+        uint64_t h = hashKey(key);
+        shared_ptr<Bits> bits;
+        {
+            lock_guard<mutex> lock(pendingMtx);
+            if (pending.size() >= kMaxPendingKeys) {
+                pending.clear();
+                atomic_store(&current, shared_ptr<Bits>());
+                logWarn("find 布隆过滤器待补入的键过多，暂停使用直到下次重建");
+            }
+            pending.push_back(h);
+            bits = atomic_load(&current);
+        }
+        if (bits) {
+            bits->add(h);
+        }
+    }
+
+    // 参数为 foldedKey；过滤器未建好时总是返回 true
+    bool mayContain(const string& key) {
+        shared_ptr<Bits> bits = atomic_load(&current);
+        if (!bits || bits->mayContain(hashKey(key))) {
+            return true;
+        }
+        rejectCount.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    void appendMetrics(string& out) {
+        shared_ptr<Bits> bits = atomic_load(&current);
+        Metrics::writeValue(out, "dns_auth_find_filter_ready", "gauge", "1 while the find Bloom filter is in use.", bits ? 1 : 0);
+        Metrics::writeValue(out, "dns_auth_find_filter_keys", "gauge", "Keys loaded into the find Bloom filter at the last rebuild.", keyCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_find_filter_rejects_total", "counter", "Find lookups answered 404 by the Bloom filter without a query.", rejectCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_find_filter_rebuilds_total", "counter", "Successful Bloom filter rebuilds.", rebuildCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_find_filter_rebuild_failures_total", "counter", "Bloom filter rebuilds that failed.", failureCount.load(memory_order_relaxed));
+    }
+};
+
+// 准入控制：全局并发上限，加上每个客户端 IP 一个令牌桶。
+// 令牌桶放在分片的开放寻址槽位表中，键为 IP 的 64 位哈希；桶状态打包在一个 64 位字里
+// （高 40 位为上次补充的毫秒时刻，低 24 位为千分之一令牌），取令牌只做 CAS，不加锁。
+// 分片内探测不到空槽时占用空闲超过 kIdleMs 的槽位，仍然没有时放行并计数
+class AdmissionControl {
+private:
+    static const size_t kShardSlots = 1024;     // 每个分片的槽位数（2 的幂）
+    static const size_t kMaxProbe = 16;
+    static const unsigned kTokenBits = 24;
+    static const uint64_t kTokenMask = (static_cast<uint64_t>(1) << kTokenBits) - 1;
+    static const uint64_t kMilli = 1000;
+    static const uint32_t kMaxBurst = static_cast<uint32_t>(kTokenMask / kMilli);
+    static const uint64_t kIdleMs = 60000;
+
+    struct Slot {
+        atomic<uint64_t> key{ 0 };      // 0 表示空槽
+        atomic<uint64_t> state{ 0 };    // 0 表示新桶，令牌是满的
+    };
+
+    unique_ptr<Slot[]> slots;
+    size_t shardCount = 0;
+    RateLimit defaults;
+    int maxInFlight = 0;
+    chrono::steady_clock::time_point epoch;
+
+    atomic<int> inFlight{ 0 };
+    atomic<uint64_t> shedCount{ 0 };
+    atomic<uint64_t> limitedCount{ 0 };
+    atomic<uint64_t> untrackedCount{ 0 };
+
+    // 从 1 开始，保证用过的桶状态不为 0
+    uint64_t nowMs() const {
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - epoch).count()) + 1;
+    }
+
+    Slot* slotFor(const string& ip, uint64_t now) {
+        uint64_t key = hashString(ip) | 1;
+        Slot* shard = &slots[static_cast<size_t>(key >> 32) % shardCount * kShardSlots];
+        size_t start = static_cast<size_t>(key) & (kShardSlots - 1);
+
+        Slot* idle = nullptr;
+        uint64_t idleKey = 0;
+        for (size_t i = 0; i < kMaxProbe; ++i) {
+            Slot& slot = shard[(start + i) & (kShardSlots - 1)];
+            uint64_t current = slot.key.load(memory_order_acquire);
+            // 空槽：占用失败时 current 变为抢先占用者的键
+            if (current == 0 && slot.key.compare_exchange_strong(current, key, memory_order_acq_rel)) {
+                return &slot;
+            }
+            if (current == key) {
+                return &slot;
+            }
+            if (!idle) {
+                uint64_t last = slot.state.load(memory_order_relaxed) >> kTokenBits;
+                if (last != 0 && now > last && now - last > kIdleMs) {
+                    idle = &slot;
+                    idleKey = current;
+                }
+            }
+        }
+
+        // 原主人再来时重新占槽，从满桶开始；它已空闲 kIdleMs 以上，桶本来也接近满
+        if (idle && idle->key.compare_exchange_strong(idleKey, key, memory_order_acq_rel)) {
+            idle->state.store(0, memory_order_relaxed);
+            return idle;
+        }
+        return nullptr;
+    }
+
+public:
+    void init(const ServerConfig& cfg) {
+        defaults.rate = cfg.clientRateLimit;
+        defaults.burst = cfg.clientRateBurst;
+        maxInFlight = cfg.maxConcurrentRequests;
+        epoch = chrono::steady_clock::now();
+        if (cfg.rateLimitSlots == 0) {
+            return;
+        }
+        shardCount = (cfg.rateLimitSlots + kShardSlots - 1) / kShardSlots;
+        slots.reset(new Slot[shardCount * kShardSlots]);
+    }
+
+    // 全局并发名额：构造时占用，析构时归还；超过 maxConcurrentRequests 时 admitted() 为 false
+    class Ticket {
+    private:
+        AdmissionControl& owner;
+        bool held;
+
+    public:
+        explicit Ticket(AdmissionControl& control) : owner(control), held(control.enter()) {}
+        ~Ticket() { if (held) owner.leave(); }
+
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+        bool admitted() const { return held; }
+    };
+
+    bool enter() {
+        int current = inFlight.fetch_add(1, memory_order_acq_rel) + 1;
+        if (maxInFlight > 0 && current > maxInFlight) {
+            inFlight.fetch_sub(1, memory_order_acq_rel);
+            shedCount.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void leave() { inFlight.fetch_sub(1, memory_order_acq_rel); }
+
+    // 从 ip 的令牌桶取 cost 个令牌。limit 为白名单条目的限额，未指定的字段取全局默认值；
+    // 速率为 0 表示不限速，容量为 0 时取一秒的令牌数。cost 超过容量时按容量计
+    bool admit(const string& ip, const RateLimit& limit, uint32_t cost = 1) {
+        uint32_t rate = limit.rate != 0 ? limit.rate : defaults.rate;
+        if (rate == 0 || !slots) {
+            return true;
+        }
+        uint32_t burst = limit.burst != 0 ? limit.burst : (limit.rate == 0 ? defaults.burst : 0);
+        if (burst == 0) burst = rate;
+        if (burst > kMaxBurst) burst = kMaxBurst;
+        if (cost == 0) cost = 1;
+        if (cost > burst) cost = burst;
+
+        uint64_t now = nowMs();
+        Slot* slot = slotFor(ip, now);
+        if (!slot) {
+            untrackedCount.fetch_add(1, memory_order_relaxed);
+            return true;
+        }
+
+        uint64_t capacity = burst * kMilli;
+        uint64_t need = cost * kMilli;
+        uint64_t old = slot->state.load(memory_order_relaxed);
+        while (true) {
+            uint64_t tokens = capacity;
+            uint64_t stamp = now;
+            if (old != 0) {
+                uint64_t last = old >> kTokenBits;
+                tokens = old & kTokenMask;
+                if (now > last) {
+                    // 每毫秒补充 rate 个千分之一令牌
+                    uint64_t elapsed = now - last;
+                    tokens = elapsed >= capacity ? capacity : tokens + elapsed * rate;
+                }
+                else {
+                    stamp = last;
+                }
+                if (tokens > capacity) tokens = capacity;
+            }
+            if (tokens < need) {
+                limitedCount.fetch_add(1, memory_order_relaxed);
+                return false;
+            }
+            if (slot->state.compare_exchange_weak(old, (stamp << kTokenBits) | (tokens - need),
+                memory_order_acq_rel, memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    void appendMetrics(string& out) const {
+        int current = inFlight.load(memory_order_relaxed);
+        Metrics::writeValue(out, "dns_auth_requests_in_flight", "gauge", "Verify, find and batch requests being handled.", current > 0 ? current : 0);
+        Metrics::writeValue(out, "dns_auth_requests_shed_total", "counter", "Requests answered 503 because maxConcurrentRequests was reached.", shedCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_rate_limited_total", "counter", "Requests answered 429 by a per-client token bucket.", limitedCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_rate_limit_untracked_total", "counter", "Requests admitted without a token bucket because the slot table was full.", untrackedCount.load(memory_order_relaxed));
+    }
+};
+
+// 入队结果
+enum WriteSubmitResult {
+    WRITE_ACCEPTED = 0,   // 已入队（ACK_ON_ENQUEUE）或已提交（ACK_ON_COMMIT）
+    WRITE_QUEUE_FULL,     // 队列持续满，触发背压
+    WRITE_FAILED          // 所在批次写入失败
+};
+
+// 多行 INSERT 按 2 的幂分块，每个连接最多缓存 kMaxInsertChunkShift+1 条预编译语句
+static const int kMaxInsertChunkShift = 10;
+
+// 单条批量 IN 查询最多携带的参数组数，与多行 INSERT 的分块上限一致
+static const size_t kBatchQueryMax = static_cast<size_t>(1) << kMaxInsertChunkShift;
+
+// 按 2 的幂行数生成多行语句：head + row × 2^shift + tail，shift 取 0 ~ kMaxInsertChunkShift
+inline vector<string> makeMultiRowSQLs(const char* head, const char* row, const char* tail) {
+    vector<string> list;
+    for (int i = 0; i <= kMaxInsertChunkShift; ++i) {
+        string sql = head;
+        for (size_t k = 0; k < (static_cast<size_t>(1) << i); ++k) {
+            if (k > 0) sql += ", ";
+            sql += row;
+        }
+        sql += tail;
+        list.push_back(sql);
+    }
+    return list;
+}
+
+// replace 为 true 时用于分区表，与 STMT_REPLACE_VERIFICATION 相同
+inline const string& verificationInsertSQL(SchemaLayout schema, bool replace, int shift) {
+    static const vector<string> sqls[SCHEMA_COUNT][2] = {
+        {
+            makeMultiRowSQLs("INSERT INTO dns_verifications (client_ip, domain, expire_time, mode) VALUES ",
+                "(?, ?, ?, 'verify')", " ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time)"),
+            makeMultiRowSQLs("REPLACE INTO dns_verifications (client_ip, domain, expire_time, mode) VALUES ",
+                "(?, ?, ?, 'verify')", ""),
+        },
+        {
+            makeMultiRowSQLs("INSERT INTO dns_verifications (client_ip, domain_id, expire_time, mode) VALUES ",
+                "(INET6_ATON(?), (SELECT id FROM domains WHERE name = ?), ?, 'verify')",
+                " ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time)"),
+            makeMultiRowSQLs("REPLACE INTO dns_verifications (client_ip, domain_id, expire_time, mode) VALUES ",
+                "(INET6_ATON(?), (SELECT id FROM domains WHERE name = ?), ?, 'verify')", ""),
+        },
+    };
+    return sqls[schema][replace ? 1 : 0][shift];
+}
+
+// 在一个事务中写入 count 行验证记录，getRow(i) 返回第 i 行（精简结构下域名已规范化）；
+// 返回是否提交成功，失败时 err 为错误码
+template <typename GetRow>
+bool insertVerificationRows(PooledConnection& conn, bool replace, size_t count, GetRow getRow, unsigned int& err) {
+    err = 0;
+    if (count == 0) {
+        return true;
+    }
+
+    bool multiChunk = (count & (count - 1)) != 0 || count > (static_cast<size_t>(1) << kMaxInsertChunkShift);
+    if (multiChunk && mysql_query(conn.get(), "START TRANSACTION") != 0) {
+        err = mysql_errno(conn.get());
+        return false;
+    }
+
+    size_t offset = 0;
+    for (int shift = kMaxInsertChunkShift; shift >= 0 && offset < count; --shift) {
+        size_t chunk = static_cast<size_t>(1) << shift;
+        while (count - offset >= chunk) {
+            PreparedStatement* stmt = conn.statement(verificationInsertSQL(conn.schema(), replace, shift), 0);
+            if (!stmt) {
+                err = mysql_errno(conn.get());
+                break;
+            }
+            for (size_t i = 0; i < chunk; ++i) {
+                const VerificationRow& row = getRow(offset + i);
+                stmt->bind(i * 3, row.clientIP);
+                stmt->bind(i * 3 + 1, row.domain);
+                stmt->bind(i * 3 + 2, row.expireTime);
+            }
+            if (!stmt->execute()) {
+                err = stmt->errorCode();
+                logError("批量写入验证记录失败: ", stmt->errorMessage());
+                break;
+            }
+            offset += chunk;
+        }
+        if (err != 0) break;
+    }
+
+    bool ok = offset == count && err == 0;
+    if (multiChunk) {
+        if (ok && mysql_query(conn.get(), "COMMIT") != 0) {
+            err = mysql_errno(conn.get());
+            ok = false;
+        }
+        if (!ok && !isConnectionLostError(err)) {
+            mysql_query(conn.get(), "ROLLBACK");
+        }
+    }
+    return ok;
+}
+
+inline const string& configUpsertSQL(SchemaLayout schema, int shift) {
+    static const vector<string> sqls[SCHEMA_COUNT] = {
+        makeMultiRowSQLs("INSERT INTO domain_configs (client_ip, domain, expire_time, status) VALUES ", "(?, ?, ?, ?)",
+            " ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time), status = VALUES(status)"),
+        makeMultiRowSQLs("INSERT INTO domain_configs (client_ip, domain_id, expire_time, status) VALUES ",
+            "(INET6_ATON(?), (SELECT id FROM domains WHERE name = ?), ?, ?)",
+            " ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time), status = VALUES(status)"),
+    };
+    return sqls[schema][shift];
+}
+
+inline const string& mappingUpsertSQL(SchemaLayout schema, int shift) {
+    static const vector<string> sqls[SCHEMA_COUNT] = {
+        makeMultiRowSQLs("INSERT INTO domain_mappings (domain, target_ip) VALUES ", "(?, ?)",
+            " ON DUPLICATE KEY UPDATE target_ip = VALUES(target_ip)"),
+        makeMultiRowSQLs("INSERT INTO domain_mappings (domain_id, target_ip) VALUES ",
+            "((SELECT id FROM domains WHERE name = ?), INET6_ATON(?))",
+            " ON DUPLICATE KEY UPDATE target_ip = VALUES(target_ip)"),
+    };
+    return sqls[schema][shift];
+}
+
+// 精简结构写入配置与映射前先登记域名；已存在的域名被忽略
+inline const string& domainInternSQL(int shift) {
+    static const vector<string> sqls = makeMultiRowSQLs("INSERT IGNORE INTO domains (name) VALUES ", "(?)", "");
+    return sqls[shift];
+}
+
+// 在一个事务中以多行 upsert 写入 count 行：getSQL(shift) 返回 2^shift 行的语句，
+// bindRow(stmt, slot, i) 把第 i 行绑定到语句中的第 slot 行。返回是否提交成功，失败时 err 为错误码
+template <typename GetSQL, typename BindRow>
+bool upsertRowsInTransaction(PooledConnection& conn, size_t count, GetSQL getSQL, BindRow bindRow, unsigned int& err) {
+    err = 0;
+    if (count == 0) {
+        return true;
+    }
+    if (mysql_query(conn.get(), "START TRANSACTION") != 0) {
+        err = mysql_errno(conn.get());
+        return false;
+    }
+
+    size_t offset = 0;
+    for (int shift = kMaxInsertChunkShift; shift >= 0 && err == 0; --shift) {
+        size_t chunk = static_cast<size_t>(1) << shift;
+        while (count - offset >= chunk) {
+            PreparedStatement* stmt = conn.statement(getSQL(shift), 0);
+            if (!stmt) {
+                err = mysql_errno(conn.get());
+                break;
+            }
+            for (size_t i = 0; i < chunk; ++i) {
+                bindRow(*stmt, i, offset + i);
+            }
+            if (!stmt->execute()) {
+                err = stmt->errorCode();
+                logError("批量导入写入失败: ", stmt->errorMessage());
+                break;
+            }
+            offset += chunk;
+        }
+    }
+
+    bool ok = offset == count && err == 0;
+    if (ok && mysql_query(conn.get(), "COMMIT") != 0) {
+        err = mysql_errno(conn.get());
+        ok = false;
+    }
+    if (!ok && !isConnectionLostError(err)) {
+        mysql_query(conn.get(), "ROLLBACK");
+    }
+    return ok;
+}
+
+// 按客户端 IP 记录本进程最近一次写入验证记录的时刻（毫秒），读写分离时用于读己之写。
+// 只覆盖本进程的写入：多进程模式或多实例下，其他进程刚写入的记录仍可能从落后的副本读不到。
+// 固定数量的槽位按 IP 哈希寻址，不加锁；哈希冲突只会让更多读查询走主库
+class RecentWrites {
+private:
+    static const size_t kSlots = 65536;     // 2 的幂
+    unique_ptr<atomic<int64_t>[]> stamps;
+
+    // 与缓存键相同的规范化，等价的 IP 写法落在同一槽位
+    static size_t slotFor(const string& clientIP) {
+        string key;
+        appendIPKey(key, clientIP);
+        return static_cast<size_t>(hashString(key)) & (kSlots - 1);
+    }
+
+public:
+    RecentWrites() : stamps(new atomic<int64_t>[kSlots]) {
+        for (size_t i = 0; i < kSlots; ++i) stamps[i].store(0, memory_order_relaxed);
+    }
+
+    static int64_t nowMs() {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void mark(const string& clientIP) { stamps[slotFor(clientIP)].store(nowMs(), memory_order_relaxed); }
+
+    // 从未写入时返回 0
+    int64_t last(const string& clientIP) const { return stamps[slotFor(clientIP)].load(memory_order_relaxed); }
+};
+
+// MySQL 存储实现：连接池 + 每连接缓存的预编译语句，连接断开时重连并重试一次
+class MySQLStorage : public DNSAuthStorage {
+private:
+    // 只读副本：各自一个连接池，健康状态与复制延迟由后台线程定期更新
+    struct Replica {
+        DBConfig config;                // 主库配置换上副本地址
+        string name;                    // host:port，用于日志与指标
+        MySQLConnectionPool pool;
+        atomic<bool> healthy{ false };
+        atomic<int64_t> lagMs{ -1 };
+        atomic<uint64_t> reads{ 0 };
+        bool legacyStatus = false;      // 8.0.22 之前的版本不支持 SHOW REPLICA STATUS，改用 SHOW SLAVE STATUS
+    };
+
+    DBConfig config;
+    MySQLConnectionPool pool;
+    bool whitelistHasLimits = true;     // 旧表补列失败时按全局默认限额加载白名单
+    atomic<bool> verifyKeyUnique{ false };  // dns_verifications 已有三列唯一键 unique_verify，每个键只有一行
+
+    vector<unique_ptr<Replica>> replicas;
+    atomic<size_t> nextReplica{ 0 };    // 负载相同时轮流选择
+    atomic<uint64_t> primaryReads{ 0 }; // 配置了副本但仍发往主库的读查询
+    RecentWrites recentWrites;
+
+    mutex monitorMtx;
+    condition_variable monitorCv;
+    thread monitor;
+    bool monitorStopping = false;
+
+    PooledConnection acquire() {
+        StageTimer timer(STAGE_POOL_ACQUIRE);
+        return pool.acquire();
+    }
+
+    // 读查询借连接：选借出连接数最少的健康副本；没有副本可用或借不到副本连接时走主库。
+    // lastWrite 为相关客户端最近一次写入的时刻，距今不超过副本延迟（按秒计，另加 1 秒余量）时
+    // 该副本可能还没有这次写入，跳过它
+    PooledConnection acquireRead(int64_t lastWrite = 0) {
+        if (replicas.empty()) {
+            return acquire();
+        }
+
+        int64_t now = lastWrite > 0 ? RecentWrites::nowMs() : 0;
+        size_t start = nextReplica.fetch_add(1, memory_order_relaxed);
+        Replica* best = nullptr;
+        size_t bestLoad = 0;
+        for (size_t i = 0; i < replicas.size(); ++i) {
+            Replica& replica = *replicas[(start + i) % replicas.size()];
+            if (!replica.healthy.load(memory_order_acquire)) {
+                continue;
+            }
+            if (lastWrite > 0 && now - lastWrite <= replica.lagMs.load(memory_order_relaxed) + 1000) {
+                continue;
+            }
+            size_t load = replica.pool.borrowed();
+            if (!best || load < bestLoad) {
+                best = &replica;
+                bestLoad = load;
+            }
+        }
+
+        if (best) {
+            StageTimer timer(STAGE_POOL_ACQUIRE);
+            PooledConnection conn = best->pool.acquire();
+            if (conn) {
+                best->reads.fetch_add(1, memory_order_relaxed);
+                return conn;
+            }
+        }
+        primaryReads.fetch_add(1, memory_order_relaxed);
+        return acquire();
+    }
+
+    // 读取副本的复制延迟（秒，多个复制通道取最大值）；返回 false 表示无法查询，
+    // lagSec < 0 表示复制线程未运行或该实例不是副本
+    bool queryReplicaLag(Replica& replica, int64_t& lagSec) {
+        lagSec = -1;
+        PooledConnection conn = replica.pool.acquire();
+        if (!conn) {
+            return false;
+        }
+        while (mysql_query(conn.get(), replica.legacyStatus ? "SHOW SLAVE STATUS" : "SHOW REPLICA STATUS") != 0) {
+            if (MySQLConnectionPool::isConnectionLost(conn.get())) {
+                conn.markBroken();
+                return false;
+            }
+            if (replica.legacyStatus) {
+                logError("查询副本状态失败: ", replica.name, " ", mysql_error(conn.get()));
+                return false;
+            }
+            replica.legacyStatus = true;
+        }
+
+        MYSQL_RES* result = mysql_store_result(conn.get());
+        if (!result) {
+            return false;
+        }
+        unsigned int fieldCount = mysql_num_fields(result);
+        MYSQL_FIELD* fields = mysql_fetch_fields(result);
+        int lagColumn = -1;
+        for (unsigned int i = 0; i < fieldCount; ++i) {
+            if (strcmp(fields[i].name, "Seconds_Behind_Source") == 0 ||
+                strcmp(fields[i].name, "Seconds_Behind_Master") == 0) {
+                lagColumn = static_cast<int>(i);
+                break;
+            }
+        }
+        bool stopped = false;
+        MYSQL_ROW row;
+        while (lagColumn >= 0 && (row = mysql_fetch_row(result)) != nullptr) {
+            if (!row[lagColumn]) {
+                stopped = true;
+                continue;
+            }
+            int64_t lag = atoll(row[lagColumn]);
+            if (lag > lagSec) lagSec = lag;
+        }
+        mysql_free_result(result);
+        if (stopped) {
+            lagSec = -1;
+        }
+        return true;
+    }
+
+    void checkReplicas() {
+        for (auto& replicaPtr : replicas) {
+            Replica& replica = *replicaPtr;
+            int64_t lagSec = -1;
+            bool ok = queryReplicaLag(replica, lagSec);
+            bool healthy = ok && lagSec >= 0 && lagSec <= config.replicaMaxLagSec;
+            replica.lagMs.store(lagSec >= 0 ? lagSec * 1000 : -1, memory_order_relaxed);
+            if (replica.healthy.exchange(healthy, memory_order_acq_rel) == healthy) {
+                continue;
+            }
+            if (healthy) {
+                logInfo("只读副本开始接收读请求: ", replica.name, "，延迟 ", lagSec, " 秒");
+            }
+            else if (!ok) {
+                logWarn("只读副本无法访问，读请求改发其他副本或主库: ", replica.name);
+            }
+            else if (lagSec < 0) {
+                logWarn("只读副本复制未运行，读请求改发其他副本或主库: ", replica.name);
+            }
+            else {
+                logWarn("只读副本延迟 ", lagSec, " 秒超过上限，读请求改发其他副本或主库: ", replica.name);
+            }
+        }
+    }
+
+    void runReplicaMonitor() {
+        unique_lock<mutex> lock(monitorMtx);
+        while (!monitorCv.wait_for(lock, chrono::milliseconds(config.replicaCheckIntervalMs),
+            [this]() { return monitorStopping; })) {
+            lock.unlock();
+            checkReplicas();
+            lock.lock();
+        }
+    }
+
+    void openReplicas() {
+        for (const ReplicaConfig& address : config.replicas) {
+            unique_ptr<Replica> replica(new Replica());
+            replica->config = config;
+            replica->config.host = address.host;
+            replica->config.port = address.port;
+            replica->config.replicas.clear();
+            replica->name = address.host + ":" + to_string(address.port);
+            if (!replica->pool.init(replica->config)) {
+                logWarn("只读副本连接失败，恢复前不接收读请求: ", replica->name);
+            }
+            replicas.push_back(move(replica));
+        }
+        if (replicas.empty()) {
+            return;
+        }
+
+        checkReplicas();
+        {
+            lock_guard<mutex> lock(monitorMtx);
+            monitorStopping = false;
+        }
+        monitor = thread([this]() { runReplicaMonitor(); });
+    }
+
+    void closeReplicas() {
+        {
+            lock_guard<mutex> lock(monitorMtx);
+            monitorStopping = true;
+        }
+        monitorCv.notify_all();
+        if (monitor.joinable()) {
+            monitor.join();
+        }
+        for (auto& replica : replicas) {
+            replica->pool.shutdown();
+        }
+    }
+
+    void markWrites(const VerificationRow* rows, size_t count) {
+        if (replicas.empty()) {
+            return;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            recentWrites.mark(rows[i].clientIP);
+        }
+    }
+
+    // 创建数据库表。已有表的结构与 compactSchema 不符时返回 false
+    bool createTables(MYSQL* conn) {
+        bool compactTables = columnExists(conn, "domain_configs", "domain_id");
+        if (config.compactSchema && !compactTables && tableExists(conn, "domain_configs")) {
+            logError("数据库中是文本结构的表，请先停止服务并运行 migrate-schema 转换后再启用 compactSchema");
+            return false;
+        }
+        if (!config.compactSchema && compactTables) {
+            logError("数据库中是精简结构的表，请设置 compactSchema = true");
+            return false;
+        }
+
+        // 表结构由其他进程维护（多进程模式下的 0 号工作进程），这里只读取现状
+        if (!config.manageSchema) {
+            whitelistHasLimits = columnExists(conn, "ip_whitelist", "rate_limit");
+            verifyKeyUnique.store(detectVerifyUniqueKey(conn));
+            return true;
+        }
+
+        const char* createTablesSQL[] = {
+            // 白名单表
+            "CREATE TABLE IF NOT EXISTS ip_whitelist ("
+            "id INT AUTO_INCREMENT PRIMARY KEY,"
+            "ip VARCHAR(45) NOT NULL UNIQUE,"
+            "description VARCHAR(255),"
+            "rate_limit INT UNSIGNED NOT NULL DEFAULT 0,"
+            "rate_burst INT UNSIGNED NOT NULL DEFAULT 0,"
+            "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
+            ")",
+
+            // A表：验证记录表，结构与分区设置有关，由 verificationsTableSQL 生成
+            nullptr,
+
+            // B表：域名-IP映射表
+            "CREATE TABLE IF NOT EXISTS domain_mappings ("
+            "id INT AUTO_INCREMENT PRIMARY KEY,"
+            "domain VARCHAR(255) NOT NULL UNIQUE,"
+            "target_ip VARCHAR(45) NOT NULL,"
+            "updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP"
+            ")",
+
+            // C表：域名配置表
+            "CREATE TABLE IF NOT EXISTS domain_configs ("
+            "id INT AUTO_INCREMENT PRIMARY KEY,"
+            "client_ip VARCHAR(45) NOT NULL,"
+            "domain VARCHAR(255) NOT NULL,"
+            "expire_time DATETIME NOT NULL,"
+            "status INT DEFAULT 1,"
+            "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
+            "UNIQUE KEY unique_ip_domain (client_ip, domain)"
+            ")"
+        };
+
+        if (config.compactSchema) {
+            // 白名单可以是网段，仍按文本保存
+            if (mysql_query(conn, createTablesSQL[0]) != 0) {
+                logError("创建表失败: ", mysql_error(conn));
+            }
+            for (const string& sql : compactTablesSQL("")) {
+                if (mysql_query(conn, sql.c_str()) != 0) {
+                    logError("创建表失败: ", mysql_error(conn));
+                }
+            }
+            verifyKeyUnique.store(detectVerifyUniqueKey(conn));
+            checkWhitelistLimits(conn);
+            return true;
+        }
+
+        // 分区表的主键需包含分区列，只能在建表时决定；已存在的表不做转换
+        string verificationsSQL = verificationsTableSQL(SCHEMA_TEXT, "dns_verifications");
+        createTablesSQL[1] = verificationsSQL.c_str();
+
+        for (const char* sql : createTablesSQL) {
+            if (mysql_query(conn, sql) != 0) {
+                logError("创建表失败: ", mysql_error(conn));
+            }
+        }
+
+        // 旧版本建的表只有 idx_ip_domain (client_ip, domain)，补上覆盖索引后旧索引成为冗余前缀。
+        // 非唯一索引总能建成，只在缺少时建一次；唯一键只检查，见 detectVerifyUniqueKey
+        if (!config.partitionVerifications && !indexExists(conn, "dns_verifications", "idx_verify_lookup") &&
+            mysql_query(conn, "ALTER TABLE dns_verifications ADD INDEX idx_verify_lookup (client_ip, domain, mode, expire_time)") != 0) {
+            logError("创建索引失败: ", mysql_error(conn));
+        }
+        verifyKeyUnique.store(detectVerifyUniqueKey(conn));
+        if (indexExists(conn, "dns_verifications", "idx_ip_domain") &&
+            mysql_query(conn, "ALTER TABLE dns_verifications DROP INDEX idx_ip_domain") != 0) {
+            logError("删除冗余索引失败: ", mysql_error(conn));
+        }
+        checkWhitelistLimits(conn);
+        return true;
+    }
+
+    // 精简结构：IP 存为 INET6_ATON 的定长二进制，域名规范化后登记在 domains 表里、其余表只存整数 id。
+    // suffix 非空时 A/B/C 表建在临时表名上（迁移时先建新表再整体改名），domains 表不带后缀
+    vector<string> compactTablesSQL(const string& suffix) const {
+        vector<string> sqls;
+        sqls.push_back("CREATE TABLE IF NOT EXISTS domains ("
+            "id INT UNSIGNED AUTO_INCREMENT PRIMARY KEY,"
+            "name VARBINARY(255) NOT NULL,"
+            "UNIQUE KEY unique_name (name)"
+            ")");
+
+        sqls.push_back(verificationsTableSQL(SCHEMA_COMPACT, "dns_verifications" + suffix));
+
+        sqls.push_back("CREATE TABLE IF NOT EXISTS domain_mappings" + suffix + " ("
+            "id INT AUTO_INCREMENT PRIMARY KEY,"
+            "domain_id INT UNSIGNED NOT NULL UNIQUE,"
+            "target_ip VARBINARY(16) NOT NULL,"
+            "updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP"
+            ")");
+
+        sqls.push_back("CREATE TABLE IF NOT EXISTS domain_configs" + suffix + " ("
+            "id INT AUTO_INCREMENT PRIMARY KEY,"
+            "client_ip VARBINARY(16) NOT NULL,"
+            "domain_id INT UNSIGNED NOT NULL,"
+            "expire_time DATETIME NOT NULL,"
+            "status INT DEFAULT 1,"
+            "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
+            "UNIQUE KEY unique_ip_domain (client_ip, domain_id)"
+            ")");
+        return sqls;
+    }
+
+    // dns_verifications 的建表语句：非分区表带唯一键 unique_verify (client_ip, domain, mode) 与覆盖索引
+    // idx_verify_lookup；分区表见 partitionedVerificationsSQL
+    string verificationsTableSQL(SchemaLayout layout, const string& table) const {
+        if (config.partitionVerifications) {
+            return partitionedVerificationsSQL(layout, table);
+        }
+        if (layout == SCHEMA_COMPACT) {
+            return "CREATE TABLE IF NOT EXISTS " + table + " ("
+                "id INT AUTO_INCREMENT PRIMARY KEY,"
+                "client_ip VARBINARY(16) NOT NULL,"
+                "domain_id INT UNSIGNED NOT NULL,"
+                "expire_time DATETIME NOT NULL,"
+                "mode VARCHAR(20) NOT NULL,"
+                "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
+                "UNIQUE KEY unique_verify (client_ip, domain_id, mode),"
+                "INDEX idx_verify_lookup (client_ip, domain_id, mode, expire_time)"
+                ")";
+        }
+        return "CREATE TABLE IF NOT EXISTS " + table + " ("
+            "id INT AUTO_INCREMENT PRIMARY KEY,"
+            "client_ip VARCHAR(45) NOT NULL,"
+            "domain VARCHAR(255) NOT NULL,"
+            "expire_time DATETIME NOT NULL,"
+            "mode VARCHAR(20) NOT NULL,"
+            "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
+            "UNIQUE KEY unique_verify (client_ip, domain, mode),"
+            "INDEX idx_verify_lookup (client_ip, domain, mode, expire_time)"
+            ")";
+    }
+
+    // 唯一键 unique_verify (client_ip, domain, mode)：每个键只保存一行，写入遇到重复时覆盖到期时间，
+    // find 按唯一键单点读取。返回 true 表示唯一键已就绪。
+    // 只检查现状，不在服务进程中改表：旧版本的表可能有重复行，加键前必须去重，由 migrate-verify-key
+    // 命令在停止服务时一次完成；在此之前写入照常追加、find 取最新一条。
+    // 分区表的唯一键必须包含分区列，只能是 (client_ip, domain, mode, expire_time)，每个键仍可能有多行，返回 false
+    bool detectVerifyUniqueKey(MYSQL* conn) {
+        if (config.partitionVerifications) {
+            return false;
+        }
+        if (indexExists(conn, "dns_verifications", "unique_verify") &&
+            !indexHasColumn(conn, "dns_verifications", "unique_verify", "expire_time")) {
+            return true;
+        }
+        if (config.manageSchema) {
+            logWarn("dns_verifications 没有三列唯一键 unique_verify，写入追加、find 取每个键最新的一条；"
+                "请停止服务后运行 migrate-verify-key 去重并建键");
+        }
+        return false;
+    }
+
+    void checkWhitelistLimits(MYSQL* conn) {
+        // 旧版本建的白名单表没有限额列
+        whitelistHasLimits = columnExists(conn, "ip_whitelist", "rate_limit");
+        if (!whitelistHasLimits) {
+            const char* sql = "ALTER TABLE ip_whitelist "
+                "ADD COLUMN rate_limit INT UNSIGNED NOT NULL DEFAULT 0, "
+                "ADD COLUMN rate_burst INT UNSIGNED NOT NULL DEFAULT 0";
+            whitelistHasLimits = mysql_query(conn, sql) == 0;
+            if (!whitelistHasLimits) {
+                logError("添加白名单限额列失败，所有客户端使用默认限额: ", mysql_error(conn));
+            }
+        }
+    }
+
+    static bool tableExists(MYSQL* conn, const string& table) {
+        return countPositive(conn, "SELECT COUNT(*) FROM information_schema.tables "
+            "WHERE table_schema = DATABASE() AND table_name = '" + table + "'");
+    }
+
+    // 检查当前库中某张表是否已有指定列
+    static bool columnExists(MYSQL* conn, const string& table, const string& column) {
+        return countPositive(conn, "SELECT COUNT(*) FROM information_schema.columns "
+            "WHERE table_schema = DATABASE() AND table_name = '" + table +
+            "' AND column_name = '" + column + "'");
+    }
+
+    // 检查当前库中某张表是否已有指定索引
+    static bool indexExists(MYSQL* conn, const string& table, const string& index) {
+        return countPositive(conn, "SELECT COUNT(*) FROM information_schema.statistics "
+            "WHERE table_schema = DATABASE() AND table_name = '" + table +
+            "' AND index_name = '" + index + "'");
+    }
+
+    // 检查索引是否包含指定列
+    static bool indexHasColumn(MYSQL* conn, const string& table, const string& index, const string& column) {
+        return countPositive(conn, "SELECT COUNT(*) FROM information_schema.statistics "
+            "WHERE table_schema = DATABASE() AND table_name = '" + table +
+            "' AND index_name = '" + index + "' AND column_name = '" + column + "'");
+    }
+
+    // 执行 SELECT COUNT(*)，结果大于 0 时返回 true
+    static bool countPositive(MYSQL* conn, const string& sql) {
+        if (mysql_query(conn, sql.c_str()) != 0) {
+            return false;
+        }
+
+        MYSQL_RES* result = mysql_store_result(conn);
+        if (!result) {
+            return false;
+        }
+
+        MYSQL_ROW row = mysql_fetch_row(result);
+        bool exists = row && row[0] && atoi(row[0]) > 0;
+        mysql_free_result(result);
+        return exists;
+    }
+
+    // 执行预编译语句；连接已断开时重连、重新预编译并重试一次。成功时返回语句，结果集已缓存在客户端
+    PreparedStatement* executeStatement(PooledConnection& conn, StatementId id,
+        initializer_list<reference_wrapper<const string>> params) {
+        return executeWithRetry(conn, [&conn, id]() { return conn.statement(id); }, params);
+    }
+
+    // 执行运行时生成的语句（如批量 IN 查询），语句同样按连接缓存
+    PreparedStatement* executeStatement(PooledConnection& conn, const string& sql, unsigned int resultColumns,
+        const vector<reference_wrapper<const string>>& params) {
+        return executeWithRetry(conn, [&conn, &sql, resultColumns]() {
+            return conn.statement(sql, resultColumns);
+            }, params);
+    }
+
+    template <typename GetStatement, typename Params>
+    PreparedStatement* executeWithRetry(PooledConnection& conn, GetStatement getStatement, const Params& params) {
+        for (int attempt = 0; attempt < 2 && conn; ++attempt) {
+            PreparedStatement* stmt = getStatement();
+            if (!stmt) {
+                if (attempt == 0 && conn.reconnectIfLost()) {
+                    continue;
+                }
+                return nullptr;
+            }
+
+            size_t index = 0;
+            for (const string& param : params) {
+                stmt->bind(index++, param);
+            }
+
+            if (stmt->execute()) {
+                return stmt;
+            }
+            if (attempt == 0 && conn.reconnectIfLost(stmt->errorCode())) {
+                continue;
+            }
+            logError("SQL执行失败: ", stmt->errorMessage());
+            return nullptr;
+        }
+        return nullptr;
+    }
+
+    // 执行返回固定列数的文本查询（白名单加载、导出等），连接已断开时标记为失效；
+    // fromReplica 为 true 时可由只读副本应答
+    bool queryRows(const string& sql, vector<vector<string>>& rows, size_t columns = 2, bool fromReplica = false) {
+        PooledConnection conn = fromReplica ? acquireRead() : acquire();
+        if (!conn) {
+            return false;
+        }
+        if (mysql_query(conn.get(), sql.c_str()) != 0) {
+            logError("查询失败: ", mysql_error(conn.get()));
+            if (MySQLConnectionPool::isConnectionLost(conn.get())) {
+                conn.markBroken();
+            }
+            return false;
+        }
+
+        MYSQL_RES* result = mysql_store_result(conn.get());
+        if (!result) {
+            return false;
+        }
+
+        MYSQL_ROW row;
+        while ((row = mysql_fetch_row(result)) != nullptr) {
+            vector<string> values(columns);
+            for (size_t i = 0; i < columns; ++i) {
+                if (row[i]) values[i] = row[i];
+            }
+            rows.push_back(move(values));
+        }
+        mysql_free_result(result);
+        return true;
+    }
+
+    // 逐行读取 (client_ip, domain) 两列的结果集，不在客户端缓存整个结果集
+    bool streamKeys(const char* sql, const function<void(const string& key)>& visit) {
+        PooledConnection conn = acquireRead();
+        if (!conn) {
+            return false;
+        }
+        if (mysql_query(conn.get(), sql) != 0) {
+            logError("查询失败: ", mysql_error(conn.get()));
+            if (MySQLConnectionPool::isConnectionLost(conn.get())) {
+                conn.markBroken();
+            }
+            return false;
+        }
+
+        MYSQL_RES* result = mysql_use_result(conn.get());
+        if (!result) {
+            return false;
+        }
+        MYSQL_ROW row;
+        while ((row = mysql_fetch_row(result)) != nullptr) {
+            if (row[0] && row[1]) {
+                visit(foldedKey(row[0], row[1]));
+            }
+        }
+        bool ok = mysql_errno(conn.get()) == 0;
+        if (!ok) {
+            logError("读取结果集失败: ", mysql_error(conn.get()));
+            if (MySQLConnectionPool::isConnectionLost(conn.get())) {
+                conn.markBroken();
+            }
+        }
+        mysql_free_result(result);
+        return ok;
+    }
+
+    // 执行管理类写语句，参数按顺序绑定，整数参数单独给出位置
+    bool executeWrite(const char* sql, initializer_list<reference_wrapper<const string>> params,
+        int intIndex = -1, long long intValue = 0) {
+        PooledConnection conn = acquire();
+        if (!conn) {
+            return false;
+        }
+        PreparedStatement* stmt = conn.statement(sql, 0);
+        if (!stmt) {
+            return false;
+        }
+
+        size_t index = 0;
+        for (const string& param : params) {
+            stmt->bind(index++, param);
+        }
+        if (intIndex >= 0) {
+            stmt->bind(static_cast<size_t>(intIndex), intValue);
+        }
+        if (!stmt->execute()) {
+            logError("SQL执行失败: ", stmt->errorMessage());
+            return false;
+        }
+        return true;
+    }
+
+    // 精简结构下查询参数使用规范化的域名，结果保存在 storage 中
+    const string& domainParam(const string& domain, string& storage) const {
+        if (!config.compactSchema) {
+            return domain;
+        }
+        storage = normalizeDomain(domain);
+        return storage;
+    }
+
+    // 精简结构写入配置或映射前把（已规范化的）域名登记到 domains 表
+    bool internDomains(vector<string> names) {
+        sort(names.begin(), names.end());
+        names.erase(unique(names.begin(), names.end()), names.end());
+        return upsertRows(names.size(), domainInternSQL, [&names](PreparedStatement& stmt, size_t slot, size_t i) {
+            stmt.bind(slot, names[i]);
+            });
+    }
+
+    template <typename GetSQL, typename BindRow>
+    bool upsertRows(size_t count, GetSQL getSQL, BindRow bindRow) {
+        PooledConnection conn = acquire();
+        if (!conn) {
+            return false;
+        }
+        unsigned int err = 0;
+        bool ok = upsertRowsInTransaction(conn, count, getSQL, bindRow, err);
+        if (!ok && conn.reconnectIfLost(err)) {
+            ok = upsertRowsInTransaction(conn, count, getSQL, bindRow, err);
+        }
+        return ok;
+    }
+
+    // 执行带两个主键边界（及可选的到期时间戳）的清理语句，返回删除行数
+    bool executeRangeDelete(PooledConnection& conn, const char* sql, int64_t from, int64_t to,
+        const int64_t* expiredBefore, uint64_t& deleted) {
+        PreparedStatement* stmt = conn.statement(sql, 0);
+        if (!stmt) {
+            return false;
+        }
+        stmt->bind(0, static_cast<long long>(from));
+        stmt->bind(1, static_cast<long long>(to));
+        if (expiredBefore) {
+            stmt->bind(2, static_cast<long long>(*expiredBefore));
+        }
+        if (!stmt->execute()) {
+            logError("清理验证记录失败: ", stmt->errorMessage());
+            conn.reconnectIfLost(stmt->errorCode());
+            return false;
+        }
+        deleted = stmt->affectedRows();
+        return true;
+    }
+
+    // 执行不返回结果的文本语句（分区维护）
+    bool executeDDL(const string& sql) {
+        PooledConnection conn = acquire();
+        if (!conn) {
+            return false;
+        }
+        if (mysql_query(conn.get(), sql.c_str()) != 0) {
+            logError("SQL执行失败: ", mysql_error(conn.get()));
+            if (MySQLConnectionPool::isConnectionLost(conn.get())) {
+                conn.markBroken();
+            }
+            return false;
+        }
+        return true;
+    }
+
+    // 月份序号（year * 12 + month - 1）对应的分区：名称取该月，上界为下个月 1 日
+    static string partitionName(int64_t month) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "p%04d%02d", static_cast<int>(month / 12), static_cast<int>(month % 12 + 1));
+        return buf;
+    }
+
+    static string partitionBound(int64_t month) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%04d-%02d-01", static_cast<int>((month + 1) / 12), static_cast<int>((month + 1) % 12 + 1));
+        return buf;
+    }
+
+    static string partitionClause(int64_t month) {
+        return "PARTITION " + partitionName(month) + " VALUES LESS THAN ('" + partitionBound(month) + "')";
+    }
+
+    static int64_t currentMonth() {
+        time_t now = time(nullptr);
+        tm tmValue;
+#ifdef _WIN32
+        localtime_s(&tmValue, &now);
+#else
+        localtime_r(&now, &tmValue);
+#endif
+        return static_cast<int64_t>(tmValue.tm_year + 1900) * 12 + tmValue.tm_mon;
+    }
+
+    string partitionedVerificationsSQL(SchemaLayout layout, const string& table) const {
+        bool compact = layout == SCHEMA_COMPACT;
+        string sql = "CREATE TABLE IF NOT EXISTS " + table + " ("
+            "id INT AUTO_INCREMENT,";
+        sql += compact ? "client_ip VARBINARY(16) NOT NULL, domain_id INT UNSIGNED NOT NULL," :
+            "client_ip VARCHAR(45) NOT NULL, domain VARCHAR(255) NOT NULL,";
+        sql += "expire_time DATETIME NOT NULL,"
+            "mode VARCHAR(20) NOT NULL,"
+            "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
+            "PRIMARY KEY (id, expire_time),";
+        sql += compact ? "UNIQUE KEY unique_verify (client_ip, domain_id, mode, expire_time)" :
+            "UNIQUE KEY unique_verify (client_ip, domain, mode, expire_time)";
+        sql += ") PARTITION BY RANGE COLUMNS(expire_time) (";
+        int64_t month = currentMonth();
+        for (int64_t m = month; m <= month + config.partitionMonthsAhead; ++m) {
+            sql += partitionClause(m) + ", ";
+        }
+        sql += "PARTITION pmax VALUES LESS THAN (MAXVALUE))";
+        return sql;
+    }
+
+    static int ceilLog2(size_t n) {
+        int shift = 0;
+        while ((static_cast<size_t>(1) << shift) < n) {
+            ++shift;
+        }
+        return shift;
+    }
+
+    // unique 为 true 时每个键只有一行，直接按唯一键读取；否则先按键取最大 id（最新写入）再回表
+    static const string& batchFindSQL(SchemaLayout schema, bool unique, int shift) {
+        static const vector<string> sqls[SCHEMA_COUNT][2] = {
+            {
+                makeMultiRowSQLs("SELECT v.client_ip, v.domain, v.expire_time, m.target_ip, UNIX_TIMESTAMP(v.expire_time) "
+                    "FROM (SELECT MAX(id) AS id FROM dns_verifications "
+                    "WHERE mode = 'verify' AND (client_ip, domain) IN (", "(?, ?)",
+                    ") GROUP BY client_ip, domain) t JOIN dns_verifications v ON v.id = t.id "
+                    "LEFT JOIN domain_mappings m ON m.domain = v.domain"),
+                makeMultiRowSQLs("SELECT v.client_ip, v.domain, v.expire_time, m.target_ip, UNIX_TIMESTAMP(v.expire_time) "
+                    "FROM dns_verifications v LEFT JOIN domain_mappings m ON m.domain = v.domain "
+                    "WHERE v.mode = 'verify' AND (v.client_ip, v.domain) IN (", "(?, ?)", ")"),
+            },
+            {
+                makeMultiRowSQLs("SELECT INET6_NTOA(v.client_ip), d.name, v.expire_time, INET6_NTOA(m.target_ip), "
+                    "UNIX_TIMESTAMP(v.expire_time) "
+                    "FROM (SELECT MAX(l.id) AS id FROM dns_verifications l JOIN domains n ON n.id = l.domain_id "
+                    "WHERE l.mode = 'verify' AND (l.client_ip, n.name) IN (", "(INET6_ATON(?), ?)",
+                    ") GROUP BY l.client_ip, l.domain_id) t JOIN dns_verifications v ON v.id = t.id "
+                    "JOIN domains d ON d.id = v.domain_id LEFT JOIN domain_mappings m ON m.domain_id = v.domain_id"),
+                makeMultiRowSQLs("SELECT INET6_NTOA(v.client_ip), d.name, v.expire_time, INET6_NTOA(m.target_ip), "
+                    "UNIX_TIMESTAMP(v.expire_time) "
+                    "FROM dns_verifications v JOIN domains d ON d.id = v.domain_id "
+                    "LEFT JOIN domain_mappings m ON m.domain_id = v.domain_id "
+                    "WHERE v.mode = 'verify' AND (v.client_ip, d.name) IN (", "(INET6_ATON(?), ?)", ")"),
+            },
+        };
+        return sqls[schema][unique ? 1 : 0][shift];
+    }
+
+    static const string& batchConfigSQL(SchemaLayout schema, int shift) {
+        static const vector<string> sqls = []() {
+            vector<string> list;
+            for (int layout = 0; layout < SCHEMA_COUNT; ++layout) {
+                for (int i = 0; i <= kMaxInsertChunkShift; ++i) {
+                    string sql = layout == SCHEMA_COMPACT ?
+                        "SELECT d.name, c.expire_time FROM domain_configs c JOIN domains d ON d.id = c.domain_id "
+                        "WHERE c.client_ip = INET6_ATON(?) AND c.status = 1 AND d.name IN (" :
+                        "SELECT domain, expire_time FROM domain_configs "
+                        "WHERE client_ip = ? AND status = 1 AND domain IN (";
+                    for (size_t k = 0; k < (static_cast<size_t>(1) << i); ++k) {
+                        sql += k == 0 ? "?" : ", ?";
+                    }
+                    sql += ")";
+                    list.push_back(sql);
+                }
+            }
+            return list;
+        }();
+        return sqls[schema * (kMaxInsertChunkShift + 1) + shift];
+    }
+
+public:
+    explicit MySQLStorage(const DBConfig& cfg) : config(cfg) {}
+
+    ~MySQLStorage() { close(); }
+
+    const char* name() const override { return "mysql"; }
+
+    // 三列唯一键是否已就绪；非阻塞查询据此选择 find 语句
+    const atomic<bool>& uniqueVerifyKey() const { return verifyKeyUnique; }
+
+    bool open() override {
+        if (!pool.init(config)) {
+            logError("MySQL连接池初始化失败");
+            return false;
+        }
+        logInfo("MySQL连接池初始化成功");
+
+        {
+            PooledConnection conn = pool.acquire();
+            if (!conn) {
+                return false;
+            }
+            if (!createTables(conn.get())) {
+                return false;
+            }
+        }
+        openReplicas();
+        return true;
+    }
+
+    void close() override {
+        closeReplicas();
+        pool.shutdown();
+    }
+
+    // 把文本结构的表就地转换为精简结构（migrate-schema 命令），需在服务停止时运行：
+    // 先登记全部域名、建 *_compact 新表并复制数据（IP 经 INET6_ATON，域名规范化后换成 id，
+    // 验证记录按主键分批复制并保留 id），再用一条 RENAME TABLE 原子地换上新表，原表改名为 *_text 保留
+    bool migrateToCompact(size_t batchRows) {
+        if (!pool.init(config)) {
+            logError("MySQL连接池初始化失败");
+            return false;
+        }
+        PooledConnection conn = pool.acquire();
+        if (!conn) {
+            return false;
+        }
+        MYSQL* handle = conn.get();
+        if (columnExists(handle, "domain_configs", "domain_id")) {
+            logInfo("数据库中已是精简结构，无需迁移");
+            return true;
+        }
+        if (!tableExists(handle, "domain_configs")) {
+            logInfo("数据库中没有文本结构的表，启用 compactSchema 后直接建表即可");
+            return true;
+        }
+
+        auto run = [handle](const string& sql) {
+            if (mysql_query(handle, sql.c_str()) != 0) {
+                logError("迁移失败: ", mysql_error(handle));
+                return false;
+            }
+            return true;
+        };
+        auto scalar = [handle](const string& sql, int64_t& value) {
+            if (mysql_query(handle, sql.c_str()) != 0) {
+                logError("迁移失败: ", mysql_error(handle));
+                return false;
+            }
+            MYSQL_RES* result = mysql_store_result(handle);
+            if (!result) {
+                return false;
+            }
+            MYSQL_ROW row = mysql_fetch_row(result);
+            value = row && row[0] ? atoll(row[0]) : 0;
+            mysql_free_result(result);
+            return true;
+        };
+
+        // 上次中断留下的新表不可靠，重新建
+        static const char* const kTables[] = { "dns_verifications", "domain_mappings", "domain_configs" };
+        for (const char* table : kTables) {
+            if (!run(string("DROP TABLE IF EXISTS ") + table + "_compact")) {
+                return false;
+            }
+        }
+        for (const string& sql : compactTablesSQL("_compact")) {
+            if (!run(sql)) {
+                return false;
+            }
+        }
+        for (const char* table : kTables) {
+            if (!run(string("INSERT IGNORE INTO domains (name) SELECT DISTINCT LOWER(TRIM(TRAILING '.' FROM domain)) FROM ") +
+                table)) {
+                return false;
+            }
+        }
+        logInfo("域名登记完成");
+
+        // 规范化后撞键的配置保留较晚的到期时间
+        if (!run("INSERT INTO domain_configs_compact (id, client_ip, domain_id, expire_time, status, created_at) "
+            "SELECT c.id, INET6_ATON(c.client_ip), d.id, c.expire_time, c.status, c.created_at FROM domain_configs c "
+            "JOIN domains d ON d.name = LOWER(TRIM(TRAILING '.' FROM c.domain)) "
+            "WHERE INET6_ATON(c.client_ip) IS NOT NULL ORDER BY c.id "
+            "ON DUPLICATE KEY UPDATE expire_time = GREATEST(domain_configs_compact.expire_time, VALUES(expire_time))") ||
+            !run("INSERT INTO domain_mappings_compact (id, domain_id, target_ip, updated_at) "
+                "SELECT m.id, d.id, INET6_ATON(m.target_ip), m.updated_at FROM domain_mappings m "
+                "JOIN domains d ON d.name = LOWER(TRIM(TRAILING '.' FROM m.domain)) "
+                "WHERE INET6_ATON(m.target_ip) IS NOT NULL ORDER BY m.id "
+                "ON DUPLICATE KEY UPDATE target_ip = VALUES(target_ip)")) {
+            return false;
+        }
+        logInfo("domain_configs / domain_mappings 复制完成");
+
+        int64_t minId = 0;
+        int64_t maxId = 0;
+        if (!scalar("SELECT COALESCE(MIN(id), 0) FROM dns_verifications", minId) ||
+            !scalar("SELECT COALESCE(MAX(id), 0) FROM dns_verifications", maxId)) {
+            return false;
+        }
+        // 按 id 顺序复制，同一键（含规范化后撞键）的多行以最后写入的到期时间为准
+        int64_t step = batchRows > 0 ? static_cast<int64_t>(batchRows) : 10000;
+        for (int64_t from = minId; maxId > 0 && from <= maxId; from += step) {
+            if (!run("INSERT INTO dns_verifications_compact (id, client_ip, domain_id, expire_time, mode, created_at) "
+                "SELECT v.id, INET6_ATON(v.client_ip), d.id, v.expire_time, v.mode, v.created_at "
+                "FROM dns_verifications v JOIN domains d ON d.name = LOWER(TRIM(TRAILING '.' FROM v.domain)) "
+                "WHERE v.id >= " + to_string(from) + " AND v.id < " + to_string(from + step) +
+                " AND INET6_ATON(v.client_ip) IS NOT NULL ORDER BY v.id "
+                "ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time)")) {
+                return false;
+            }
+            if ((from - minId) / step % 100 == 99) {
+                logInfo("dns_verifications 已复制到 id ", from + step - 1, " / ", maxId);
+            }
+        }
+        logInfo("dns_verifications 复制完成");
+
+        // IP 无法解析的行不会进入新表，原表保留以便核对
+        static const char* const kIPColumns[] = { "client_ip", "target_ip", "client_ip" };
+        for (size_t i = 0; i < 3; ++i) {
+            int64_t skipped = 0;
+            if (scalar(string("SELECT COUNT(*) FROM ") + kTables[i] + " WHERE INET6_ATON(" + kIPColumns[i] + ") IS NULL",
+                skipped) && skipped > 0) {
+                logWarn(kTables[i], " 中有 ", skipped, " 行 IP 无法解析，未迁移");
+            }
+        }
+
+        string rename = "RENAME TABLE ";
+        for (size_t i = 0; i < 3; ++i) {
+            string table = kTables[i];
+            rename += (i > 0 ? ", " : "") + table + " TO " + table + "_text, " + table + "_compact TO " + table;
+        }
+        if (!run(rename)) {
+            return false;
+        }
+        logInfo("迁移完成，原表已改名为 *_text，确认无误后可手动删除；启动服务前请设置 compactSchema = true");
+        return true;
+    }
+
+    // 为旧版本的 dns_verifications 去重并建立唯一键（migrate-verify-key 命令），需在服务停止时运行：
+    // 建带唯一键的 dns_verifications_dedup，按主键分批复制（保留 id，同一键以最后写入的到期时间为准），
+    // 再用一条 RENAME TABLE 原子地换上新表，原表改名为 dns_verifications_dup 保留
+    bool migrateVerifyKey(size_t batchRows) {
+        if (!pool.init(config)) {
+            logError("MySQL连接池初始化失败");
+            return false;
+        }
+        PooledConnection conn = pool.acquire();
+        if (!conn) {
+            return false;
+        }
+        MYSQL* handle = conn.get();
+        if (!tableExists(handle, "dns_verifications")) {
+            logInfo("数据库中没有 dns_verifications，启动服务时直接建表即可");
+            return true;
+        }
+        if (config.compactSchema != columnExists(handle, "dns_verifications", "domain_id")) {
+            logError("dns_verifications 的结构与 compactSchema 设置不符");
+            return false;
+        }
+        bool hasKey = indexExists(handle, "dns_verifications", "unique_verify");
+        bool keyHasExpire = hasKey && indexHasColumn(handle, "dns_verifications", "unique_verify", "expire_time");
+        if (hasKey && keyHasExpire == config.partitionVerifications) {
+            logInfo("dns_verifications 已有唯一键 unique_verify，无需迁移");
+            return true;
+        }
+        if (tableExists(handle, "dns_verifications_dup")) {
+            logError("dns_verifications_dup 已存在（上一次迁移保留的原表），确认后手动删除再运行");
+            return false;
+        }
+
+        auto run = [handle](const string& sql) {
+            if (mysql_query(handle, sql.c_str()) != 0) {
+                logError("迁移失败: ", mysql_error(handle));
+                return false;
+            }
+            return true;
+        };
+        auto scalar = [handle](const string& sql, int64_t& value) {
+            if (mysql_query(handle, sql.c_str()) != 0) {
+                logError("迁移失败: ", mysql_error(handle));
+                return false;
+            }
+            MYSQL_RES* result = mysql_store_result(handle);
+            if (!result) {
+                return false;
+            }
+            MYSQL_ROW row = mysql_fetch_row(result);
+            value = row && row[0] ? atoll(row[0]) : 0;
+            mysql_free_result(result);
+            return true;
+        };
+
+        // 上次中断留下的新表不可靠，重新建
+        if (!run("DROP TABLE IF EXISTS dns_verifications_dedup") ||
+            !run(verificationsTableSQL(schemaLayout(config), "dns_verifications_dedup"))) {
+            return false;
+        }
+
+        int64_t minId = 0;
+        int64_t maxId = 0;
+        if (!scalar("SELECT COALESCE(MIN(id), 0) FROM dns_verifications", minId) ||
+            !scalar("SELECT COALESCE(MAX(id), 0) FROM dns_verifications", maxId)) {
+            return false;
+        }
+        string columns = config.compactSchema ? "id, client_ip, domain_id, expire_time, mode, created_at" :
+            "id, client_ip, domain, expire_time, mode, created_at";
+        int64_t step = batchRows > 0 ? static_cast<int64_t>(batchRows) : 10000;
+        for (int64_t from = minId; maxId > 0 && from <= maxId; from += step) {
+            if (!run("INSERT INTO dns_verifications_dedup (" + columns + ") SELECT " + columns +
+                " FROM dns_verifications WHERE id >= " + to_string(from) + " AND id < " + to_string(from + step) +
+                " ORDER BY id ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time)")) {
+                return false;
+            }
+            if ((from - minId) / step % 100 == 99) {
+                logInfo("dns_verifications 已复制到 id ", from + step - 1, " / ", maxId);
+            }
+        }
+
+        int64_t before = 0;
+        int64_t after = 0;
+        if (scalar("SELECT COUNT(*) FROM dns_verifications", before) &&
+            scalar("SELECT COUNT(*) FROM dns_verifications_dedup", after)) {
+            logInfo("dns_verifications 复制完成，", before, " 行去重后 ", after, " 行");
+        }
+
+        if (!run("RENAME TABLE dns_verifications TO dns_verifications_dup, dns_verifications_dedup TO dns_verifications")) {
+            return false;
+        }
+        logInfo("唯一键已建立，原表已改名为 dns_verifications_dup，确认无误后可手动删除");
+        return true;
+    }
+
+    bool loadWhitelist(int64_t afterId, vector<WhitelistEntry>& out) override {
+        vector<vector<string>> rows;
+        string sql = whitelistHasLimits ? "SELECT id, ip, rate_limit, rate_burst FROM ip_whitelist WHERE id > " :
+            "SELECT id, ip, 0, 0 FROM ip_whitelist WHERE id > ";
+        if (!queryRows(sql + to_string(afterId) + " ORDER BY id", rows, 4, true)) {
+            return false;
+        }
+        out.reserve(out.size() + rows.size());
+        for (auto& row : rows) {
+            WhitelistEntry entry;
+            entry.id = stoll(row[0].empty() ? "0" : row[0]);
+            entry.ip = move(row[1]);
+            entry.limit.rate = static_cast<uint32_t>(strtoul(row[2].c_str(), nullptr, 10));
+            entry.limit.burst = static_cast<uint32_t>(strtoul(row[3].c_str(), nullptr, 10));
+            out.push_back(move(entry));
+        }
+        return true;
+    }
+
+    bool whitelistSummary(uint64_t& count, int64_t& maxId) override {
+        vector<vector<string>> rows;
+        if (!queryRows("SELECT COUNT(*), COALESCE(MAX(id), 0) FROM ip_whitelist", rows, 2, true) ||
+            rows.empty() || rows[0][0].empty() || rows[0][1].empty()) {
+            return false;
+        }
+        count = stoull(rows[0][0]);
+        maxId = stoll(rows[0][1]);
+        return true;
+    }
+
+    StorageStatus whitelistContains(const string& ip) override {
+        PooledConnection conn = acquireRead();
+        if (!conn) {
+            return STORAGE_UNAVAILABLE;
+        }
+        PreparedStatement* stmt = executeStatement(conn, STMT_WHITELIST_LOOKUP, { ip });
+        if (!stmt) {
+            return STORAGE_ERROR;
+        }
+        bool exists = stmt->fetch();
+        stmt->freeResult();
+        return exists ? STORAGE_OK : STORAGE_NOT_FOUND;
+    }
+
+    StorageStatus lookupConfig(const string& clientIP, const string& domain, string& expireTime) override {
+        PooledConnection conn = acquire();
+        if (!conn) {
+            return STORAGE_UNAVAILABLE;
+        }
+        string normalized;
+        PreparedStatement* stmt = executeStatement(conn, STMT_CONFIG_EXPIRE,
+            { clientIP, domainParam(domain, normalized) });
+        if (!stmt) {
+            return STORAGE_ERROR;
+        }
+        bool found = stmt->fetch();
+        if (found) {
+            expireTime = stmt->column(0);
+        }
+        stmt->freeResult();
+        return found ? STORAGE_OK : STORAGE_NOT_FOUND;
+    }
+
+    // 按 2 的幂分块的 IN 查询，参数个数补齐到 2 的幂，补位重复最后一个，不影响结果
+    StorageStatus lookupConfigs(const string& clientIP, const vector<const string*>& domains,
+        vector<ConfigRecord>& out) override {
+        if (domains.empty()) {
+            return STORAGE_OK;
+        }
+        PooledConnection conn = acquire();
+        if (!conn) {
+            return STORAGE_UNAVAILABLE;
+        }
+
+        // 精简结构下按规范化的域名查询，结果还原为调用方的写法
+        vector<string> normalized;
+        unordered_multimap<string, const string*> spellings;
+        if (config.compactSchema) {
+            normalized.reserve(domains.size());
+            for (const string* domain : domains) {
+                normalized.push_back(normalizeDomain(*domain));
+                spellings.emplace(normalized.back(), domain);
+            }
+        }
+
+        for (size_t start = 0; start < domains.size(); start += kBatchQueryMax) {
+            size_t count = min(kBatchQueryMax, domains.size() - start);
+            int shift = ceilLog2(count);
+
+            vector<reference_wrapper<const string>> params;
+            params.reserve((static_cast<size_t>(1) << shift) + 1);
+            params.push_back(cref(clientIP));
+            for (size_t k = 0; k < (static_cast<size_t>(1) << shift); ++k) {
+                size_t i = start + min(k, count - 1);
+                params.push_back(config.compactSchema ? cref(normalized[i]) : cref(*domains[i]));
+            }
+
+            PreparedStatement* stmt = executeStatement(conn, batchConfigSQL(schemaLayout(config), shift), 2, params);
+            if (!stmt) {
+                return STORAGE_ERROR;
+            }
+            while (stmt->fetch()) {
+                ConfigRecord record;
+                record.domain = stmt->column(0);
+                record.expireTime = stmt->column(1);
+                if (!config.compactSchema) {
+                    out.push_back(move(record));
+                    continue;
+                }
+                auto range = spellings.equal_range(record.domain);
+                for (auto it = range.first; it != range.second; ++it) {
+                    out.push_back({ *it->second, record.expireTime });
+                }
+            }
+            stmt->freeResult();
+        }
+        return STORAGE_OK;
+    }
+
+    // 提交前后各记一次写入时刻：提交后才到达的 find 按提交时刻判断副本是否已追上
+    StorageStatus insertVerifications(const VerificationRow* rows, size_t count) override {
+        PooledConnection conn = acquire();
+        if (!conn) {
+            return STORAGE_UNAVAILABLE;
+        }
+        markWrites(rows, count);
+        vector<VerificationRow> normalized;
+        if (config.compactSchema) {
+            normalized.assign(rows, rows + count);
+            for (VerificationRow& row : normalized) {
+                row.domain = normalizeDomain(row.domain);
+            }
+        }
+        const VerificationRow* source = config.compactSchema ? normalized.data() : rows;
+        unsigned int err = 0;
+        auto getRow = [source](size_t i) -> const VerificationRow& { return source[i]; };
+        bool ok = insertVerificationRows(conn, config.partitionVerifications, count, getRow, err);
+        if (!ok && conn.reconnectIfLost(err)) {
+            ok = insertVerificationRows(conn, config.partitionVerifications, count, getRow, err);
+        }
+        markWrites(rows, count);
+        return ok ? STORAGE_OK : STORAGE_ERROR;
+    }
+
+    StorageStatus findActive(const string& clientIP, const string& domain, FindRecord& out) override {
+        PooledConnection conn = acquireRead(replicas.empty() ? 0 : recentWrites.last(clientIP));
+        if (!conn) {
+            return STORAGE_UNAVAILABLE;
+        }
+
+        // 一次往返：A表最新验证记录 + 到期时间戳 + B表映射IP
+        string normalized;
+        PreparedStatement* stmt = executeStatement(conn, verifyKeyUnique.load() ? STMT_FIND_ACTIVE : STMT_FIND_LATEST,
+            { clientIP, domainParam(domain, normalized) });
+        if (!stmt) {
+            return STORAGE_ERROR;
+        }
+        if (!stmt->fetch()) {
+            stmt->freeResult();
+            return STORAGE_NOT_FOUND;
+        }
+
+        out.clientIP = clientIP;
+        out.domain = domain;
+        out.expireTime = stmt->column(0);
+        out.targetIP = stmt->column(1);
+        out.expireAt = stmt->columnInt64(2);
+        stmt->freeResult();
+        return STORAGE_OK;
+    }
+
+    StorageStatus findActiveBatch(const vector<pair<const string*, const string*>>& keys,
+        vector<FindRecord>& out) override {
+        if (keys.empty()) {
+            return STORAGE_OK;
+        }
+        int64_t lastWrite = 0;
+        for (size_t i = 0; i < keys.size() && !replicas.empty(); ++i) {
+            int64_t written = recentWrites.last(*keys[i].first);
+            if (written > lastWrite) lastWrite = written;
+        }
+        PooledConnection conn = acquireRead(lastWrite);
+        if (!conn) {
+            return STORAGE_UNAVAILABLE;
+        }
+
+        // 精简结构下按规范化的域名查询，结果还原为调用方的 IP 与域名写法
+        vector<string> normalized;
+        unordered_multimap<string, size_t> spellings;
+        if (config.compactSchema) {
+            normalized.reserve(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) {
+                normalized.push_back(normalizeDomain(*keys[i].second));
+                spellings.emplace(foldedKey(*keys[i].first, normalized.back()), i);
+            }
+        }
+
+        for (size_t start = 0; start < keys.size(); start += kBatchQueryMax) {
+            size_t count = min(kBatchQueryMax, keys.size() - start);
+            int shift = ceilLog2(count);
+
+            vector<reference_wrapper<const string>> params;
+            params.reserve(static_cast<size_t>(2) << shift);
+            for (size_t k = 0; k < (static_cast<size_t>(1) << shift); ++k) {
+                size_t i = start + min(k, count - 1);
+                params.push_back(cref(*keys[i].first));
+                params.push_back(config.compactSchema ? cref(normalized[i]) : cref(*keys[i].second));
+            }
+
+            PreparedStatement* stmt = executeStatement(conn,
+                batchFindSQL(schemaLayout(config), verifyKeyUnique.load(), shift), 5, params);
+            if (!stmt) {
+                return STORAGE_ERROR;
+            }
+            while (stmt->fetch()) {
+                FindRecord record;
+                record.clientIP = stmt->column(0);
+                record.domain = stmt->column(1);
+                record.expireTime = stmt->column(2);
+                record.targetIP = stmt->column(3);
+                record.expireAt = stmt->columnInt64(4);
+                if (!config.compactSchema) {
+                    out.push_back(move(record));
+                    continue;
+                }
+                auto range = spellings.equal_range(foldedKey(record.clientIP, record.domain));
+                for (auto it = range.first; it != range.second; ++it) {
+                    record.clientIP = *keys[it->second].first;
+                    record.domain = *keys[it->second].second;
+                    out.push_back(record);
+                }
+            }
+            stmt->freeResult();
+        }
+        return STORAGE_OK;
+    }
+
+    bool scanFindKeys(const function<void(const string& key)>& visit) override {
+        if (config.compactSchema) {
+            return streamKeys("SELECT DISTINCT INET6_NTOA(v.client_ip), d.name "
+                "FROM dns_verifications v JOIN domains d ON d.id = v.domain_id", visit) &&
+                streamKeys("SELECT INET6_NTOA(c.client_ip), d.name "
+                    "FROM domain_configs c JOIN domains d ON d.id = c.domain_id", visit);
+        }
+        return streamKeys("SELECT DISTINCT client_ip, domain FROM dns_verifications", visit) &&
+            streamKeys("SELECT client_ip, domain FROM domain_configs", visit);
+    }
+
+    bool addWhitelist(const string& ip, const string& description) override {
+        return executeWrite("INSERT IGNORE INTO ip_whitelist (ip, description) VALUES (?, ?)", { ip, description });
+    }
+
+    bool setWhitelistLimit(const string& ip, const RateLimit& limit) override {
+        string rate = to_string(limit.rate);
+        string burst = to_string(limit.burst);
+        return executeWrite("UPDATE ip_whitelist SET rate_limit = ?, rate_burst = ? WHERE ip = ?", { rate, burst, ip });
+    }
+
+    bool upsertDomainConfig(const string& clientIP, const string& domain,
+        const string& expireTime, int status) override {
+        string normalized;
+        const string& name = domainParam(domain, normalized);
+        if (config.compactSchema && !internDomains({ name })) {
+            return false;
+        }
+        return executeWrite(configUpsertSQL(schemaLayout(config), 0).c_str(), { clientIP, name, expireTime }, 3, status);
+    }
+
+    bool upsertDomainMapping(const string& domain, const string& targetIP) override {
+        string normalized;
+        const string& name = domainParam(domain, normalized);
+        if (config.compactSchema && !internDomains({ name })) {
+            return false;
+        }
+        return executeWrite(mappingUpsertSQL(schemaLayout(config), 0).c_str(), { name, targetIP });
+    }
+
+    // 批量导入：事务内的多行 upsert 都是幂等的，连接断开时整批重做
+    bool upsertDomainConfigs(const DomainConfigRow* rows, size_t count) override {
+        SchemaLayout schema = schemaLayout(config);
+        vector<string> names;
+        if (config.compactSchema) {
+            names.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                names.push_back(normalizeDomain(rows[i].domain));
+            }
+            if (!internDomains(names)) {
+                return false;
+            }
+        }
+        auto getSQL = [schema](int shift) -> const string& { return configUpsertSQL(schema, shift); };
+        return upsertRows(count, getSQL, [rows, &names](PreparedStatement& stmt, size_t slot, size_t i) {
+            stmt.bind(slot * 4, rows[i].clientIP);
+            stmt.bind(slot * 4 + 1, names.empty() ? rows[i].domain : names[i]);
+            stmt.bind(slot * 4 + 2, rows[i].expireTime);
+            stmt.bind(slot * 4 + 3, static_cast<long long>(rows[i].status));
+            });
+    }
+
+    bool upsertDomainMappings(const MappingRow* rows, size_t count) override {
+        SchemaLayout schema = schemaLayout(config);
+        vector<string> names;
+        if (config.compactSchema) {
+            names.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                names.push_back(normalizeDomain(rows[i].domain));
+            }
+            if (!internDomains(names)) {
+                return false;
+            }
+        }
+        auto getSQL = [schema](int shift) -> const string& { return mappingUpsertSQL(schema, shift); };
+        return upsertRows(count, getSQL, [rows, &names](PreparedStatement& stmt, size_t slot, size_t i) {
+            stmt.bind(slot * 2, names.empty() ? rows[i].domain : names[i]);
+            stmt.bind(slot * 2 + 1, rows[i].targetIP);
+            });
+    }
+
+    bool listActiveConfigs(vector<DomainConfigRow>& out) override {
+        vector<vector<string>> rows;
+        const char* sql = config.compactSchema ?
+            "SELECT INET6_NTOA(c.client_ip), d.name, c.expire_time FROM domain_configs c "
+            "JOIN domains d ON d.id = c.domain_id WHERE c.status = 1" :
+            "SELECT client_ip, domain, expire_time FROM domain_configs WHERE status = 1";
+        if (!queryRows(sql, rows, 3, true)) {
+            return false;
+        }
+        out.reserve(out.size() + rows.size());
+        for (auto& row : rows) {
+            out.push_back({ move(row[0]), move(row[1]), move(row[2]) });
+        }
+        return true;
+    }
+
+    bool listMappings(vector<MappingRow>& out) override {
+        vector<vector<string>> rows;
+        const char* sql = config.compactSchema ?
+            "SELECT d.name, INET6_NTOA(m.target_ip) FROM domain_mappings m JOIN domains d ON d.id = m.domain_id" :
+            "SELECT domain, target_ip FROM domain_mappings";
+        if (!queryRows(sql, rows, 2, true)) {
+            return false;
+        }
+        out.reserve(out.size() + rows.size());
+        for (auto& row : rows) {
+            out.push_back({ move(row[0]), move(row[1]) });
+        }
+        return true;
+    }
+
+    StorageStatus purgeVerifications(PurgeCursor& cursor, size_t span, int64_t expiredBefore) override {
+        // 本轮的主键范围在开始时确定，之后插入的行留到下一轮
+        if (cursor.end < 0) {
+            vector<vector<string>> rows;
+            if (!queryRows("SELECT COALESCE(MIN(id), 0), COALESCE(MAX(id), 0) FROM dns_verifications", rows)) {
+                return STORAGE_ERROR;
+            }
+            int64_t maxId = rows.empty() ? 0 : atoll(rows[0][1].c_str());
+            if (maxId <= 0) {
+                cursor.done = true;
+                return STORAGE_OK;
+            }
+            cursor.next = atoll(rows[0][0].c_str());
+            cursor.end = maxId + 1;
+        }
+
+        PooledConnection conn = acquire();
+        if (!conn) {
+            return STORAGE_UNAVAILABLE;
+        }
+
+        int64_t from = cursor.next;
+        int64_t to = cursor.end - from > static_cast<int64_t>(span) ? from + static_cast<int64_t>(span) : cursor.end;
+        uint64_t expired = 0;
+        uint64_t superseded = 0;
+        if (!executeRangeDelete(conn,
+            "DELETE FROM dns_verifications WHERE id >= ? AND id < ? AND expire_time < FROM_UNIXTIME(?)",
+            from, to, &expiredBefore, expired)) {
+            return STORAGE_ERROR;
+        }
+        // find 只读取每个键最新写入（id 最大）的一条，其余都是可以删除的旧记录；
+        // 按 id 而不是到期时间判断，缩短或撤销的到期时间不会被更早写入的较晚到期记录取代
+        const char* supersededSQL = config.compactSchema ?
+            "DELETE v FROM dns_verifications v JOIN dns_verifications n "
+            "ON n.client_ip = v.client_ip AND n.domain_id = v.domain_id AND n.mode = v.mode AND n.id > v.id "
+            "WHERE v.id >= ? AND v.id < ?" :
+            "DELETE v FROM dns_verifications v JOIN dns_verifications n "
+            "ON n.client_ip = v.client_ip AND n.domain = v.domain AND n.mode = v.mode AND n.id > v.id "
+            "WHERE v.id >= ? AND v.id < ?";
+        if (!executeRangeDelete(conn, supersededSQL, from, to, nullptr, superseded)) {
+            return STORAGE_ERROR;
+        }
+
+        cursor.deleted += expired + superseded;
+        cursor.next = to;
+        cursor.done = to >= cursor.end;
+        return STORAGE_OK;
+    }
+
+    bool maintainPartitions(int64_t expiredBefore, uint64_t& droppedPartitions) override {
+        droppedPartitions = 0;
+        if (!config.partitionVerifications) {
+            return true;
+        }
+
+        vector<vector<string>> rows;
+        if (!queryRows("SELECT partition_name, partition_description FROM information_schema.partitions "
+            "WHERE table_schema = DATABASE() AND table_name = 'dns_verifications' AND partition_name IS NOT NULL "
+            "ORDER BY partition_ordinal_position", rows)) {
+            return false;
+        }
+        if (rows.empty()) {
+            logWarn("dns_verifications 不是分区表，跳过分区维护（已有的表需手动转换）");
+            return true;
+        }
+
+        // 分区上界形如 '2026-11-01' 或 '2026-11-01 00:00:00'，最后一个为 MAXVALUE
+        string dropList;
+        bool hasMax = false;
+        int64_t lastMonth = -1;
+        for (const vector<string>& row : rows) {
+            string bound = row[1];
+            bound.erase(remove(bound.begin(), bound.end(), '\''), bound.end());
+            if (bound == "MAXVALUE") {
+                hasMax = true;
+                continue;
+            }
+            if (bound.size() == 10) {
+                bound += " 00:00:00";
+            }
+            int64_t boundAt = parseDateTime(bound);
+            if (boundAt < 0) {
+                continue;
+            }
+            lastMonth = atoll(bound.substr(0, 4).c_str()) * 12 + atoll(bound.substr(5, 2).c_str()) - 2;
+            if (boundAt <= expiredBefore) {
+                dropList += (dropList.empty() ? "" : ", ") + row[0];
+                ++droppedPartitions;
+            }
+        }
+
+        if (!dropList.empty() && !executeDDL("ALTER TABLE dns_verifications DROP PARTITION " + dropList)) {
+            droppedPartitions = 0;
+            return false;
+        }
+
+        // 预建到 partitionMonthsAhead 个月之后；MAXVALUE 分区中的行在拆分时会被移动
+        int64_t month = currentMonth();
+        int64_t first = lastMonth < month ? month : lastMonth + 1;
+        string clauses;
+        for (int64_t m = first; m <= month + config.partitionMonthsAhead; ++m) {
+            clauses += (clauses.empty() ? "" : ", ") + partitionClause(m);
+        }
+        if (clauses.empty()) {
+            return true;
+        }
+        if (hasMax) {
+            return executeDDL("ALTER TABLE dns_verifications REORGANIZE PARTITION pmax INTO (" + clauses +
+                ", PARTITION pmax VALUES LESS THAN (MAXVALUE))");
+        }
+        return executeDDL("ALTER TABLE dns_verifications ADD PARTITION (" + clauses + ")");
+    }
+
+    PoolStats poolStats() override { return pool.getStats(); }
+
+    void appendMetrics(string& out) override {
+        if (replicas.empty()) {
+            return;
+        }
+        Metrics::writeValue(out, "dns_auth_primary_reads_total", "counter", "Read queries sent to the primary although replicas are configured.", primaryReads.load(memory_order_relaxed));
+
+        auto writeReplicaValues = [this, &out](const char* name, const char* type, const char* help,
+            int64_t (*value)(const Replica&)) {
+            out += string("# HELP ") + name + ' ' + help + '\n';
+            out += string("# TYPE ") + name + ' ' + type + '\n';
+            for (const auto& replica : replicas) {
+                out += string(name) + "{replica=\"" + replica->name + "\"} " + to_string(value(*replica)) + '\n';
+            }
+        };
+        writeReplicaValues("dns_auth_replica_healthy", "gauge", "1 while the read replica receives reads.",
+            [](const Replica& r) -> int64_t { return r.healthy.load(memory_order_relaxed) ? 1 : 0; });
+        writeReplicaValues("dns_auth_replica_lag_seconds", "gauge", "Replication lag at the last check, -1 when unknown.",
+            [](const Replica& r) -> int64_t { int64_t lag = r.lagMs.load(memory_order_relaxed); return lag < 0 ? -1 : lag / 1000; });
+        writeReplicaValues("dns_auth_replica_reads_total", "counter", "Read queries sent to the replica.",
+            [](const Replica& r) -> int64_t { return static_cast<int64_t>(r.reads.load(memory_order_relaxed)); });
+    }
+};
+
+#ifdef DNS_AUTH_ASYNC_DB
+// 即发即弃的协程：创建后立即执行，结束时自行销毁，结果通过回调交付
+struct AsyncTask {
+    struct promise_type {
+        AsyncTask get_return_object() { return AsyncTask(); }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+// 可等待的协程：被 co_await 时才开始执行，结束后直接切回等待方
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        T value{};
+        coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(coroutine_handle<promise_type>::from_promise(*this)); }
+        suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept { return false; }
+            coroutine_handle<> await_suspend(coroutine_handle<promise_type> self) noexcept {
+                return self.promise().continuation;
+            }
+            void await_resume() const noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T result) { value = move(result); }
+        void unhandled_exception() { terminate(); }
+    };
+
+    explicit Task(coroutine_handle<promise_type> h) : handle(h) {}
+    Task(Task&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    coroutine_handle<> await_suspend(coroutine_handle<> waiter) noexcept {
+        handle.promise().continuation = waiter;
+        return handle;
+    }
+
+    T await_resume() { return move(handle.promise().value); }
+
+private:
+    coroutine_handle<promise_type> handle;
+};
+
+// 把 SQL 中的 '?' 依次替换为字符串字面量（非阻塞 API 只有文本协议，不能绑定参数）。
+// 转义由 mysql_real_escape_string_quote 在将要执行查询的连接上完成，按该会话的字符集与
+// sql_mode（NO_BACKSLASH_ESCAPES 时引号成对转义）处理；转义失败返回 false
+inline bool bindLiterals(MYSQL* conn, const char* sql, const vector<string>& params, string& out) {
+    out.clear();
+    size_t next = 0;
+    vector<char> escaped;
+    for (const char* p = sql; *p; ++p) {
+        if (*p != '?' || next == params.size()) {
+            out += *p;
+            continue;
+        }
+        const string& value = params[next++];
+        escaped.resize(value.size() * 2 + 1);
+        unsigned long n = mysql_real_escape_string_quote(conn, escaped.data(), value.data(),
+            static_cast<unsigned long>(value.size()), '\'');
+        if (n == static_cast<unsigned long>(-1)) {
+            return false;
+        }
+        out += '\'';
+        out.append(escaped.data(), n);
+        out += '\'';
+    }
+    return true;
+}
+
+// 非阻塞 MySQL 查询的 reactor：每个线程一个 epoll 实例和一组独立连接（不经过连接池）。
+// 提交的查询排队等待空闲连接，连接可读时推进 mysql_real_query_nonblocking /
+// mysql_store_result_nonblocking 状态机，完成后在 reactor 线程上恢复等待的协程。
+class MySQLReactor {
+public:
+    // 一次查询；NULL 列读作空字符串。sql 为带 '?' 的语句，分到连接后才按该连接转义 params 得到 text
+    struct Query {
+        const char* sql = nullptr;
+        vector<string> params;
+        string text;
+        size_t columns = 0;
+        bool ok = false;
+        vector<vector<string>> rows;
+        coroutine_handle<> waiter;
+    };
+
+    class QueryAwaiter {
+    private:
+        MySQLReactor& reactor;
+        Query& query;
+
+    public:
+        QueryAwaiter(MySQLReactor& r, Query& q) : reactor(r), query(q) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        // 提交失败（reactor 已停止）时不挂起，query.ok 为 false
+        bool await_suspend(coroutine_handle<> waiter) {
+            query.waiter = waiter;
+            return reactor.submit(&query);
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+private:
+    static const int kTickMs = 10;                  // 定期推进所有进行中的查询，兜底写缓冲区满等不产生可读事件的情况
+    static const int kReconnectIntervalMs = 1000;   // 断开的连接重连间隔
+    static const int kStopTimeoutMs = 3000;         // 停止时等待进行中查询的上限
+    static const int kMaxEvents = 64;
+
+    struct Connection {
+        MYSQL* handle = nullptr;
+        Query* query = nullptr;
+        bool storing = false;           // 查询已发出，正在读取结果
+        bool connecting = false;        // 已交给重连线程，等待结果
+        chrono::steady_clock::time_point lastConnectAttempt;
+    };
+
+    struct Loop {
+        int epollFd = -1;
+        int wakeFd = -1;
+        mutex mtx;
+        deque<Query*> incoming;         // 其他线程提交、尚未取走的查询
+        deque<pair<Connection*, MYSQL*>> connected;     // 重连线程的结果，句柄为空表示失败
+        bool closed = false;            // 已退出，不再接受提交
+        deque<Query*> waiting;          // 等待空闲连接的查询（仅 reactor 线程访问）
+        vector<unique_ptr<Connection>> connections;
+        thread worker;
+    };
+
+    DBConfig config;
+    const atomic<bool>* verifyKeyUnique = nullptr;  // 由 MySQLStorage 维护，决定 find 用单点读取还是取最新一条
+    vector<unique_ptr<Loop>> loops;
+    shared_timed_mutex loopsMtx;        // submit 持共享锁访问 loops 与 wakeFd，stop 持独占锁关闭并清空
+    atomic<size_t> nextLoop{ 0 };
+    atomic<bool> stopping{ false };
+    bool running = false;
+
+    // 重连在单独的线程上进行：mysql_real_connect 会阻塞到连接超时，不能占用 reactor 线程
+    thread connector;
+    mutex connectorMtx;
+    condition_variable connectorCv;
+    deque<pair<Loop*, Connection*>> connectRequests;
+    bool connectorStopping = false;
+
+    atomic<uint64_t> queryCount{ 0 };
+    atomic<uint64_t> failureCount{ 0 };
+    atomic<uint64_t> reconnectCount{ 0 };
+    atomic<int64_t> inFlight{ 0 };
+
+    bool submit(Query* query) {
+        query->ok = false;
+        shared_lock<shared_timed_mutex> guard(loopsMtx);
+        if (stopping.load(memory_order_acquire) || loops.empty()) {
+            return false;
+        }
+
+        Loop& loop = *loops[nextLoop.fetch_add(1, memory_order_relaxed) % loops.size()];
+        {
+            lock_guard<mutex> lock(loop.mtx);
+            if (loop.closed) {
+                return false;
+            }
+            inFlight.fetch_add(1, memory_order_relaxed);
+            loop.incoming.push_back(query);
+        }
+        uint64_t one = 1;
+        ssize_t written = write(loop.wakeFd, &one, sizeof(one));
+        (void)written;
+        return true;
+    }
+
+    // 把已建立的连接交给 loop；EPOLLRDHUP 让对端关闭空闲连接时也产生事件
+    bool attach(Loop& loop, Connection& conn, MYSQL* handle) {
+        conn.handle = handle;
+        if (!handle) {
+            return false;
+        }
+        if (handle->net.fd >= 0) {
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.ptr = &conn;
+            epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, handle->net.fd, &event);
+        }
+        return true;
+    }
+
+    void requestConnect(Loop& loop, Connection& conn) {
+        conn.connecting = true;
+        conn.lastConnectAttempt = chrono::steady_clock::now();
+        reconnectCount.fetch_add(1, memory_order_relaxed);
+        {
+            lock_guard<mutex> lock(connectorMtx);
+            connectRequests.emplace_back(&loop, &conn);
+        }
+        connectorCv.notify_one();
+    }
+
+    // 重连线程：建立连接后放回所属 loop 并唤醒它；loop 已退出时直接关闭
+    void runConnector() {
+        while (true) {
+            pair<Loop*, Connection*> request;
+            {
+                unique_lock<mutex> lock(connectorMtx);
+                connectorCv.wait(lock, [this]() { return connectorStopping || !connectRequests.empty(); });
+                if (connectorStopping) {
+                    return;
+                }
+                request = connectRequests.front();
+                connectRequests.pop_front();
+            }
+
+            Loop& loop = *request.first;
+            MYSQL* handle = openMySQLHandle(config);
+            {
+                lock_guard<mutex> lock(loop.mtx);
+                if (!loop.closed) {
+                    loop.connected.emplace_back(request.second, handle);
+                    handle = nullptr;
+                }
+            }
+            if (handle) {
+                mysql_close(handle);
+            }
+            uint64_t one = 1;
+            ssize_t written = write(loop.wakeFd, &one, sizeof(one));
+            (void)written;
+        }
+    }
+
+    void disconnect(Loop& loop, Connection& conn) {
+        if (!conn.handle) return;
+        if (conn.handle->net.fd >= 0) {
+            epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, conn.handle->net.fd, nullptr);
+        }
+        mysql_close(conn.handle);
+        conn.handle = nullptr;
+    }
+
+    // 结束连接上的查询并恢复等待的协程。连接断开时只关闭句柄，由 dispatch 按重连间隔交给重连线程。
+    // 协程在 reactor 线程上继续执行到下一次 co_await，其间不能有阻塞调用
+    void finish(Loop& loop, Connection& conn, bool ok) {
+        Query* query = conn.query;
+        conn.query = nullptr;
+        conn.storing = false;
+        query->ok = ok;
+        if (!ok) {
+            failureCount.fetch_add(1, memory_order_relaxed);
+            unsigned int err = conn.handle ? mysql_errno(conn.handle) : 0;
+            if (conn.handle) {
+                logError("异步查询失败: ", mysql_error(conn.handle));
+            }
+            if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+                disconnect(loop, conn);
+                conn.lastConnectAttempt = chrono::steady_clock::now();
+            }
+        }
+        inFlight.fetch_sub(1, memory_order_relaxed);
+        query->waiter.resume();
+    }
+
+    // 推进连接上的查询；未就绪时直接返回，等待下一次可读事件
+    void step(Loop& loop, Connection& conn) {
+        Query* query = conn.query;
+        if (!query) return;
+
+        if (!conn.storing) {
+            net_async_status status = mysql_real_query_nonblocking(conn.handle, query->text.data(),
+                static_cast<unsigned long>(query->text.size()));
+            if (status == NET_ASYNC_NOT_READY) return;
+            if (status == NET_ASYNC_ERROR) {
+                finish(loop, conn, false);
+                return;
+            }
+            conn.storing = true;
+        }
+
+        MYSQL_RES* result = nullptr;
+        net_async_status status = mysql_store_result_nonblocking(conn.handle, &result);
+        if (status == NET_ASYNC_NOT_READY) return;
+        if (status == NET_ASYNC_ERROR) {
+            finish(loop, conn, false);
+            return;
+        }
+
+        if (result) {
+            while (MYSQL_ROW row = mysql_fetch_row(result)) {
+                vector<string> values(query->columns);
+                for (size_t i = 0; i < query->columns; ++i) {
+                    if (row[i]) values[i] = row[i];
+                }
+                query->rows.push_back(move(values));
+            }
+            mysql_free_result(result);
+        }
+        finish(loop, conn, true);
+    }
+
+    // 连接上出现挂断、错误，或空闲时可读（MySQL 不会主动发数据，只能是对端关闭或发来断开前的错误包）：
+    // 进行中的查询先读出结果或错误，然后关闭连接，由 dispatch 按重连间隔重连。
+    // 不关闭的话水平触发的可读事件会一直到来，reactor 线程空转
+    void drop(Loop& loop, Connection& conn) {
+        if (conn.query) {
+            step(loop, conn);
+        }
+        if (conn.query) {
+            finish(loop, conn, false);
+        }
+        if (conn.handle) {
+            logWarn("异步查询连接被对端关闭，稍后重连");
+            disconnect(loop, conn);
+            conn.lastConnectAttempt = chrono::steady_clock::now();
+        }
+    }
+
+    // 把排队的查询分给空闲连接；查询同步完成时连接立即接下一条
+    void dispatch(Loop& loop) {
+        auto now = chrono::steady_clock::now();
+        for (auto& conn : loop.connections) {
+            if (loop.waiting.empty()) return;
+            if (!conn->handle) {
+                if (!conn->connecting && now - conn->lastConnectAttempt >= chrono::milliseconds(kReconnectIntervalMs)) {
+                    requestConnect(loop, *conn);
+                }
+                continue;
+            }
+            while (!conn->query && conn->handle && !loop.waiting.empty()) {
+                conn->query = loop.waiting.front();
+                loop.waiting.pop_front();
+                queryCount.fetch_add(1, memory_order_relaxed);
+                if (!bindLiterals(conn->handle, conn->query->sql, conn->query->params, conn->query->text)) {
+                    finish(loop, *conn, false);
+                    continue;
+                }
+                step(loop, *conn);
+            }
+        }
+    }
+
+    void failAll(deque<Query*>& queries) {
+        while (!queries.empty()) {
+            Query* query = queries.front();
+            queries.pop_front();
+            failureCount.fetch_add(1, memory_order_relaxed);
+            inFlight.fetch_sub(1, memory_order_relaxed);
+            query->ok = false;
+            query->waiter.resume();
+        }
+    }
+
+    void run(Loop& loop) {
+        epoll_event events[kMaxEvents];
+        auto lastTick = chrono::steady_clock::now();
+        chrono::steady_clock::time_point stopDeadline;
+        bool draining = false;
+
+        while (true) {
+            int ready = epoll_wait(loop.epollFd, events, kMaxEvents, kTickMs);
+            for (int i = 0; i < ready; ++i) {
+                Connection* conn = static_cast<Connection*>(events[i].data.ptr);
+                if (!conn) {
+                    uint64_t count = 0;
+                    ssize_t drained = read(loop.wakeFd, &count, sizeof(count));
+                    (void)drained;
+                    continue;
+                }
+                // 同一批事件中已被关闭的连接
+                if (!conn->handle) continue;
+                if ((events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) || !conn->query) {
+                    drop(loop, *conn);
+                    continue;
+                }
+                step(loop, *conn);
+            }
+
+            auto now = chrono::steady_clock::now();
+            if (now - lastTick >= chrono::milliseconds(kTickMs)) {
+                lastTick = now;
+                for (auto& conn : loop.connections) {
+                    step(loop, *conn);
+                }
+            }
+
+            deque<pair<Connection*, MYSQL*>> connected;
+            {
+                lock_guard<mutex> lock(loop.mtx);
+                loop.waiting.insert(loop.waiting.end(), loop.incoming.begin(), loop.incoming.end());
+                loop.incoming.clear();
+                connected.swap(loop.connected);
+            }
+            for (auto& result : connected) {
+                result.first->connecting = false;
+                if (!attach(loop, *result.first, result.second)) {
+                    result.first->lastConnectAttempt = now;
+                }
+            }
+
+            if (!stopping.load(memory_order_acquire)) {
+                dispatch(loop);
+                continue;
+            }
+
+            // 停止：排队的查询直接失败，进行中的查询最多再等待 kStopTimeoutMs
+            failAll(loop.waiting);
+            if (!draining) {
+                draining = true;
+                stopDeadline = now + chrono::milliseconds(kStopTimeoutMs);
+            }
+            bool busy = false;
+            for (auto& conn : loop.connections) {
+                busy = busy || conn->query != nullptr;
+            }
+            if (busy && now < stopDeadline) {
+                continue;
+            }
+            for (auto& conn : loop.connections) {
+                if (conn->query) {
+                    finish(loop, *conn, false);
+                }
+            }
+            deque<pair<Connection*, MYSQL*>> late;
+            {
+                lock_guard<mutex> lock(loop.mtx);
+                loop.closed = true;
+                loop.waiting.swap(loop.incoming);
+                late.swap(loop.connected);
+            }
+            failAll(loop.waiting);
+            for (auto& result : late) {
+                if (result.second) mysql_close(result.second);
+            }
+            break;
+        }
+
+        for (auto& conn : loop.connections) {
+            disconnect(loop, *conn);
+        }
+    }
+
+public:
+    MySQLReactor() = default;
+    MySQLReactor(const MySQLReactor&) = delete;
+    MySQLReactor& operator=(const MySQLReactor&) = delete;
+
+    ~MySQLReactor() { stop(); }
+
+    bool start(const DBConfig& cfg, const atomic<bool>& uniqueKey) {
+        config = cfg;
+        verifyKeyUnique = &uniqueKey;
+        int threads = config.asyncReactorThreads > 0 ? config.asyncReactorThreads : 1;
+        size_t perThread = config.asyncConnectionsPerThread > 0 ? config.asyncConnectionsPerThread : 1;
+        stopping.store(false);
+
+        size_t opened = 0;
+        for (int t = 0; t < threads; ++t) {
+            unique_ptr<Loop> loop(new Loop());
+            loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+            loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &event);
+
+            for (size_t c = 0; c < perThread; ++c) {
+                loop->connections.emplace_back(new Connection());
+                Connection& conn = *loop->connections.back();
+                conn.lastConnectAttempt = chrono::steady_clock::now();
+                if (attach(*loop, conn, openMySQLHandle(config))) {
+                    ++opened;
+                }
+            }
+            loops.push_back(move(loop));
+        }
+
+        if (opened == 0) {
+            logError("异步查询连接全部建立失败");
+            for (auto& loop : loops) {
+                close(loop->epollFd);
+                close(loop->wakeFd);
+            }
+            loops.clear();
+            return false;
+        }
+
+        connectorStopping = false;
+        connector = thread([this]() { runConnector(); });
+        for (auto& loop : loops) {
+            Loop* target = loop.get();
+            loop->worker = thread([this, target]() { run(*target); });
+        }
+        running = true;
+        logInfo("异步查询已启动，reactor 线程 ", threads, " 个，连接 ", opened, " 条");
+        return true;
+    }
+
+    void stop() {
+        if (!running) return;
+        stopping.store(true, memory_order_release);
+        for (auto& loop : loops) {
+            uint64_t one = 1;
+            ssize_t written = write(loop->wakeFd, &one, sizeof(one));
+            (void)written;
+        }
+        for (auto& loop : loops) {
+            if (loop->worker.joinable()) {
+                loop->worker.join();
+            }
+        }
+        // 重连线程可能仍在建立连接，结束后由它自己关闭（loop 已标记 closed）
+        {
+            lock_guard<mutex> lock(connectorMtx);
+            connectorStopping = true;
+            connectRequests.clear();
+        }
+        connectorCv.notify_all();
+        if (connector.joinable()) {
+            connector.join();
+        }
+        // 等仍在 submit 中的线程离开后再关闭 eventfd
+        unique_lock<shared_timed_mutex> guard(loopsMtx);
+        for (auto& loop : loops) {
+            close(loop->epollFd);
+            close(loop->wakeFd);
+        }
+        loops.clear();
+        running = false;
+    }
+
+    QueryAwaiter execute(Query& query) { return QueryAwaiter(*this, query); }
+
+    // 以下与 MySQLStorage 的同名方法语义一致
+    Task<StorageStatus> lookupConfig(const string& clientIP, const string& domain, string& expireTime) {
+        const StatementDef& def = kStatementDefs[schemaLayout(config)][STMT_CONFIG_EXPIRE];
+        string name = config.compactSchema ? normalizeDomain(domain) : domain;
+        Query query;
+        query.sql = def.sql;
+        query.params = { clientIP, name };
+        query.columns = def.resultColumns;
+        co_await execute(query);
+        if (!query.ok) co_return STORAGE_ERROR;
+        if (query.rows.empty()) co_return STORAGE_NOT_FOUND;
+        expireTime = move(query.rows[0][0]);
+        co_return STORAGE_OK;
+    }
+
+    Task<StorageStatus> insertVerification(const VerificationRow& row) {
+        Query query;
+        string name = config.compactSchema ? normalizeDomain(row.domain) : row.domain;
+        StatementId insert = config.partitionVerifications ? STMT_REPLACE_VERIFICATION : STMT_INSERT_VERIFICATION;
+        query.sql = kStatementDefs[schemaLayout(config)][insert].sql;
+        query.params = { row.clientIP, name, row.expireTime };
+        co_await execute(query);
+        co_return query.ok ? STORAGE_OK : STORAGE_ERROR;
+    }
+
+    Task<StorageStatus> findActive(const string& clientIP, const string& domain, FindRecord& out) {
+        const StatementDef& def = kStatementDefs[schemaLayout(config)][verifyKeyUnique->load() ? STMT_FIND_ACTIVE : STMT_FIND_LATEST];
+        string name = config.compactSchema ? normalizeDomain(domain) : domain;
+        Query query;
+        query.sql = def.sql;
+        query.params = { clientIP, name };
+        query.columns = def.resultColumns;
+        co_await execute(query);
+        if (!query.ok) co_return STORAGE_ERROR;
+        if (query.rows.empty()) co_return STORAGE_NOT_FOUND;
+
+        vector<string>& row = query.rows[0];
+        out.clientIP = clientIP;
+        out.domain = domain;
+        out.expireTime = move(row[0]);
+        out.targetIP = move(row[1]);
+        out.expireAt = atoll(row[2].c_str());
+        co_return STORAGE_OK;
+    }
+
+    void appendMetrics(string& out) const {
+        Metrics::writeValue(out, "dns_auth_async_queries_total", "counter", "Queries executed on non-blocking connections.", queryCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_async_query_failures_total", "counter", "Non-blocking queries that failed or were rejected during shutdown.", failureCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_async_reconnects_total", "counter", "Non-blocking connections re-established.", reconnectCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_async_in_flight", "gauge", "Queries submitted to the reactor and not yet completed.", static_cast<uint64_t>(max<int64_t>(0, inFlight.load(memory_order_relaxed))));
+    }
+};
+#endif
+
+// 文件与校验工具（嵌入式存储与启动快照共用），整数均按小端读写
+// CRC-32（IEEE），按 8 字节一组查表（slicing-by-8），启动快照校验整个文件时不成为瓶颈
+inline uint32_t crc32Of(const char* data, size_t len) {
+    static const vector<uint32_t> table = []() {
+        vector<uint32_t> t(256 * 8);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) t[k * 256 + i] = (t[(k - 1) * 256 + i] >> 8) ^ t[t[(k - 1) * 256 + i] & 0xFF];
+        }
+        return t;
+    }();
+    const uint32_t* t = table.data();
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint32_t lo = crc ^ (static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+            (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24));
+        crc = t[7 * 256 + (lo & 0xFF)] ^ t[6 * 256 + ((lo >> 8) & 0xFF)] ^
+            t[5 * 256 + ((lo >> 16) & 0xFF)] ^ t[4 * 256 + (lo >> 24)] ^
+            t[3 * 256 + p[4]] ^ t[2 * 256 + p[5]] ^ t[1 * 256 + p[6]] ^ t[p[7]];
+    }
+    for (; len > 0; --len, ++p) {
+        crc = t[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+inline void putU32(string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+inline uint32_t getU32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) v = (v << 8) | static_cast<unsigned char>(p[i]);
+    return v;
+}
+
+inline FILE* openFile(const string& path, const char* mode) {
+#ifdef _WIN32
+    FILE* f = nullptr;
+    return fopen_s(&f, path.c_str(), mode) == 0 ? f : nullptr;
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+inline void syncFile(FILE* f) {
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+}
+
+// 写临时文件再改名替换；同一目标可能由多个进程各自重写，临时文件名带上进程号
+inline string tempPathFor(const string& path) {
+#ifdef _WIN32
+    return path + "." + to_string(_getpid()) + ".tmp";
+#else
+    return path + "." + to_string(getpid()) + ".tmp";
+#endif
+}
+
+inline bool replaceFile(const string& from, const string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+inline void makeDirectory(const string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+// 嵌入式存储引擎：全部数据保存在内存哈希索引中，写操作先追加到日志文件再更新索引；
+// 后台线程在日志累计到一定记录数后把当前状态写成快照并截断日志。启动时加载快照再重放日志。
+// 日志记录格式：[长度 u32][CRC32 u32][类型 u8][字段...]，每个字段为 [长度 u16][字节]，整数均为小端。
+class EmbeddedStorage : public DNSAuthStorage {
+private:
+    enum RecordType {
+        REC_WHITELIST = 1,      // id, ip, description
+        REC_CONFIG,             // client_ip, domain, expire_time, status
+        REC_MAPPING,            // domain, target_ip
+        REC_VERIFICATION,       // client_ip, domain, expire_time
+        REC_WHITELIST_LIMIT     // ip, rate, burst
+    };
+
+    static const uint32_t kMaxRecordSize = 1 << 20;
+
+    struct ConfigEntry {
+        string expireTime;
+        int64_t expireAt = 0;
+        int status = 1;
+    };
+
+    // 每个 (client_ip, domain) 只保留最后写入的一条：后写入的记录覆盖先前的到期时间，即使到期时间更早
+    struct VerificationEntry {
+        string clientIP;
+        string domain;
+        string expireTime;
+        int64_t expireAt = 0;
+    };
+
+    ServerConfig config;
+    string logPath;
+    string snapshotPath;
+
+    // 写操作持有独占锁完成“追加日志 + 更新索引”，日志顺序与索引更新顺序一致
+    shared_timed_mutex indexMtx;
+    vector<WhitelistEntry> whitelist;
+    unordered_set<string> whitelistIndex;
+    IPPrefixTrie whitelistPrefixes;                         // 白名单条目（单个 IP 或 CIDR）的前缀树
+    unordered_map<string, ConfigEntry> configs;             // foldedKey(client_ip, domain)
+    unordered_map<string, string> mappings;                 // 小写 domain -> target_ip
+    unordered_map<string, VerificationEntry> verifications; // foldedKey(client_ip, domain)
+    int64_t nextWhitelistId = 1;
+
+    // 日志文件只在独占锁下追加；快照在共享锁下截断日志（此时不可能有写请求），多个快照由 snapshotWriteMtx 串行化
+    FILE* logFile = nullptr;
+    atomic<uint64_t> logRecords{ 0 };
+    mutex snapshotWriteMtx;
+
+    mutex snapshotMtx;
+    condition_variable snapshotCv;
+    thread snapshotter;
+    bool stopping = false;
+
+    atomic<uint64_t> snapshotCount{ 0 };
+    atomic<uint64_t> appendedRecords{ 0 };
+
+    static string lowerCase(const string& text) {
+        string out(text);
+        for (char& c : out) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return out;
+    }
+
+    // 追加一条记录到 out
+    static void encodeRecord(string& out, RecordType type, initializer_list<reference_wrapper<const string>> fields) {
+        string payload(1, static_cast<char>(type));
+        for (const string& field : fields) {
+            size_t len = field.size() < 0xFFFF ? field.size() : 0xFFFF;
+            payload += static_cast<char>(len & 0xFF);
+            payload += static_cast<char>((len >> 8) & 0xFF);
+            payload.append(field.data(), len);
+        }
+        putU32(out, static_cast<uint32_t>(payload.size()));
+        putU32(out, crc32Of(payload.data(), payload.size()));
+        out += payload;
+    }
+
+    void applyWhitelist(int64_t id, const string& ip) {
+        if (!whitelistIndex.insert(ip).second) {
+            return;
+        }
+        IPAddress addr;
+        int prefixLen = 0;
+        if (parseIPPrefix(ip, addr, prefixLen)) {
+            whitelistPrefixes.insert(addr, prefixLen);
+        }
+        else {
+            logWarn("忽略无法解析的白名单条目: ", ip);
+        }
+        WhitelistEntry entry;
+        entry.id = id;
+        entry.ip = ip;
+        whitelist.push_back(move(entry));
+        if (id >= nextWhitelistId) nextWhitelistId = id + 1;
+    }
+
+    void applyWhitelistLimit(const string& ip, const RateLimit& limit) {
+        for (WhitelistEntry& entry : whitelist) {
+            if (entry.ip == ip) {
+                entry.limit = limit;
+                return;
+            }
+        }
+    }
+
+    void applyConfig(const string& clientIP, const string& domain, const string& expireTime, int status) {
+        ConfigEntry& entry = configs[foldedKey(clientIP, domain)];
+        entry.expireTime = expireTime;
+        entry.expireAt = parseDateTime(expireTime);
+        entry.status = status;
+    }
+
+    void applyMapping(const string& domain, const string& targetIP) {
+        mappings[lowerCase(domain)] = targetIP;
+    }
+
+    void applyVerification(const VerificationRow& row, int64_t expireAt) {
+        VerificationEntry& entry = verifications[foldedKey(row.clientIP, row.domain)];
+        entry.clientIP = row.clientIP;
+        entry.domain = row.domain;
+        entry.expireTime = row.expireTime;
+        entry.expireAt = expireAt;
+    }
+
+    // 应用一条已解码的记录（加载快照与重放日志共用）
+    bool applyRecord(const char* payload, size_t len) {
+        if (len < 1) return false;
+        int type = static_cast<unsigned char>(payload[0]);
+        vector<string> fields;
+        size_t pos = 1;
+        while (pos < len) {
+            if (pos + 2 > len) return false;
+            size_t fieldLen = static_cast<unsigned char>(payload[pos]) |
+                (static_cast<size_t>(static_cast<unsigned char>(payload[pos + 1])) << 8);
+            pos += 2;
+            if (pos + fieldLen > len) return false;
+            fields.emplace_back(payload + pos, fieldLen);
+            pos += fieldLen;
+        }
+
+        switch (type) {
+        case REC_WHITELIST:
+            if (fields.size() != 3) return false;
+            applyWhitelist(atoll(fields[0].c_str()), fields[1]);
+            return true;
+        case REC_CONFIG:
+            if (fields.size() != 4) return false;
+            applyConfig(fields[0], fields[1], fields[2], atoi(fields[3].c_str()));
+            return true;
+        case REC_MAPPING:
+            if (fields.size() != 2) return false;
+            applyMapping(fields[0], fields[1]);
+            return true;
+        case REC_WHITELIST_LIMIT: {
+            if (fields.size() != 3) return false;
+            RateLimit limit;
+            limit.rate = static_cast<uint32_t>(strtoul(fields[1].c_str(), nullptr, 10));
+            limit.burst = static_cast<uint32_t>(strtoul(fields[2].c_str(), nullptr, 10));
+            applyWhitelistLimit(fields[0], limit);
+            return true;
+        }
+        case REC_VERIFICATION: {
+            if (fields.size() != 3) return false;
+            VerificationRow row;
+            row.clientIP = fields[0];
+            row.domain = fields[1];
+            row.expireTime = fields[2];
+            applyVerification(row, parseDateTime(row.expireTime));
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // 读取并应用文件中的全部记录；返回是否读到文件末尾（遇到损坏或不完整的尾部返回 false）
+    bool replayFile(const string& path, uint64_t& records) {
+        FILE* f = openFile(path, "rb");
+        if (!f) {
+            return true;
+        }
+
+        bool clean = true;
+        char header[8];
+        string payload;
+        while (true) {
+            size_t n = fread(header, 1, sizeof(header), f);
+            if (n == 0) break;
+            if (n != sizeof(header)) { clean = false; break; }
+
+            uint32_t len = getU32(header);
+            uint32_t crc = getU32(header + 4);
+            if (len == 0 || len > kMaxRecordSize) { clean = false; break; }
+            payload.resize(len);
+            if (fread(&payload[0], 1, len, f) != len || crc32Of(payload.data(), len) != crc ||
+                !applyRecord(payload.data(), len)) {
+                clean = false;
+                break;
+            }
+            ++records;
+        }
+        fclose(f);
+        return clean;
+    }
+
+    // 追加记录并刷盘，调用方持有独占锁
+    bool appendLocked(const string& records, uint64_t count) {
+        if (!logFile) {
+            return false;
+        }
+        if (fwrite(records.data(), 1, records.size(), logFile) != records.size() || fflush(logFile) != 0) {
+            logError("写入嵌入式存储日志失败: ", logPath);
+            return false;
+        }
+        if (config.embeddedFsync) {
+            syncFile(logFile);
+        }
+        logRecords.fetch_add(count, memory_order_relaxed);
+        appendedRecords.fetch_add(count, memory_order_relaxed);
+        return true;
+    }
+
+    // 把当前状态写成快照并截断日志。持有共享锁：读请求不受影响，写请求等待快照完成
+    bool writeSnapshot() {
+        lock_guard<mutex> writeLock(snapshotWriteMtx);
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        string tmpPath = tempPathFor(snapshotPath);
+        FILE* f = openFile(tmpPath, "wb");
+        if (!f) {
+            logError("创建快照文件失败: ", tmpPath);
+            return false;
+        }
+
+        string buffer;
+        bool ok = true;
+        auto flushBuffer = [&buffer, &ok, f](bool force) {
+            if (ok && (force || buffer.size() >= (1 << 20))) {
+                ok = fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+                buffer.clear();
+            }
+        };
+
+        const string noDescription;
+        for (const WhitelistEntry& entry : whitelist) {
+            string id = to_string(entry.id);
+            encodeRecord(buffer, REC_WHITELIST, { id, entry.ip, noDescription });
+            if (entry.limit.rate != 0 || entry.limit.burst != 0) {
+                string rate = to_string(entry.limit.rate);
+                string burst = to_string(entry.limit.burst);
+                encodeRecord(buffer, REC_WHITELIST_LIMIT, { entry.ip, rate, burst });
+            }
+            flushBuffer(false);
+        }
+        for (const auto& entry : configs) {
+            // 键已折叠为小写，快照中保存折叠后的值，查询同样按折叠键进行
+            string clientIP;
+            string domain;
+            splitFoldedKey(entry.first, clientIP, domain);
+            string status = to_string(entry.second.status);
+            encodeRecord(buffer, REC_CONFIG, { clientIP, domain, entry.second.expireTime, status });
+            flushBuffer(false);
+        }
+        for (const auto& entry : mappings) {
+            encodeRecord(buffer, REC_MAPPING, { entry.first, entry.second });
+            flushBuffer(false);
+        }
+        for (const auto& entry : verifications) {
+            encodeRecord(buffer, REC_VERIFICATION, { entry.second.clientIP, entry.second.domain, entry.second.expireTime });
+            flushBuffer(false);
+        }
+        flushBuffer(true);
+
+        ok = ok && fflush(f) == 0;
+        if (ok) syncFile(f);
+        fclose(f);
+        if (!ok || !replaceFile(tmpPath, snapshotPath)) {
+            logError("写入快照失败: ", snapshotPath);
+            remove(tmpPath.c_str());
+            return false;
+        }
+
+        // 快照已包含日志中的全部记录；写请求此时都在等待锁，可以安全截断日志
+        if (logFile) fclose(logFile);
+        logFile = openFile(logPath, "wb");
+        logRecords.store(0, memory_order_relaxed);
+        snapshotCount.fetch_add(1, memory_order_relaxed);
+        return logFile != nullptr;
+    }
+
+    void runSnapshotter() {
+        unique_lock<mutex> lock(snapshotMtx);
+        while (!stopping) {
+            snapshotCv.wait_for(lock, chrono::seconds(config.embeddedSnapshotIntervalSec));
+            if (stopping) break;
+
+            if (logRecords.load(memory_order_relaxed) >= config.embeddedSnapshotMinRecords) {
+                lock.unlock();
+                writeSnapshot();
+                lock.lock();
+            }
+        }
+    }
+
+public:
+    explicit EmbeddedStorage(const ServerConfig& cfg)
+        : config(cfg), logPath(logFilePath(cfg.embeddedDataDir)), snapshotPath(snapshotFilePath(cfg.embeddedDataDir)) {}
+
+    ~EmbeddedStorage() { close(); }
+
+    static string logFilePath(const string& dir) { return dir + "/dns_auth.log"; }
+    static string snapshotFilePath(const string& dir) { return dir + "/dns_auth.snapshot"; }
+
+    const char* name() const override { return "embedded"; }
+
+    bool open() override {
+        makeDirectory(config.embeddedDataDir);
+
+        uint64_t snapshotRecords = 0;
+        uint64_t replayed = 0;
+        bool clean;
+        {
+            unique_lock<shared_timed_mutex> lock(indexMtx);
+            if (!replayFile(snapshotPath, snapshotRecords)) {
+                logError("快照文件损坏: ", snapshotPath);
+                return false;
+            }
+            clean = replayFile(logPath, replayed);
+            logRecords.store(replayed, memory_order_relaxed);
+        }
+        logInfo("嵌入式存储已加载，快照记录数: ", snapshotRecords, "，重放日志记录数: ", replayed);
+
+        if (clean) {
+            logFile = openFile(logPath, "ab");
+        }
+        else {
+            // 日志尾部不完整（写入中途崩溃），立即做一次快照以丢弃损坏的尾部
+            logWarn("嵌入式存储日志尾部不完整，已忽略损坏部分: ", logPath);
+            writeSnapshot();
+        }
+        if (!logFile) {
+            logError("打开嵌入式存储日志失败: ", logPath);
+            return false;
+        }
+
+        stopping = false;
+        snapshotter = thread([this]() { runSnapshotter(); });
+        return true;
+    }
+
+    void close() override {
+        {
+            lock_guard<mutex> lock(snapshotMtx);
+            stopping = true;
+        }
+        snapshotCv.notify_all();
+        if (snapshotter.joinable()) {
+            snapshotter.join();
+        }
+
+        unique_lock<shared_timed_mutex> lock(indexMtx);
+        if (logFile) {
+            fclose(logFile);
+            logFile = nullptr;
+        }
+    }
+
+    // 手动触发快照
+    bool snapshot() { return writeSnapshot(); }
+
+    bool loadWhitelist(int64_t afterId, vector<WhitelistEntry>& out) override {
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        for (const WhitelistEntry& entry : whitelist) {
+            if (entry.id > afterId) out.push_back(entry);
+        }
+        return true;
+    }
+
+    bool whitelistSummary(uint64_t& count, int64_t& maxId) override {
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        count = whitelist.size();
+        maxId = whitelist.empty() ? 0 : whitelist.back().id;
+        return true;
+    }
+
+    // 与内存白名单一致：IP 命中任一条目（单个 IP 或 CIDR 前缀）即在白名单中
+    StorageStatus whitelistContains(const string& ip) override {
+        IPAddress addr;
+        bool parsed = parseIPAddress(ip, addr);
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        if (whitelistIndex.count(ip) > 0 || (parsed && whitelistPrefixes.contains(addr))) {
+            return STORAGE_OK;
+        }
+        return STORAGE_NOT_FOUND;
+    }
+
+    StorageStatus lookupConfig(const string& clientIP, const string& domain, string& expireTime) override {
+        string key = foldedKey(clientIP, domain);
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        auto it = configs.find(key);
+        if (it == configs.end() || it->second.status != 1) {
+            return STORAGE_NOT_FOUND;
+        }
+        expireTime = it->second.expireTime;
+        return STORAGE_OK;
+    }
+
+    StorageStatus lookupConfigs(const string& clientIP, const vector<const string*>& domains,
+        vector<ConfigRecord>& out) override {
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        for (const string* domain : domains) {
+            auto it = configs.find(foldedKey(clientIP, *domain));
+            if (it != configs.end() && it->second.status == 1) {
+                ConfigRecord record;
+                record.domain = *domain;
+                record.expireTime = it->second.expireTime;
+                out.push_back(move(record));
+            }
+        }
+        return STORAGE_OK;
+    }
+
+    StorageStatus insertVerifications(const VerificationRow* rows, size_t count) override {
+        if (count == 0) {
+            return STORAGE_OK;
+        }
+        vector<int64_t> expireAts(count);
+        for (size_t i = 0; i < count; ++i) {
+            expireAts[i] = parseDateTime(rows[i].expireTime);
+        }
+
+        // 与 MySQL 的唯一键一致：每个键以最后写入的到期时间为准，到期时间不变的行不写日志
+        unique_lock<shared_timed_mutex> lock(indexMtx);
+        string records;
+        vector<size_t> changed;
+        for (size_t i = 0; i < count; ++i) {
+            auto it = verifications.find(foldedKey(rows[i].clientIP, rows[i].domain));
+            if (it != verifications.end() && it->second.expireTime == rows[i].expireTime) {
+                continue;
+            }
+            encodeRecord(records, REC_VERIFICATION, { rows[i].clientIP, rows[i].domain, rows[i].expireTime });
+            changed.push_back(i);
+        }
+        if (changed.empty()) {
+            return STORAGE_OK;
+        }
+        if (!appendLocked(records, changed.size())) {
+            return STORAGE_ERROR;
+        }
+        for (size_t i : changed) {
+            applyVerification(rows[i], expireAts[i]);
+        }
+        return STORAGE_OK;
+    }
+
+    StorageStatus findActive(const string& clientIP, const string& domain, FindRecord& out) override {
+        string key = foldedKey(clientIP, domain);
+        string domainKey = lowerCase(domain);
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        auto it = verifications.find(key);
+        if (it == verifications.end()) {
+            return STORAGE_NOT_FOUND;
+        }
+        auto mapping = mappings.find(domainKey);
+        out.clientIP = clientIP;
+        out.domain = domain;
+        out.expireTime = it->second.expireTime;
+        out.targetIP = mapping == mappings.end() ? string() : mapping->second;
+        out.expireAt = it->second.expireAt;
+        return STORAGE_OK;
+    }
+
+    StorageStatus findActiveBatch(const vector<pair<const string*, const string*>>& keys,
+        vector<FindRecord>& out) override {
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        for (const auto& key : keys) {
+            auto it = verifications.find(foldedKey(*key.first, *key.second));
+            if (it == verifications.end()) {
+                continue;
+            }
+            auto mapping = mappings.find(lowerCase(*key.second));
+            FindRecord record;
+            record.clientIP = *key.first;
+            record.domain = *key.second;
+            record.expireTime = it->second.expireTime;
+            record.targetIP = mapping == mappings.end() ? string() : mapping->second;
+            record.expireAt = it->second.expireAt;
+            out.push_back(move(record));
+        }
+        return STORAGE_OK;
+    }
+
+    // 索引键本身就是 foldedKey
+    bool scanFindKeys(const function<void(const string& key)>& visit) override {
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        for (const auto& entry : verifications) {
+            visit(entry.first);
+        }
+        for (const auto& entry : configs) {
+            visit(entry.first);
+        }
+        return true;
+    }
+
+    bool addWhitelist(const string& ip, const string& description) override {
+        unique_lock<shared_timed_mutex> lock(indexMtx);
+        if (whitelistIndex.count(ip) > 0) {
+            return true;
+        }
+        int64_t id = nextWhitelistId;
+        string idText = to_string(id);
+        string records;
+        encodeRecord(records, REC_WHITELIST, { idText, ip, description });
+        if (!appendLocked(records, 1)) {
+            return false;
+        }
+        applyWhitelist(id, ip);
+        return true;
+    }
+
+    bool setWhitelistLimit(const string& ip, const RateLimit& limit) override {
+        string rate = to_string(limit.rate);
+        string burst = to_string(limit.burst);
+        string records;
+        encodeRecord(records, REC_WHITELIST_LIMIT, { ip, rate, burst });
+        unique_lock<shared_timed_mutex> lock(indexMtx);
+        if (whitelistIndex.count(ip) == 0) {
+            return true;
+        }
+        if (!appendLocked(records, 1)) {
+            return false;
+        }
+        applyWhitelistLimit(ip, limit);
+        return true;
+    }
+
+    bool upsertDomainConfig(const string& clientIP, const string& domain,
+        const string& expireTime, int status) override {
+        string statusText = to_string(status);
+        string records;
+        encodeRecord(records, REC_CONFIG, { clientIP, domain, expireTime, statusText });
+        unique_lock<shared_timed_mutex> lock(indexMtx);
+        if (!appendLocked(records, 1)) {
+            return false;
+        }
+        applyConfig(clientIP, domain, expireTime, status);
+        return true;
+    }
+
+    bool upsertDomainMapping(const string& domain, const string& targetIP) override {
+        string records;
+        encodeRecord(records, REC_MAPPING, { domain, targetIP });
+        unique_lock<shared_timed_mutex> lock(indexMtx);
+        if (!appendLocked(records, 1)) {
+            return false;
+        }
+        applyMapping(domain, targetIP);
+        return true;
+    }
+
+    // 批量导入：整批编码后一次追加，写入成功才更新索引
+    bool upsertDomainConfigs(const DomainConfigRow* rows, size_t count) override {
+        string records;
+        for (size_t i = 0; i < count; ++i) {
+            string statusText = to_string(rows[i].status);
+            encodeRecord(records, REC_CONFIG, { rows[i].clientIP, rows[i].domain, rows[i].expireTime, statusText });
+        }
+        unique_lock<shared_timed_mutex> lock(indexMtx);
+        if (!appendLocked(records, count)) {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            applyConfig(rows[i].clientIP, rows[i].domain, rows[i].expireTime, rows[i].status);
+        }
+        return true;
+    }
+
+    bool upsertDomainMappings(const MappingRow* rows, size_t count) override {
+        string records;
+        for (size_t i = 0; i < count; ++i) {
+            encodeRecord(records, REC_MAPPING, { rows[i].domain, rows[i].targetIP });
+        }
+        unique_lock<shared_timed_mutex> lock(indexMtx);
+        if (!appendLocked(records, count)) {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            applyMapping(rows[i].domain, rows[i].targetIP);
+        }
+        return true;
+    }
+
+    // 配置键已折叠为小写，导出的 client_ip 为规范写法、domain 为小写
+    bool listActiveConfigs(vector<DomainConfigRow>& out) override {
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        for (const auto& entry : configs) {
+            if (entry.second.status != 1) {
+                continue;
+            }
+            DomainConfigRow row;
+            splitFoldedKey(entry.first, row.clientIP, row.domain);
+            row.expireTime = entry.second.expireTime;
+            out.push_back(move(row));
+        }
+        return true;
+    }
+
+    bool listMappings(vector<MappingRow>& out) override {
+        shared_lock<shared_timed_mutex> lock(indexMtx);
+        for (const auto& entry : mappings) {
+            out.push_back({ entry.first, entry.second });
+        }
+        return true;
+    }
+
+    // 按哈希桶分批扫描（每个键只保留最新一条，没有被取代的记录）。删除不写日志，
+    // 本轮结束时重写快照并截断日志，被删除的记录不会在重启后恢复。扫描期间发生 rehash 时
+    // 个别键可能被跳过，留到下一轮处理
+    StorageStatus purgeVerifications(PurgeCursor& cursor, size_t span, int64_t expiredBefore) override {
+        {
+            unique_lock<shared_timed_mutex> lock(indexMtx);
+            size_t buckets = verifications.bucket_count();
+            if (cursor.end < 0) {
+                cursor.next = 0;
+                cursor.end = static_cast<int64_t>(buckets);
+            }
+
+            size_t from = static_cast<size_t>(cursor.next);
+            size_t to = from + span < buckets ? from + span : buckets;
+            vector<string> expired;
+            for (size_t b = from; b < to; ++b) {
+                for (auto it = verifications.begin(b); it != verifications.end(b); ++it) {
+                    if (it->second.expireAt < expiredBefore) {
+                        expired.push_back(it->first);
+                    }
+                }
+            }
+            for (const string& key : expired) {
+                verifications.erase(key);
+            }
+
+            cursor.deleted += expired.size();
+            cursor.next = static_cast<int64_t>(to);
+            cursor.done = cursor.next >= cursor.end || to >= buckets;
+        }
+
+        if (cursor.done && cursor.deleted > 0 && !writeSnapshot()) {
+            return STORAGE_ERROR;
+        }
+        return STORAGE_OK;
+    }
+
+    void appendMetrics(string& out) override {
+        uint64_t configCount, verificationCount;
+        {
+            shared_lock<shared_timed_mutex> lock(indexMtx);
+            configCount = configs.size();
+            verificationCount = verifications.size();
+        }
+        Metrics::writeValue(out, "dns_auth_embedded_configs", "gauge", "Domain configs held by the embedded engine.", configCount);
+        Metrics::writeValue(out, "dns_auth_embedded_verification_keys", "gauge", "Distinct (client_ip, domain) verification keys.", verificationCount);
+        Metrics::writeValue(out, "dns_auth_embedded_log_records", "gauge", "Records in the log since the last snapshot.", logRecords.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_embedded_appended_total", "counter", "Records appended to the log.", appendedRecords.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_embedded_snapshots_total", "counter", "Snapshots written.", snapshotCount.load(memory_order_relaxed));
+    }
+};
+
+// dns_verifications 写缓冲：多个请求线程入队，单个后台线程按批次合并为多行 INSERT（group commit）
+// 验证记录批次首次写入失败后延迟这么久再重试一次，给连接池重建连接留出时间
+static const int kVerifyRetryDelayMs = 200;
+
+class VerificationWriter {
+private:
+    struct PendingWrite {
+        VerificationRow row;
+        chrono::steady_clock::time_point enqueuedAt;
+        unique_ptr<promise<bool>> done;   // 仅 ACK_ON_COMMIT 模式下使用
+    };
+
+    // 首次写入失败、等待重试的批次
+    struct RetryBatch {
+        vector<PendingWrite> writes;
+        chrono::steady_clock::time_point retryAt;
+    };
+
+    ServerConfig config;
+    DNSAuthStorage* storage = nullptr;
+    VerifyCoalescer* coalescer = nullptr;
+    vector<VerificationRow> rows;   // 仅后台线程使用，批次之间复用
+    deque<RetryBatch> retries;      // 仅后台线程使用，按重试时刻先后排列
+
+    mutex mtx;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    deque<PendingWrite> queue;
+    thread worker;
+    bool stopping = false;
+    bool running = false;
+
+    atomic<uint64_t> batchCount{ 0 };
+    atomic<uint64_t> rowCount{ 0 };
+    atomic<uint64_t> rejectedCount{ 0 };
+    atomic<uint64_t> failedCount{ 0 };
+
+    // 写入一个批次。存储层只在原连接上就地重连一次；借不到连接或重连失败时，首次写入的批次带着重试时刻
+    // 放入 retries，后台线程继续写其他批次，到时换一条连接再试一次，仍失败则丢弃
+    void flush(vector<PendingWrite>& batch, bool retrying) {
+        rows.clear();
+        for (auto& pending : batch) {
+            rows.push_back(std::move(pending.row));
+        }
+        bool ok = storage->insertVerifications(rows.data(), rows.size()) == STORAGE_OK;
+        if (!ok && !retrying) {
+            logWarn("验证记录批次写入失败，", kVerifyRetryDelayMs, "ms 后重试 ", batch.size(), " 行");
+            for (size_t i = 0; i < batch.size(); ++i) {
+                batch[i].row = std::move(rows[i]);
+            }
+            RetryBatch retry;
+            retry.writes = std::move(batch);
+            retry.retryAt = chrono::steady_clock::now() + chrono::milliseconds(kVerifyRetryDelayMs);
+            retries.push_back(std::move(retry));
+            batch.clear();
+            return;
+        }
+
+        batchCount.fetch_add(1, memory_order_relaxed);
+        if (ok) {
+            rowCount.fetch_add(batch.size(), memory_order_relaxed);
+            // 提交之后才开始合并窗口，失败的记录不会让后续重复 verify 被直接应答
+            if (coalescer) {
+                for (const VerificationRow& row : rows) {
+                    coalescer->record(foldedKey(row.clientIP, row.domain), row.expireTime);
+                }
+            }
+        }
+        else {
+            failedCount.fetch_add(batch.size(), memory_order_relaxed);
+            logError("验证记录批次重试后仍写入失败，丢弃 ", batch.size(), " 行");
+        }
+
+        for (auto& row : batch) {
+            if (row.done) row.done->set_value(ok);
+        }
+        batch.clear();
+    }
+
+    void run() {
+        vector<PendingWrite> batch;
+        batch.reserve(config.verifyBatchSize);
+
+        auto flushInterval = chrono::milliseconds(config.verifyFlushIntervalMs);
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            auto now = chrono::steady_clock::now();
+            if (!retries.empty() && retries.front().retryAt <= now) {
+                RetryBatch retry = std::move(retries.front());
+                retries.pop_front();
+                lock.unlock();
+                flush(retry.writes, true);
+                lock.lock();
+                continue;
+            }
+            if (queue.empty() && retries.empty()) {
+                if (stopping) break;
+                notEmpty.wait(lock);
+                continue;
+            }
+
+            // 未攒满一批时等到最早一条的刷盘期限；有待重试的批次时最多等到它的重试时刻
+            bool ready = !queue.empty() &&
+                (queue.size() >= config.verifyBatchSize || stopping || queue.front().enqueuedAt + flushInterval <= now);
+            if (!ready) {
+                auto deadline = queue.empty() ? retries.front().retryAt : queue.front().enqueuedAt + flushInterval;
+                if (!retries.empty() && retries.front().retryAt < deadline) {
+                    deadline = retries.front().retryAt;
+                }
+                notEmpty.wait_until(lock, deadline);
+                continue;
+            }
+
+            size_t n = queue.size() < config.verifyBatchSize ? queue.size() : config.verifyBatchSize;
+            for (size_t i = 0; i < n; ++i) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            lock.unlock();
+            notFull.notify_all();
+
+            flush(batch, false);
+            lock.lock();
+        }
+    }
+
+public:
+    VerificationWriter() = default;
+    VerificationWriter(const VerificationWriter&) = delete;
+    VerificationWriter& operator=(const VerificationWriter&) = delete;
+
+    ~VerificationWriter() { stop(); }
+
+    // coalescer 非空时，批次提交后把其中的键记入 verify 合并窗口
+    void start(DNSAuthStorage& backend, const ServerConfig& cfg, VerifyCoalescer* verifyCoalescer = nullptr) {
+        config = cfg;
+        size_t maxBatch = static_cast<size_t>(1) << kMaxInsertChunkShift;
+        if (config.verifyBatchSize == 0) config.verifyBatchSize = 1;
+        if (config.verifyBatchSize > maxBatch) config.verifyBatchSize = maxBatch;
+        if (config.verifyQueueCapacity < config.verifyBatchSize) config.verifyQueueCapacity = config.verifyBatchSize;
+
+        storage = &backend;
+        coalescer = verifyCoalescer;
+        stopping = false;
+        running = true;
+        worker = thread([this]() { run(); });
+    }
+
+    // 提交一条验证记录；队列满时最多等待 verifyEnqueueTimeoutMs，mayWait 为 false 时不等待
+    // （在异步查询的 reactor 线程上提交时不能阻塞）
+    WriteSubmitResult submit(const string& clientIP, const string& domain, const string& expireTime, bool mayWait = true) {
+        bool waitCommit = config.verifyWriteMode == VERIFY_WRITE_ACK_ON_COMMIT;
+        future<bool> committed;
+
+        {
+            unique_lock<mutex> lock(mtx);
+            auto deadline = chrono::steady_clock::now() + chrono::milliseconds(mayWait ? config.verifyEnqueueTimeoutMs : 0);
+            if (!notFull.wait_until(lock, deadline, [this]() {
+                return queue.size() < config.verifyQueueCapacity || stopping;
+                }) || stopping || !running) {
+                rejectedCount.fetch_add(1, memory_order_relaxed);
+                return WRITE_QUEUE_FULL;
+            }
+
+            PendingWrite row;
+            row.row.clientIP = clientIP;
+            row.row.domain = domain;
+            row.row.expireTime = expireTime;
+            row.enqueuedAt = chrono::steady_clock::now();
+            if (waitCommit) {
+                row.done.reset(new promise<bool>());
+                committed = row.done->get_future();
+            }
+            queue.push_back(std::move(row));
+        }
+        notEmpty.notify_one();
+
+        if (waitCommit && !committed.get()) {
+            return WRITE_FAILED;
+        }
+        return WRITE_ACCEPTED;
+    }
+
+    size_t depth() {
+        lock_guard<mutex> lock(mtx);
+        return queue.size();
+    }
+
+    uint64_t batches() const { return batchCount.load(memory_order_relaxed); }
+    uint64_t rowsWritten() const { return rowCount.load(memory_order_relaxed); }
+    uint64_t rejected() const { return rejectedCount.load(memory_order_relaxed); }
+    uint64_t failed() const { return failedCount.load(memory_order_relaxed); }
+
+    // 停止并把队列中剩余记录全部写完
+    void stop() {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (!running) return;
+            stopping = true;
+        }
+        notEmpty.notify_all();
+        notFull.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        lock_guard<mutex> lock(mtx);
+        running = false;
+    }
+};
+
+// dns_verifications 数据保留：后台线程每隔 retentionIntervalSec 做一轮清理，删除过期超过宽限期的记录
+// 以及被同一 (client_ip, domain) 更晚记录取代的旧记录。每批只处理一小段主键范围，批次之间停顿，
+// 避免长时间持锁或占满磁盘带宽
+class VerificationRetention {
+private:
+    ServerConfig config;
+    DNSAuthStorage* storage = nullptr;
+
+    mutex mtx;
+    condition_variable wake;
+    thread worker;
+    bool stopping = false;
+    bool running = false;
+
+    atomic<uint64_t> passCount{ 0 };
+    atomic<uint64_t> batchCount{ 0 };
+    atomic<uint64_t> deletedCount{ 0 };
+    atomic<uint64_t> droppedPartitionCount{ 0 };
+    atomic<uint64_t> errorCount{ 0 };
+    atomic<uint64_t> lastPassDeleted{ 0 };
+    atomic<uint64_t> lastPassMs{ 0 };
+    atomic<int64_t> cursorNext{ 0 };     // 进行中的一轮的当前位置与结束位置，空闲时为 0
+    atomic<int64_t> cursorEnd{ 0 };
+
+    // 等待指定时长；期间收到停止通知时返回 false
+    bool pause(chrono::milliseconds duration) {
+        unique_lock<mutex> lock(mtx);
+        return !wake.wait_for(lock, duration, [this]() { return stopping; });
+    }
+
+    void runPass() {
+        auto started = chrono::steady_clock::now();
+        int64_t expiredBefore = static_cast<int64_t>(time(nullptr)) - config.retentionGraceSec;
+
+        uint64_t dropped = 0;
+        if (storage->maintainPartitions(expiredBefore, dropped)) {
+            droppedPartitionCount.fetch_add(dropped, memory_order_relaxed);
+        }
+        else {
+            errorCount.fetch_add(1, memory_order_relaxed);
+        }
+
+        PurgeCursor cursor;
+        bool interrupted = false;
+        while (!cursor.done) {
+            StorageStatus status = storage->purgeVerifications(cursor, config.retentionBatchRows, expiredBefore);
+            batchCount.fetch_add(1, memory_order_relaxed);
+            if (status != STORAGE_OK) {
+                errorCount.fetch_add(1, memory_order_relaxed);
+                logWarn("验证记录清理中断，位置: ", cursor.next, "，下一轮重试");
+                interrupted = true;
+                break;
+            }
+            cursorNext.store(cursor.next, memory_order_relaxed);
+            cursorEnd.store(cursor.end, memory_order_relaxed);
+            if (!cursor.done && !pause(chrono::milliseconds(config.retentionBatchPauseMs))) {
+                interrupted = true;
+                break;
+            }
+        }
+        cursorNext.store(0, memory_order_relaxed);
+        cursorEnd.store(0, memory_order_relaxed);
+
+        uint64_t elapsedMs = static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - started).count());
+        passCount.fetch_add(1, memory_order_relaxed);
+        deletedCount.fetch_add(cursor.deleted, memory_order_relaxed);
+        lastPassDeleted.store(cursor.deleted, memory_order_relaxed);
+        lastPassMs.store(elapsedMs, memory_order_relaxed);
+        logInfo(interrupted ? "验证记录清理未完成" : "验证记录清理完成", "，删除 ", cursor.deleted,
+            " 行，删除分区 ", dropped, " 个，耗时 ", elapsedMs, " ms");
+    }
+
+    void run() {
+        while (pause(chrono::seconds(config.retentionIntervalSec))) {
+            runPass();
+        }
+    }
+
+public:
+    VerificationRetention() = default;
+    VerificationRetention(const VerificationRetention&) = delete;
+    VerificationRetention& operator=(const VerificationRetention&) = delete;
+
+    ~VerificationRetention() { stop(); }
+
+    void start(DNSAuthStorage& backend, const ServerConfig& cfg) {
+        config = cfg;
+        if (config.retentionIntervalSec <= 0) config.retentionIntervalSec = 1;
+        if (config.retentionBatchRows == 0) config.retentionBatchRows = 1;
+        if (config.retentionBatchPauseMs < 0) config.retentionBatchPauseMs = 0;
+
+        storage = &backend;
+        stopping = false;
+        running = true;
+        worker = thread([this]() { run(); });
+    }
+
+    // 中断进行中的一轮（已删除的批次不回滚）并等待后台线程退出
+    void stop() {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (!running) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        lock_guard<mutex> lock(mtx);
+        running = false;
+    }
+
+    void appendMetrics(string& out) const {
+        Metrics::writeValue(out, "dns_auth_retention_passes_total", "counter", "Retention passes run.", passCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_retention_batches_total", "counter", "Retention batches executed.", batchCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_retention_deleted_rows_total", "counter", "Expired or superseded verification rows deleted.", deletedCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_retention_dropped_partitions_total", "counter", "Expired dns_verifications partitions dropped.", droppedPartitionCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_retention_errors_total", "counter", "Retention batches or partition maintenance that failed.", errorCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_retention_last_pass_deleted_rows", "gauge", "Rows deleted by the last pass.", lastPassDeleted.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_retention_last_pass_milliseconds", "gauge", "Duration of the last pass.", lastPassMs.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_retention_cursor", "gauge", "Position of the pass in progress (0 when idle).", static_cast<uint64_t>(cursorNext.load(memory_order_relaxed)));
+        Metrics::writeValue(out, "dns_auth_retention_cursor_end", "gauge", "End position of the pass in progress (0 when idle).", static_cast<uint64_t>(cursorEnd.load(memory_order_relaxed)));
+    }
+};
+
+// 启动快照：ip_whitelist、domain_mappings 与启用状态的 domain_configs 的只读二进制镜像。
+// 启动时整个文件 mmap 进来，校验后直接在映射上二分查找，不做反序列化。
+// 文件格式（小端）：
+//   文件头 32 字节：magic "DNSWARM1" | u32 版本 | u32 段数 | i64 生成时间 | u32 段表 CRC32 | u32 保留
+//   段表：每段 24 字节：u32 类型 | u32 条目数 | u64 偏移 | u32 长度 | u32 段内容 CRC32
+//   段内容：u32 偏移表[条目数 + 1]（相对于记录区起点）| 记录区：按键的字节序排列的 "key\0value"
+class WarmSnapshot {
+public:
+    enum Section {
+        SECTION_WHITELIST = 1,  // ip -> id，有限额时为 "id rate burst"
+        SECTION_MAPPINGS,       // 小写 domain -> target_ip
+        SECTION_CONFIGS,        // foldedKey(client_ip, domain) -> expire_time
+        SECTION_LAST = SECTION_CONFIGS
+    };
+
+    static const uint32_t kVersion = 2;     // 2：配置段的键改为定长二进制 IP
+
+private:
+    static const size_t kHeaderSize = 32;
+    static const size_t kSectionEntrySize = 24;
+
+    struct SectionView {
+        const char* offsets = nullptr;
+        const char* records = nullptr;
+        uint32_t count = 0;
+    };
+
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    const void* view = nullptr;
+#endif
+    int64_t created = 0;
+    SectionView sections[SECTION_LAST + 1];
+
+    static void putU64(string& out, uint64_t v) {
+        putU32(out, static_cast<uint32_t>(v & 0xFFFFFFFFu));
+        putU32(out, static_cast<uint32_t>(v >> 32));
+    }
+
+    static uint64_t getU64(const char* p) {
+        return static_cast<uint64_t>(getU32(p)) | (static_cast<uint64_t>(getU32(p + 4)) << 32);
+    }
+
+    // 排序去重后编码一个段
+    static string encodeSection(vector<pair<string, string>>& records) {
+        sort(records.begin(), records.end(),
+            [](const pair<string, string>& a, const pair<string, string>& b) { return a.first < b.first; });
+        records.erase(unique(records.begin(), records.end(),
+            [](const pair<string, string>& a, const pair<string, string>& b) { return a.first == b.first; }),
+            records.end());
+
+        string offsets;
+        string blob;
+        for (const auto& record : records) {
+            putU32(offsets, static_cast<uint32_t>(blob.size()));
+            blob += record.first;
+            blob += '\0';
+            blob += record.second;
+        }
+        putU32(offsets, static_cast<uint32_t>(blob.size()));
+        return offsets + blob;
+    }
+
+    bool mapFile(const string& path) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);
+        if (!mapping) {
+            return false;
+        }
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!view) {
+            return false;
+        }
+        data = static_cast<const char*>(view);
+        size = static_cast<size_t>(fileSize.QuadPart);
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        void* mapped = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<const char*>(mapped);
+        size = static_cast<size_t>(st.st_size);
+        return true;
+#endif
+    }
+
+    void unmap() {
+        if (!data) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(view);
+        view = nullptr;
+#else
+        munmap(const_cast<char*>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    // 校验文件头、段表与各段 CRC，并检查偏移表单调且不越界，之后的查找不再做边界检查
+    bool validate() {
+        if (size < kHeaderSize || memcmp(data, "DNSWARM1", 8) != 0 || getU32(data + 8) != kVersion) {
+            return false;
+        }
+        uint32_t sectionCount = getU32(data + 12);
+        created = static_cast<int64_t>(getU64(data + 16));
+        size_t tableSize = static_cast<size_t>(sectionCount) * kSectionEntrySize;
+        if (sectionCount > 64 || size < kHeaderSize + tableSize ||
+            crc32Of(data + kHeaderSize, tableSize) != getU32(data + 24)) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < sectionCount; ++i) {
+            const char* entry = data + kHeaderSize + i * kSectionEntrySize;
+            uint32_t type = getU32(entry);
+            uint32_t count = getU32(entry + 4);
+            uint64_t offset = getU64(entry + 8);
+            uint32_t length = getU32(entry + 16);
+            if (offset > size || length > size - offset || crc32Of(data + offset, length) != getU32(entry + 20)) {
+                return false;
+            }
+            // 不认识的段类型留给后续版本，跳过
+            if (type < SECTION_WHITELIST || type > SECTION_LAST) {
+                continue;
+            }
+
+            uint64_t offsetsSize = (static_cast<uint64_t>(count) + 1) * 4;
+            if (offsetsSize > length) {
+                return false;
+            }
+            SectionView& section = sections[type];
+            section.offsets = data + offset;
+            section.records = section.offsets + offsetsSize;
+            section.count = count;
+            uint64_t recordsSize = length - offsetsSize;
+            uint32_t previous = 0;
+            for (uint32_t k = 0; k <= count; ++k) {
+                uint32_t value = getU32(section.offsets + 4 * k);
+                if (value < previous || value > recordsSize) {
+                    return false;
+                }
+                previous = value;
+            }
+            if (previous != recordsSize) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 第 index 条记录的键与值
+    void record(const SectionView& section, uint32_t index, const char*& key, size_t& keyLen,
+        const char*& value, size_t& valueLen) const {
+        uint32_t begin = getU32(section.offsets + 4 * index);
+        uint32_t end = getU32(section.offsets + 4 * (index + 1));
+        key = section.records + begin;
+        // 键可能含 '\0'（二进制 IP），值不含，分隔符取最后一个 '\0'
+        const char* sep = nullptr;
+        for (const char* p = section.records + end; p > key; --p) {
+            if (p[-1] == '\0') {
+                sep = p - 1;
+                break;
+            }
+        }
+        keyLen = sep ? static_cast<size_t>(sep - key) : end - begin;
+        value = sep ? sep + 1 : key + keyLen;
+        valueLen = section.records + end - value;
+    }
+
+public:
+    WarmSnapshot() = default;
+    WarmSnapshot(const WarmSnapshot&) = delete;
+    WarmSnapshot& operator=(const WarmSnapshot&) = delete;
+
+    ~WarmSnapshot() { unmap(); }
+
+    // 映射并校验快照文件；文件不存在、版本不符或校验失败时返回 false
+    bool open(const string& path) {
+        if (!mapFile(path)) {
+            return false;
+        }
+        if (!validate()) {
+            logWarn("启动快照校验失败，忽略: ", path);
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    // 先写临时文件再原子替换
+    static bool write(const string& path, const vector<WhitelistEntry>& whitelist,
+        const vector<MappingRow>& mappings, const vector<DomainConfigRow>& configs) {
+        vector<pair<string, string>> records[SECTION_LAST + 1];
+        for (const WhitelistEntry& entry : whitelist) {
+            string value = to_string(entry.id);
+            if (entry.limit.rate != 0 || entry.limit.burst != 0) {
+                value += ' ' + to_string(entry.limit.rate) + ' ' + to_string(entry.limit.burst);
+            }
+            records[SECTION_WHITELIST].emplace_back(entry.ip, move(value));
+        }
+        for (const MappingRow& row : mappings) {
+            string domain(row.domain);
+            for (char& c : domain) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            records[SECTION_MAPPINGS].emplace_back(move(domain), row.targetIP);
+        }
+        for (const DomainConfigRow& row : configs) {
+            records[SECTION_CONFIGS].emplace_back(foldedKey(row.clientIP, row.domain), row.expireTime);
+        }
+
+        string table;
+        string body;
+        size_t bodyStart = kHeaderSize + SECTION_LAST * kSectionEntrySize;
+        for (int type = SECTION_WHITELIST; type <= SECTION_LAST; ++type) {
+            while (body.size() % 4 != 0) body += '\0';
+            string section = encodeSection(records[type]);
+            putU32(table, static_cast<uint32_t>(type));
+            putU32(table, static_cast<uint32_t>(records[type].size()));
+            putU64(table, bodyStart + body.size());
+            putU32(table, static_cast<uint32_t>(section.size()));
+            putU32(table, crc32Of(section.data(), section.size()));
+            body += section;
+        }
+
+        string file("DNSWARM1", 8);
+        putU32(file, kVersion);
+        putU32(file, static_cast<uint32_t>(SECTION_LAST));
+        putU64(file, static_cast<uint64_t>(time(nullptr)));
+        putU32(file, crc32Of(table.data(), table.size()));
+        putU32(file, 0);
+        file += table;
+        file += body;
+
+        string tmpPath = tempPathFor(path);
+        FILE* f = openFile(tmpPath, "wb");
+        if (!f) {
+            logError("创建启动快照失败: ", tmpPath);
+            return false;
+        }
+        bool ok = fwrite(file.data(), 1, file.size(), f) == file.size() && fflush(f) == 0;
+        if (ok) syncFile(f);
+        fclose(f);
+        if (!ok || !replaceFile(tmpPath, path)) {
+            logError("写入启动快照失败: ", path);
+            remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    int64_t createdAt() const { return created; }
+    size_t count(Section section) const { return sections[section].count; }
+
+    bool lookup(Section type, const string& key, string& value) const {
+        const SectionView& section = sections[type];
+        uint32_t low = 0;
+        uint32_t high = section.count;
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+            const char* recordKey;
+            const char* recordValue;
+            size_t keyLen, valueLen;
+            record(section, mid, recordKey, keyLen, recordValue, valueLen);
+
+            int cmp = memcmp(recordKey, key.data(), keyLen < key.size() ? keyLen : key.size());
+            if (cmp == 0) {
+                cmp = keyLen < key.size() ? -1 : (keyLen > key.size() ? 1 : 0);
+            }
+            if (cmp == 0) {
+                value.assign(recordValue, valueLen);
+                return true;
+            }
+            if (cmp < 0) low = mid + 1;
+            else high = mid;
+        }
+        return false;
+    }
+
+    void whitelistEntries(vector<WhitelistEntry>& out) const {
+        const SectionView& section = sections[SECTION_WHITELIST];
+        out.reserve(out.size() + section.count);
+        for (uint32_t i = 0; i < section.count; ++i) {
+            const char* key;
+            const char* value;
+            size_t keyLen, valueLen;
+            record(section, i, key, keyLen, value, valueLen);
+            WhitelistEntry entry;
+            entry.ip.assign(key, keyLen);
+            string text(value, valueLen);
+            char* end = nullptr;
+            entry.id = strtoll(text.c_str(), &end, 10);
+            entry.limit.rate = static_cast<uint32_t>(strtoul(end, &end, 10));
+            entry.limit.burst = static_cast<uint32_t>(strtoul(end, &end, 10));
+            out.push_back(move(entry));
+        }
+    }
+};
+
+// 启动快照的加载、服务窗口与定期重写。服务窗口内域名配置查询先查快照，未命中再查存储；
+// 窗口结束后释放映射（Windows 上被映射的文件不能被替换），之后每隔 warmSnapshotIntervalSec 从存储导出重写
+// （warmSnapshotRewrite 为 false 时不重写）
+class WarmStart {
+private:
+    ServerConfig config;
+    DNSAuthStorage* storage = nullptr;
+    shared_ptr<const WarmSnapshot> active;
+    chrono::steady_clock::time_point serveUntil;
+
+    mutex mtx;
+    condition_variable wake;
+    thread worker;
+    bool stopping = false;
+    bool running = false;
+
+    atomic<uint64_t> configHits{ 0 };
+    atomic<uint64_t> writeCount{ 0 };
+    atomic<uint64_t> writeFailures{ 0 };
+    atomic<int64_t> lastWriteAt{ 0 };
+
+    bool pause(chrono::milliseconds duration) {
+        unique_lock<mutex> lock(mtx);
+        return !wake.wait_for(lock, duration, [this]() { return stopping; });
+    }
+
+    void run() {
+        chrono::steady_clock::duration remaining = serveUntil - chrono::steady_clock::now();
+        if (remaining.count() > 0 && !pause(chrono::duration_cast<chrono::milliseconds>(remaining))) {
+            return;
+        }
+        atomic_store(&active, shared_ptr<const WarmSnapshot>());
+        if (!config.warmSnapshotRewrite) {
+            return;
+        }
+
+        do {
+            rewrite();
+        } while (pause(chrono::seconds(config.warmSnapshotIntervalSec)));
+    }
+
+public:
+    WarmStart() = default;
+    WarmStart(const WarmStart&) = delete;
+    WarmStart& operator=(const WarmStart&) = delete;
+
+    ~WarmStart() { stop(); }
+
+    // 映射启动快照并开始服务窗口；快照不存在、损坏或过旧时返回空
+    shared_ptr<const WarmSnapshot> load(const ServerConfig& cfg) {
+        config = cfg;
+        auto snapshot = make_shared<WarmSnapshot>();
+        if (!snapshot->open(config.warmSnapshotPath)) {
+            return nullptr;
+        }
+        // 服务窗口内 verify 按快照中的配置应答，快照最多比正常重写周期旧一个周期
+        int64_t maxAge = min<int64_t>(config.warmSnapshotMaxAgeSec, 2 * static_cast<int64_t>(max(config.warmSnapshotIntervalSec, 1)));
+        int64_t age = static_cast<int64_t>(time(nullptr)) - snapshot->createdAt();
+        if (age > maxAge) {
+            logWarn("启动快照已生成 ", age, " 秒，超过上限，忽略");
+            return nullptr;
+        }
+
+        serveUntil = chrono::steady_clock::now() + chrono::seconds(config.warmSnapshotServeSec);
+        atomic_store(&active, shared_ptr<const WarmSnapshot>(snapshot));
+        return snapshot;
+    }
+
+    // 服务窗口内返回快照，否则为空
+    shared_ptr<const WarmSnapshot> serving() const {
+        auto snapshot = atomic_load(&active);
+        if (snapshot && chrono::steady_clock::now() >= serveUntil) {
+            return nullptr;
+        }
+        return snapshot;
+    }
+
+    void countConfigHit() { configHits.fetch_add(1, memory_order_relaxed); }
+
+    // 提前结束服务窗口（批量导入修改了域名配置，快照中的到期时间可能已过时）
+    void retire() {
+        atomic_store(&active, shared_ptr<const WarmSnapshot>());
+    }
+
+    // 从存储导出三张表并重写快照
+    bool rewrite() {
+        auto started = chrono::steady_clock::now();
+        vector<WhitelistEntry> whitelist;
+        vector<MappingRow> mappings;
+        vector<DomainConfigRow> configs;
+        bool ok = storage->loadWhitelist(0, whitelist) && storage->listMappings(mappings) &&
+            storage->listActiveConfigs(configs) &&
+            WarmSnapshot::write(config.warmSnapshotPath, whitelist, mappings, configs);
+        if (!ok) {
+            writeFailures.fetch_add(1, memory_order_relaxed);
+            logWarn("启动快照重写失败: ", config.warmSnapshotPath);
+            return false;
+        }
+
+        writeCount.fetch_add(1, memory_order_relaxed);
+        lastWriteAt.store(static_cast<int64_t>(time(nullptr)), memory_order_relaxed);
+        logInfo("启动快照已重写，白名单 ", whitelist.size(), " 条，域名映射 ", mappings.size(),
+            " 条，域名配置 ", configs.size(), " 条，耗时 ", chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now() - started).count(), " ms");
+        return true;
+    }
+
+    void start(DNSAuthStorage& backend, const ServerConfig& cfg) {
+        config = cfg;
+        if (config.warmSnapshotIntervalSec <= 0) config.warmSnapshotIntervalSec = 1;
+
+        storage = &backend;
+        stopping = false;
+        running = true;
+        worker = thread([this]() { run(); });
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (!running) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        lock_guard<mutex> lock(mtx);
+        running = false;
+    }
+
+    void appendMetrics(string& out) const {
+        Metrics::writeValue(out, "dns_auth_warm_snapshot_serving", "gauge", "1 while domain config lookups are answered from the startup snapshot.", serving() ? 1 : 0);
+        Metrics::writeValue(out, "dns_auth_warm_snapshot_config_hits_total", "counter", "Domain config lookups answered from the startup snapshot.", configHits.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_warm_snapshot_writes_total", "counter", "Startup snapshots written.", writeCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_warm_snapshot_write_failures_total", "counter", "Startup snapshot rewrites that failed.", writeFailures.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_warm_snapshot_last_write_timestamp_seconds", "gauge", "Unix time of the last successful rewrite.", static_cast<uint64_t>(lastWriteAt.load(memory_order_relaxed)));
+    }
+};
+
+// 批量导入的目标表与输入格式
+enum ImportTable {
+    IMPORT_DOMAIN_CONFIGS = 0,     // client_ip, domain, expire_time[, status]
+    IMPORT_DOMAIN_MAPPINGS         // domain, target_ip
+};
+
+enum ImportFormat {
+    IMPORT_FORMAT_CSV = 0,         // 逗号分隔，字段可用双引号包裹；首行为表头时跳过
+    IMPORT_FORMAT_NDJSON           // 每行一个 JSON 对象，字段名与列名相同
+};
+
+// 导入进度与结果
+struct ImportStats {
+    uint64_t lines = 0;            // 数据行数（不含空行、注释与表头）
+    uint64_t imported = 0;         // 已提交的行数
+    uint64_t rejected = 0;         // 格式错误被跳过的行数
+    uint64_t batches = 0;          // 已提交的事务数
+    bool failed = false;           // 写入失败，导入中止（此前提交的批次保留）
+    vector<string> errors;         // 前若干条错误说明（"第 N 行: 原因"）
+    int64_t elapsedMs = 0;
+};
+
+// 批量导入 domain_configs / domain_mappings：按任意大小的数据块流式输入，逐行解析校验，
+// 每攒满 batchRows 行经存储后端的多行 upsert 在一个事务中写入。
+// 同时记录已提交的键，供调用方在结束后失效进程内缓存（超过上限后只记“全部失效”）
+class BulkImporter {
+private:
+    static const size_t kMaxLineBytes = 64 * 1024;
+    static const size_t kMaxReportedErrors = 20;
+    static const size_t kMaxTrackedKeys = 10000;
+    static const uint64_t kProgressEveryRows = 100000;
+
+    DNSAuthStorage& storage;
+    ImportTable table;
+    ImportFormat format;
+    size_t batchRows;
+    chrono::steady_clock::time_point startedAt;
+
+    string partial;                // 尚未遇到换行的行首部分
+    bool skipping = false;         // 当前行超长，丢弃到下一个换行
+    uint64_t lineNo = 0;
+    bool headerChecked = false;
+    vector<DomainConfigRow> configs;
+    vector<MappingRow> mappings;
+    vector<string> fields;
+
+    ImportStats result;
+    vector<pair<string, string>> configKeys;
+    vector<string> mappingDomains;
+    bool overflow = false;
+
+    void reject(const char* reason) {
+        ++result.rejected;
+        if (result.errors.size() < kMaxReportedErrors) {
+            result.errors.push_back("第 " + to_string(lineNo) + " 行: " + reason);
+        }
+    }
+
+    // 解析一行 CSV；不支持字段内换行
+    static bool splitCsv(const char* p, size_t len, vector<string>& out) {
+        out.clear();
+        size_t i = 0;
+        while (true) {
+            string field;
+            while (i < len && (p[i] == ' ' || p[i] == '\t')) ++i;
+            if (i < len && p[i] == '"') {
+                ++i;
+                while (true) {
+                    if (i >= len) return false;
+                    if (p[i] == '"') {
+                        if (i + 1 < len && p[i + 1] == '"') {
+                            field += '"';
+                            i += 2;
+                            continue;
+                        }
+                        ++i;
+                        break;
+                    }
+                    field += p[i++];
+                }
+                while (i < len && (p[i] == ' ' || p[i] == '\t')) ++i;
+                if (i < len && p[i] != ',') return false;
+            }
+            else {
+                size_t start = i;
+                while (i < len && p[i] != ',') ++i;
+                size_t end = i;
+                while (end > start && (p[end - 1] == ' ' || p[end - 1] == '\t')) --end;
+                field.assign(p + start, end - start);
+            }
+            out.push_back(move(field));
+            if (i >= len) return true;
+            ++i;   // 跳过逗号
+        }
+    }
+
+    // 把一行 NDJSON 按当前表的列顺序展开为字段
+    bool splitJson(const char* p, size_t len, vector<string>& out) const {
+        Json::CharReaderBuilder reader;
+        Json::Value value;
+        string errors;
+        istringstream stream(string(p, len));
+        if (!Json::parseFromStream(reader, stream, &value, &errors) || !value.isObject()) {
+            return false;
+        }
+        out.clear();
+        if (table == IMPORT_DOMAIN_CONFIGS) {
+            out.push_back(value["client_ip"].asString());
+            out.push_back(value["domain"].asString());
+            out.push_back(value["expire_time"].asString());
+            if (value.isMember("status")) {
+                out.push_back(value["status"].asString());
+            }
+        }
+        else {
+            out.push_back(value["domain"].asString());
+            out.push_back(value["target_ip"].asString());
+        }
+        return true;
+    }
+
+    // 域名只接受字母、数字与 - . _ *（通配），长度 1 ~ 255
+    static bool validDomain(const string& domain) {
+        if (domain.empty() || domain.size() > 255) return false;
+        for (char c : domain) {
+            if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.' && c != '_' && c != '*') {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool validIP(const string& ip) {
+        IPAddress addr;
+        return parseIPAddress(ip, addr);
+    }
+
+    void processLine(const char* p, size_t len) {
+        ++lineNo;
+        if (len > 0 && p[len - 1] == '\r') --len;
+        size_t lead = 0;
+        while (lead < len && (p[lead] == ' ' || p[lead] == '\t')) ++lead;
+        if (lead == len || p[lead] == '#') {
+            return;
+        }
+
+        bool parsed = format == IMPORT_FORMAT_CSV ? splitCsv(p, len, fields) : splitJson(p, len, fields);
+
+        // CSV 首个数据行若以列名开头则视为表头
+        if (!headerChecked) {
+            headerChecked = true;
+            if (format == IMPORT_FORMAT_CSV && parsed && !fields.empty() &&
+                (fields[0] == "client_ip" || fields[0] == "domain")) {
+                return;
+            }
+        }
+
+        ++result.lines;
+        if (!parsed) {
+            reject(format == IMPORT_FORMAT_CSV ? "CSV 格式错误" : "JSON 解析失败");
+            return;
+        }
+
+        if (table == IMPORT_DOMAIN_CONFIGS) {
+            if (fields.size() != 3 && fields.size() != 4) {
+                reject("字段数应为 3 或 4（client_ip, domain, expire_time[, status]）");
+                return;
+            }
+            DomainConfigRow row;
+            row.clientIP = move(fields[0]);
+            row.domain = move(fields[1]);
+            row.expireTime = move(fields[2]);
+            if (!validIP(row.clientIP)) {
+                reject("client_ip 不是合法的 IP 地址");
+                return;
+            }
+            if (!validDomain(row.domain)) {
+                reject("domain 格式错误");
+                return;
+            }
+            if (row.expireTime.size() != 19 || parseDateTime(row.expireTime) < 0) {
+                reject("expire_time 应为 YYYY-MM-DD HH:MM:SS");
+                return;
+            }
+            if (fields.size() == 4 && !fields[3].empty()) {
+                if (fields[3].size() > 9 || fields[3].find_first_not_of("0123456789") != string::npos) {
+                    reject("status 应为非负整数");
+                    return;
+                }
+                row.status = atoi(fields[3].c_str());
+            }
+            configs.push_back(move(row));
+        }
+        else {
+            if (fields.size() != 2) {
+                reject("字段数应为 2（domain, target_ip）");
+                return;
+            }
+            MappingRow row;
+            row.domain = move(fields[0]);
+            row.targetIP = move(fields[1]);
+            if (!validDomain(row.domain)) {
+                reject("domain 格式错误");
+                return;
+            }
+            if (!validIP(row.targetIP)) {
+                reject("target_ip 不是合法的 IP 地址");
+                return;
+            }
+            mappings.push_back(move(row));
+        }
+
+        if (configs.size() + mappings.size() >= batchRows) {
+            flush();
+        }
+    }
+
+    // 写入已攒下的行；失败后不再接受输入
+    bool flush() {
+        size_t count = configs.size() + mappings.size();
+        if (count == 0 || result.failed) {
+            return !result.failed;
+        }
+
+        bool ok = table == IMPORT_DOMAIN_CONFIGS ? storage.upsertDomainConfigs(configs.data(), count) :
+            storage.upsertDomainMappings(mappings.data(), count);
+        if (!ok) {
+            result.failed = true;
+            logError("批量导入写入失败，已提交 ", result.imported, " 行，导入中止");
+            configs.clear();
+            mappings.clear();
+            return false;
+        }
+
+        uint64_t before = result.imported;
+        result.imported += count;
+        ++result.batches;
+        track();
+        if (result.imported / kProgressEveryRows != before / kProgressEveryRows) {
+            logInfo("导入进度: 已提交 ", result.imported, " 行，跳过 ", result.rejected, " 行，耗时 ",
+                chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startedAt).count(), " ms");
+        }
+        return true;
+    }
+
+    // 记录刚提交的键
+    void track() {
+        if (!overflow && configKeys.size() + mappingDomains.size() + configs.size() + mappings.size() > kMaxTrackedKeys) {
+            overflow = true;
+            configKeys.clear();
+            mappingDomains.clear();
+        }
+        if (!overflow) {
+            for (auto& row : configs) {
+                configKeys.emplace_back(move(row.clientIP), move(row.domain));
+            }
+            for (auto& row : mappings) {
+                mappingDomains.push_back(move(row.domain));
+            }
+        }
+        configs.clear();
+        mappings.clear();
+    }
+
+public:
+    BulkImporter(DNSAuthStorage& backend, ImportTable target, ImportFormat inputFormat, size_t rowsPerBatch)
+        : storage(backend), table(target), format(inputFormat),
+        batchRows(rowsPerBatch > 0 ? rowsPerBatch : 1), startedAt(chrono::steady_clock::now()) {
+        configs.reserve(table == IMPORT_DOMAIN_CONFIGS ? batchRows : 0);
+        mappings.reserve(table == IMPORT_DOMAIN_MAPPINGS ? batchRows : 0);
+    }
+
+    static bool parseTable(const string& text, ImportTable& out) {
+        if (text == "configs" || text == "domain_configs") {
+            out = IMPORT_DOMAIN_CONFIGS;
+            return true;
+        }
+        if (text == "mappings" || text == "domain_mappings") {
+            out = IMPORT_DOMAIN_MAPPINGS;
+            return true;
+        }
+        return false;
+    }
+
+    static bool parseFormat(const string& text, ImportFormat& out) {
+        if (text == "csv") {
+            out = IMPORT_FORMAT_CSV;
+            return true;
+        }
+        if (text == "ndjson" || text == "jsonl") {
+            out = IMPORT_FORMAT_NDJSON;
+            return true;
+        }
+        return false;
+    }
+
+    ImportTable target() const { return table; }
+
+    // 输入任意切分的数据块；写入失败后返回 false，之后的输入被忽略
+    bool feed(const char* data, size_t len) {
+        const char* end = data + len;
+        while (data < end && !result.failed) {
+            const char* newline = static_cast<const char*>(memchr(data, '\n', static_cast<size_t>(end - data)));
+            const char* stop = newline ? newline : end;
+            if (!skipping) {
+                if (partial.size() + static_cast<size_t>(stop - data) > kMaxLineBytes) {
+                    skipping = true;
+                    partial.clear();
+                }
+                else if (newline && partial.empty()) {
+                    processLine(data, static_cast<size_t>(stop - data));
+                }
+                else {
+                    partial.append(data, stop);
+                    if (newline) {
+                        processLine(partial.data(), partial.size());
+                        partial.clear();
+                    }
+                }
+            }
+            if (newline && skipping) {
+                ++lineNo;
+                ++result.lines;
+                reject("行过长");
+                skipping = false;
+            }
+            data = newline ? newline + 1 : end;
+        }
+        return !result.failed;
+    }
+
+    // 处理末尾没有换行的最后一行并写入剩余的行；complete 为 false 时输入被截断（上传中断或超限），
+    // 不完整的最后一行直接丢弃
+    bool finish(bool complete = true) {
+        if (!complete) {
+            skipping = false;
+        }
+        else if (skipping) {
+            ++lineNo;
+            ++result.lines;
+            reject("行过长");
+            skipping = false;
+        }
+        else if (!partial.empty() && !result.failed) {
+            processLine(partial.data(), partial.size());
+        }
+        partial.clear();
+        flush();
+        result.elapsedMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startedAt).count();
+        logInfo("导入", result.failed ? "中止" : "完成", ": 数据行 ", result.lines, "，提交 ", result.imported,
+            " 行（", result.batches, " 个事务），跳过 ", result.rejected, " 行，耗时 ", result.elapsedMs, " ms");
+        return !result.failed;
+    }
+
+    const ImportStats& stats() const { return result; }
+
+    // 已提交的键；overflowed() 为 true 时键太多未逐个记录，调用方应整体失效
+    bool overflowed() const { return overflow; }
+    const vector<pair<string, string>>& importedConfigKeys() const { return configKeys; }
+    const vector<string>& importedDomains() const { return mappingDomains; }
+};
+
+// DNS 应答码
+enum DnsRcode {
+    DNS_RCODE_NOERROR = 0,
+    DNS_RCODE_FORMERR = 1,
+    DNS_RCODE_SERVFAIL = 2,
+    DNS_RCODE_NXDOMAIN = 3,
+    DNS_RCODE_NOTIMP = 4,
+    DNS_RCODE_REFUSED = 5
+};
+
+// 一次 DNS 查询的结果；type 为 0 时应答不带记录
+struct DnsAnswer {
+    uint8_t rcode = DNS_RCODE_SERVFAIL;
+    uint16_t type = 0;
+    uint32_t ttl = 0;
+    unsigned char address[16] = {};
+};
+
+// UDP DNS 应答器：只处理单问题的标准查询，问题名交给 handler 解析后按 A/AAAA 应答。
+// Linux 上套接字非阻塞，用 recvmmsg/sendmmsg 每次收发一批报文；其他平台逐个 recvfrom/sendto。
+class DNSResponder {
+public:
+    static const uint16_t kTypeA = 1;
+    static const uint16_t kTypeAAAA = 28;
+
+    typedef function<void(const string& clientIP, const string& name, uint16_t type, DnsAnswer& answer)> Handler;
+
+    // 异步 handler：结果就绪后调用 reply（可在其他线程），应答由该线程直接发出
+    typedef function<void(const DnsAnswer& answer)> Reply;
+    typedef function<void(const string& clientIP, const string& name, uint16_t type, Reply reply)> AsyncHandler;
+
+    // 解析出的查询；ask 为 false 时直接以 rcode 应答
+    struct ParsedQuery {
+        uint16_t flags = 0;
+        bool wellFormed = false;
+        bool ask = false;
+        uint8_t rcode = DNS_RCODE_NOERROR;
+        string name;
+        uint16_t type = 0;
+        size_t questionEnd = 0;
+    };
+
+private:
+#ifdef _WIN32
+    typedef SOCKET SocketHandle;
+#else
+    typedef int SocketHandle;
+#endif
+
+    static const size_t kPacketMax = 512;
+    static const size_t kHeaderSize = 12;
+    static const uint16_t kClassIN = 1;
+    static const int kPollIntervalMs = 100;    // 检查停止标志的间隔
+
+    // 等待异步结果的查询：保留原报文与来源地址，结果就绪后构造应答
+    struct PendingQuery {
+        vector<unsigned char> packet;
+        ParsedQuery query;
+        sockaddr_storage from;
+        socklen_t fromLen;
+    };
+
+    ServerConfig config;
+    Handler handler;
+    AsyncHandler asyncHandler;
+    SocketHandle sock;
+    bool opened = false;
+    atomic<bool> stopping{ false };
+    vector<thread> workers;
+
+    atomic<uint64_t> receivedCount{ 0 };
+    atomic<uint64_t> sentCount{ 0 };
+    atomic<uint64_t> droppedCount{ 0 };
+    atomic<uint64_t> pendingCount{ 0 };
+
+    static void closeSocket(SocketHandle handle) {
+#ifdef _WIN32
+        closesocket(handle);
+#else
+        close(handle);
+#endif
+    }
+
+    // 等待套接字可读，超时返回 false
+    bool waitReadable() const {
+#ifdef _WIN32
+        WSAPOLLFD pfd = {};
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        return WSAPoll(&pfd, 1, kPollIntervalMs) > 0;
+#else
+        pollfd pfd = {};
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        return poll(&pfd, 1, kPollIntervalMs) > 0;
+#endif
+    }
+
+    // 报文源地址转为文本 IP；IPv4 映射的 IPv6 地址按 IPv4 输出，与 HTTP 侧的 remote_addr 一致
+    static bool formatAddress(const sockaddr_storage& addr, string& out) {
+        char text[INET6_ADDRSTRLEN];
+        if (addr.ss_family == AF_INET) {
+            const sockaddr_in& v4 = reinterpret_cast<const sockaddr_in&>(addr);
+            if (!inet_ntop(AF_INET, &v4.sin_addr, text, sizeof(text))) return false;
+        }
+        else if (addr.ss_family == AF_INET6) {
+            const sockaddr_in6& v6 = reinterpret_cast<const sockaddr_in6&>(addr);
+            static const unsigned char kMappedPrefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v6.sin6_addr);
+            if (memcmp(bytes, kMappedPrefix, sizeof(kMappedPrefix)) == 0) {
+                if (!inet_ntop(AF_INET, bytes + 12, text, sizeof(text))) return false;
+            }
+            else if (!inet_ntop(AF_INET6, &v6.sin6_addr, text, sizeof(text))) {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+        out = text;
+        return true;
+    }
+
+    // 处理一个收到的报文并写出应答，返回应答长度；0 表示丢弃或已转交异步 handler
+    size_t respond(const unsigned char* in, size_t len, const sockaddr_storage& from, socklen_t fromLen,
+        unsigned char* out) {
+        receivedCount.fetch_add(1, memory_order_relaxed);
+        string clientIP;
+        ParsedQuery query;
+        if (!formatAddress(from, clientIP) || !parse(in, len, query)) {
+            droppedCount.fetch_add(1, memory_order_relaxed);
+            return 0;
+        }
+
+        if (query.ask && asyncHandler) {
+            shared_ptr<PendingQuery> pending = make_shared<PendingQuery>();
+            pending->packet.assign(in, in + len);
+            pending->query = move(query);
+            pending->from = from;
+            pending->fromLen = fromLen;
+            pendingCount.fetch_add(1, memory_order_relaxed);
+            asyncHandler(clientIP, pending->query.name, pending->query.type, [this, pending](const DnsAnswer& answer) {
+                this->sendDeferred(*pending, answer);
+                });
+            return 0;
+        }
+
+        DnsAnswer answer;
+        if (query.ask) {
+            handler(clientIP, query.name, query.type, answer);
+        }
+        else {
+            answer.rcode = query.rcode;
+        }
+        size_t outLen = encode(in, query, answer, out, kPacketMax);
+        if (outLen == 0) {
+            droppedCount.fetch_add(1, memory_order_relaxed);
+        }
+        return outLen;
+    }
+
+    // 异步结果就绪后逐个发出应答
+    void sendDeferred(const PendingQuery& pending, const DnsAnswer& answer) {
+        pendingCount.fetch_sub(1, memory_order_relaxed);
+        unsigned char out[kPacketMax];
+        size_t outLen = encode(pending.packet.data(), pending.query, answer, out, sizeof(out));
+        if (outLen > 0 && sendto(sock, reinterpret_cast<const char*>(out), static_cast<int>(outLen), 0,
+            reinterpret_cast<const sockaddr*>(&pending.from), pending.fromLen) > 0) {
+            sentCount.fetch_add(1, memory_order_relaxed);
+        }
+        else {
+            droppedCount.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    // 绑定端口并启动收发线程
+    bool open(const ServerConfig& cfg) {
+        config = cfg;
+        if (config.dnsBatchSize == 0) config.dnsBatchSize = 1;
+        if (config.dnsThreads <= 0) config.dnsThreads = 1;
+
+        sockaddr_storage addr;
+        memset(&addr, 0, sizeof(addr));
+        socklen_t addrLen = 0;
+        sockaddr_in& v4 = reinterpret_cast<sockaddr_in&>(addr);
+        sockaddr_in6& v6 = reinterpret_cast<sockaddr_in6&>(addr);
+        if (inet_pton(AF_INET, config.dnsBindAddress.c_str(), &v4.sin_addr) == 1) {
+            v4.sin_family = AF_INET;
+            v4.sin_port = htons(static_cast<uint16_t>(config.dnsPort));
+            addrLen = sizeof(sockaddr_in);
+        }
+        else if (inet_pton(AF_INET6, config.dnsBindAddress.c_str(), &v6.sin6_addr) == 1) {
+            v6.sin6_family = AF_INET6;
+            v6.sin6_port = htons(static_cast<uint16_t>(config.dnsPort));
+            addrLen = sizeof(sockaddr_in6);
+        }
+        else {
+            logError("DNS 监听地址无效: ", config.dnsBindAddress);
+            return false;
+        }
+
+        sock = socket(addr.ss_family, SOCK_DGRAM, 0);
+#ifdef _WIN32
+        if (sock == INVALID_SOCKET) {
+#else
+        if (sock < 0) {
+#endif
+            logError("创建 DNS 套接字失败");
+            return false;
+        }
+#ifdef DNS_AUTH_WORKERS
+        if (config.workerProcesses != 0) {
+            int on = 1;
+            setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        }
+#endif
+        if (bind(sock, reinterpret_cast<const sockaddr*>(&addr), addrLen) != 0) {
+            logError("DNS 端口绑定失败: ", config.dnsBindAddress, ":", config.dnsPort);
+            closeSocket(sock);
+            return false;
+        }
+#ifdef __linux__
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+        opened = true;
+        stopping.store(false);
+        for (int i = 0; i < config.dnsThreads; ++i) {
+            workers.emplace_back([this]() { run(); });
+        }
+        logInfo("DNS 应答已启动，监听 ", config.dnsBindAddress, ":", config.dnsPort, "/udp");
+        return true;
+    }
+
+#ifdef __linux__
+    void run() {
+        size_t batch = config.dnsBatchSize;
+        vector<unsigned char> inBuffers(batch * kPacketMax);
+        vector<unsigned char> outBuffers(batch * kPacketMax);
+        vector<sockaddr_storage> addrs(batch);
+        vector<iovec> inVecs(batch);
+        vector<iovec> outVecs(batch);
+        vector<mmsghdr> inMsgs(batch);
+        vector<mmsghdr> outMsgs(batch);
+
+        for (size_t i = 0; i < batch; ++i) {
+            inVecs[i].iov_base = &inBuffers[i * kPacketMax];
+            inVecs[i].iov_len = kPacketMax;
+        }
+
+        while (!stopping.load(memory_order_relaxed)) {
+            if (!waitReadable()) continue;
+
+            for (size_t i = 0; i < batch; ++i) {
+                memset(&inMsgs[i], 0, sizeof(mmsghdr));
+                inMsgs[i].msg_hdr.msg_name = &addrs[i];
+                inMsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+                inMsgs[i].msg_hdr.msg_iov = &inVecs[i];
+                inMsgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int received = recvmmsg(sock, inMsgs.data(), static_cast<unsigned int>(batch), MSG_DONTWAIT, nullptr);
+            if (received <= 0) continue;
+
+            size_t replies = 0;
+            for (int i = 0; i < received; ++i) {
+                unsigned char* out = &outBuffers[replies * kPacketMax];
+                size_t outLen = respond(&inBuffers[i * kPacketMax], inMsgs[i].msg_len, addrs[i],
+                    inMsgs[i].msg_hdr.msg_namelen, out);
+                if (outLen == 0) continue;
+
+                outVecs[replies].iov_base = out;
+                outVecs[replies].iov_len = outLen;
+                memset(&outMsgs[replies], 0, sizeof(mmsghdr));
+                outMsgs[replies].msg_hdr.msg_name = &addrs[i];
+                outMsgs[replies].msg_hdr.msg_namelen = inMsgs[i].msg_hdr.msg_namelen;
+                outMsgs[replies].msg_hdr.msg_iov = &outVecs[replies];
+                outMsgs[replies].msg_hdr.msg_iovlen = 1;
+                ++replies;
+            }
+
+            // 发送缓冲区满时不等待，剩余应答丢弃（客户端会重试）
+            size_t offset = 0;
+            while (offset < replies) {
+                int sent = sendmmsg(sock, &outMsgs[offset], static_cast<unsigned int>(replies - offset), MSG_DONTWAIT);
+                if (sent <= 0) {
+                    droppedCount.fetch_add(replies - offset, memory_order_relaxed);
+                    break;
+                }
+                sentCount.fetch_add(static_cast<uint64_t>(sent), memory_order_relaxed);
+                offset += static_cast<size_t>(sent);
+            }
+        }
+    }
+#else
+    void run() {
+        unsigned char in[kPacketMax];
+        unsigned char out[kPacketMax];
+        while (!stopping.load(memory_order_relaxed)) {
+            if (!waitReadable()) continue;
+
+            sockaddr_storage from;
+            socklen_t fromLen = sizeof(from);
+            int received = recvfrom(sock, reinterpret_cast<char*>(in), static_cast<int>(sizeof(in)), 0,
+                reinterpret_cast<sockaddr*>(&from), &fromLen);
+            if (received <= 0) continue;
+
+            size_t outLen = respond(in, static_cast<size_t>(received), from, fromLen, out);
+            if (outLen == 0) continue;
+            if (sendto(sock, reinterpret_cast<const char*>(out), static_cast<int>(outLen), 0,
+                reinterpret_cast<const sockaddr*>(&from), fromLen) > 0) {
+                sentCount.fetch_add(1, memory_order_relaxed);
+            }
+            else {
+                droppedCount.fetch_add(1, memory_order_relaxed);
+            }
+        }
+    }
+#endif
+
+public:
+    DNSResponder() = default;
+    DNSResponder(const DNSResponder&) = delete;
+    DNSResponder& operator=(const DNSResponder&) = delete;
+
+    ~DNSResponder() { stop(); }
+
+    // HTTP 返回码对应的 DNS 应答码
+    static uint8_t rcodeFor(int code) {
+        switch (code) {
+        case 200: return DNS_RCODE_NOERROR;
+        case 400: return DNS_RCODE_FORMERR;
+        case 403: return DNS_RCODE_REFUSED;
+        case 404: return DNS_RCODE_NXDOMAIN;
+        default: return DNS_RCODE_SERVFAIL;
+        }
+    }
+
+    // 解析查询报文；报文过短或本身是应答时返回 false（直接丢弃）
+    static bool parse(const unsigned char* in, size_t len, ParsedQuery& query) {
+        if (len < kHeaderSize) return false;
+        query.flags = static_cast<uint16_t>((in[2] << 8) | in[3]);
+        if (query.flags & 0x8000) return false;
+
+        // 问题名：不接受压缩指针，统一转为小写；线上格式（含各标签长度字节与结尾 0）不超过 255 字节
+        uint16_t questions = static_cast<uint16_t>((in[4] << 8) | in[5]);
+        query.wellFormed = questions == 1;
+        size_t pos = kHeaderSize;
+        query.name.clear();
+        while (query.wellFormed) {
+            if (pos >= len) {
+                query.wellFormed = false;
+                break;
+            }
+            size_t labelLen = in[pos++];
+            if (labelLen == 0) break;
+            if ((labelLen & 0xC0) != 0 || pos + labelLen > len || pos + labelLen + 1 - kHeaderSize > 255) {
+                query.wellFormed = false;
+                break;
+            }
+            if (!query.name.empty()) query.name += '.';
+            for (size_t i = 0; i < labelLen; ++i) {
+                query.name += static_cast<char>(tolower(in[pos + i]));
+            }
+            pos += labelLen;
+        }
+        query.wellFormed = query.wellFormed && pos + 4 <= len;
+        query.questionEnd = query.wellFormed ? pos + 4 : kHeaderSize;
+
+        query.ask = false;
+        if (!query.wellFormed) {
+            query.rcode = DNS_RCODE_FORMERR;
+        }
+        else if ((query.flags & 0x7800) != 0 || ((in[pos + 2] << 8) | in[pos + 3]) != kClassIN) {
+            query.rcode = DNS_RCODE_NOTIMP;
+        }
+        else {
+            query.type = static_cast<uint16_t>((in[pos] << 8) | in[pos + 1]);
+            query.ask = true;
+        }
+        return true;
+    }
+
+    // 按原查询与结果构造应答写入 out，返回应答长度；超出 capacity 时返回 0
+    static size_t encode(const unsigned char* in, const ParsedQuery& query, const DnsAnswer& answer,
+        unsigned char* out, size_t capacity) {
+        size_t rdataLen = answer.type == kTypeA ? 4 : answer.type == kTypeAAAA ? 16 : 0;
+        size_t total = query.questionEnd + (rdataLen ? 12 + rdataLen : 0);
+        if (total > capacity) return 0;
+
+        // 头部：沿用 ID、opcode 与 RD，置 QR 与 AA
+        out[0] = in[0];
+        out[1] = in[1];
+        uint16_t outFlags = static_cast<uint16_t>(0x8000 | (query.flags & 0x7800) | 0x0400 | (query.flags & 0x0100) | answer.rcode);
+        out[2] = static_cast<unsigned char>(outFlags >> 8);
+        out[3] = static_cast<unsigned char>(outFlags & 0xFF);
+        out[4] = 0;
+        out[5] = query.wellFormed ? 1 : 0;
+        out[6] = 0;
+        out[7] = rdataLen ? 1 : 0;
+        memset(out + 8, 0, 4);
+        memcpy(out + kHeaderSize, in + kHeaderSize, query.questionEnd - kHeaderSize);
+
+        if (rdataLen) {
+            unsigned char* record = out + query.questionEnd;
+            record[0] = 0xC0;   // 名称压缩指针，指向问题名（偏移 12）
+            record[1] = 0x0C;
+            record[2] = static_cast<unsigned char>(answer.type >> 8);
+            record[3] = static_cast<unsigned char>(answer.type & 0xFF);
+            record[4] = 0;
+            record[5] = static_cast<unsigned char>(kClassIN);
+            record[6] = static_cast<unsigned char>(answer.ttl >> 24);
+            record[7] = static_cast<unsigned char>(answer.ttl >> 16);
+            record[8] = static_cast<unsigned char>(answer.ttl >> 8);
+            record[9] = static_cast<unsigned char>(answer.ttl);
+            record[10] = 0;
+            record[11] = static_cast<unsigned char>(rdataLen);
+            memcpy(record + 12, answer.address, rdataLen);
+        }
+        return total;
+    }
+
+    // 解析查询、同步调用 handler 并写出应答，返回应答长度；0 表示丢弃
+    static size_t process(const unsigned char* in, size_t len, const string& clientIP,
+        const Handler& handler, unsigned char* out, size_t capacity) {
+        ParsedQuery query;
+        if (!parse(in, len, query)) return 0;
+
+        DnsAnswer answer;
+        if (query.ask) {
+            handler(clientIP, query.name, query.type, answer);
+        }
+        else {
+            answer.rcode = query.rcode;
+        }
+        return encode(in, query, answer, out, capacity);
+    }
+
+    // 绑定 UDP 端口并启动收发线程，handler 在收发线程内同步给出结果
+    bool start(const ServerConfig& cfg, Handler onQuery) {
+        handler = move(onQuery);
+        asyncHandler = nullptr;
+        return open(cfg);
+    }
+
+    // 同上，但结果由异步 handler 稍后交付，收发线程不等待
+    bool startAsync(const ServerConfig& cfg, AsyncHandler onQuery) {
+        handler = nullptr;
+        asyncHandler = move(onQuery);
+        return open(cfg);
+    }
+
+    void stop() {
+        if (!opened) return;
+        stopping.store(true);
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+        workers.clear();
+        closeSocket(sock);
+        opened = false;
+    }
+
+    void appendMetrics(string& out) const {
+        Metrics::writeValue(out, "dns_auth_dns_packets_received_total", "counter", "UDP DNS packets received.", receivedCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_dns_responses_sent_total", "counter", "UDP DNS responses sent.", sentCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_dns_dropped_total", "counter", "UDP DNS packets dropped without a response.", droppedCount.load(memory_order_relaxed));
+        Metrics::writeValue(out, "dns_auth_dns_pending", "gauge", "UDP DNS queries waiting for an asynchronous result.", pendingCount.load(memory_order_relaxed));
+    }
+};
+
+class DNSAuthServer {
+private:
+    DBConfig dbConfig;
+    ServerConfig serverConfig;
+    unique_ptr<DNSAuthStorage> storage;
+    IPWhitelistCache whitelist;
+    VerificationWriter verifyWriter;
+    VerificationRetention retention;
+    WarmStart warmStart;
+    FindResultCache findCache;
+    NegativeCache negativeCache;
+    VerifyCoalescer verifyCoalescer;
+    FindKeyFilter findFilter;
+    AdmissionControl admission;
+    DNSResponder dnsResponder;
+    mutex importMtx;                    // 同一时间只运行一个 /admin/import
+#ifdef DNS_AUTH_ASYNC_DB
+    unique_ptr<MySQLReactor> asyncDb;   // 启用异步查询且使用 MySQL 存储时非空
+#endif
+    Server server;
+    atomic<bool> stopRequested{ false };    // 开始监听之前收到 stop() 时不再监听
+
+    // 批量请求中的一条
+    struct BatchItem {
+        bool find = false;
+        bool pending = false;   // 尚未得到结果
+        string ip;              // verify 为请求方 IP，find 为被查询的 client_ip
+        string domain;
+    };
+
+public:
+    DNSAuthServer() {}
+
+    DNSAuthServer(const DBConfig& db, const ServerConfig& cfg) : dbConfig(db), serverConfig(cfg) {}
+
+    // 供辅助函数在修改 domain_configs / domain_mappings 后失效缓存
+    FindResultCache& findResultCache() { return findCache; }
+
+    // 当前使用的存储后端，initStorage() 成功前为空
+    DNSAuthStorage* storageBackend() { return storage.get(); }
+
+    // 批量导入结束后失效受影响的缓存：导入过域名配置时结束启动快照的服务窗口；
+    // 键太多或涉及的映射域名较多（逐个失效需遍历全部分片）时整体清空 find 缓存
+    void invalidateImported(const BulkImporter& importer) {
+        static const size_t kMaxDomainInvalidations = 64;
+        if (importer.stats().imported == 0) {
+            return;
+        }
+        if (importer.target() == IMPORT_DOMAIN_CONFIGS) {
+            warmStart.retire();
+            if (importer.overflowed()) {
+                findFilter.requestRebuild();
+            }
+        }
+        for (const auto& key : importer.importedConfigKeys()) {
+            findFilter.add(foldedKey(key.first, key.second));
+        }
+        if (importer.overflowed() || importer.importedDomains().size() > kMaxDomainInvalidations) {
+            findCache.clear();
+            return;
+        }
+        for (const auto& key : importer.importedConfigKeys()) {
+            findCache.invalidate(key.first, key.second);
+        }
+        for (const string& domain : importer.importedDomains()) {
+            findCache.invalidateDomain(domain);
+        }
+    }
+
+    ~DNSAuthServer() {
+#ifdef DNS_AUTH_ASYNC_DB
+        // 先停 reactor：未完成的 DNS 查询以失败结束并在套接字关闭前发出应答
+        if (asyncDb) {
+            asyncDb->stop();
+        }
+#endif
+        dnsResponder.stop();
+        whitelist.stop();
+        warmStart.stop();
+        findFilter.stop();
+        retention.stop();
+        verifyWriter.stop();
+        if (storage) {
+            storage->close();
+        }
+    }
+
+    // 按配置创建并打开存储后端
+    bool initStorage() {
+        if (serverConfig.storageEngine == STORAGE_ENGINE_EMBEDDED) {
+            storage.reset(new EmbeddedStorage(serverConfig));
+        }
+        else {
+            storage.reset(new MySQLStorage(dbConfig));
+        }
+
+        if (!storage->open()) {
+            logError("存储后端初始化失败: ", storage->name());
+            return false;
+        }
+
+        logInfo("存储后端初始化成功: ", storage->name());
+
+        // 有可用的启动快照时白名单直接从快照建立，与数据库的对齐交给后台刷新线程
+        bool useWarmSnapshot = serverConfig.storageEngine == STORAGE_ENGINE_MYSQL &&
+            !serverConfig.warmSnapshotPath.empty();
+        bool warm = false;
+        if (useWarmSnapshot) {
+            auto started = chrono::steady_clock::now();
+            shared_ptr<const WarmSnapshot> snapshot = warmStart.load(serverConfig);
+            if (snapshot) {
+                vector<WhitelistEntry> entries;
+                snapshot->whitelistEntries(entries);
+                whitelist.seed(entries);
+                warm = true;
+                logInfo("启动快照已加载，白名单 ", entries.size(), " 条，域名映射 ",
+                    snapshot->count(WarmSnapshot::SECTION_MAPPINGS), " 条，域名配置 ",
+                    snapshot->count(WarmSnapshot::SECTION_CONFIGS), " 条，耗时 ",
+                    chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count(), " us");
+            }
+        }
+
+        // 预加载白名单并启动后台增量刷新
+        if (!warm) {
+            if (whitelist.reload(*storage)) {
+                logInfo("白名单已加载，条目数: ", whitelist.size());
+            }
+            else {
+                logWarn("白名单加载失败，暂时回退为逐请求查询存储");
+            }
+        }
+        whitelist.startRefresher(*storage, serverConfig, warm);
+
+        bool compactKeys = serverConfig.storageEngine == STORAGE_ENGINE_MYSQL && dbConfig.compactSchema;
+        findCache.init(serverConfig, compactKeys);
+        negativeCache.init(serverConfig);
+        verifyCoalescer.init(serverConfig);
+        admission.init(serverConfig);
+        if (serverConfig.findFilterEnabled) {
+            findFilter.start(*storage, serverConfig, compactKeys);
+        }
+
+        if (serverConfig.verifyWriteMode != VERIFY_WRITE_SYNC) {
+            verifyWriter.start(*storage, serverConfig, &verifyCoalescer);
+        }
+
+        if (serverConfig.retentionEnabled) {
+            retention.start(*storage, serverConfig);
+        }
+
+        if (useWarmSnapshot) {
+            warmStart.start(*storage, serverConfig);
+        }
+
+        if (dbConfig.asyncQueries && serverConfig.storageEngine == STORAGE_ENGINE_MYSQL) {
+#ifdef DNS_AUTH_ASYNC_DB
+            asyncDb.reset(new MySQLReactor());
+            if (!asyncDb->start(dbConfig, static_cast<MySQLStorage*>(storage.get())->uniqueVerifyKey())) {
+                logWarn("异步查询启动失败，回退为连接池同步查询");
+                asyncDb.reset();
+            }
+#else
+            logWarn("当前构建不支持异步查询（需要 C++20 协程与 Linux epoll），使用连接池同步查询");
+#endif
+        }
+
+        return true;
+    }
+
+    // 把存储层的失败状态转换为响应：连接池耗尽为 503，其余为 500
+    static ResponseStruct storageFailure(StorageStatus status, const char* message) {
+        if (status == STORAGE_UNAVAILABLE) {
+            return makeErrorResponse(503, "数据库连接繁忙，请稍后重试");
+        }
+        return makeErrorResponse(500, message);
+    }
+
+    // 查询域名配置：启动快照服务窗口内先查快照，未命中（快照之后新增的配置）再查存储
+    StorageStatus lookupConfig(const string& clientIP, const string& domain, string& expireTime) {
+        shared_ptr<const WarmSnapshot> snapshot = warmStart.serving();
+        if (snapshot && snapshot->lookup(WarmSnapshot::SECTION_CONFIGS, foldedKey(clientIP, domain), expireTime)) {
+            warmStart.countConfigHit();
+            return STORAGE_OK;
+        }
+        return storage->lookupConfig(clientIP, domain, expireTime);
+    }
+
+    StorageStatus lookupConfigs(const string& clientIP, const vector<const string*>& domains, vector<ConfigRecord>& out) {
+        shared_ptr<const WarmSnapshot> snapshot = warmStart.serving();
+        if (!snapshot) {
+            return storage->lookupConfigs(clientIP, domains, out);
+        }
+
+        vector<const string*> misses;
+        for (const string* domain : domains) {
+            ConfigRecord record;
+            if (snapshot->lookup(WarmSnapshot::SECTION_CONFIGS, foldedKey(clientIP, *domain), record.expireTime)) {
+                warmStart.countConfigHit();
+                record.domain = *domain;
+                out.push_back(move(record));
+            }
+            else {
+                misses.push_back(domain);
+            }
+        }
+        return misses.empty() ? STORAGE_OK : storage->lookupConfigs(clientIP, misses, out);
+    }
+
+    // 检查IP是否在白名单中；limit 不为空时写入匹配条目的请求限额
+    bool checkIPInWhitelist(const string& ip, RateLimit* limit = nullptr) {
+        if (whitelist.isReady()) {
+            return whitelist.contains(ip, limit);
+        }
+
+        // 内存白名单尚未加载成功时回退到存储查询，限额取全局默认值；不在白名单中的 IP 在未命中缓存到期前不再查询
+        if (negativeCache.contains(ip)) {
+            return false;
+        }
+        StorageStatus status = storage->whitelistContains(ip);
+        if (status == STORAGE_NOT_FOUND) {
+            negativeCache.insert(ip);
+        }
+        else if (status != STORAGE_OK) {
+            logError("查询白名单失败");
+        }
+        return status == STORAGE_OK;
+    }
+
+    // 本进程写入了 (clientIP, domain) 的验证记录：丢弃旧的 find 缓存与未命中记录，加入布隆过滤器；
+    // committed 为 true 表示写入已提交，开始 verify 合并窗口（经写队列的记录由 VerificationWriter 在提交后记录）
+    void noteVerified(const string& clientIP, const string& domain, const string& expireTime, bool committed = true) {
+        findCache.invalidate(clientIP, domain);
+        string key = foldedKey(clientIP, domain);
+        negativeCache.erase(key);
+        findFilter.add(key);
+        if (committed) {
+            verifyCoalescer.record(key, expireTime);
+        }
+    }
+
+    // 未命中缓存或布隆过滤器表明 (ip, domain) 没有验证记录时直接给出 404，不访问存储
+    bool knownFindMiss(const string& ip, const string& domain, ResponseStruct& response) {
+        string key = foldedKey(ip, domain);
+        if (!negativeCache.contains(key) && findFilter.mayContain(key)) {
+            return false;
+        }
+        response.code = 404;
+        response.message = "验证记录不存在";
+        return true;
+    }
+
+    // 验证模式处理
+    ResponseStruct handleVerifyMode(const string& clientIP, const Json::Value& jsonData) {
+#ifdef DNS_AUTH_ASYNC_DB
+        if (asyncDb) {
+            return awaitResponse(handleVerifyModeAsync(clientIP, jsonData));
+        }
+#endif
+        ResponseStruct response;
+
+        // 获取域名
+        string domain;
+        if (!verifyParams(jsonData, domain, response)) {
+            return response;
+        }
+
+        // 从C表查询到期时间
+        StageTimer configTimer(STAGE_CONFIG_QUERY);
+        string expireTime;
+        StorageStatus status = lookupConfig(clientIP, domain, expireTime);
+        configTimer.finish();
+        if (!acceptConfig(status, response)) {
+            return response;
+        }
+
+        // 窗口内本进程刚写入过同样的记录，直接应答
+        if (verifyCoalescer.coalesce(foldedKey(clientIP, domain), expireTime)) {
+            return buildVerifyResponse(clientIP, domain, expireTime);
+        }
+
+        // 插入A表记录
+        StageTimer insertTimer(STAGE_VERIFY_INSERT);
+        if (serverConfig.verifyWriteMode == VERIFY_WRITE_SYNC) {
+            VerificationRow row = { clientIP, domain, expireTime };
+            status = storage->insertVerifications(&row, 1);
+            if (status != STORAGE_OK) {
+                return storageFailure(status, "数据库插入失败");
+            }
+        }
+        else if (!enqueueVerification(clientIP, domain, expireTime, response)) {
+            return response;
+        }
+        insertTimer.finish();
+
+        // 新的验证记录可能改变到期时间，丢弃旧的 find 缓存
+        noteVerified(clientIP, domain, expireTime, serverConfig.verifyWriteMode == VERIFY_WRITE_SYNC);
+
+        return buildVerifyResponse(clientIP, domain, expireTime);
+    }
+
+    // verify 参数校验
+    static bool verifyParams(const Json::Value& jsonData, string& domain, ResponseStruct& response) {
+        if (!jsonData.isMember("domain") || jsonData["domain"].asString().empty()) {
+            response.code = 400;
+            response.message = "缺少域名参数";
+            return false;
+        }
+        domain = jsonData["domain"].asString();
+        return true;
+    }
+
+    // 域名配置查询结果：不存在为 404，查询失败按存储状态给出 500 / 503
+    static bool acceptConfig(StorageStatus status, ResponseStruct& response) {
+        if (status == STORAGE_NOT_FOUND) {
+            response.code = 404;
+            response.message = "域名配置不存在或已禁用";
+            return false;
+        }
+        if (status != STORAGE_OK) {
+            response = storageFailure(status, "数据库查询失败");
+            return false;
+        }
+        return true;
+    }
+
+    // 交给后台写队列；队列满为 503，所在批次写入失败为 500
+    bool enqueueVerification(const string& clientIP, const string& domain, const string& expireTime,
+        ResponseStruct& response, bool mayWait = true) {
+        WriteSubmitResult result = verifyWriter.submit(clientIP, domain, expireTime, mayWait);
+        if (result == WRITE_QUEUE_FULL) {
+            response.code = 503;
+            response.message = "写入队列繁忙，请稍后重试";
+            return false;
+        }
+        if (result == WRITE_FAILED) {
+            response.code = 500;
+            response.message = "数据库插入失败";
+            return false;
+        }
+        return true;
+    }
+
+    // 构造 verify 成功响应
+    static ResponseStruct buildVerifyResponse(const string& clientIP, const string& domain, const string& expireTime) {
+        ResponseStruct response;
+        response.code = 200;
+        response.message = "验证成功";
+        response.hasData = true;
+        response.domain = domain;
+        response.ip = clientIP;
+        response.expireTime = expireTime;
+
+        return response;
+    }
+
+    // 查找模式处理
+    ResponseStruct handleFindMode(const string& clientIP, const Json::Value& jsonData) {
+#ifdef DNS_AUTH_ASYNC_DB
+        if (asyncDb) {
+            return awaitResponse(handleFindModeAsync(jsonData));
+        }
+#endif
+        ResponseStruct response;
+
+        // 验证必要参数
+        string ip;
+        string domain;
+        if (!findParams(jsonData, ip, domain, response)) {
+            return response;
+        }
+
+        FindCacheValue value;
+        if (!resolveFind(ip, domain, value, response)) {
+            return response;
+        }
+        return buildFindResponse(domain, value.targetIP, value.expireTime);
+    }
+
+    // find 参数校验
+    static bool findParams(const Json::Value& jsonData, string& ip, string& domain, ResponseStruct& response) {
+        if (!jsonData.isMember("ip") || jsonData["ip"].asString().empty()) {
+            response.code = 400;
+            response.message = "缺少IP参数";
+            return false;
+        }
+
+        if (!jsonData.isMember("dn") || jsonData["dn"].asString().empty()) {
+            response.code = 400;
+            response.message = "缺少域名参数";
+            return false;
+        }
+
+        ip = jsonData["ip"].asString();
+        domain = jsonData["dn"].asString();
+        return true;
+    }
+
+    // find 的查询与判定（HTTP 与 DNS 共用）：成功时填充 value 并返回 true，否则在 response 中给出错误
+    bool resolveFind(const string& ip, const string& domain, FindCacheValue& value, ResponseStruct& response) {
+        // 优先命中进程内缓存，命中时不访问数据库
+        if (findCache.lookup(ip, domain, value)) {
+            return true;
+        }
+        if (knownFindMiss(ip, domain, response)) {
+            return false;
+        }
+
+        // 一次往返：A表最新验证记录 + 到期时间戳 + B表映射IP
+        StageTimer queryTimer(STAGE_FIND_QUERY);
+        FindRecord record;
+        StorageStatus status = storage->findActive(ip, domain, record);
+        queryTimer.finish();
+        return acceptFindRecord(ip, domain, status, record, value, response);
+    }
+
+    // 判定 findActive 的结果：记录不存在、查询失败、已过期或缺少映射时给出错误，否则写入缓存
+    bool acceptFindRecord(const string& ip, const string& domain, StorageStatus status,
+        const FindRecord& record, FindCacheValue& value, ResponseStruct& response) {
+        if (status == STORAGE_NOT_FOUND) {
+            negativeCache.insert(foldedKey(ip, domain));
+            response.code = 404;
+            response.message = "验证记录不存在";
+            return false;
+        }
+        if (status != STORAGE_OK) {
+            response = storageFailure(status, "数据库查询失败");
+            return false;
+        }
+
+        const string& expireTime = record.expireTime;
+        const string& targetIP = record.targetIP;
+        int64_t expireAt = record.expireAt;
+
+        // UNIX_TIMESTAMP 对超出 TIMESTAMP 范围的时间返回 0，此时在进程内解析
+        if (expireAt <= 0) {
+            expireAt = parseDateTime(expireTime);
+        }
+
+        // 检查是否到期
+        if (static_cast<int64_t>(time(nullptr)) > expireAt) {
+            response.code = 403;
+            response.message = "域名已过期";
+            return false;
+        }
+
+        if (targetIP.empty()) {
+            response.code = 404;
+            response.message = "域名映射不存在";
+            return false;
+        }
+
+        value.targetIP = targetIP;
+        value.expireTime = expireTime;
+        value.expireAt = expireAt;
+        findCache.insert(ip, domain, value);
+        return true;
+    }
+
+    // DNS 查询：报文源 IP 即 client_ip，结果与 HTTP find 一致，
+    // 403 对应 REFUSED、404 对应 NXDOMAIN；记录地址族与查询类型不符时返回无应答的 NOERROR
+    void answerDnsQuery(const string& clientIP, const string& name, uint16_t type, DnsAnswer& answer) {
+        RequestScope access(clientIP, "dns");
+
+        StageTimer whitelistTimer(STAGE_WHITELIST);
+        bool allowed = checkIPInWhitelist(clientIP);
+        whitelistTimer.finish();
+        if (!allowed || name.empty()) {
+            access.code = 403;
+            answer.rcode = DNSResponder::rcodeFor(access.code);
+            return;
+        }
+
+        ResponseStruct response;
+        FindCacheValue value;
+        if (!resolveFind(clientIP, name, value, response)) {
+            access.code = response.code;
+            answer.rcode = DNSResponder::rcodeFor(access.code);
+            return;
+        }
+
+        access.code = 200;
+        fillDnsAnswer(value, type, answer);
+    }
+
+    // 成功结果转为应答记录：TTL 不超过记录剩余有效期，地址族与查询类型不符时不带记录
+    void fillDnsAnswer(const FindCacheValue& value, uint16_t type, DnsAnswer& answer) const {
+        answer.rcode = DNS_RCODE_NOERROR;
+        int64_t remaining = value.expireAt - static_cast<int64_t>(time(nullptr));
+        answer.ttl = static_cast<uint32_t>(max<int64_t>(0, min<int64_t>(serverConfig.dnsTtlSec, remaining)));
+        if (type == DNSResponder::kTypeA && inet_pton(AF_INET, value.targetIP.c_str(), answer.address) == 1) {
+            answer.type = type;
+        }
+        else if (type == DNSResponder::kTypeAAAA && inet_pton(AF_INET6, value.targetIP.c_str(), answer.address) == 1) {
+            answer.type = type;
+        }
+    }
+
+#ifdef DNS_AUTH_ASYNC_DB
+    // ---- 协程版本：数据库往返经 MySQLReactor 完成，等待期间不占用线程 ----
+    // 参数以引用传入，调用方在协程结束前保持其有效
+
+    // httplib 的处理函数是同步的，HTTP 请求在当前线程等待协程完成；
+    // 数据库连接由 reactor 持有，连接数不再随 HTTP 工作线程数增长
+    static ResponseStruct awaitResponse(Task<ResponseStruct> task) {
+        shared_ptr<promise<ResponseStruct>> result = make_shared<promise<ResponseStruct>>();
+        future<ResponseStruct> ready = result->get_future();
+        deliverResponse(move(task), result);
+        return ready.get();
+    }
+
+    static AsyncTask deliverResponse(Task<ResponseStruct> task, shared_ptr<promise<ResponseStruct>> result) {
+        result->set_value(co_await task);
+    }
+
+    Task<StorageStatus> lookupConfigAsync(const string& clientIP, const string& domain, string& expireTime) {
+        shared_ptr<const WarmSnapshot> snapshot = warmStart.serving();
+        if (snapshot && snapshot->lookup(WarmSnapshot::SECTION_CONFIGS, foldedKey(clientIP, domain), expireTime)) {
+            warmStart.countConfigHit();
+            co_return STORAGE_OK;
+        }
+        co_return co_await asyncDb->lookupConfig(clientIP, domain, expireTime);
+    }
+
+    // 入队即返回的模式沿用写队列；同步模式与等待批次提交的模式直接异步插入一行，
+    // 两者都在写入提交后才应答，且不会让 reactor 线程阻塞在批次上
+    Task<ResponseStruct> handleVerifyModeAsync(const string& clientIP, const Json::Value& jsonData) {
+        ResponseStruct response;
+        string domain;
+        if (!verifyParams(jsonData, domain, response)) {
+            co_return response;
+        }
+
+        StageTimer configTimer(STAGE_CONFIG_QUERY);
+        string expireTime;
+        StorageStatus status = co_await lookupConfigAsync(clientIP, domain, expireTime);
+        configTimer.finish();
+        if (!acceptConfig(status, response)) {
+            co_return response;
+        }
+        if (verifyCoalescer.coalesce(foldedKey(clientIP, domain), expireTime)) {
+            co_return buildVerifyResponse(clientIP, domain, expireTime);
+        }
+
+        StageTimer insertTimer(STAGE_VERIFY_INSERT);
+        if (serverConfig.verifyWriteMode == VERIFY_WRITE_ACK_ON_ENQUEUE) {
+            // 此时运行在 reactor 线程上：队列满立即返回 503，不等待
+            if (!enqueueVerification(clientIP, domain, expireTime, response, false)) {
+                co_return response;
+            }
+        }
+        else {
+            VerificationRow row = { clientIP, domain, expireTime };
+            status = co_await asyncDb->insertVerification(row);
+            if (status != STORAGE_OK) {
+                co_return storageFailure(status, "数据库插入失败");
+            }
+        }
+        insertTimer.finish();
+
+        noteVerified(clientIP, domain, expireTime, serverConfig.verifyWriteMode != VERIFY_WRITE_ACK_ON_ENQUEUE);
+        co_return buildVerifyResponse(clientIP, domain, expireTime);
+    }
+
+    Task<bool> resolveFindAsync(const string& ip, const string& domain, FindCacheValue& value, ResponseStruct& response) {
+        if (findCache.lookup(ip, domain, value)) {
+            co_return true;
+        }
+        if (knownFindMiss(ip, domain, response)) {
+            co_return false;
+        }
+
+        StageTimer queryTimer(STAGE_FIND_QUERY);
+        FindRecord record;
+        StorageStatus status = co_await asyncDb->findActive(ip, domain, record);
+        queryTimer.finish();
+        co_return acceptFindRecord(ip, domain, status, record, value, response);
+    }
+
+    Task<ResponseStruct> handleFindModeAsync(const Json::Value& jsonData) {
+        ResponseStruct response;
+        string ip;
+        string domain;
+        if (!findParams(jsonData, ip, domain, response)) {
+            co_return response;
+        }
+
+        FindCacheValue value;
+        if (!co_await resolveFindAsync(ip, domain, value, response)) {
+            co_return response;
+        }
+        co_return buildFindResponse(domain, value.targetIP, value.expireTime);
+    }
+
+    // DNS 查询的协程版本：收发线程只负责发起，结果就绪后由 reply 在 reactor 线程发出应答
+    AsyncTask answerDnsQueryAsync(string clientIP, string name, uint16_t type, DNSResponder::Reply reply) {
+        DnsAnswer answer;
+        {
+            RequestScope access(clientIP, "dns");
+
+            StageTimer whitelistTimer(STAGE_WHITELIST);
+            bool allowed = checkIPInWhitelist(clientIP);
+            whitelistTimer.finish();
+
+            ResponseStruct response;
+            FindCacheValue value;
+            if (!allowed || name.empty()) {
+                access.code = 403;
+                answer.rcode = DNSResponder::rcodeFor(access.code);
+            }
+            else if (!co_await resolveFindAsync(clientIP, name, value, response)) {
+                access.code = response.code;
+                answer.rcode = DNSResponder::rcodeFor(access.code);
+            }
+            else {
+                access.code = 200;
+                fillDnsAnswer(value, type, answer);
+            }
+        }
+        reply(answer);
+    }
+#endif
+
+    // 构造 find 成功响应
+    static ResponseStruct buildFindResponse(const string& domain, const string& targetIP, const string& expireTime) {
+        ResponseStruct response;
+        response.code = 200;
+        response.message = "查询成功";
+        response.hasData = true;
+        response.domain = domain;
+        response.ip = targetIP;
+        response.expireTime = expireTime;
+
+        return response;
+    }
+
+    // 同时处理的请求已达上限：直接拒绝，不再排队等待数据库连接
+    static void rejectOverloaded(Response& res, RequestScope& access) {
+        static const string kOverloaded = ResponseWriter::makeTemplate(503, "服务繁忙，请稍后重试");
+        res.set_content(kOverloaded, "application/json");
+        access.code = 503;
+    }
+
+    // 客户端超出自己的请求限额
+    static void rejectRateLimited(Response& res, RequestScope& access) {
+        static const string kRateLimited = ResponseWriter::makeTemplate(429, "请求过于频繁，请稍后重试");
+        res.set_content(kRateLimited, "application/json");
+        access.code = 429;
+    }
+
+    // 处理HTTP POST请求
+    void handlePost(const Request& req, Response& res) {
+        // 获取客户端IP
+        string clientIP = resolveClientIP(req);
+
+        RequestScope access(clientIP, "-");
+
+        AdmissionControl::Ticket ticket(admission);
+        if (!ticket.admitted()) {
+            rejectOverloaded(res, access);
+            return;
+        }
+
+        // 检查IP白名单
+        StageTimer whitelistTimer(STAGE_WHITELIST);
+        RateLimit limit;
+        bool allowed = checkIPInWhitelist(clientIP, &limit);
+        whitelistTimer.finish();
+        if (!allowed) {
+            static const string kNotWhitelisted = ResponseWriter::makeTemplate(403, "IP不在白名单中");
+            res.set_content(kNotWhitelisted, "application/json");
+            access.code = 403;
+            return;
+        }
+        if (!admission.admit(clientIP, limit)) {
+            rejectRateLimited(res, access);
+            return;
+        }
+
+        // 解析JSON数据
+        Json::Value jsonData;
+        if (!parseRequestBody(req, res, jsonData)) {
+            access.code = 400;
+            return;
+        }
+
+        // 验证mode字段
+        if (!jsonData.isMember("mode") || jsonData["mode"].asString().empty()) {
+            static const string kMissingMode = ResponseWriter::makeTemplate(400, "缺少mode参数");
+            res.set_content(kMissingMode, "application/json");
+            access.code = 400;
+            return;
+        }
+
+        string mode = jsonData["mode"].asString();
+        access.setMode(mode);
+
+        ResponseStruct processResponse;
+
+        // 根据mode处理不同请求
+        if (mode == "verify") {
+            processResponse = handleVerifyMode(clientIP, jsonData);
+        }
+        else if (mode == "find") {
+            processResponse = handleFindMode(clientIP, jsonData);
+        }
+        else {
+            processResponse.code = 400;
+            processResponse.message = "不支持的mode类型";
+        }
+
+        // 构建响应
+        access.code = processResponse.code;
+        sendResponse(res, processResponse);
+    }
+
+    // 处理批量请求：白名单只检查一次，find 条目合并为一次 IN 查询，verify 条目合并为一次多行插入
+    void handleBatchPost(const Request& req, Response& res) {
+        string clientIP = resolveClientIP(req);
+
+        RequestScope access(clientIP, "batch");
+
+        AdmissionControl::Ticket ticket(admission);
+        if (!ticket.admitted()) {
+            rejectOverloaded(res, access);
+            return;
+        }
+
+        StageTimer whitelistTimer(STAGE_WHITELIST);
+        RateLimit limit;
+        bool allowed = checkIPInWhitelist(clientIP, &limit);
+        whitelistTimer.finish();
+        if (!allowed) {
+            static const string kNotWhitelisted = ResponseWriter::makeTemplate(403, "IP不在白名单中");
+            res.set_content(kNotWhitelisted, "application/json");
+            access.code = 403;
+            return;
+        }
+
+        Json::Value jsonData;
+        if (!parseRequestBody(req, res, jsonData)) {
+            access.code = 400;
+            return;
+        }
+
+        if (!jsonData.isMember("items") || !jsonData["items"].isArray()) {
+            static const string kMissingItems = ResponseWriter::makeTemplate(400, "缺少items参数");
+            res.set_content(kMissingItems, "application/json");
+            access.code = 400;
+            return;
+        }
+
+        const Json::Value& itemsJson = jsonData["items"];
+        if (itemsJson.size() > serverConfig.batchMaxItems) {
+            static const string kTooMany = ResponseWriter::makeTemplate(400, "批量条目数超过上限");
+            res.set_content(kTooMany, "application/json");
+            access.code = 400;
+            return;
+        }
+
+        // 每个条目消耗一个令牌
+        if (!admission.admit(clientIP, limit, static_cast<uint32_t>(itemsJson.size()))) {
+            rejectRateLimited(res, access);
+            return;
+        }
+
+        // 逐条校验参数，校验失败的条目直接得到 400 结果
+        vector<BatchItem> items(itemsJson.size());
+        vector<ResponseStruct> results(itemsJson.size());
+        for (Json::ArrayIndex i = 0; i < itemsJson.size(); ++i) {
+            const Json::Value& item = itemsJson[i];
+            BatchItem& batchItem = items[i];
+            string mode = item.isObject() && item.isMember("mode") ? item["mode"].asString() : string();
+
+            if (mode == "verify") {
+                batchItem.ip = clientIP;
+                batchItem.domain = item.isMember("domain") ? item["domain"].asString() : string();
+                if (batchItem.domain.empty()) {
+                    results[i] = makeErrorResponse(400, "缺少域名参数");
+                    continue;
+                }
+            }
+            else if (mode == "find") {
+                batchItem.find = true;
+                batchItem.ip = item.isMember("ip") ? item["ip"].asString() : string();
+                batchItem.domain = item.isMember("dn") ? item["dn"].asString() : string();
+                if (batchItem.ip.empty()) {
+                    results[i] = makeErrorResponse(400, "缺少IP参数");
+                    continue;
+                }
+                if (batchItem.domain.empty()) {
+                    results[i] = makeErrorResponse(400, "缺少域名参数");
+                    continue;
+                }
+            }
+            else {
+                results[i] = makeErrorResponse(400, mode.empty() ? "缺少mode参数" : "不支持的mode类型");
+                continue;
+            }
+            batchItem.pending = true;
+        }
+
+        resolveBatchFinds(items, results);
+        resolveBatchVerifies(clientIP, items, results);
+
+        ResponseStruct envelope;
+        envelope.code = 200;
+        envelope.message = "批量处理完成";
+
+        StageTimer serializeTimer(STAGE_SERIALIZE);
+        string& body = ResponseWriter::buffer();
+        ResponseWriter::writeBatch(body, envelope, results);
+        res.set_content(body.data(), body.size(), "application/json");
+        access.code = envelope.code;
+    }
+
+    // 批量 find：先查缓存，未命中的 (ip, domain) 去重后交给存储层一次查出
+    void resolveBatchFinds(vector<BatchItem>& items, vector<ResponseStruct>& results) {
+        unordered_map<string, vector<size_t>> waiting;
+        vector<pair<const string*, const string*>> keys;
+        for (size_t i = 0; i < items.size(); ++i) {
+            BatchItem& item = items[i];
+            if (!item.find || !item.pending) {
+                continue;
+            }
+
+            FindCacheValue cached;
+            if (findCache.lookup(item.ip, item.domain, cached)) {
+                results[i] = buildFindResponse(item.domain, cached.targetIP, cached.expireTime);
+                item.pending = false;
+                continue;
+            }
+            if (knownFindMiss(item.ip, item.domain, results[i])) {
+                item.pending = false;
+                continue;
+            }
+
+            vector<size_t>& list = waiting[foldedKey(item.ip, item.domain)];
+            if (list.empty()) {
+                keys.emplace_back(&item.ip, &item.domain);
+            }
+            list.push_back(i);
+        }
+        if (keys.empty()) {
+            return;
+        }
+
+        StageTimer queryTimer(STAGE_FIND_QUERY);
+        vector<FindRecord> records;
+        StorageStatus status = storage->findActiveBatch(keys, records);
+        queryTimer.finish();
+        if (status != STORAGE_OK) {
+            finishBatchItems(items, results, waiting, storageFailure(status, "数据库查询失败"));
+            return;
+        }
+
+        int64_t now = static_cast<int64_t>(time(nullptr));
+        for (const FindRecord& record : records) {
+            auto it = waiting.find(foldedKey(record.clientIP, record.domain));
+            if (it == waiting.end()) {
+                continue;
+            }
+
+            const BatchItem& item = items[it->second.front()];
+            int64_t expireAt = record.expireAt;
+            if (expireAt <= 0) {
+                expireAt = parseDateTime(record.expireTime);
+            }
+
+            ResponseStruct result;
+            if (now > expireAt) {
+                result = makeErrorResponse(403, "域名已过期");
+            }
+            else if (record.targetIP.empty()) {
+                result = makeErrorResponse(404, "域名映射不存在");
+            }
+            else {
+                FindCacheValue value;
+                value.targetIP = record.targetIP;
+                value.expireTime = record.expireTime;
+                value.expireAt = expireAt;
+                findCache.insert(item.ip, item.domain, value);
+                result = buildFindResponse(item.domain, record.targetIP, record.expireTime);
+            }
+            finishBatchKey(items, results, waiting, it->first, result);
+        }
+
+        // 查询结果中没有出现的 (ip, domain) 即没有验证记录
+        for (const auto& entry : waiting) {
+            if (items[entry.second.front()].pending) {
+                negativeCache.insert(entry.first);
+            }
+        }
+        finishBatchItems(items, results, waiting, makeErrorResponse(404, "验证记录不存在"));
+    }
+
+    // 批量 verify：一次取出全部域名配置，再一次性写入 dns_verifications
+    void resolveBatchVerifies(const string& clientIP, vector<BatchItem>& items, vector<ResponseStruct>& results) {
+        unordered_map<string, vector<size_t>> waiting;
+        vector<size_t> uniqueItems;
+        vector<const string*> domains;
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (items[i].find || !items[i].pending) {
+                continue;
+            }
+            vector<size_t>& list = waiting[foldedKey(clientIP, items[i].domain)];
+            if (list.empty()) {
+                uniqueItems.push_back(i);
+                domains.push_back(&items[i].domain);
+            }
+            list.push_back(i);
+        }
+        if (uniqueItems.empty()) {
+            return;
+        }
+
+        StageTimer configTimer(STAGE_CONFIG_QUERY);
+        vector<ConfigRecord> configs;
+        StorageStatus status = lookupConfigs(clientIP, domains, configs);
+        configTimer.finish();
+        if (status != STORAGE_OK) {
+            finishBatchItems(items, results, waiting, storageFailure(status, "数据库查询失败"));
+            return;
+        }
+
+        unordered_map<string, string> expireTimes;
+        for (const ConfigRecord& config : configs) {
+            expireTimes[foldedKey(clientIP, config.domain)] = config.expireTime;
+        }
+
+        vector<VerificationRow> rows;
+        vector<string> rowKeys;
+        for (size_t index : uniqueItems) {
+            string key = foldedKey(clientIP, items[index].domain);
+            auto it = expireTimes.find(key);
+            if (it == expireTimes.end()) {
+                finishBatchKey(items, results, waiting, key, makeErrorResponse(404, "域名配置不存在或已禁用"));
+                continue;
+            }
+            if (verifyCoalescer.coalesce(key, it->second)) {
+                finishBatchKey(items, results, waiting, key, buildVerifyResponse(clientIP, items[index].domain, it->second));
+                continue;
+            }
+            rows.push_back({ clientIP, items[index].domain, it->second });
+            rowKeys.push_back(key);
+        }
+        if (rows.empty()) {
+            return;
+        }
+
+        StageTimer insertTimer(STAGE_VERIFY_INSERT);
+        status = storage->insertVerifications(rows.data(), rows.size());
+        insertTimer.finish();
+
+        ResponseStruct failure = storageFailure(status, "数据库插入失败");
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (status == STORAGE_OK) {
+                noteVerified(rows[i].clientIP, rows[i].domain, rows[i].expireTime);
+                finishBatchKey(items, results, waiting, rowKeys[i],
+                    buildVerifyResponse(rows[i].clientIP, rows[i].domain, rows[i].expireTime));
+            }
+            else {
+                finishBatchKey(items, results, waiting, rowKeys[i], failure);
+            }
+        }
+    }
+
+    // 把同一个键下的全部条目标记为完成
+    static void finishBatchKey(vector<BatchItem>& items, vector<ResponseStruct>& results,
+        const unordered_map<string, vector<size_t>>& waiting, const string& key, const ResponseStruct& result) {
+        auto it = waiting.find(key);
+        if (it == waiting.end()) {
+            return;
+        }
+        for (size_t index : it->second) {
+            if (items[index].pending) {
+                results[index] = result;
+                items[index].pending = false;
+            }
+        }
+    }
+
+    // 把所有仍未完成的条目标记为同一结果
+    static void finishBatchItems(vector<BatchItem>& items, vector<ResponseStruct>& results,
+        const unordered_map<string, vector<size_t>>& waiting, const ResponseStruct& result) {
+        for (const auto& entry : waiting) {
+            finishBatchKey(items, results, waiting, entry.first, result);
+        }
+    }
+
+    static ResponseStruct makeErrorResponse(int code, const char* message) {
+        ResponseStruct response;
+        response.code = code;
+        response.message = message;
+        return response;
+    }
+
+    // 校验 Authorization: Bearer <adminToken>；逐字节比较全部内容，耗时与匹配位置无关
+    bool adminAuthorized(const Request& req) const {
+        static const string kBearer = "Bearer ";
+        const string& token = serverConfig.adminToken;
+        string header = req.get_header_value("Authorization");
+        if (token.empty() || header.size() != kBearer.size() + token.size() ||
+            header.compare(0, kBearer.size(), kBearer) != 0) {
+            return false;
+        }
+        unsigned char diff = 0;
+        for (size_t i = 0; i < token.size(); ++i) {
+            diff |= static_cast<unsigned char>(header[kBearer.size() + i] ^ token[i]);
+        }
+        return diff == 0;
+    }
+
+    // 批量导入：POST /admin/import?table=configs|mappings&format=csv|ndjson，请求体为导入数据。
+    // 请求体边收边解析，不整体缓存；数据按 importBatchRows 行一个事务写入，结束后失效受影响的缓存并返回导入统计。
+    // 请求体超过 importMaxBytes 时返回 413，超限前已提交的批次保留
+    void handleAdminImport(const Request& req, Response& res, const ContentReader& content) {
+        string clientIP = resolveClientIP(req);
+        if (!adminAuthorized(req)) {
+            logWarn("管理接口认证失败: ", clientIP);
+            static const string kUnauthorized = ResponseWriter::makeTemplate(401, "管理令牌无效");
+            res.set_content(kUnauthorized, "application/json");
+            return;
+        }
+
+        ImportTable table = IMPORT_DOMAIN_CONFIGS;
+        ImportFormat format = IMPORT_FORMAT_CSV;
+        if (!BulkImporter::parseTable(req.get_param_value("table"), table) ||
+            (req.has_param("format") && !BulkImporter::parseFormat(req.get_param_value("format"), format))) {
+            static const string kBadParams = ResponseWriter::makeTemplate(400,
+                "table 应为 configs 或 mappings，format 应为 csv 或 ndjson");
+            res.set_content(kBadParams, "application/json");
+            return;
+        }
+
+        unique_lock<mutex> lock(importMtx, try_to_lock);
+        if (!lock.owns_lock()) {
+            static const string kBusy = ResponseWriter::makeTemplate(503, "已有导入任务在进行，请稍后重试");
+            res.set_content(kBusy, "application/json");
+            return;
+        }
+
+        if (req.has_header("Content-Length") &&
+            strtoull(req.get_header_value("Content-Length").c_str(), nullptr, 10) > serverConfig.importMaxBytes) {
+            static const string kTooLarge = ResponseWriter::makeTemplate(413, "导入数据超过大小上限");
+            res.set_content(kTooLarge, "application/json");
+            return;
+        }
+
+        logInfo("开始批量导入: ", clientIP, " table=", req.get_param_value("table"));
+        BulkImporter importer(*storage, table, format, serverConfig.importBatchRows);
+        uint64_t received = 0;
+        bool tooLarge = false;
+        bool complete = content([this, &importer, &received, &tooLarge](const char* data, size_t length) {
+            received += length;
+            if (received > serverConfig.importMaxBytes) {
+                tooLarge = true;
+                return false;
+            }
+            importer.feed(data, length);
+            return true;
+        });
+        bool ok = importer.finish(complete) && complete;
+        invalidateImported(importer);
+        if (!complete) {
+            logWarn("批量导入的数据", tooLarge ? "超过大小上限" : "未接收完整", "，已收到 ", received, " 字节");
+        }
+
+        const ImportStats& stats = importer.stats();
+        string errors;
+        for (const string& error : stats.errors) {
+            if (!errors.empty()) errors += "; ";
+            errors += error;
+        }
+
+        Json::Value data;
+        data["lines"] = Json::Value(std::to_string(stats.lines));
+        data["imported"] = Json::Value(std::to_string(stats.imported));
+        data["rejected"] = Json::Value(std::to_string(stats.rejected));
+        data["batches"] = Json::Value(std::to_string(stats.batches));
+        data["elapsed_ms"] = Json::Value(std::to_string(stats.elapsedMs));
+        data["errors"] = Json::Value(errors);
+
+        Json::Value body;
+        if (ok) {
+            body["code"] = Json::Value("200");
+            body["message"] = Json::Value("导入完成");
+        }
+        else if (tooLarge) {
+            body["code"] = Json::Value("413");
+            body["message"] = Json::Value("导入数据超过大小上限，已提交的批次保留");
+        }
+        else if (!complete) {
+            body["code"] = Json::Value("400");
+            body["message"] = Json::Value("导入数据未接收完整，已提交的批次保留");
+        }
+        else {
+            body["code"] = Json::Value("500");
+            body["message"] = Json::Value("数据库写入失败，导入中止");
+        }
+        body["data"] = data;
+
+        Json::StreamWriterBuilder writer;
+        res.set_content(Json::writeString(writer, body), "application/json");
+    }
+
+    // 获取客户端IP：优先使用反向代理设置的 X-Real-IP
+    static string resolveClientIP(const Request& req) {
+        return req.has_header("X-Real-IP") ? req.get_header_value("X-Real-IP") : req.remote_addr;
+    }
+
+    // 解析请求体 JSON，失败时直接写好 400 响应
+    static bool parseRequestBody(const Request& req, Response& res, Json::Value& jsonData) {
+        StageTimer timer(STAGE_PARSE);
+        Json::CharReaderBuilder reader;
+        string errors;
+
+        istringstream jsonStream(req.body);
+        if (!Json::parseFromStream(reader, jsonStream, &jsonData, &errors)) {
+            ResponseStruct errorResponse;
+            errorResponse.code = 400;
+            errorResponse.message = "JSON解析失败: ";
+            errorResponse.detail = errors;
+            timer.finish();
+            sendResponse(res, errorResponse);
+            return false;
+        }
+        return true;
+    }
+
+    // 把处理结果序列化到线程内缓冲区并写入 HTTP 响应
+    static void sendResponse(Response& res, const ResponseStruct& response) {
+        StageTimer timer(STAGE_SERIALIZE);
+        string& body = ResponseWriter::buffer();
+        ResponseWriter::write(body, response);
+        res.set_content(body.data(), body.size(), "application/json");
+    }
+
+    // 汇总请求指标并附加连接池、缓存、写队列的当前状态（Prometheus 文本格式）
+    string renderMetrics() {
+        string out;
+        out.reserve(32768);
+        Metrics::instance().render(out);
+
+        PoolStats stats = storage->poolStats();
+        Metrics::writeValue(out, "dns_auth_pool_connections", "gauge", "Open MySQL connections.", stats.total);
+        Metrics::writeValue(out, "dns_auth_pool_idle_connections", "gauge", "Idle MySQL connections.", stats.idle);
+        Metrics::writeValue(out, "dns_auth_pool_acquired_total", "counter", "Connections handed out by the pool.", stats.acquired);
+        Metrics::writeValue(out, "dns_auth_pool_waited_total", "counter", "Acquires that had to wait for a connection.", stats.waited);
+        Metrics::writeValue(out, "dns_auth_pool_timeouts_total", "counter", "Acquires that timed out.", stats.timeouts);
+        Metrics::writeValue(out, "dns_auth_pool_reconnects_total", "counter", "Connections re-established after being lost.", stats.reconnects);
+        Metrics::writeValue(out, "dns_auth_pool_max_wait_microseconds", "gauge", "Longest single wait for a connection.", stats.maxWaitUs);
+        storage->appendMetrics(out);
+
+        Metrics::writeValue(out, "dns_auth_whitelist_entries", "gauge", "Prefixes in the in-memory whitelist.", whitelist.size());
+        Metrics::writeValue(out, "dns_auth_find_cache_entries", "gauge", "Entries in the find result cache.", findCache.size());
+        Metrics::writeValue(out, "dns_auth_find_cache_hits_total", "counter", "Find cache hits.", findCache.hits());
+        Metrics::writeValue(out, "dns_auth_find_cache_misses_total", "counter", "Find cache misses.", findCache.misses());
+        Metrics::writeValue(out, "dns_auth_find_cache_evictions_total", "counter", "Find cache evictions.", findCache.evictions());
+
+        Metrics::writeValue(out, "dns_auth_verify_queue_depth", "gauge", "Verification rows waiting to be written.", verifyWriter.depth());
+        Metrics::writeValue(out, "dns_auth_verify_batches_total", "counter", "Verification batches written.", verifyWriter.batches());
+        Metrics::writeValue(out, "dns_auth_verify_rows_total", "counter", "Verification rows written.", verifyWriter.rowsWritten());
+        Metrics::writeValue(out, "dns_auth_verify_rejected_total", "counter", "Verification rows rejected because the queue was full.", verifyWriter.rejected());
+        Metrics::writeValue(out, "dns_auth_verify_failed_total", "counter", "Verification rows whose batch failed to commit.", verifyWriter.failed());
+        retention.appendMetrics(out);
+        warmStart.appendMetrics(out);
+        Metrics::writeValue(out, "dns_auth_negative_cache_entries", "gauge", "Entries in the miss cache.", negativeCache.size());
+        Metrics::writeValue(out, "dns_auth_negative_cache_hits_total", "counter", "Lookups answered from the miss cache without a query.", negativeCache.hits());
+        Metrics::writeValue(out, "dns_auth_verify_coalesce_entries", "gauge", "Recently written verification keys tracked for coalescing.", verifyCoalescer.size());
+        Metrics::writeValue(out, "dns_auth_verify_coalesced_total", "counter", "Verify requests acknowledged without a write because an identical row was just written.", verifyCoalescer.hits());
+        findFilter.appendMetrics(out);
+        admission.appendMetrics(out);
+        dnsResponder.appendMetrics(out);
+#ifdef DNS_AUTH_ASYNC_DB
+        if (asyncDb) {
+            asyncDb->appendMetrics(out);
+        }
+#endif
+        return out;
+    }
+
+    // 启动服务器
+    // onListening 在端口绑定成功、开始接受连接之前调用（多进程模式用于通知主进程）
+    void start(int port = 8080, const function<void()>& onListening = nullptr) {
+        Logger::instance().setLevel(serverConfig.logLevel);
+        Logger::instance().setAccessSampling(serverConfig.accessLogSampleEvery);
+
+        if (!initStorage()) {
+            logError("存储初始化失败，服务器启动中止");
+            return;
+        }
+
+        server.Post("/dns-auth", [this](const Request& req, Response& res) {
             this->handlePost(req, res);
             });
 
-        server.Get("/health", [](const Request& req, Response& res) {
+        server.Post("/dns-auth/batch", [this](const Request& req, Response& res) {
+            this->handleBatchPost(req, res);
+            });
+
+        server.Get("/health", [this](const Request& req, Response& res) {
+            PoolStats stats = storage->poolStats();
+
             Json::Value healthJson;
             healthJson["status"] = Json::Value("ok");
+            healthJson["storage"] = Json::Value(storage->name());
             healthJson["timestamp"] = Json::Value(std::to_string(static_cast<int>(time(nullptr))));
+            healthJson["pool_total"] = Json::Value(std::to_string(stats.total));
+            healthJson["pool_idle"] = Json::Value(std::to_string(stats.idle));
+            healthJson["pool_waited"] = Json::Value(std::to_string(stats.waited));
+            healthJson["pool_timeouts"] = Json::Value(std::to_string(stats.timeouts));
+            healthJson["pool_max_wait_us"] = Json::Value(std::to_string(stats.maxWaitUs));
+            healthJson["find_cache_hits"] = Json::Value(std::to_string(findCache.hits()));
+            healthJson["find_cache_misses"] = Json::Value(std::to_string(findCache.misses()));
+
+            Json::StreamWriterBuilder writer;
+            res.set_content(Json::writeString(writer, healthJson), "application/json");
+            });
+
+        server.Get("/metrics", [this](const Request& /*req*/, Response& res) {
+            res.set_content(renderMetrics(), "text/plain; version=0.0.4");
+            });
+
+        // 请求体上限由 httplib 在读取前按 Content-Length 检查
+        server.set_payload_max_length(serverConfig.importMaxBytes);
+        if (!serverConfig.adminToken.empty()) {
+            server.Post("/admin/import", [this](const Request& req, Response& res, const ContentReader& content) {
+                this->handleAdminImport(req, res, content);
+                });
+        }
+
+        if (serverConfig.dnsPort > 0) {
+            startDns();
+        }
+
+#ifdef DNS_AUTH_WORKERS
+        if (serverConfig.workerProcesses != 0) {
+            // 各工作进程绑定同一端口，由内核按连接分配
+            server.set_socket_options([](int sock) {
+                int on = 1;
+                setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+                });
+        }
+#endif
+
+        logInfo("DNS验证服务器启动，监听端口: ", port);
+        if (!server.bind_to_port("0.0.0.0", port)) {
+            logError("HTTP 端口绑定失败: ", port);
+            return;
+        }
+        if (stopRequested.load()) {
+            return;
+        }
+        if (onListening) {
+            onListening();
+        }
+        server.listen_after_bind();
+    }
 
-            Json::StreamWriterBuilder writer;
-            res.set_content(Json::writeString(writer, healthJson), "application/json");
+    // 启动 UDP DNS 应答；需在 initStorage() 成功之后调用
+    bool startDns() {
+#ifdef DNS_AUTH_ASYNC_DB
+        if (asyncDb) {
+            return dnsResponder.startAsync(serverConfig, [this](const string& clientIP, const string& name,
+                uint16_t type, DNSResponder::Reply reply) {
+                this->answerDnsQueryAsync(clientIP, name, type, move(reply));
+                });
+        }
+#endif
+        return dnsResponder.start(serverConfig, [this](const string& clientIP, const string& name,
+            uint16_t type, DnsAnswer& answer) {
+            this->answerDnsQuery(clientIP, name, type, answer);
             });
+    }
 
-        cout << "DNS验证服务器启动，监听端口: " << port << endl;
-        server.listen("0.0.0.0", port);
+    // 停止监听，start() 随之返回
+    void stop() {
+        stopRequested.store(true);
+        // 先停止接受 HTTP 请求；DNS 收发线程在 reactor 之后停止，未完成的 DNS 查询以失败结束并在套接字关闭前应答
+        server.stop();
+#ifdef DNS_AUTH_ASYNC_DB
+        if (asyncDb) {
+            asyncDb->stop();
+        }
+#endif
+        dnsResponder.stop();
     }
 };
 
 // 辅助函数：添加IP到白名单
-void addIPToWhitelist(MYSQL* conn, const string& ip, const string& description = "") {
-    string sql = "INSERT IGNORE INTO ip_whitelist (ip, description) VALUES ('" +
-        ip + "', '" + description + "')";
+void addIPToWhitelist(DNSAuthStorage& storage, const string& ip, const string& description = "") {
+    if (storage.addWhitelist(ip, description)) {
+        logInfo("IP ", ip, " 已添加到白名单");
+    }
+    else {
+        logError("添加白名单失败: ", ip);
+    }
+}
 
-    if (mysql_query(conn, sql.c_str()) == 0) {
-        cout << "IP " << ip << " 已添加到白名单" << endl;
+// 辅助函数：设置白名单条目的请求限额（每秒令牌数与令牌桶容量，0 表示使用全局默认值）
+void setClientRateLimit(DNSAuthStorage& storage, const string& ip, uint32_t rate, uint32_t burst = 0) {
+    RateLimit limit;
+    limit.rate = rate;
+    limit.burst = burst;
+    if (storage.setWhitelistLimit(ip, limit)) {
+        logInfo("IP ", ip, " 的请求限额已设置为每秒 ", rate, "，容量 ", burst);
     }
     else {
-        cerr << "添加白名单失败: " << mysql_error(conn) << endl;
+        logError("设置请求限额失败: ", ip);
     }
 }
 
 // 辅助函数：添加域名配置
-void addDomainConfig(MYSQL* conn, const string& clientIP, const string& domain,
-    const string& expireTime, int status = 1) {
-    string sql = "INSERT INTO domain_configs (client_ip, domain, expire_time, status) VALUES ('" +
-        clientIP + "', '" + domain + "', '" + expireTime + "', " + to_string(status) +
-        ") ON DUPLICATE KEY UPDATE expire_time = VALUES(expire_time), status = VALUES(status)";
-
-    if (mysql_query(conn, sql.c_str()) == 0) {
-        cout << "域名配置已添加/更新: " << domain << " -> " << clientIP << endl;
+void addDomainConfig(DNSAuthStorage& storage, const string& clientIP, const string& domain,
+    const string& expireTime, int status = 1, FindResultCache* cache = nullptr) {
+    if (storage.upsertDomainConfig(clientIP, domain, expireTime, status)) {
+        if (cache) cache->invalidate(clientIP, domain);
+        logInfo("域名配置已添加/更新: ", domain, " -> ", clientIP);
     }
     else {
-        cerr << "添加域名配置失败: " << mysql_error(conn) << endl;
+        logError("添加域名配置失败: ", domain);
     }
 }
 
 // 辅助函数：添加域名映射
-void addDomainMapping(MYSQL* conn, const string& domain, const string& targetIP) {
-    string sql = "INSERT INTO domain_mappings (domain, target_ip) VALUES ('" +
-        domain + "', '" + targetIP + "') ON DUPLICATE KEY UPDATE target_ip = VALUES(target_ip)";
+void addDomainMapping(DNSAuthStorage& storage, const string& domain, const string& targetIP,
+    FindResultCache* cache = nullptr) {
+    if (storage.upsertDomainMapping(domain, targetIP)) {
+        if (cache) cache->invalidateDomain(domain);
+        logInfo("域名映射已添加/更新: ", domain, " -> ", targetIP);
+    }
+    else {
+        logError("添加域名映射失败: ", domain);
+    }
+}
+
+// 解析 --name=value 形式的命令行参数
+static bool parseCommandOption(const string& arg, const char* name, string& value) {
+    string prefix = string("--") + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+#ifndef DNS_AUTH_BENCH
+// 命令行批量导入：import --table=configs|mappings [--format=csv|ndjson] [--batch=N] [--embedded=DIR] <文件|->
+// 格式缺省按扩展名判断（.ndjson / .jsonl 为 NDJSON，其余为 CSV）。只写存储，不影响运行中服务进程的缓存
+// （find 缓存在 findCacheTtlSec 内自然过期）；需要立即生效时改用 POST /admin/import
+static int runImportCommand(int argc, char** argv, const DBConfig& dbConfig, ServerConfig serverConfig) {
+    string tableText;
+    string formatText;
+    string path;
+    size_t batchRows = serverConfig.importBatchRows;
+    for (int i = 0; i < argc; ++i) {
+        string arg = argv[i];
+        string value;
+        if (parseCommandOption(arg, "table", value)) tableText = value;
+        else if (parseCommandOption(arg, "format", value)) formatText = value;
+        else if (parseCommandOption(arg, "batch", value)) batchRows = strtoull(value.c_str(), nullptr, 10);
+        else if (parseCommandOption(arg, "embedded", value)) {
+            serverConfig.storageEngine = STORAGE_ENGINE_EMBEDDED;
+            serverConfig.embeddedDataDir = value;
+        }
+        else if (path.empty() && (arg == "-" || arg.compare(0, 2, "--") != 0)) path = arg;
+        else {
+            path.clear();
+            break;
+        }
+    }
+
+    ImportTable table = IMPORT_DOMAIN_CONFIGS;
+    ImportFormat format = IMPORT_FORMAT_CSV;
+    if (formatText.empty()) {
+        size_t dot = path.rfind('.');
+        string ext = dot == string::npos ? string() : path.substr(dot + 1);
+        formatText = ext == "ndjson" || ext == "jsonl" ? "ndjson" : "csv";
+    }
+    if (path.empty() || batchRows == 0 || !BulkImporter::parseTable(tableText, table) ||
+        !BulkImporter::parseFormat(formatText, format)) {
+        fprintf(stderr,
+            "用法: import --table=configs|mappings [--format=csv|ndjson] [--batch=N] [--embedded=DIR] <文件|->\n"
+            "  configs 每行 client_ip,domain,expire_time[,status]；mappings 每行 domain,target_ip\n");
+        return 1;
+    }
+
+    unique_ptr<DNSAuthStorage> storage;
+    if (serverConfig.storageEngine == STORAGE_ENGINE_EMBEDDED) {
+        storage.reset(new EmbeddedStorage(serverConfig));
+    }
+    else {
+        storage.reset(new MySQLStorage(dbConfig));
+    }
+    if (!storage->open()) {
+        logError("存储后端初始化失败: ", storage->name());
+        return 1;
+    }
+
+    FILE* in = path == "-" ? stdin : openFile(path, "rb");
+    if (!in) {
+        logError("无法打开导入文件: ", path);
+        return 1;
+    }
+
+    BulkImporter importer(*storage, table, format, batchRows);
+    vector<char> buffer(static_cast<size_t>(1) << 16);
+    size_t n = 0;
+    while ((n = fread(buffer.data(), 1, buffer.size(), in)) > 0 && importer.feed(buffer.data(), n)) {
+    }
+    bool readFailed = ferror(in) != 0;
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (readFailed) {
+        logError("读取导入文件失败: ", path);
+    }
+
+    bool ok = importer.finish() && !readFailed;
+    for (const string& error : importer.stats().errors) {
+        logWarn(error);
+    }
+    storage->close();
+    return ok ? 0 : 1;
+}
+
+// 命令行表结构迁移（仅 MySQL 存储，需先停止服务），参数均为 [--batch=N]：
+// migrate-schema 把文本结构的表转换为 compactSchema 使用的精简结构；
+// migrate-verify-key 为旧版本的 dns_verifications 去重并建立唯一键
+static int runMigrateCommand(const string& command, int argc, char** argv, DBConfig dbConfig, const ServerConfig& serverConfig) {
+    size_t batchRows = serverConfig.importBatchRows;
+    for (int i = 0; i < argc; ++i) {
+        string value;
+        if (parseCommandOption(argv[i], "batch", value)) {
+            batchRows = strtoull(value.c_str(), nullptr, 10);
+        }
+        else {
+            batchRows = 0;
+            break;
+        }
+    }
+    if (batchRows == 0 || serverConfig.storageEngine != STORAGE_ENGINE_MYSQL) {
+        fprintf(stderr, "用法: %s [--batch=N]（仅 MySQL 存储，需先停止服务）\n", command.c_str());
+        return 1;
+    }
 
-    if (mysql_query(conn, sql.c_str()) == 0) {
-        cout << "域名映射已添加/更新: " << domain << " -> " << targetIP << endl;
+    bool ok = false;
+    if (command == "migrate-schema") {
+        dbConfig.compactSchema = true;
+        MySQLStorage storage(dbConfig);
+        ok = storage.migrateToCompact(batchRows);
+        storage.close();
     }
     else {
-        cerr << "添加域名映射失败: " << mysql_error(conn) << endl;
+        MySQLStorage storage(dbConfig);
+        ok = storage.migrateVerifyKey(batchRows);
+        storage.close();
     }
+    return ok ? 0 : 1;
 }
 
-int main() {
+#ifdef DNS_AUTH_WORKERS
+// 多进程模式下主进程与工作进程都屏蔽这些信号，只由 sigwait / sigtimedwait 处理；
+// 必须在任何线程（包括日志线程）启动之前调用，新线程继承屏蔽字
+static void blockControlSignals(sigset_t& set) {
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+}
+
+// 工作进程：worker --index=N --ready-fd=N，由主进程启动。开始监听后向 ready-fd 写一个字节，
+// 收到 SIGTERM / SIGINT 时停止接受新连接，处理完在途请求后退出
+static int runWorker(int argc, char** argv, const DBConfig& dbConfig, const ServerConfig& serverConfig, int port) {
+    int index = 0;
+    int readyFd = -1;
+    for (int i = 0; i < argc; ++i) {
+        string value;
+        if (parseCommandOption(argv[i], "index", value)) index = atoi(value.c_str());
+        else if (parseCommandOption(argv[i], "ready-fd", value)) readyFd = atoi(value.c_str());
+    }
+
+    // 单例的后台任务只在 0 号工作进程运行，见 ServerConfig::workerProcesses
+    DBConfig workerDbConfig = dbConfig;
+    ServerConfig workerConfig = serverConfig;
+    if (index != 0) {
+        workerDbConfig.manageSchema = false;
+        workerConfig.retentionEnabled = false;
+        workerConfig.warmSnapshotRewrite = false;
+    }
+
+    DNSAuthServer server(workerDbConfig, workerConfig);
+    thread signalWaiter([&server, index]() {
+        sigset_t stopSignals;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGTERM);
+        sigaddset(&stopSignals, SIGINT);
+        int sig = 0;
+        sigwait(&stopSignals, &sig);
+        logInfo("工作进程 ", index, " 停止接受新连接");
+        server.stop();
+        });
+
+    bool listening = false;
+    server.start(port, [&readyFd, &listening]() {
+        listening = true;
+        if (readyFd >= 0) {
+            char ready = 1;
+            if (write(readyFd, &ready, 1) != 1) {
+                logWarn("通知主进程失败");
+            }
+            close(readyFd);
+            readyFd = -1;
+        }
+        });
+    if (readyFd >= 0) {
+        close(readyFd);
+    }
+
+    // start() 因初始化失败提前返回时信号线程仍在等待
+    pthread_kill(signalWaiter.native_handle(), SIGTERM);
+    signalWaiter.join();
+    return listening ? 0 : 1;
+}
+
+// 多进程模式的主进程：按 workerProcesses 启动工作进程，自身不处理请求。
+// 工作进程由 fork 后 exec 本程序的 worker 子命令得到，从干净的状态启动，不继承主进程的线程与锁；
+// 异常退出的工作进程按退避间隔重启。SIGHUP 逐个滚动重启（新进程开始监听后才停止旧进程，
+// 可执行文件已被替换时同时完成升级），SIGTERM / SIGINT 停止全部工作进程后退出
+class WorkerSupervisor {
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int cpu = -1;                                   // 绑定的 CPU，-1 表示不绑定
+        chrono::steady_clock::time_point startedAt;
+        chrono::steady_clock::time_point restartAt;     // pid < 0 时计划重启的时刻
+        int failures = 0;                               // 连续启动后很快退出的次数，决定退避时长
+    };
+
+    static const int kQuickExitSec = 10;        // 启动后这么短时间内退出视为启动失败
+    static const int kMaxBackoffMs = 30000;
+
+    ServerConfig config;
+    string executable;
+    string programName;
+    sigset_t signals;
+    vector<Worker> workers;
+
+    static string describeExit(int status) {
+        if (WIFEXITED(status)) return "退出码 " + to_string(WEXITSTATUS(status));
+        if (WIFSIGNALED(status)) return "信号 " + to_string(WTERMSIG(status));
+        return "状态 " + to_string(status);
+    }
+
+    // 启动第 index 个工作进程，readyFd 返回就绪通知管道的读端
+    pid_t spawn(size_t index, int& readyFd) {
+        readyFd = -1;
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            logError("创建工作进程通知管道失败");
+            return -1;
+        }
+
+        // fork 之后子进程只调用异步信号安全的函数，参数提前准备好
+        string indexArg = "--index=" + to_string(index);
+        string readyArg = "--ready-fd=" + to_string(fds[1]);
+        char* args[] = { &programName[0], const_cast<char*>("worker"), &indexArg[0], &readyArg[0], nullptr };
+        int cpu = workers[index].cpu;
+        pid_t parent = getpid();
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            logError("创建工作进程失败: ", strerror(errno));
+            return -1;
+        }
+        if (pid == 0) {
+            // 主进程意外退出时工作进程随之停止
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            if (getppid() != parent) _exit(1);
+            if (cpu >= 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                sched_setaffinity(0, sizeof(set), &set);
+            }
+            fcntl(fds[1], F_SETFD, 0);
+            execv(executable.c_str(), args);
+            _exit(127);
+        }
+
+        close(fds[1]);
+        readyFd = fds[0];
+        logInfo("工作进程 ", index, " 已启动，pid ", static_cast<int>(pid), cpu >= 0 ? "，CPU " : "", cpu >= 0 ? to_string(cpu) : string());
+        return pid;
+    }
+
+    // 等待工作进程开始监听；进程提前退出（管道关闭）或超时返回 false
+    bool waitReady(int readyFd) {
+        pollfd pfd;
+        pfd.fd = readyFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        char ready = 0;
+        bool ok = poll(&pfd, 1, config.workerReadyTimeoutSec * 1000) == 1 && read(readyFd, &ready, 1) == 1;
+        close(readyFd);
+        return ok;
+    }
+
+    // 启动并等待就绪，失败时按退避间隔安排重启
+    void startWorker(size_t index) {
+        Worker& worker = workers[index];
+        int readyFd = -1;
+        worker.pid = spawn(index, readyFd);
+        worker.startedAt = chrono::steady_clock::now();
+        if (worker.pid < 0) {
+            scheduleRestart(index);
+            return;
+        }
+        if (!waitReady(readyFd)) {
+            logError("工作进程 ", index, " 未能开始监听");
+        }
+    }
+
+    void scheduleRestart(size_t index) {
+        Worker& worker = workers[index];
+        auto now = chrono::steady_clock::now();
+        bool quick = chrono::duration_cast<chrono::seconds>(now - worker.startedAt).count() < kQuickExitSec;
+        worker.failures = quick ? worker.failures + 1 : 0;
+        int delayMs = 0;
+        if (worker.failures > 0) {
+            delayMs = 500 << (worker.failures < 6 ? worker.failures : 6);
+            if (delayMs > kMaxBackoffMs) delayMs = kMaxBackoffMs;
+        }
+        worker.pid = -1;
+        worker.restartAt = now + chrono::milliseconds(delayMs);
+        if (delayMs > 0) {
+            logWarn("工作进程 ", index, " 将在 ", delayMs, " 毫秒后重启");
+        }
+    }
+
+    // 回收已退出的工作进程并安排重启
+    void reap() {
+        int status = 0;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (size_t i = 0; i < workers.size(); ++i) {
+                if (workers[i].pid == pid) {
+                    logWarn("工作进程 ", i, "（pid ", static_cast<int>(pid), "）意外退出，", describeExit(status));
+                    scheduleRestart(i);
+                    break;
+                }
+            }
+        }
+    }
+
+    // 到期的重启；返回距下一次计划重启的毫秒数（没有时为 -1）
+    int restartDue() {
+        int nextMs = -1;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            if (workers[i].pid >= 0) {
+                continue;
+            }
+            auto now = chrono::steady_clock::now();
+            if (workers[i].restartAt <= now) {
+                startWorker(i);
+                continue;
+            }
+            int waitMs = static_cast<int>(chrono::duration_cast<chrono::milliseconds>(workers[i].restartAt - now).count()) + 1;
+            if (nextMs < 0 || waitMs < nextMs) nextMs = waitMs;
+        }
+        return nextMs;
+    }
+
+    // 向给定进程发送 SIGTERM，等待它们退出，超时后强制结束
+    void stopProcesses(vector<pid_t> pids) {
+        for (pid_t pid : pids) {
+            kill(pid, SIGTERM);
+        }
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(config.workerStopTimeoutSec);
+        while (!pids.empty()) {
+            int status = 0;
+            for (size_t i = 0; i < pids.size();) {
+                if (waitpid(pids[i], &status, WNOHANG) != 0) {
+                    pids[i] = pids.back();
+                    pids.pop_back();
+                }
+                else {
+                    ++i;
+                }
+            }
+            if (pids.empty()) {
+                break;
+            }
+            if (chrono::steady_clock::now() >= deadline) {
+                for (pid_t pid : pids) {
+                    logWarn("工作进程 pid ", static_cast<int>(pid), " 未在 ", config.workerStopTimeoutSec, " 秒内退出，强制结束");
+                    kill(pid, SIGKILL);
+                    waitpid(pid, &status, 0);
+                }
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(50));
+        }
+    }
+
+    void stopAll() {
+        vector<pid_t> pids;
+        for (Worker& worker : workers) {
+            if (worker.pid > 0) pids.push_back(worker.pid);
+            worker.pid = -1;
+        }
+        stopProcesses(pids);
+    }
+
+    // 逐个替换工作进程：新进程开始监听后再停止旧进程，任何时刻至少有 workers.size() 个进程在监听
+    void rollingRestart() {
+        logInfo("开始滚动重启 ", workers.size(), " 个工作进程");
+        for (size_t i = 0; i < workers.size(); ++i) {
+            Worker& worker = workers[i];
+            int readyFd = -1;
+            pid_t pid = spawn(i, readyFd);
+            if (pid < 0 || !waitReady(readyFd)) {
+                logError("新工作进程 ", i, " 未能开始监听，中止滚动重启，其余工作进程保持不变");
+                if (pid > 0) {
+                    stopProcesses(vector<pid_t>(1, pid));
+                }
+                return;
+            }
+            pid_t old = worker.pid;
+            worker.pid = pid;
+            worker.startedAt = chrono::steady_clock::now();
+            worker.failures = 0;
+            if (old > 0) {
+                stopProcesses(vector<pid_t>(1, old));
+            }
+        }
+        logInfo("滚动重启完成");
+    }
+
+public:
+    WorkerSupervisor(const ServerConfig& cfg, const char* argv0, const sigset_t& controlSignals)
+        : config(cfg), programName(argv0), signals(controlSignals) {
+        // 记下当前可执行文件的路径：替换文件后滚动重启即运行新版本
+        char path[4096];
+        ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        executable = n > 0 ? string(path, static_cast<size_t>(n)) : programName;
+
+        vector<int> cpus;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+            }
+        }
+        if (cpus.empty()) {
+            cpus.push_back(0);
+        }
+
+        size_t count = config.workerProcesses > 0 ? static_cast<size_t>(config.workerProcesses) : cpus.size();
+        workers.resize(count);
+        for (size_t i = 0; i < count && config.workerCpuAffinity; ++i) {
+            workers[i].cpu = cpus[i % cpus.size()];
+        }
+    }
+
+    int run() {
+        logInfo("多进程模式：启动 ", workers.size(), " 个工作进程");
+        // 0 号工作进程负责建表与表结构变更，等它开始监听后再启动其余进程
+        vector<int> readyFds(workers.size(), -1);
+        size_t ready = 0;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].pid = spawn(i, readyFds[i]);
+            workers[i].startedAt = chrono::steady_clock::now();
+            if (i == 0 && readyFds[i] >= 0) {
+                ready += waitReady(readyFds[i]) ? 1 : 0;
+                readyFds[i] = -1;
+            }
+        }
+        for (size_t i = 1; i < workers.size(); ++i) {
+            if (readyFds[i] >= 0 && waitReady(readyFds[i])) {
+                ++ready;
+            }
+        }
+        if (ready == 0) {
+            logError("没有工作进程开始监听，退出");
+            stopAll();
+            return 1;
+        }
+        logInfo(ready, " 个工作进程已开始监听");
+
+        while (true) {
+            reap();
+            int nextMs = restartDue();
+            int waitMs = nextMs < 0 || nextMs > 1000 ? 1000 : nextMs;
+            timespec timeout;
+            timeout.tv_sec = waitMs / 1000;
+            timeout.tv_nsec = static_cast<long>(waitMs % 1000) * 1000000L;
+            int sig = sigtimedwait(&signals, nullptr, &timeout);
+            if (sig == SIGHUP) {
+                reap();
+                rollingRestart();
+            }
+            else if (sig == SIGTERM || sig == SIGINT) {
+                logInfo("停止全部工作进程");
+                stopAll();
+                reap();
+                logInfo("主进程退出");
+                return 0;
+            }
+        }
+    }
+};
+#endif
+
+int main(int argc, char** argv) {
     // 数据库配置
     DBConfig dbConfig;
     // 可以根据需要修改配置
     // dbConfig.host = "127.0.0.1";
     // dbConfig.user = "your_username";
     // dbConfig.password = "your_password";
+    // 读请求分流到只读副本
+    // dbConfig.replicas = { { "10.0.0.12", 3306 }, { "10.0.0.13", 3306 } };
+
+    // 服务器配置
+    ServerConfig serverConfig;
+    // 不依赖 MySQL 独立运行时改用嵌入式存储
+    // serverConfig.storageEngine = STORAGE_ENGINE_EMBEDDED;
+    // serverConfig.embeddedDataDir = "dns_auth_data";
+    // 多进程：每个 CPU 一个工作进程
+    // serverConfig.workerProcesses = -1;
+    // serverConfig.workerCpuAffinity = true;
 
-    // 初始化数据库（一次性操作）
-    MYSQL* initConn = mysql_init(nullptr);
-    if (initConn && mysql_real_connect(initConn, dbConfig.host.c_str(),
-        dbConfig.user.c_str(), dbConfig.password.c_str(),
-        nullptr, dbConfig.port, nullptr, 0)) {
+    bool workerProcess = argc > 1 && strcmp(argv[1], "worker") == 0;
+    bool importCommand = argc > 1 && strcmp(argv[1], "import") == 0;
+    if (serverConfig.workerProcesses != 0 && serverConfig.storageEngine == STORAGE_ENGINE_EMBEDDED) {
+        logWarn("嵌入式存储不能由多个进程共用，改为单进程运行");
+        serverConfig.workerProcesses = 0;
+    }
+#ifdef DNS_AUTH_WORKERS
+    sigset_t controlSignals;
+    if (workerProcess || (serverConfig.workerProcesses != 0 && !importCommand)) {
+        blockControlSignals(controlSignals);
+    }
+#endif
+
+    // 初始化数据库（一次性操作，仅 MySQL 存储需要；工作进程启动前已由主进程完成）
+    if (serverConfig.storageEngine == STORAGE_ENGINE_MYSQL && !workerProcess) {
+        MYSQL* initConn = mysql_init(nullptr);
+        if (initConn && mysql_real_connect(initConn, dbConfig.host.c_str(),
+            dbConfig.user.c_str(), dbConfig.password.c_str(),
+            nullptr, dbConfig.port, nullptr, 0)) {
 
-        // 创建数据库
-        if (mysql_query(initConn, ("CREATE DATABASE IF NOT EXISTS " + dbConfig.database).c_str()) == 0) {
-            cout << "数据库创建/验证成功" << endl;
+            // 创建数据库
+            if (mysql_query(initConn, ("CREATE DATABASE IF NOT EXISTS " + dbConfig.database).c_str()) == 0) {
+                logInfo("数据库创建/验证成功");
+            }
+
+            mysql_close(initConn);
         }
+    }
+
+    // 批量导入 domain_configs / domain_mappings，例如: mysql import --table=configs configs.csv
+    if (importCommand) {
+        return runImportCommand(argc - 2, argv + 2, dbConfig, serverConfig);
+    }
+
+    // 文本结构的表转换为精简结构：mysql migrate-schema [--batch=N]；
+    // 旧版本的验证记录表去重并建立唯一键：mysql migrate-verify-key [--batch=N]。均需先停止服务
+    if (argc > 1 && (strcmp(argv[1], "migrate-schema") == 0 || strcmp(argv[1], "migrate-verify-key") == 0)) {
+        return runMigrateCommand(argv[1], argc - 2, argv + 2, dbConfig, serverConfig);
+    }
 
-        mysql_close(initConn);
+#ifdef DNS_AUTH_WORKERS
+    if (workerProcess) {
+        return runWorker(argc - 2, argv + 2, dbConfig, serverConfig, 8080);
+    }
+    if (serverConfig.workerProcesses != 0) {
+        WorkerSupervisor supervisor(serverConfig, argv[0], controlSignals);
+        return supervisor.run();
     }
+#else
+    if (serverConfig.workerProcesses != 0) {
+        logWarn("多进程模式仅支持 Linux，改为单进程运行");
+    }
+#endif
 
     // 创建并启动DNS验证服务器
-    DNSAuthServer server;
+    DNSAuthServer server(dbConfig, serverConfig);
     server.start(8080);
 
     return 0;
-}
\ No newline at end of file
+}
+#else
+// ---------------------------------------------------------------------------
+// 基准测试入口（定义 DNS_AUTH_BENCH 时编译）：数据库为 fake_mysql.h 中的内存替身，
+// 按固定种子生成 verify/find 混合负载，先在进程内直接调用 handlePost，
+// 再（链接真实 httplib 时）经回环 HTTP 压测，输出吞吐量与 p50/p99/p999。
+// ---------------------------------------------------------------------------
+
+struct BenchOptions {
+    int threads = 8;
+    size_t requests = 200000;          // 每个阶段的总请求数
+    size_t warmup = 1000;              // 每个线程的预热请求数（不计入结果）
+    double findRatio = 0.8;            // find 请求占比，其余为 verify
+    int httpPort = 18080;              // 0 表示跳过回环 HTTP 阶段
+    bool asyncQueries = false;         // 经 MySQLReactor 非阻塞查询（仅 C++20 Linux 构建生效）
+    fakedb::Options db;
+    ServerConfig server;
+};
+
+// 一条预生成的请求：requester 为发起方 IP（verify 用作 client_ip）
+struct BenchRequest {
+    string requester;
+    string body;
+    string domain;
+};
+
+struct BenchResult {
+    size_t requests = 0;
+    size_t errors = 0;
+    double seconds = 0;
+    vector<uint64_t> latenciesNs;
+};
+
+static bool parseBenchArgs(int argc, char** argv, BenchOptions& opts) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        string value;
+        if (parseCommandOption(arg, "threads", value)) opts.threads = atoi(value.c_str());
+        else if (parseCommandOption(arg, "requests", value)) opts.requests = strtoull(value.c_str(), nullptr, 10);
+        else if (parseCommandOption(arg, "warmup", value)) opts.warmup = strtoull(value.c_str(), nullptr, 10);
+        else if (parseCommandOption(arg, "find-ratio", value)) opts.findRatio = atof(value.c_str());
+        else if (parseCommandOption(arg, "http-port", value)) opts.httpPort = atoi(value.c_str());
+        else if (parseCommandOption(arg, "dns-port", value)) opts.server.dnsPort = atoi(value.c_str());
+        else if (parseCommandOption(arg, "clients", value)) opts.db.clients = strtoull(value.c_str(), nullptr, 10);
+        else if (parseCommandOption(arg, "domains", value)) opts.db.domainsPerClient = strtoull(value.c_str(), nullptr, 10);
+        else if (parseCommandOption(arg, "read-latency-us", value)) opts.db.readLatencyUs = atoi(value.c_str());
+        else if (parseCommandOption(arg, "write-latency-us", value)) opts.db.writeLatencyUs = atoi(value.c_str());
+        else if (parseCommandOption(arg, "jitter-us", value)) opts.db.jitterUs = atoi(value.c_str());
+        else if (parseCommandOption(arg, "cache", value)) opts.server.findCacheCapacity = value == "off" ? 0 : opts.server.findCacheCapacity;
+        else if (parseCommandOption(arg, "warm-snapshot", value)) opts.server.warmSnapshotPath = value;
+        else if (parseCommandOption(arg, "async", value)) opts.asyncQueries = value == "on";
+        else if (parseCommandOption(arg, "schema", value)) {
+            if (value == "text") opts.db.compactSchema = false;
+            else if (value == "compact") opts.db.compactSchema = true;
+            else return false;
+        }
+        else if (parseCommandOption(arg, "storage", value)) {
+            if (value == "mysql") opts.server.storageEngine = STORAGE_ENGINE_MYSQL;
+            else if (value == "embedded") opts.server.storageEngine = STORAGE_ENGINE_EMBEDDED;
+            else return false;
+        }
+        else if (parseCommandOption(arg, "write-mode", value)) {
+            if (value == "sync") opts.server.verifyWriteMode = VERIFY_WRITE_SYNC;
+            else if (value == "enqueue") opts.server.verifyWriteMode = VERIFY_WRITE_ACK_ON_ENQUEUE;
+            else if (value == "commit") opts.server.verifyWriteMode = VERIFY_WRITE_ACK_ON_COMMIT;
+            else return false;
+        }
+        else {
+            return false;
+        }
+    }
+    return opts.threads > 0 && opts.db.clients > 0 && opts.db.domainsPerClient > 0;
+}
+
+// 按线程编号生成确定性的请求序列
+static vector<BenchRequest> makeBenchRequests(const BenchOptions& opts, int thread, size_t count) {
+    vector<BenchRequest> requests;
+    requests.reserve(count);
+    uint64_t state = 0x9E3779B97F4A7C15ULL * static_cast<uint64_t>(thread + 1);
+    for (size_t i = 0; i < count; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t client = static_cast<size_t>(state % opts.db.clients);
+        size_t domain = client * opts.db.domainsPerClient + static_cast<size_t>((state >> 32) % opts.db.domainsPerClient);
+        bool find = static_cast<double>((state >> 16) % 10000) < opts.findRatio * 10000;
+
+        BenchRequest request;
+        request.domain = fakedb::domainName(domain);
+        if (find) {
+            request.requester = "127.0.0.1";
+            request.body = "{\"mode\":\"find\",\"ip\":\"" + fakedb::clientIP(client) +
+                "\",\"dn\":\"" + fakedb::domainName(domain) + "\"}";
+        }
+        else {
+            request.requester = fakedb::clientIP(client);
+            request.body = "{\"mode\":\"verify\",\"domain\":\"" + fakedb::domainName(domain) + "\"}";
+        }
+        requests.push_back(move(request));
+    }
+    return requests;
+}
+
+static bool isSuccessBody(const string& body) {
+    return body.compare(0, 13, "{\"code\":\"200\"") == 0;
+}
+
+// 多线程执行 send(thread, request) 并合并每个请求的耗时
+template <typename Send>
+static BenchResult runBenchPhase(const BenchOptions& opts, Send send) {
+    size_t perThread = (opts.requests + opts.threads - 1) / opts.threads;
+    vector<vector<BenchRequest>> requests;
+    for (int t = 0; t < opts.threads; ++t) {
+        requests.push_back(makeBenchRequests(opts, t, perThread));
+    }
+
+    vector<vector<uint64_t>> latencies(opts.threads);
+    vector<size_t> errors(opts.threads, 0);
+    atomic<int> ready{ 0 };
+    atomic<bool> go{ false };
+    chrono::steady_clock::time_point start;
+
+    vector<thread> workers;
+    for (int t = 0; t < opts.threads; ++t) {
+        workers.emplace_back([&, t]() {
+            const vector<BenchRequest>& mine = requests[t];
+            for (size_t i = 0; i < opts.warmup && !mine.empty(); ++i) {
+                send(t, mine[i % mine.size()]);
+            }
+            latencies[t].reserve(mine.size());
+            ready.fetch_add(1);
+            while (!go.load()) this_thread::yield();
+
+            for (const BenchRequest& request : mine) {
+                auto begin = chrono::steady_clock::now();
+                bool ok = send(t, request);
+                auto end = chrono::steady_clock::now();
+                latencies[t].push_back(static_cast<uint64_t>(
+                    chrono::duration_cast<chrono::nanoseconds>(end - begin).count()));
+                if (!ok) ++errors[t];
+            }
+            });
+    }
+
+    while (ready.load() < opts.threads) this_thread::sleep_for(chrono::milliseconds(1));
+    start = chrono::steady_clock::now();
+    go.store(true);
+    for (auto& worker : workers) worker.join();
+
+    BenchResult result;
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (int t = 0; t < opts.threads; ++t) {
+        result.errors += errors[t];
+        result.latenciesNs.insert(result.latenciesNs.end(), latencies[t].begin(), latencies[t].end());
+    }
+    result.requests = result.latenciesNs.size();
+    return result;
+}
+
+static double percentileUs(vector<uint64_t>& values, double p) {
+    if (values.empty()) return 0;
+    size_t index = static_cast<size_t>(p * (values.size() - 1));
+    nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index] / 1000.0;
+}
+
+static void printBenchResult(const char* phase, BenchResult& result) {
+    double p50 = percentileUs(result.latenciesNs, 0.50);
+    double p99 = percentileUs(result.latenciesNs, 0.99);
+    double p999 = percentileUs(result.latenciesNs, 0.999);
+    printf("%-10s requests=%zu errors=%zu elapsed=%.3fs throughput=%.0f req/s p50=%.1fus p99=%.1fus p999=%.1fus\n",
+        phase, result.requests, result.errors, result.seconds,
+        result.seconds > 0 ? result.requests / result.seconds : 0.0, p50, p99, p999);
+}
+
+// DNS 阶段：回环地址即 client_ip，为它补上全部域名的验证记录
+static bool seedDnsClient(DNSAuthStorage& storage, const BenchOptions& opts) {
+    vector<VerificationRow> rows;
+    size_t domains = opts.db.clients * opts.db.domainsPerClient;
+    for (size_t i = 0; i < domains; ++i) {
+        VerificationRow row = { "127.0.0.1", fakedb::domainName(i), "2099-12-31 23:59:59" };
+        rows.push_back(move(row));
+    }
+    return storage.insertVerifications(rows.data(), rows.size()) == STORAGE_OK;
+}
+
+// 每个线程一个回环 UDP 套接字，逐个发送 A 查询并等待应答；应答码为 NOERROR 且带一条记录视为成功
+class BenchDnsClient {
+private:
+#ifdef _WIN32
+    SOCKET sock = INVALID_SOCKET;
+#else
+    int sock = -1;
+#endif
+    static const size_t kHeaderSize = 12;
+
+    sockaddr_in server;
+    uint16_t nextId = 0;
+    unsigned char query[300];
+    unsigned char reply[512];
+
+public:
+    explicit BenchDnsClient(int port) {
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&server, 0, sizeof(server));
+        server.sin_family = AF_INET;
+        server.sin_port = htons(static_cast<uint16_t>(port));
+        inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+#ifdef _WIN32
+        DWORD timeout = 1000;
+#else
+        timeval timeout = { 1, 0 };
+#endif
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    }
+
+    ~BenchDnsClient() {
+#ifdef _WIN32
+        closesocket(sock);
+#else
+        close(sock);
+#endif
+    }
+
+    bool lookup(const string& domain) {
+        uint16_t id = ++nextId;
+        memset(query, 0, kHeaderSize);
+        query[0] = static_cast<unsigned char>(id >> 8);
+        query[1] = static_cast<unsigned char>(id & 0xFF);
+        query[2] = 0x01;    // RD
+        query[5] = 1;       // QDCOUNT
+        size_t pos = kHeaderSize;
+        size_t start = 0;
+        while (start <= domain.size()) {
+            size_t dot = domain.find('.', start);
+            if (dot == string::npos) dot = domain.size();
+            query[pos++] = static_cast<unsigned char>(dot - start);
+            memcpy(query + pos, domain.data() + start, dot - start);
+            pos += dot - start;
+            start = dot + 1;
+        }
+        query[pos++] = 0;
+        query[pos++] = 0;
+        query[pos++] = static_cast<unsigned char>(DNSResponder::kTypeA);
+        query[pos++] = 0;
+        query[pos++] = 1;
+
+        if (sendto(sock, reinterpret_cast<const char*>(query), static_cast<int>(pos), 0,
+            reinterpret_cast<const sockaddr*>(&server), sizeof(server)) <= 0) {
+            return false;
+        }
+        int received = recv(sock, reinterpret_cast<char*>(reply), static_cast<int>(sizeof(reply)), 0);
+        return received >= static_cast<int>(kHeaderSize) && reply[0] == query[0] && reply[1] == query[1] &&
+            (reply[3] & 0x0F) == DNS_RCODE_NOERROR && reply[6] == 0 && reply[7] == 1;
+    }
+};
+
+// 嵌入式存储：清空数据目录后写入与内存替身相同的数据集并做一次快照，服务器启动时从快照恢复
+static bool seedEmbedded(const BenchOptions& opts) {
+    remove(EmbeddedStorage::logFilePath(opts.server.embeddedDataDir).c_str());
+    remove(EmbeddedStorage::snapshotFilePath(opts.server.embeddedDataDir).c_str());
+
+    EmbeddedStorage storage(opts.server);
+    if (!storage.open()) {
+        return false;
+    }
+    const string expireTime = "2099-12-31 23:59:59";
+    bool ok = storage.addWhitelist("127.0.0.1", "bench");
+    for (size_t c = 0; c < opts.db.clients && ok; ++c) {
+        string ip = fakedb::clientIP(c);
+        ok = storage.addWhitelist(ip, "bench");
+        for (size_t d = 0; d < opts.db.domainsPerClient && ok; ++d) {
+            size_t domainIndex = c * opts.db.domainsPerClient + d;
+            string domain = fakedb::domainName(domainIndex);
+            ok = storage.upsertDomainConfig(ip, domain, expireTime, 1) &&
+                storage.upsertDomainMapping(domain, fakedb::mappedIP(domainIndex));
+            if (ok && opts.db.preloadVerifications) {
+                VerificationRow row = { ip, domain, expireTime };
+                ok = storage.insertVerifications(&row, 1) == STORAGE_OK;
+            }
+        }
+    }
+    ok = ok && storage.snapshot();
+    storage.close();
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opts;
+    opts.server.logLevel = LOG_WARN;
+    opts.server.accessLogSampleEvery = 0;
+    opts.server.warmSnapshotPath.clear();
+    opts.server.dnsBindAddress = "127.0.0.1";
+    if (!parseBenchArgs(argc, argv, opts)) {
+        fprintf(stderr,
+            "用法: %s [--threads=N] [--requests=N] [--warmup=N] [--find-ratio=0.8]\n"
+            "          [--clients=N] [--domains=N] [--read-latency-us=N] [--write-latency-us=N] [--jitter-us=N]\n"
+            "          [--write-mode=sync|enqueue|commit] [--cache=on|off] [--http-port=N(0 跳过)] [--dns-port=N]\n"
+            "          [--storage=mysql|embedded]（embedded 不使用注入延迟）[--warm-snapshot=PATH] [--async=on|off]\n"
+            "          [--schema=text|compact]\n", argv[0]);
+        return 2;
+    }
+
+    Logger::instance().setLevel(opts.server.logLevel);
+    Logger::instance().setAccessSampling(opts.server.accessLogSampleEvery);
+    fakedb::backend().seed(opts.db);
+    if (opts.server.storageEngine == STORAGE_ENGINE_EMBEDDED) {
+        opts.server.embeddedDataDir = "dns_auth_bench_data";
+        if (!seedEmbedded(opts)) {
+            fprintf(stderr, "嵌入式存储初始化失败\n");
+            return 1;
+        }
+    }
+    printf("数据集: clients=%zu domains/client=%zu read_latency=%dus write_latency=%dus jitter=%dus find_ratio=%.2f threads=%d storage=%s\n",
+        opts.db.clients, opts.db.domainsPerClient, opts.db.readLatencyUs, opts.db.writeLatencyUs,
+        opts.db.jitterUs, opts.findRatio, opts.threads,
+        opts.server.storageEngine == STORAGE_ENGINE_EMBEDDED ? "embedded" : "mysql");
+
+    DBConfig dbConfig;
+    dbConfig.poolMaxSize = static_cast<size_t>(opts.threads) * 2;
+    dbConfig.asyncQueries = opts.asyncQueries;
+    dbConfig.compactSchema = opts.db.compactSchema;
+
+    // 指定 --warm-snapshot 时先从替身导出启动快照，服务器从快照启动
+    if (opts.server.storageEngine == STORAGE_ENGINE_MYSQL && !opts.server.warmSnapshotPath.empty()) {
+        MySQLStorage exporter(dbConfig);
+        vector<WhitelistEntry> whitelist;
+        vector<MappingRow> mappings;
+        vector<DomainConfigRow> configs;
+        if (!exporter.open() || !exporter.loadWhitelist(0, whitelist) || !exporter.listMappings(mappings) ||
+            !exporter.listActiveConfigs(configs) ||
+            !WarmSnapshot::write(opts.server.warmSnapshotPath, whitelist, mappings, configs)) {
+            fprintf(stderr, "启动快照生成失败\n");
+            return 1;
+        }
+    }
+
+    {
+        DNSAuthServer server(dbConfig, opts.server);
+        auto initStarted = chrono::steady_clock::now();
+        if (!server.initStorage()) {
+            fprintf(stderr, "初始化失败\n");
+            return 1;
+        }
+        printf("%-10s %.3fms\n", "init", chrono::duration<double, milli>(chrono::steady_clock::now() - initStarted).count());
+
+        BenchResult result = runBenchPhase(opts, [&server](int, const BenchRequest& request) {
+            Request req;
+            req.remote_addr = request.requester;
+            req.body = request.body;
+            Response res;
+            server.handlePost(req, res);
+            return isSuccessBody(res.body);
+            });
+        printBenchResult("in-process", result);
+
+        if (opts.server.dnsPort > 0) {
+            if (!seedDnsClient(*server.storageBackend(), opts) || !server.startDns()) {
+                fprintf(stderr, "DNS 应答启动失败\n");
+                return 1;
+            }
+            vector<unique_ptr<BenchDnsClient>> clients;
+            for (int t = 0; t < opts.threads; ++t) {
+                clients.emplace_back(new BenchDnsClient(opts.server.dnsPort));
+            }
+            BenchResult dnsResult = runBenchPhase(opts, [&clients](int t, const BenchRequest& request) {
+                return clients[t]->lookup(request.domain);
+                });
+            printBenchResult("dns", dnsResult);
+        }
+    }
+
+#ifdef CPPHTTPLIB_VERSION
+    if (opts.httpPort > 0) {
+        DNSAuthServer server(dbConfig, opts.server);
+        thread listener([&server, &opts]() { server.start(opts.httpPort); });
+
+        bool up = false;
+        for (int i = 0; i < 200 && !up; ++i) {
+            httplib::Client probe("127.0.0.1", opts.httpPort);
+            auto res = probe.Get("/health");
+            up = res && res->status == 200;
+            if (!up) this_thread::sleep_for(chrono::milliseconds(50));
+        }
+
+        if (up) {
+            vector<unique_ptr<httplib::Client>> clients;
+            for (int t = 0; t < opts.threads; ++t) {
+                clients.emplace_back(new httplib::Client("127.0.0.1", opts.httpPort));
+                clients.back()->set_keep_alive(true);
+            }
+
+            BenchResult result = runBenchPhase(opts, [&clients](int t, const BenchRequest& request) {
+                httplib::Headers headers = { { "X-Real-IP", request.requester } };
+                auto res = clients[t]->Post("/dns-auth", headers, request.body, "application/json");
+                return res && res->status == 200 && isSuccessBody(res->body);
+                });
+            printBenchResult("http", result);
+        }
+        else {
+            fprintf(stderr, "HTTP 服务未能在端口 %d 启动，跳过回环压测\n", opts.httpPort);
+        }
+
+        server.stop();
+        listener.join();
+    }
+#else
+    if (opts.httpPort > 0) {
+        printf("%-10s 跳过：未找到 httplib.h\n", "http");
+    }
+#endif
+
+    printf("数据库替身: queries=%llu verification_rows=%llu\n",
+        static_cast<unsigned long long>(fakedb::backend().queries()),
+        static_cast<unsigned long long>(fakedb::backend().verificationRowCount()));
+    return 0;
+}
+#endif
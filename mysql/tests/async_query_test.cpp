@@ -0,0 +1,191 @@
+// 异步查询（MySQLReactor）的参数转义测试：含单引号、反斜杠与 NUL 的域名和 IP 经完整的 verify / find 请求路径，
+// 在默认 sql_mode 与 NO_BACKSLASH_ESCAPES 下都必须原样到达数据库，且不能改变语句结构。
+// 另测服务端关闭空闲连接后 reactor 不空转并能重连。存储为 fake_mysql.h 中的内存替身，需以 -std=c++20 并定义 DNS_AUTH_BENCH 编译，由 run_tests.sh 构建并运行
+#define main dns_auth_main
+#include "../mysql.cpp"
+#undef main
+
+#include <sys/resource.h>
+
+#ifdef DNS_AUTH_ASYNC_DB
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: 检查失败: %s\n", __FILE__, __LINE__, #cond);    \
+            ++failures;                                                              \
+        }                                                                            \
+    } while (0)
+
+static const char* kExpireTime = "2099-12-31 23:59:59";
+static const char* kTargetIP = "198.51.100.7";
+
+static Json::Value post(DNSAuthServer& server, const string& ip, const Json::Value& body) {
+    Json::StreamWriterBuilder writer;
+    Request req;
+    req.remote_addr = ip;
+    req.body = Json::writeString(writer, body);
+    Response res;
+    server.handlePost(req, res);
+    Json::Value value;
+    Json::Reader().parse(res.body, value);
+    return value;
+}
+
+static int code(const Json::Value& response) {
+    return atoi(response["code"].asString().c_str());
+}
+
+static ServerConfig asyncServerConfig() {
+    ServerConfig serverConfig;
+    serverConfig.warmSnapshotPath = "";
+    serverConfig.retentionEnabled = false;
+    serverConfig.verifyWriteMode = VERIFY_WRITE_ACK_ON_COMMIT;
+    serverConfig.findCacheCapacity = 0;
+    serverConfig.negativeCacheCapacity = 0;
+    serverConfig.verifyCoalesceWindowMs = 0;
+    return serverConfig;
+}
+
+static DBConfig asyncDBConfig() {
+    DBConfig dbConfig;
+    dbConfig.asyncQueries = true;
+    dbConfig.asyncReactorThreads = 1;
+    dbConfig.asyncConnectionsPerThread = 2;
+    return dbConfig;
+}
+
+// 从指标文本中取出某个无标签指标的值，不存在时返回 -1
+static long long metricValue(const string& text, const string& name) {
+    size_t pos = text.find("\n" + name + " ");
+    if (pos == string::npos) {
+        return -1;
+    }
+    return atoll(text.c_str() + pos + name.size() + 2);
+}
+
+static int64_t processCpuMs() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (static_cast<int64_t>(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000 +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+static void testEscaping(bool noBackslashEscapes) {
+    fakedb::Options options;
+    options.clients = 1;
+    options.domainsPerClient = 0;
+    options.noBackslashEscapes = noBackslashEscapes;
+    fakedb::backend().seed(options);
+
+    const string clientIP = fakedb::clientIP(0);
+    const vector<string> domains = {
+        "q'uote.test",
+        "back\\slash.test",
+        string("nul\0byte.test", 13),
+        "mixed\\'' OR ''1''=''1.test",
+    };
+    for (const string& domain : domains) {
+        fakedb::backend().upsertConfig(clientIP, domain, kExpireTime, 1);
+        fakedb::backend().upsertMapping(domain, kTargetIP);
+    }
+
+    DNSAuthServer server(asyncDBConfig(), asyncServerConfig());
+    CHECK(server.initStorage());
+
+    for (const string& domain : domains) {
+        Json::Value verify;
+        verify["mode"] = "verify";
+        verify["domain"] = domain;
+        Json::Value verified = post(server, clientIP, verify);
+        CHECK(code(verified) == 200);
+        CHECK(verified["data"]["expire_time"].asString() == kExpireTime);
+
+        // 数据库中的键与请求中的域名逐字节相同
+        vector<string> row;
+        bool mappingNull = false;
+        CHECK(fakedb::backend().findActive(clientIP, domain, row, mappingNull));
+
+        Json::Value find;
+        find["mode"] = "find";
+        find["ip"] = clientIP;
+        find["dn"] = domain;
+        Json::Value found = post(server, clientIP, find);
+        CHECK(code(found) == 200);
+        CHECK(found["data"]["expire_time"].asString() == kExpireTime);
+    }
+
+    // 试图闭合字面量的输入只能作为普通字符串比较
+    Json::Value verify;
+    verify["mode"] = "verify";
+    verify["domain"] = "absent.test' OR '1'='1";
+    CHECK(code(post(server, clientIP, verify)) == 404);
+
+    Json::Value find;
+    find["mode"] = "find";
+    find["ip"] = clientIP + "' OR '1'='1";
+    find["dn"] = domains[0];
+    CHECK(code(post(server, clientIP, find)) == 404);
+    find["ip"] = clientIP;
+    find["dn"] = "absent.test\\' OR 1=1 -- ";
+    CHECK(code(post(server, clientIP, find)) == 404);
+
+    server.stop();
+}
+
+// 服务端关闭空闲连接后套接字一直可读：reactor 应关闭连接而不是空转，之后的查询经重连完成
+static void testIdleDisconnect() {
+    fakedb::Options options;
+    options.clients = 1;
+    options.domainsPerClient = 1;
+    fakedb::backend().seed(options);
+
+    // 只有一条连接：关闭后的查询必须等重连完成
+    DBConfig dbConfig = asyncDBConfig();
+    dbConfig.asyncConnectionsPerThread = 1;
+    DNSAuthServer server(dbConfig, asyncServerConfig());
+    CHECK(server.initStorage());
+
+    const string clientIP = fakedb::clientIP(0);
+    Json::Value verify;
+    verify["mode"] = "verify";
+    verify["domain"] = fakedb::domainName(0);
+    CHECK(code(post(server, clientIP, verify)) == 200);
+
+    CHECK(fakedb::backend().closeIdleAsyncConnections() == 1);
+    int64_t cpuBefore = processCpuMs();
+    this_thread::sleep_for(chrono::milliseconds(500));
+    CHECK(processCpuMs() - cpuBefore < 200);
+
+    CHECK(code(post(server, clientIP, verify)) == 200);
+    CHECK(metricValue(server.renderMetrics(), "dns_auth_async_reconnects_total") > 0);
+
+    server.stop();
+}
+
+int main() {
+    Logger::instance().setLevel(LOG_WARN);
+
+    testEscaping(false);
+    testEscaping(true);
+    testIdleDisconnect();
+
+    Logger::instance().shutdown();
+    if (failures != 0) {
+        fprintf(stderr, "async_query_test: %d 项检查失败\n", failures);
+        return 1;
+    }
+    printf("async_query_test: 全部通过\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    printf("async_query_test: 当前构建不支持异步查询（需要 C++20 协程与 Linux），跳过\n");
+    return 0;
+}
+
+#endif
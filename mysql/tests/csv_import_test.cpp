@@ -0,0 +1,221 @@
+// 批量导入的 CSV 解析测试：引号字段（含转义引号、逗号与首尾空白）、跨多个 feed 数据块的超长行、
+// 末尾没有换行的最后一行，以及同一份输入按任意位置切分时结果不变。存储为 fake_mysql.h 中的内存替身，
+// 需定义 DNS_AUTH_BENCH 编译，由 run_tests.sh 构建并运行
+#define main dns_auth_main
+#include "../mysql.cpp"
+#undef main
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: 检查失败: %s\n", __FILE__, __LINE__, #cond);    \
+            ++failures;                                                              \
+        }                                                                            \
+    } while (0)
+
+static const char* kExpireTime = "2099-12-31 23:59:59";
+
+static ServerConfig importServerConfig() {
+    ServerConfig serverConfig;
+    serverConfig.warmSnapshotPath = "";
+    serverConfig.retentionEnabled = false;
+    serverConfig.verifyWriteMode = VERIFY_WRITE_SYNC;
+    return serverConfig;
+}
+
+static void resetBackend() {
+    fakedb::Options options;
+    options.clients = 0;
+    options.domainsPerClient = 0;
+    fakedb::backend().seed(options);
+}
+
+// 当前 domain_configs 中启用的行：client_ip + 空格 + domain -> expire_time
+static map<string, string> storedConfigs() {
+    vector<vector<string>> rows;
+    fakedb::backend().activeConfigs(rows);
+    map<string, string> out;
+    for (const auto& row : rows) {
+        out[row[0] + " " + row[1]] = row[2];
+    }
+    return out;
+}
+
+// 按给定的块长度依次 feed，最后一块取剩余全部
+static ImportStats importChunks(DNSAuthStorage& storage, const string& input, const vector<size_t>& chunks,
+    ImportTable table = IMPORT_DOMAIN_CONFIGS, size_t batchRows = 2) {
+    BulkImporter importer(storage, table, IMPORT_FORMAT_CSV, batchRows);
+    size_t offset = 0;
+    for (size_t chunk : chunks) {
+        size_t len = min(chunk, input.size() - offset);
+        CHECK(importer.feed(input.data() + offset, len));
+        offset += len;
+    }
+    CHECK(importer.feed(input.data() + offset, input.size() - offset));
+    CHECK(importer.finish());
+    return importer.stats();
+}
+
+struct CsvCase {
+    const char* title;
+    string line;            // 不含换行的一行
+    bool accepted;
+    string clientIP;
+    string domain;
+};
+
+// 单行用例：引号字段与分隔规则
+static void testQuoting(DNSAuthStorage& storage) {
+    const vector<CsvCase> cases = {
+        { "普通字段", "192.0.2.1,plain.test,2099-12-31 23:59:59", true, "192.0.2.1", "plain.test" },
+        { "首尾空白", "  192.0.2.2 ,\tspaced.test\t, 2099-12-31 23:59:59 ", true, "192.0.2.2", "spaced.test" },
+        { "引号字段", "\"192.0.2.3\",\"quoted.test\",\"2099-12-31 23:59:59\"", true, "192.0.2.3", "quoted.test" },
+        { "引号外的空白", " \"192.0.2.4\" , \"outer.test\" ,\"2099-12-31 23:59:59\"", true, "192.0.2.4", "outer.test" },
+        { "引号内的逗号与空格", "192.0.2.5,\"a,b.test\",2099-12-31 23:59:59", false, "", "" },
+        { "引号内的转义引号", "192.0.2.6,\"a\"\"b.test\",2099-12-31 23:59:59", false, "", "" },
+        { "引号未闭合", "192.0.2.7,\"open.test,2099-12-31 23:59:59", false, "", "" },
+        { "闭合引号后多余字符", "192.0.2.8,\"tail.test\"x,2099-12-31 23:59:59", false, "", "" },
+        { "空的引号字段作为 status", "192.0.2.9,empty.test,2099-12-31 23:59:59,\"\"", true, "192.0.2.9", "empty.test" },
+        { "CRLF 行尾", "192.0.2.10,crlf.test,2099-12-31 23:59:59\r", true, "192.0.2.10", "crlf.test" },
+        { "字段数过少", "192.0.2.11,\"few.test\"", false, "", "" },
+    };
+
+    for (const CsvCase& item : cases) {
+        resetBackend();
+        ImportStats stats = importChunks(storage, item.line + "\n", {});
+        map<string, string> stored = storedConfigs();
+        int before = failures;
+        CHECK(stats.lines == 1);
+        CHECK(stats.imported == (item.accepted ? 1u : 0u));
+        CHECK(stats.rejected == (item.accepted ? 0u : 1u));
+        if (item.accepted) {
+            CHECK(stored.size() == 1);
+            CHECK(stored[item.clientIP + " " + item.domain] == kExpireTime);
+        }
+        else {
+            CHECK(stored.empty());
+        }
+        if (failures != before) {
+            fprintf(stderr, "用例：%s\n", item.title);
+        }
+    }
+
+    // 引号内的逗号与转义引号由 splitCsv 正确拆分：按字段数判断（映射表只有两列）
+    resetBackend();
+    ImportStats stats = importChunks(storage, "\"quoted.test\",\"198.51.100.1\"\n\"comma,inside\",198.51.100.2\n"
+        "\"a\"\"b\",198.51.100.3,extra\n", {}, IMPORT_DOMAIN_MAPPINGS);
+    CHECK(stats.lines == 3);
+    CHECK(stats.imported == 1);
+    CHECK(stats.rejected == 2);
+    CHECK(stats.errors.size() == 2);
+    if (stats.errors.size() == 2) {
+        CHECK(stats.errors[0].find("domain 格式错误") != string::npos);
+        CHECK(stats.errors[1].find("字段数应为 2") != string::npos);
+    }
+}
+
+// 超长行跨多个数据块：整行计为一条“行过长”，前后的行不受影响；行号连续
+static void testLongLine(DNSAuthStorage& storage) {
+    resetBackend();
+    string longLine = "192.0.2.20," + string(70 * 1024, 'x') + ".test," + kExpireTime;
+    string input = string("client_ip,domain,expire_time\n") +
+        "192.0.2.21,before.test," + kExpireTime + "\n" +
+        longLine + "\n" +
+        "192.0.2.22,after.test," + kExpireTime + "\n";
+
+    // 超长行被切成多个小于上限的块，且行首与前一行位于同一块
+    size_t longStart = input.find(longLine);
+    ImportStats stats = importChunks(storage, input, { longStart + 100, 30 * 1024, 30 * 1024, 30 * 1024 });
+    map<string, string> stored = storedConfigs();
+    CHECK(stats.lines == 3);
+    CHECK(stats.imported == 2);
+    CHECK(stats.rejected == 1);
+    CHECK(stats.errors.size() == 1 && stats.errors[0] == "第 3 行: 行过长");
+    CHECK(stored.size() == 2);
+    CHECK(stored.count("192.0.2.21 before.test") == 1);
+    CHECK(stored.count("192.0.2.22 after.test") == 1);
+
+    // 超长行正好是没有换行的最后一行
+    resetBackend();
+    stats = importChunks(storage, "192.0.2.23,first.test," + string(kExpireTime) + "\n" + longLine, { 10, 40 * 1024 });
+    CHECK(stats.lines == 2);
+    CHECK(stats.imported == 1);
+    CHECK(stats.rejected == 1);
+    CHECK(storedConfigs().size() == 1);
+}
+
+// 末尾没有换行的最后一行由 finish 处理；输入被截断时（finish(false)）丢弃
+static void testFinalLine(DNSAuthStorage& storage) {
+    string input = "192.0.2.30,one.test," + string(kExpireTime) + "\n192.0.2.31,\"two.test\"," + kExpireTime;
+
+    resetBackend();
+    ImportStats stats = importChunks(storage, input, { input.size() - 5 });
+    map<string, string> stored = storedConfigs();
+    CHECK(stats.lines == 2);
+    CHECK(stats.imported == 2);
+    CHECK(stored.count("192.0.2.31 two.test") == 1);
+
+    resetBackend();
+    BulkImporter truncated(storage, IMPORT_DOMAIN_CONFIGS, IMPORT_FORMAT_CSV, 100);
+    CHECK(truncated.feed(input.data(), input.size()));
+    CHECK(truncated.finish(false));
+    stored = storedConfigs();
+    CHECK(truncated.stats().lines == 1);
+    CHECK(truncated.stats().imported == 1);
+    CHECK(stored.size() == 1 && stored.count("192.0.2.30 one.test") == 1);
+}
+
+// 同一份输入按任意位置切成两块，结果与整块输入相同
+static void testSplitPoints(DNSAuthStorage& storage) {
+    string input = string("client_ip,domain,expire_time,status\r\n") +
+        "# 注释行\n" +
+        "\"192.0.2.40\",\"split.test\",\"" + kExpireTime + "\",1\r\n" +
+        "\n" +
+        "192.0.2.41 , other.test , " + kExpireTime + " ,\"1\"\n" +
+        "192.0.2.42,\"bad.test" + "\n" +
+        "192.0.2.43,last.test," + kExpireTime;
+
+    resetBackend();
+    ImportStats whole = importChunks(storage, input, {});
+    map<string, string> expected = storedConfigs();
+    CHECK(whole.lines == 4);
+    CHECK(whole.imported == 3);
+    CHECK(whole.rejected == 1);
+    CHECK(expected.size() == 3);
+
+    for (size_t split = 1; split < input.size(); ++split) {
+        resetBackend();
+        ImportStats stats = importChunks(storage, input, { split });
+        if (stats.lines != whole.lines || stats.imported != whole.imported || stats.rejected != whole.rejected ||
+            storedConfigs() != expected) {
+            fprintf(stderr, "切分位置：%zu\n", split);
+            CHECK(false);
+            break;
+        }
+    }
+}
+
+int main() {
+    Logger::instance().setLevel(LOG_WARN);
+
+    resetBackend();
+    DNSAuthServer server(DBConfig(), importServerConfig());
+    CHECK(server.initStorage());
+    DNSAuthStorage& storage = *server.storageBackend();
+
+    testQuoting(storage);
+    testLongLine(storage);
+    testFinalLine(storage);
+    testSplitPoints(storage);
+
+    server.stop();
+    Logger::instance().shutdown();
+    if (failures != 0) {
+        fprintf(stderr, "csv_import_test: %d 项检查失败\n", failures);
+        return 1;
+    }
+    printf("csv_import_test: 全部通过\n");
+    return 0;
+}
@@ -0,0 +1,279 @@
+// UDP DNS 应答器的报文解析与编码测试：逐条给出构造好的查询报文，检查 DNSResponder::parse 对截断头部、
+// 越界标签、压缩指针、问题数不为 1、255 字节名称上限等情况的判定，以及 encode 的应答格式与容量检查。
+// 不涉及存储与套接字，需定义 DNS_AUTH_BENCH 编译，由 run_tests.sh 构建并运行
+#define main dns_auth_main
+#include "../mysql.cpp"
+#undef main
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: 检查失败: %s\n", __FILE__, __LINE__, #cond);    \
+            ++failures;                                                              \
+        }                                                                            \
+    } while (0)
+
+typedef vector<unsigned char> Packet;
+
+static const size_t kHeaderSize = 12;
+
+// 报文头：ID 固定为 0x1234，除问题数外各计数为 0
+static Packet header(uint16_t flags, uint16_t questions) {
+    Packet packet = { 0x12, 0x34 };
+    packet.push_back(static_cast<unsigned char>(flags >> 8));
+    packet.push_back(static_cast<unsigned char>(flags & 0xFF));
+    packet.push_back(static_cast<unsigned char>(questions >> 8));
+    packet.push_back(static_cast<unsigned char>(questions & 0xFF));
+    packet.resize(kHeaderSize, 0);
+    return packet;
+}
+
+// 按点分名称追加线上格式的标签序列（含结尾 0）
+static void appendName(Packet& packet, const string& name) {
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == string::npos) dot = name.size();
+        packet.push_back(static_cast<unsigned char>(dot - start));
+        packet.insert(packet.end(), name.begin() + static_cast<long>(start), name.begin() + static_cast<long>(dot));
+        start = dot + 1;
+    }
+    packet.push_back(0);
+}
+
+static void appendTypeClass(Packet& packet, uint16_t type, uint16_t klass) {
+    packet.push_back(static_cast<unsigned char>(type >> 8));
+    packet.push_back(static_cast<unsigned char>(type & 0xFF));
+    packet.push_back(static_cast<unsigned char>(klass >> 8));
+    packet.push_back(static_cast<unsigned char>(klass & 0xFF));
+}
+
+// 标准查询：RD 置位，单个问题
+static Packet query(const string& name, uint16_t type = DNSResponder::kTypeA, uint16_t klass = 1) {
+    Packet packet = header(0x0100, 1);
+    appendName(packet, name);
+    appendTypeClass(packet, type, klass);
+    return packet;
+}
+
+// 按给定的各标签长度拼出名称
+static string labels(const vector<size_t>& lengths) {
+    string name;
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        if (i) name += '.';
+        name += string(lengths[i], static_cast<char>('a' + i));
+    }
+    return name;
+}
+
+struct ParseCase {
+    const char* title;
+    Packet packet;
+    bool accepted;          // parse 的返回值
+    bool ask;               // 需要交给 handler 解析
+    uint8_t rcode;          // ask 为 false 时的应答码
+    string name;
+    uint16_t type;
+    size_t questionEnd;
+};
+
+static vector<ParseCase> parseCases() {
+    vector<ParseCase> cases;
+    Packet packet;
+
+    cases.push_back({ "空报文", Packet(), false, false, 0, "", 0, 0 });
+    packet = header(0x0100, 1);
+    packet.resize(kHeaderSize - 1);
+    cases.push_back({ "头部截断", packet, false, false, 0, "", 0, 0 });
+    cases.push_back({ "应答报文", header(0x8180, 1), false, false, 0, "", 0, 0 });
+
+    packet = query("Example.COM");
+    cases.push_back({ "A 查询，名称转为小写", packet, true, true, 0, "example.com", DNSResponder::kTypeA, packet.size() });
+    packet = query("v6.example.com", DNSResponder::kTypeAAAA);
+    cases.push_back({ "AAAA 查询", packet, true, true, 0, "v6.example.com", DNSResponder::kTypeAAAA, packet.size() });
+
+    // 附加区（如 EDNS OPT）不计入问题
+    packet = query("example.com");
+    size_t questionEnd = packet.size();
+    packet.insert(packet.end(), { 0, 0, 41, 0x10, 0, 0, 0, 0, 0, 0, 0 });
+    packet[11] = 1;
+    cases.push_back({ "问题之后的附加区", packet, true, true, 0, "example.com", DNSResponder::kTypeA, questionEnd });
+
+    packet = query("example.com");
+    packet[5] = 0;
+    cases.push_back({ "QDCOUNT 为 0", packet, true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+    packet[5] = 2;
+    cases.push_back({ "QDCOUNT 为 2", packet, true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+    cases.push_back({ "只有头部", header(0x0100, 1), true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+
+    packet = header(0x0100, 1);
+    packet.insert(packet.end(), { 10, 'a', 'b', 'c' });
+    cases.push_back({ "标签长度越过报文末尾", packet, true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+    packet = header(0x0100, 1);
+    packet.insert(packet.end(), { 3, 'a', 'b', 'c' });
+    cases.push_back({ "名称缺少结尾 0", packet, true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+    packet = query("example.com");
+    packet.resize(packet.size() - 1);
+    cases.push_back({ "类型与类别被截断", packet, true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+
+    packet = header(0x0100, 1);
+    packet.insert(packet.end(), { 0xC0, 0x0C });
+    appendTypeClass(packet, DNSResponder::kTypeA, 1);
+    cases.push_back({ "名称为压缩指针", packet, true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+    packet = header(0x0100, 1);
+    packet.insert(packet.end(), { 3, 'w', 'w', 'w', 0xC0, 0x0C });
+    appendTypeClass(packet, DNSResponder::kTypeA, 1);
+    cases.push_back({ "标签之后的压缩指针", packet, true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+    packet = header(0x0100, 1);
+    packet.insert(packet.end(), { 0x41, 'a', 0 });
+    appendTypeClass(packet, DNSResponder::kTypeA, 1);
+    cases.push_back({ "扩展标签类型", packet, true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+
+    // 线上格式恰为 255 字节（文本 253 字节）可以接受，再多一个字节即为格式错误
+    string longest = labels({ 63, 63, 63, 61 });
+    packet = query(longest);
+    cases.push_back({ "255 字节名称", packet, true, true, 0, longest, DNSResponder::kTypeA, packet.size() });
+    cases.push_back({ "256 字节名称", query(labels({ 63, 63, 63, 62 })), true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+    cases.push_back({ "文本 255 字节的名称", query(labels({ 63, 63, 63, 63 })), true, false, DNS_RCODE_FORMERR, "", 0, kHeaderSize });
+
+    packet = query("example.com");
+    packet[2] |= 0x08;
+    cases.push_back({ "非标准查询 opcode", packet, true, false, DNS_RCODE_NOTIMP, "example.com", 0, packet.size() });
+    packet = query("example.com", DNSResponder::kTypeA, 3);
+    cases.push_back({ "CH 类别", packet, true, false, DNS_RCODE_NOTIMP, "example.com", 0, packet.size() });
+    return cases;
+}
+
+static void testParse() {
+    for (const ParseCase& item : parseCases()) {
+        DNSResponder::ParsedQuery parsed;
+        bool accepted = DNSResponder::parse(item.packet.data(), item.packet.size(), parsed);
+        if (accepted != item.accepted) {
+            fprintf(stderr, "用例：%s\n", item.title);
+            CHECK(accepted == item.accepted);
+            continue;
+        }
+        if (!accepted) continue;
+
+        int before = failures;
+        CHECK(parsed.ask == item.ask);
+        CHECK(parsed.questionEnd == item.questionEnd);
+        CHECK(parsed.wellFormed == (item.questionEnd > kHeaderSize));
+        if (item.ask) {
+            CHECK(parsed.name == item.name);
+            CHECK(parsed.type == item.type);
+        }
+        else {
+            CHECK(parsed.rcode == item.rcode);
+        }
+        if (failures != before) {
+            fprintf(stderr, "用例：%s\n", item.title);
+        }
+    }
+}
+
+static DnsAnswer answerFor(uint8_t rcode, uint16_t type) {
+    DnsAnswer answer;
+    answer.rcode = rcode;
+    answer.type = type;
+    answer.ttl = 0x01020304;
+    for (size_t i = 0; i < sizeof(answer.address); ++i) {
+        answer.address[i] = static_cast<unsigned char>(0xA0 + i);
+    }
+    return answer;
+}
+
+// A / AAAA 应答：头部标志与计数、问题原样复制、资源记录指向问题名；容量差一个字节即返回 0
+static void testEncodeAnswer(uint16_t type, size_t rdataLen) {
+    Packet in = query("host.example.com", type);
+    DNSResponder::ParsedQuery parsed;
+    CHECK(DNSResponder::parse(in.data(), in.size(), parsed));
+    DnsAnswer answer = answerFor(DNS_RCODE_NOERROR, type);
+
+    size_t expected = in.size() + 12 + rdataLen;
+    unsigned char out[512];
+    CHECK(DNSResponder::encode(in.data(), parsed, answer, out, expected - 1) == 0);
+    CHECK(DNSResponder::encode(in.data(), parsed, answer, out, expected) == expected);
+
+    CHECK(out[0] == 0x12 && out[1] == 0x34);
+    CHECK(out[2] == 0x85 && out[3] == 0x00);     // QR、AA、RD，NOERROR
+    CHECK(out[4] == 0 && out[5] == 1);
+    CHECK(out[6] == 0 && out[7] == 1);
+    CHECK(out[8] == 0 && out[9] == 0 && out[10] == 0 && out[11] == 0);
+    CHECK(memcmp(out + kHeaderSize, in.data() + kHeaderSize, in.size() - kHeaderSize) == 0);
+
+    const unsigned char* record = out + in.size();
+    CHECK(record[0] == 0xC0 && record[1] == 0x0C);
+    CHECK(((record[2] << 8) | record[3]) == type);
+    CHECK(record[4] == 0 && record[5] == 1);
+    CHECK(record[6] == 1 && record[7] == 2 && record[8] == 3 && record[9] == 4);
+    CHECK(record[10] == 0 && record[11] == rdataLen);
+    CHECK(memcmp(record + 12, answer.address, rdataLen) == 0);
+}
+
+// 无记录的应答：NXDOMAIN 保留问题；格式错误只回头部且问题数为 0
+static void testEncodeNoRecord() {
+    Packet in = query("absent.example.com");
+    DNSResponder::ParsedQuery parsed;
+    CHECK(DNSResponder::parse(in.data(), in.size(), parsed));
+    DnsAnswer answer = answerFor(DNS_RCODE_NXDOMAIN, 0);
+    unsigned char out[512];
+    CHECK(DNSResponder::encode(in.data(), parsed, answer, out, in.size() - 1) == 0);
+    CHECK(DNSResponder::encode(in.data(), parsed, answer, out, in.size()) == in.size());
+    CHECK(out[3] == DNS_RCODE_NXDOMAIN);
+    CHECK(out[5] == 1 && out[7] == 0);
+
+    Packet bad = header(0x0100, 1);
+    bad.insert(bad.end(), { 0xC0, 0x0C, 0, 1, 0, 1 });
+    CHECK(DNSResponder::parse(bad.data(), bad.size(), parsed));
+    answer = answerFor(parsed.rcode, 0);
+    CHECK(DNSResponder::encode(bad.data(), parsed, answer, out, kHeaderSize - 1) == 0);
+    CHECK(DNSResponder::encode(bad.data(), parsed, answer, out, sizeof(out)) == kHeaderSize);
+    CHECK(out[2] == 0x85 && out[3] == DNS_RCODE_FORMERR);
+    CHECK(out[5] == 0 && out[7] == 0);
+}
+
+// process：只有 ask 的查询会调用 handler，应答报文不回复
+static void testProcess() {
+    int calls = 0;
+    DNSResponder::Handler handler = [&calls](const string&, const string& name, uint16_t type, DnsAnswer& answer) {
+        ++calls;
+        answer = answerFor(name == "known.example.com" ? DNS_RCODE_NOERROR : DNS_RCODE_NXDOMAIN,
+            name == "known.example.com" ? type : 0);
+    };
+    unsigned char out[512];
+
+    Packet known = query("KNOWN.example.com");
+    CHECK(DNSResponder::process(known.data(), known.size(), "192.0.2.1", handler, out, sizeof(out)) == known.size() + 16);
+    Packet unknown = query("other.example.com");
+    CHECK(DNSResponder::process(unknown.data(), unknown.size(), "192.0.2.1", handler, out, sizeof(out)) == unknown.size());
+    CHECK((out[3] & 0x0F) == DNS_RCODE_NXDOMAIN);
+    CHECK(calls == 2);
+
+    Packet chaos = query("known.example.com", DNSResponder::kTypeA, 3);
+    CHECK(DNSResponder::process(chaos.data(), chaos.size(), "192.0.2.1", handler, out, sizeof(out)) == chaos.size());
+    CHECK((out[3] & 0x0F) == DNS_RCODE_NOTIMP);
+    Packet reply = header(0x8180, 1);
+    CHECK(DNSResponder::process(reply.data(), reply.size(), "192.0.2.1", handler, out, sizeof(out)) == 0);
+    CHECK(calls == 2);
+}
+
+int main() {
+    Logger::instance().setLevel(LOG_WARN);
+
+    testParse();
+    testEncodeAnswer(DNSResponder::kTypeA, 4);
+    testEncodeAnswer(DNSResponder::kTypeAAAA, 16);
+    testEncodeNoRecord();
+    testProcess();
+
+    Logger::instance().shutdown();
+    if (failures != 0) {
+        fprintf(stderr, "dns_parse_test: %d 项检查失败\n", failures);
+        return 1;
+    }
+    printf("dns_parse_test: 全部通过\n");
+    return 0;
+}
@@ -0,0 +1,270 @@
+// 请求限额测试：白名单前缀树的最长匹配、嵌入式引擎按前缀判断白名单、令牌桶（含多线程 CAS 竞争）、并发名额，
+// 以及经 DNSAuthServer 的按 IP / 按前缀限额。存储为 fake_mysql.h 中的内存替身，
+// 需定义 DNS_AUTH_BENCH 编译，由 run_tests.sh 构建并运行
+#define main dns_auth_main
+#include "../mysql.cpp"
+#undef main
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: 检查失败: %s\n", __FILE__, __LINE__, #cond);    \
+            ++failures;                                                              \
+        }                                                                            \
+    } while (0)
+
+// 从指标文本中取出某个无标签指标的值，不存在时返回 -1
+static long long metricValue(const string& text, const string& name) {
+    size_t pos = text.find("\n" + name + " ");
+    if (pos == string::npos) {
+        return -1;
+    }
+    return atoll(text.c_str() + pos + name.size() + 2);
+}
+
+static void testPrefixTrie() {
+    IPPrefixTrie trie;
+    IPAddress address;
+    int prefixLen = 0;
+    RateLimit wide;
+    wide.rate = 5;
+    RateLimit narrow;
+    narrow.rate = 50;
+    narrow.burst = 7;
+    CHECK(parseIPPrefix("10.0.0.0/8", address, prefixLen));
+    trie.insert(address, prefixLen, wide);
+    CHECK(parseIPPrefix("10.1.2.3", address, prefixLen));
+    trie.insert(address, prefixLen, narrow);
+    CHECK(trie.size() == 2);
+
+    RateLimit found;
+    CHECK(parseIPAddress("10.1.2.3", address));
+    CHECK(trie.contains(address, &found));
+    CHECK(found.rate == 50 && found.burst == 7);
+
+    found = RateLimit();
+    CHECK(parseIPAddress("10.9.9.9", address));
+    CHECK(trie.contains(address, &found));
+    CHECK(found.rate == 5 && found.burst == 0);
+
+    CHECK(parseIPAddress("11.0.0.1", address));
+    CHECK(!trie.contains(address));
+}
+
+// 内存白名单未就绪时的回退查询：嵌入式引擎与内存白名单一样按 CIDR 条目匹配，重新打开后不变
+static void testEmbeddedWhitelist() {
+    char dir[] = "/tmp/dns_auth_rate_limit_test.XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    ServerConfig config;
+    config.embeddedDataDir = dir;
+
+    for (int round = 0; round < 2; ++round) {
+        EmbeddedStorage storage(config);
+        CHECK(storage.open());
+        if (round == 0) {
+            CHECK(storage.addWhitelist("10.0.0.0/8", ""));
+            CHECK(storage.addWhitelist("2001:db8::/32", ""));
+            CHECK(storage.addWhitelist("192.0.2.7", ""));
+        }
+        CHECK(storage.whitelistContains("10.200.3.4") == STORAGE_OK);
+        CHECK(storage.whitelistContains("2001:db8:1::9") == STORAGE_OK);
+        CHECK(storage.whitelistContains("192.0.2.7") == STORAGE_OK);
+        CHECK(storage.whitelistContains("192.0.2.8") == STORAGE_NOT_FOUND);
+        CHECK(storage.whitelistContains("11.0.0.1") == STORAGE_NOT_FOUND);
+        CHECK(storage.whitelistContains("not-an-ip") == STORAGE_NOT_FOUND);
+        storage.close();
+    }
+
+    remove(EmbeddedStorage::logFilePath(dir).c_str());
+    remove(EmbeddedStorage::snapshotFilePath(dir).c_str());
+    rmdir(dir);
+}
+
+static void testTokenBucket() {
+    ServerConfig config;
+    config.clientRateLimit = 10;
+    config.clientRateBurst = 5;
+    AdmissionControl admission;
+    admission.init(config);
+
+    int admitted = 0;
+    for (int i = 0; i < 8; ++i) admitted += admission.admit("1.1.1.1", RateLimit());
+    CHECK(admitted == 5);
+    CHECK(!admission.admit("1.1.1.1", RateLimit()));
+
+    // 每秒 10 个令牌：250ms 后至少补回 2 个
+    this_thread::sleep_for(chrono::milliseconds(250));
+    admitted = 0;
+    for (int i = 0; i < 8; ++i) admitted += admission.admit("1.1.1.1", RateLimit());
+    CHECK(admitted >= 2 && admitted < 8);
+
+    // 各 IP 的桶互不影响；单次消耗超过容量时按容量计
+    CHECK(admission.admit("2.2.2.2", RateLimit()));
+    CHECK(admission.admit("3.3.3.3", RateLimit(), 100));
+    CHECK(!admission.admit("3.3.3.3", RateLimit()));
+
+    // 条目自带的限额优先于全局默认值
+    RateLimit own;
+    own.rate = 1;
+    own.burst = 2;
+    admitted = 0;
+    for (int i = 0; i < 5; ++i) admitted += admission.admit("4.4.4.4", own);
+    CHECK(admitted == 2);
+}
+
+// 多个线程争用同一个桶：CAS 失败重试不能多发或丢失令牌
+static void testBucketContention() {
+    ServerConfig config;
+    config.clientRateLimit = 1;
+    config.clientRateBurst = 1000;
+    AdmissionControl admission;
+    admission.init(config);
+
+    const int threadCount = 8;
+    const int attempts = 10000;
+    atomic<int> admitted{ 0 };
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&admission, &admitted, attempts]() {
+            int n = 0;
+            for (int i = 0; i < attempts; ++i) {
+                n += admission.admit("9.9.9.9", RateLimit()) ? 1 : 0;
+            }
+            admitted.fetch_add(n);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    long long elapsedSec = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - start).count();
+
+    CHECK(admitted.load() >= 1000);
+    CHECK(admitted.load() <= 1000 + elapsedSec + 1);
+
+    string metrics;
+    admission.appendMetrics(metrics);
+    CHECK(metricValue(metrics, "dns_auth_rate_limited_total") == threadCount * attempts - admitted.load());
+}
+
+// 槽位表占满后新 IP 不限速放行并计数
+static void testSlotExhaustion() {
+    ServerConfig config;
+    config.clientRateLimit = 1;
+    config.rateLimitSlots = 1;
+    AdmissionControl admission;
+    admission.init(config);
+
+    int admitted = 0;
+    for (int i = 0; i < 5000; ++i) {
+        admitted += admission.admit("10.0." + to_string(i / 256) + "." + to_string(i % 256), RateLimit());
+    }
+    CHECK(admitted == 5000);
+
+    string metrics;
+    admission.appendMetrics(metrics);
+    CHECK(metricValue(metrics, "dns_auth_rate_limit_untracked_total") > 0);
+}
+
+static void testConcurrencyTickets() {
+    ServerConfig config;
+    config.maxConcurrentRequests = 1;
+    AdmissionControl admission;
+    admission.init(config);
+    {
+        AdmissionControl::Ticket first(admission);
+        AdmissionControl::Ticket second(admission);
+        CHECK(first.admitted());
+        CHECK(!second.admitted());
+    }
+    AdmissionControl::Ticket third(admission);
+    CHECK(third.admitted());
+}
+
+static int post(DNSAuthServer& server, const string& ip, const string& body, bool batch = false) {
+    Request req;
+    req.remote_addr = ip;
+    req.body = body;
+    Response res;
+    if (batch) server.handleBatchPost(req, res);
+    else server.handlePost(req, res);
+    Json::Value value;
+    Json::Reader().parse(res.body, value);
+    return atoi(value["code"].asString().c_str());
+}
+
+// 经完整请求路径：默认限额、按 IP 限额、按前缀限额（最长匹配），以及 429 计数
+static void testServerLimits() {
+    fakedb::Options options;
+    options.clients = 10;
+    options.domainsPerClient = 2;
+    fakedb::backend().seed(options);
+
+    DBConfig dbConfig;
+    ServerConfig serverConfig;
+    serverConfig.warmSnapshotPath = "";
+    serverConfig.retentionEnabled = false;
+    serverConfig.verifyWriteMode = VERIFY_WRITE_SYNC;
+    serverConfig.clientRateLimit = 100;
+    serverConfig.clientRateBurst = 20;
+
+    // 第一个实例只用来写白名单限额，第二个实例启动时加载
+    DNSAuthServer setup(dbConfig, serverConfig);
+    CHECK(setup.initStorage());
+    DNSAuthStorage& storage = *setup.storageBackend();
+    setClientRateLimit(storage, fakedb::clientIP(1), 1, 3);
+    addIPToWhitelist(storage, "192.0.2.0/24");
+    setClientRateLimit(storage, "192.0.2.0/24", 1, 2);
+    addIPToWhitelist(storage, "192.0.2.10");
+    setClientRateLimit(storage, "192.0.2.10", 100, 5);
+
+    DNSAuthServer server(dbConfig, serverConfig);
+    CHECK(server.initStorage());
+
+    string find = "{\"mode\":\"find\",\"ip\":\"" + fakedb::clientIP(0) + "\",\"dn\":\"" + fakedb::domainName(0) + "\"}";
+    auto countLimited = [&server, &find](const string& ip, int requests) {
+        int limited = 0;
+        for (int i = 0; i < requests; ++i) {
+            limited += post(server, ip, find) == 429 ? 1 : 0;
+        }
+        return limited;
+    };
+
+    CHECK(countLimited(fakedb::clientIP(0), 30) == 10);
+    CHECK(countLimited(fakedb::clientIP(1), 30) == 27);
+    CHECK(countLimited("192.0.2.9", 30) == 28);
+    CHECK(countLimited("192.0.2.10", 30) == 25);
+    CHECK(post(server, "203.0.113.9", find) == 403);
+
+    // 批量请求按条目数取令牌，超过容量时按容量计
+    string batch = "{\"items\":[";
+    for (int i = 0; i < 25; ++i) batch += string(i ? "," : "") + find;
+    batch += "]}";
+    CHECK(post(server, fakedb::clientIP(2), batch, true) == 200);
+    CHECK(post(server, fakedb::clientIP(2), find) == 429);
+
+    string metrics = server.renderMetrics();
+    CHECK(metricValue(metrics, "dns_auth_rate_limited_total") == 10 + 27 + 28 + 25 + 1);
+}
+
+int main() {
+    Logger::instance().setLevel(LOG_WARN);
+
+    testPrefixTrie();
+    testEmbeddedWhitelist();
+    testTokenBucket();
+    testBucketContention();
+    testSlotExhaustion();
+    testConcurrencyTickets();
+    testServerLimits();
+
+    Logger::instance().shutdown();
+    if (failures != 0) {
+        fprintf(stderr, "rate_limit_test: %d 项检查失败\n", failures);
+        return 1;
+    }
+    printf("rate_limit_test: 全部通过\n");
+    return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+# 编译并运行 mysql/tests 下的测试（Linux + g++，需要 jsoncpp）。每次构建后运行：
+#   mysql/tests/run_tests.sh [输出目录，默认 mysql/tests/build]
+# 任一测试编译失败或返回非 0 时脚本以非 0 退出
+set -e
+cd "$(dirname "$0")"
+CXX=${CXX:-g++}
+OUT=${1:-build}
+mkdir -p "$OUT"
+
+$CXX -std=c++17 -O1 -DDNS_AUTH_BENCH rate_limit_test.cpp -o "$OUT/rate_limit_test" -ljsoncpp -pthread
+"$OUT/rate_limit_test"
+
+$CXX -std=c++17 -O1 -DDNS_AUTH_FAKE_DB worker_test.cpp -o "$OUT/worker_test" -ljsoncpp -pthread
+"$OUT/worker_test"
+
+$CXX -std=c++17 -O1 -DDNS_AUTH_BENCH dns_parse_test.cpp -o "$OUT/dns_parse_test" -ljsoncpp -pthread
+"$OUT/dns_parse_test"
+
+$CXX -std=c++17 -O1 -DDNS_AUTH_BENCH csv_import_test.cpp -o "$OUT/csv_import_test" -ljsoncpp -pthread
+"$OUT/csv_import_test"
+
+# 异步查询路径依赖 C++20 协程
+$CXX -std=c++20 -O1 -DDNS_AUTH_BENCH async_query_test.cpp -o "$OUT/async_query_test" -ljsoncpp -pthread
+"$OUT/async_query_test"
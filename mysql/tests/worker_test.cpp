@@ -0,0 +1,239 @@
+// 多进程模式测试：WorkerSupervisor 先等 0 号工作进程就绪再启动其余进程、异常退出的工作进程被重启、
+// SIGHUP 滚动重启（新进程启动后才停止同一编号的旧进程）、SIGTERM 停止全部工作进程。
+// 存储为 fake_mysql.h 中的内存替身（每个工作进程一份），需定义 DNS_AUTH_FAKE_DB 编译，由 run_tests.sh 构建并运行。
+// 工作进程由主进程 exec 本程序的 worker 子命令得到，启动与退出时各向事件文件追加一行
+#define main dns_auth_main
+#include "../mysql.cpp"
+#undef main
+
+#ifdef DNS_AUTH_WORKERS
+
+static const int kWorkers = 3;
+static const int kSchemaDelayMs = 300;     // 0 号工作进程在开始监听前多等这么久，模拟建表
+static const char* kEventsEnv = "DNS_AUTH_WORKER_TEST_EVENTS";
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: 检查失败: %s\n", __FILE__, __LINE__, #cond);    \
+            ++failures;                                                              \
+        }                                                                            \
+    } while (0)
+
+// 事件文件中的一行：start|exit 编号 pid 单调时钟毫秒
+struct WorkerEvent {
+    string kind;
+    int index = -1;
+    pid_t pid = -1;
+    int64_t atMs = 0;
+};
+
+static int64_t monotonicMs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+static void appendEvent(const char* kind, int index) {
+    const char* path = getenv(kEventsEnv);
+    if (!path) {
+        return;
+    }
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%s %d %d %lld\n", kind, index, static_cast<int>(getpid()),
+        static_cast<long long>(monotonicMs()));
+    int fd = ::open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd >= 0) {
+        if (write(fd, line, static_cast<size_t>(n)) != n) {
+            fprintf(stderr, "写入事件文件失败\n");
+        }
+        close(fd);
+    }
+}
+
+static vector<WorkerEvent> readEvents(const string& path) {
+    vector<WorkerEvent> events;
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        return events;
+    }
+    char kind[16];
+    int index = 0;
+    int pid = 0;
+    long long atMs = 0;
+    while (fscanf(file, "%15s %d %d %lld", kind, &index, &pid, &atMs) == 4) {
+        WorkerEvent event;
+        event.kind = kind;
+        event.index = index;
+        event.pid = pid;
+        event.atMs = atMs;
+        events.push_back(event);
+    }
+    fclose(file);
+    return events;
+}
+
+static size_t countEvents(const vector<WorkerEvent>& events, const string& kind) {
+    size_t n = 0;
+    for (const WorkerEvent& event : events) {
+        n += event.kind == kind ? 1 : 0;
+    }
+    return n;
+}
+
+// 等到事件文件中至少有 starts 条 start 与 exits 条 exit，超时返回 false
+static bool waitEvents(const string& path, size_t starts, size_t exits, vector<WorkerEvent>& events, int timeoutMs = 15000) {
+    int64_t deadline = monotonicMs() + timeoutMs;
+    while (true) {
+        events = readEvents(path);
+        if (countEvents(events, "start") >= starts && countEvents(events, "exit") >= exits) {
+            return true;
+        }
+        if (monotonicMs() >= deadline) {
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(20));
+    }
+}
+
+static const WorkerEvent* findEvent(const vector<WorkerEvent>& events, const string& kind, pid_t pid) {
+    for (const WorkerEvent& event : events) {
+        if (event.kind == kind && event.pid == pid) return &event;
+    }
+    return nullptr;
+}
+
+static ServerConfig workerServerConfig() {
+    ServerConfig config;
+    config.workerProcesses = kWorkers;
+    config.workerCpuAffinity = false;
+    config.workerStopTimeoutSec = 5;
+    config.workerReadyTimeoutSec = 10;
+    config.warmSnapshotPath = "";
+    config.logLevel = LOG_WARN;
+    return config;
+}
+
+// 工作进程入口：worker --index=N --ready-fd=N
+static int workerMain(int argc, char** argv) {
+    sigset_t controlSignals;
+    blockControlSignals(controlSignals);
+
+    int index = -1;
+    for (int i = 2; i < argc; ++i) {
+        string value;
+        if (parseCommandOption(argv[i], "index", value)) index = atoi(value.c_str());
+    }
+    appendEvent("start", index);
+    if (index == 0) {
+        this_thread::sleep_for(chrono::milliseconds(kSchemaDelayMs));
+    }
+
+    int status = runWorker(argc - 2, argv + 2, DBConfig(), workerServerConfig(), 0);
+    appendEvent("exit", index);
+    Logger::instance().shutdown();
+    return status;
+}
+
+static void testSupervisor(const char* argv0) {
+    char dir[] = "/tmp/dns_auth_worker_test.XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    string eventsPath = string(dir) + "/events";
+    setenv(kEventsEnv, eventsPath.c_str(), 1);
+
+    // 主进程放在子进程中运行，本进程只负责发信号与检查事件
+    pid_t supervisor = fork();
+    if (supervisor == 0) {
+        sigset_t controlSignals;
+        blockControlSignals(controlSignals);
+        Logger::instance().setLevel(LOG_WARN);
+        WorkerSupervisor workerSupervisor(workerServerConfig(), argv0, controlSignals);
+        int status = workerSupervisor.run();
+        Logger::instance().shutdown();
+        _exit(status);
+    }
+    CHECK(supervisor > 0);
+    if (supervisor <= 0) {
+        return;
+    }
+
+    // 启动：0 号先启动，其余进程在它就绪之后才启动
+    vector<WorkerEvent> events;
+    CHECK(waitEvents(eventsPath, kWorkers, 0, events));
+    map<int, WorkerEvent> current;
+    for (const WorkerEvent& event : events) {
+        if (event.kind == "start") current[event.index] = event;
+    }
+    CHECK(current.size() == static_cast<size_t>(kWorkers));
+    CHECK(!events.empty() && events[0].index == 0);
+    for (int i = 1; i < kWorkers; ++i) {
+        CHECK(current[i].atMs - current[0].atMs >= kSchemaDelayMs);
+    }
+
+    // 异常退出：被 SIGKILL 的工作进程按退避间隔重启，编号不变
+    pid_t killed = current[1].pid;
+    kill(killed, SIGKILL);
+    CHECK(waitEvents(eventsPath, kWorkers + 1, 0, events));
+    const WorkerEvent& restarted = events.back();
+    CHECK(restarted.kind == "start" && restarted.index == 1 && restarted.pid != killed);
+    current[1] = restarted;
+
+    // 滚动重启：逐个编号启动新进程，新进程启动之后旧进程才退出
+    size_t startsBefore = countEvents(events, "start");
+    kill(supervisor, SIGHUP);
+    CHECK(waitEvents(eventsPath, startsBefore + kWorkers, kWorkers, events));
+    vector<WorkerEvent> newStarts(events.begin() + static_cast<long>(startsBefore), events.end());
+    size_t checked = 0;
+    for (const WorkerEvent& event : newStarts) {
+        if (event.kind != "start") continue;
+        CHECK(event.index == static_cast<int>(checked));
+        const WorkerEvent* oldExit = findEvent(events, "exit", current[event.index].pid);
+        CHECK(oldExit != nullptr);
+        if (oldExit) {
+            CHECK(oldExit->atMs >= event.atMs);
+        }
+        current[event.index] = event;
+        ++checked;
+    }
+    CHECK(checked == static_cast<size_t>(kWorkers));
+
+    // SIGTERM：全部工作进程退出后主进程以 0 退出
+    kill(supervisor, SIGTERM);
+    int status = 0;
+    CHECK(waitpid(supervisor, &status, 0) == supervisor);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    events = readEvents(eventsPath);
+    for (auto& entry : current) {
+        CHECK(findEvent(events, "exit", entry.second.pid) != nullptr);
+        CHECK(kill(entry.second.pid, 0) != 0);
+    }
+
+    unlink(eventsPath.c_str());
+    rmdir(dir);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "worker") == 0) {
+        return workerMain(argc, argv);
+    }
+
+    testSupervisor(argv[0]);
+
+    if (failures != 0) {
+        fprintf(stderr, "worker_test: %d 项检查失败\n", failures);
+        return 1;
+    }
+    printf("worker_test: 全部通过\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    printf("worker_test: 当前平台不支持多进程模式，跳过\n");
+    return 0;
+}
+
+#endif